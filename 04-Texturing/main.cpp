@@ -111,6 +111,18 @@ Sampler activeSampler = Sampler::Nearest;
 bool vsync = true;
 // Depth test on?
 bool depthTest = true;
+// Depth prepass before shading on?
+bool depthPrepass = false;
+// Pipeline statistics queries available, i.e., OpenGL 4.6 context?
+bool pipelineStatsSupported = false;
+// Fragment shader invocation queries of the shading pass, double buffered
+GLuint fsInvocationQueries[2] = {0};
+// Depth prepass state of the frames the queries were issued in
+bool fsInvocationPrepass[2] = {false};
+// Last shading fragment shader invocations without [0] and with [1] the depth prepass
+GLuint64 fsInvocations[2] = {0};
+// Frame counter for the double buffered queries
+unsigned int frameCount = 0;
 
 // ----------------------------------------------------------------------------
 
@@ -197,6 +209,13 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
       glfwSwapInterval(0);
   }
 
+  // Enable/disable the depth prepass
+  if (key == GLFW_KEY_F6 && action == GLFW_PRESS)
+  {
+    depthPrepass = !depthPrepass;
+    printf("Depth prepass: %s\n", depthPrepass ? "on" : "off");
+  }
+
   // Zoom in
   if (key == GLFW_KEY_KP_ADD || key == GLFW_KEY_EQUAL && action == GLFW_PRESS)
   {
@@ -258,9 +277,13 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 // Helper method for creating scene geometry
 void createGeometry()
 {
-  // Prepare meshes
-  quad = Geometry::CreateQuadTex();
-  cube = Geometry::CreateCubeTex();
+  // Prepare meshes with position only streams for the depth prepass
+  quad = Geometry::CreateQuadTex(true);
+  cube = Geometry::CreateCubeTex(true);
+
+  // Queries for counting the shading fragment shader invocations
+  if (pipelineStatsSupported)
+    glGenQueries(2, fsInvocationQueries);
 
   // Prepare textures
   checkerTex = Textures::CreateCheckerBoardTexture(256, 16);
@@ -276,9 +299,9 @@ bool initOpenGL()
   // Initialize the GLFW library
   if (!glfwInit()) return false;
 
-  // Request OpenGL 4.6 core profile upon window creation
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  // Request OpenGL 4.6 core profile upon window creation for pipeline statistics, fall back to 3.3 without them
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
   glfwWindowHint(GLFW_SAMPLES, MSAA_SAMPLES);
 #if _ENABLE_OPENGL_DEBUG
   glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
@@ -287,6 +310,13 @@ bool initOpenGL()
 
   // Create the window
   mainWindow.handle = glfwCreateWindow(Window::DefaultWidth, Window::DefaultHeight, "", nullptr, nullptr);
+  if (mainWindow.handle == nullptr)
+  {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    mainWindow.handle = glfwCreateWindow(Window::DefaultWidth, Window::DefaultHeight, "", nullptr, nullptr);
+  }
+
   if (mainWindow.handle == nullptr)
   {
     printf("Failed to create the GLFW window!");
@@ -302,6 +332,11 @@ bool initOpenGL()
     return false;
   }
 
+  // Fragment shader invocation counts need pipeline statistics queries
+  pipelineStatsSupported = GLAD_GL_VERSION_4_6 != 0;
+  if (!pipelineStatsSupported)
+    printf("OpenGL 4.6 not available, depth prepass statistics disabled.\n");
+
 #if _ENABLE_OPENGL_DEBUG
   // Enable error handling callback function - context must be created with DEBUG flags
   glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
@@ -361,6 +396,9 @@ void shutDown()
   if (glIsTexture(checkerTex))
     glDeleteTextures(1, &checkerTex);
 
+  // Release the queries
+  glDeleteQueries(2, fsInvocationQueries);
+
   // Release the window
   glfwDestroyWindow(mainWindow.handle);
 
@@ -422,6 +460,42 @@ void processInput(float dt)
   }
 }
 
+// Draw the scene geometry, the position only streams are enough for the depth prepass
+void drawGeometry(bool positionsOnly)
+{
+  // Create transformation matrix
+  glm::mat4x4 transformation = glm::mat4x4(1.0f);
+
+#if _PLANE
+  transformation *= glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
+  glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(transformation));
+
+  // Draw the quad
+  glBindVertexArray(positionsOnly ? quad->GetPositionVAO() : quad->GetVAO());
+  glDrawElements(GL_TRIANGLES, quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+#endif
+
+#if _TUNNEL
+  // Update transformation matrix for the cube
+  transformation = glm::mat4x4(1.0f);
+  transformation *= glm::scale(glm::vec3(2.0f, 2.0f, 200.0f));
+  glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(transformation));
+
+  // Draw the cube
+  glBindVertexArray(positionsOnly ? cube->GetPositionVAO() : cube->GetVAO());
+  glDrawElements(GL_TRIANGLES, cube->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+#elif _CUBE
+  // Update transformation matrix for the cube
+  transformation = glm::mat4x4(1.0f);
+  transformation *= glm::translate(glm::vec3(0.0f, 0.5f, 0.0f));
+  glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(transformation));
+
+  // Draw the cube
+  glBindVertexArray(positionsOnly ? cube->GetPositionVAO() : cube->GetVAO());
+  glDrawElements(GL_TRIANGLES, cube->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+#endif
+}
+
 void renderScene()
 {
   // Enable/disable depth test and write
@@ -442,6 +516,29 @@ void renderScene()
   glClearColor(0.1f, 0.2f, 0.4f, 1.0f);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+  // Optional depth prepass, then shade only the fragments matching the primed depth
+  bool prepass = depthPrepass && depthTest;
+  if (prepass)
+  {
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+    glUseProgram(shaderProgram[ShaderProgram::DepthPrepass]);
+    glUniformMatrix4fv(0, 1, GL_FALSE, glm::value_ptr(camera.GetWorldToView()));
+    glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(camera.GetProjection()));
+    drawGeometry(true);
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+  }
+
+  // Count the fragment shader invocations of the shading pass
+  if (pipelineStatsSupported)
+  {
+    fsInvocationPrepass[frameCount % 2] = prepass;
+    glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS, fsInvocationQueries[frameCount % 2]);
+  }
+
   // Tell OpenGL we'd like to use the previously compiled shader program
   glUseProgram(shaderProgram[ShaderProgram::Default]);
 
@@ -460,40 +557,26 @@ void renderScene()
 
   // --------------------------------------------------------------------------
 
-  // Create transformation matrix
-  glm::mat4x4 transformation = glm::mat4x4(1.0f);
-
-#if _PLANE
-  transformation *= glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
-  glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(transformation));
-
-  // Draw the quad
-  glBindVertexArray(quad->GetVAO());
-  glDrawElements(GL_TRIANGLES, quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
-#endif
-
-#if _TUNNEL
-  // Update transformation matrix for the cube
-  transformation = glm::mat4x4(1.0f);
-  transformation *= glm::scale(glm::vec3(2.0f, 2.0f, 200.0f));
-  glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(transformation));
-
-  // Draw the cube
-  glBindVertexArray(cube->GetVAO());
-  glDrawElements(GL_TRIANGLES, cube->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
-#elif _CUBE
-  // Update transformation matrix for the cube
-  transformation = glm::mat4x4(1.0f);
-  transformation *= glm::translate(glm::vec3(0.0f, 0.5f, 0.0f));
-  glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(transformation));
-
-  // Draw the cube
-  glBindVertexArray(cube->GetVAO());
-  glDrawElements(GL_TRIANGLES, cube->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
-#endif
+  drawGeometry(false);
 
   // --------------------------------------------------------------------------
 
+  // Read the statistics of the previous frame if they are available
+  if (pipelineStatsSupported)
+  {
+    glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS);
+
+    if (frameCount > 0)
+    {
+      int previous = (frameCount + 1) % 2;
+      GLint available = 0;
+      glGetQueryObjectiv(fsInvocationQueries[previous], GL_QUERY_RESULT_AVAILABLE, &available);
+      if (available)
+        glGetQueryObjectui64v(fsInvocationQueries[previous], GL_QUERY_RESULT, &fsInvocations[fsInvocationPrepass[previous] ? 1 : 0]);
+    }
+  }
+  ++frameCount;
+
   // Unbind the shader program and other resources
   glBindVertexArray(0);
   glUseProgram(0);
@@ -512,7 +595,15 @@ void mainLoop()
 
     // Print it to the title bar
     static char title[MAX_TEXT_LENGTH];
-    snprintf(title, MAX_TEXT_LENGTH, "dt = %.2fms, FPS = %.1f", dt * 1000.0f, 1.0f / dt);
+    bool primed = depthPrepass && depthTest;
+    if (fsInvocations[0] && fsInvocations[1])
+      snprintf(title, MAX_TEXT_LENGTH, "%sdt = %.2fms, FPS = %.1f, FS invocations: %llu, saved by prepass: %lld", primed ? "[Prepass] " : "", dt * 1000.0f, 1.0f / dt,
+               (unsigned long long)fsInvocations[primed ? 1 : 0], (long long)fsInvocations[0] - (long long)fsInvocations[1]);
+    else if (pipelineStatsSupported)
+      snprintf(title, MAX_TEXT_LENGTH, "%sdt = %.2fms, FPS = %.1f, FS invocations: %llu", primed ? "[Prepass] " : "", dt * 1000.0f, 1.0f / dt,
+               (unsigned long long)fsInvocations[primed ? 1 : 0]);
+    else
+      snprintf(title, MAX_TEXT_LENGTH, "%sdt = %.2fms, FPS = %.1f", primed ? "[Prepass] " : "", dt * 1000.0f, 1.0f / dt);
     glfwSetWindowTitle(mainWindow.handle, title);
 
     // Poll the events like keyboard, mouse, etc.
@@ -75,6 +75,15 @@ bool compileShaders()
     return false;
   }
 
+  shaderProgram[ShaderProgram::DepthPrepass] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::DepthPrepass], vertexShader[VertexShader::Default]);
+  glAttachShader(shaderProgram[ShaderProgram::DepthPrepass], fragmentShader[FragmentShader::DepthOnly]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::DepthPrepass]))
+  {
+    cleanUp();
+    return false;
+  }
+
   cleanUp();
   return true;
 }
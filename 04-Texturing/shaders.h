@@ -12,7 +12,7 @@ namespace ShaderProgram
 {
   enum
   {
-    Default, NumShaderPrograms
+    Default, DepthPrepass, NumShaderPrograms
   };
 }
 
@@ -56,6 +56,9 @@ layout (location = 1) in vec2 texCoord;
 // Vertex output
 out vec2 vTexCoord;
 
+// Depth primed pass relies on bit exact positions with GL_EQUAL
+invariant gl_Position;
+
 void main()
 {
   vTexCoord = texCoord;
@@ -70,7 +73,7 @@ namespace FragmentShader
 {
   enum
   {
-    Default, NumFragmentShaders
+    Default, DepthOnly, NumFragmentShaders
   };
 }
 
@@ -102,4 +105,15 @@ void main()
   vec3 texSample = texture(diffuse, vTexCoord.st).rgb;
   color = vec4(texSample, 1.0f);
 }
+)",
+// ----------------------------------------------------------------------------
+// Depth only fragment shader source for the depth prepass
+// ----------------------------------------------------------------------------
+R"(
+#version 330 core
+
+void main()
+{
+  // Nothing to do, depth is written by the fixed function pipeline
+}
 )", ""};
@@ -3,6 +3,7 @@
  * Licensed under the zlib license, see LICENSE.txt in the root directory.
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <vector>
 #include <glad/gl.h>
@@ -13,6 +14,9 @@
 #include <MathSupport.h>
 #include <Camera.h>
 #include <Geometry.h>
+#include <MeshImporter.h>
+#include <RenderTargetPool.h>
+#include <ResourceRegistry.h>
 #include <Textures.h>
 
 #include "shaders.h"
@@ -94,6 +98,8 @@ static const unsigned int MAX_INSTANCES = 1024;
 static const unsigned int MAX_TEXT_LENGTH = 256;
 // MSAA samples
 static const GLsizei MSAA_SAMPLES = 4;
+// Screen space error in pixels a coarser level of detail may introduce
+static const float LOD_PIXEL_ERROR = 1.0f;
 // Used MSAA samples
 GLsizei msaaLevel = MSAA_SAMPLES;
 
@@ -101,6 +107,15 @@ GLsizei msaaLevel = MSAA_SAMPLES;
 const int numCubes = 10;
 // Cube position
 std::vector<glm::vec3> cubePositions;
+// Optional OBJ or glTF mesh drawn instead of the cubes, given as the first command line argument
+const char *meshFile = nullptr;
+// Transformation fitting the imported mesh into the unit cube
+glm::mat4x4 meshFit = glm::mat4x4(1.0f);
+
+// Maximum number of lights for Forward+ rendering
+static const int MAX_LIGHTS = 4096;
+// Number of lights used by Forward+ rendering
+int numLights = 1;
 
 
 // Camera instance
@@ -118,7 +133,7 @@ GLuint vao = 0;
 GLuint fbo = 0;
 // Our render target for rendering
 GLuint renderTarget = 0;
-// Our depth stencil for rendering
+// Our depth stencil for rendering, a texture so that Forward+ can read it
 GLuint depthStencil = 0;
 
 // Vsync on?
@@ -129,10 +144,67 @@ bool depthTest = true;
 bool wireframe = false;
 // Tonemapping on?
 bool tonemapping = true;
+// Forward+ available, i.e., OpenGL 4.3 context?
+bool forwardPlusSupported = false;
+// Forward+ rendering on?
+bool forwardPlus = false;
+// Depth prepass before shading on?
+bool depthPrepass = false;
+// Pipeline statistics queries available, i.e., OpenGL 4.6 context?
+bool pipelineStatsSupported = false;
+// Screen space error based level of detail selection on?
+bool lodSelection = true;
 // Instancing buffer handle
 GLuint instancingBuffer = 0;
+// Size of the instance uniform block and its aligned stride, the buffer holds one block per level of detail
+GLsizeiptr instancingBlockSize = 0;
+GLsizeiptr instancingStride = 0;
+// Number of instances drawn with each level of detail in the current frame
+std::vector<int> lodInstanceCounts;
+// Triangles saved by the level of detail selection in the current frame
+int lodTrianglesSaved = 0;
+// GPU meshlet culling available, i.e., OpenGL 4.3 context and an imported mesh?
+bool meshletCullingSupported = false;
+// GPU meshlet culling of the full detail instances on?
+bool meshletCulling = true;
+// Indirect draws with the count from a buffer available, i.e., OpenGL 4.6 context?
+bool indirectCountSupported = false;
+// Meshlets of the full detail level of the imported mesh
+std::vector<Meshlet> meshlets;
+// Meshlet bounds and index ranges shader storage buffer
+GLuint meshletBuffer = 0;
+// Indirect draw commands of the visible meshlets, one slot per meshlet and instance
+GLuint drawCommandBuffer = 0;
+// Draw and triangle counters of the culling, double buffered to read back the previous frame
+GLuint meshletCounterBuffers[2] = {0};
+// Counter buffer written in the current frame
+int meshletCounterIndex = 0;
+// Triangles of the full detail instances culled in the last read back frame
+int meshletTrianglesCulled = 0;
+// Identity instance index stream, provides the instancing shaders with the base instance of indirect draws
+GLuint instanceIndexBuffer = 0;
+// Hierarchical depth buffer, farthest depth in each texel of each level
+GLuint hiZTexture = 0;
+int hiZLevels = 0;
+// Hi-Z holds the depth of the previous frame rendered with this world to clip transformation
+bool hiZValid = false;
+glm::mat4x4 hiZWorldToClip = glm::mat4x4(1.0f);
 // Transformation matrices uniform buffer object
 GLuint transformBlockUBO = 0;
+// Forward+ light shader storage buffer
+GLuint lightBuffer = 0;
+// Forward+ per tile light lists shader storage buffer
+GLuint tileBuffer = 0;
+// Number of Forward+ screen tiles
+int numTilesX = 0, numTilesY = 0;
+// Fragment shader invocation queries of the shading passes, double buffered
+GLuint fsInvocationQueries[2] = {0};
+// Depth prepass state of the frames the queries were issued in
+bool fsInvocationPrepass[2] = {false};
+// Last shading fragment shader invocations without [0] and with [1] the depth prepass
+GLuint64 fsInvocations[2] = {0};
+// Frame counter for the double buffered queries
+unsigned int frameCount = 0;
 
 // Data for a single object instance
 struct InstanceData
@@ -141,6 +213,15 @@ struct InstanceData
   glm::mat3x4 transformation;
 };
 
+// Data for a single Forward+ light
+struct LightData
+{
+  // Position of the light, radius in w
+  glm::vec4 position;
+  // Color of the light
+  glm::vec4 color;
+};
+
 // ----------------------------------------------------------------------------
 
 // Textures we'll be using
@@ -157,6 +238,10 @@ GLuint loadedTextures[LoadedTextures::NumTextures] = {0};
 
 // Forward declaration for the framebuffer creation
 void createFramebuffer(int width, int height, GLsizei MSAA);
+// Forward declaration for the Forward+ tile buffer creation
+void createTileBuffer(int width, int height);
+// Forward declaration for the Hi-Z creation
+void createHiZ(int width, int height);
 
 // Callback for handling GLFW errors
 void errorCallback(int error, const char* description)
@@ -172,15 +257,25 @@ void APIENTRY debugCallback(GLenum source, GLenum type, GLuint id, GLenum severi
 }
 #endif
 
-// Callback for handling window resize events
-void resizeCallback(GLFWwindow* window, int width, int height)
+// Apply the window size to the viewport, camera and the per tile and Hi-Z buffers, the render targets are recreated separately once the size settles
+void resize(int width, int height)
 {
   mainWindow.width = width;
   mainWindow.height = height;
   glViewport(0, 0, width, height);
   camera.SetProjection(fov, (float)width / (float)height, nearClipPlane, farClipPlane);
 
-  createFramebuffer(width, height, msaaLevel);
+  createTileBuffer(width, height);
+  createHiZ(width, height);
+}
+
+// Callback for handling window resize events, the viewport and camera follow right away while the render targets are
+// recreated only once the size settles and leaves their size buckets so that dragging the window edge doesn't
+// reallocate them on every event
+void resizeCallback(GLFWwindow* window, int width, int height)
+{
+  resize(width, height);
+  RenderTargetPool::GetInstance().RequestResize(width, height);
 }
 
 // Callback for handling mouse movement over the window - called when mouse movement is detected
@@ -250,6 +345,57 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     tonemapping = !tonemapping;
   }
 
+  // Enable/disable Forward+ rendering
+  if (key == GLFW_KEY_F7 && action == GLFW_PRESS)
+  {
+    if (forwardPlusSupported)
+      forwardPlus = !forwardPlus;
+    else
+      printf("Forward+ requires OpenGL 4.3!\n");
+  }
+
+  // Enable/disable the depth prepass
+  if (key == GLFW_KEY_F8 && action == GLFW_PRESS)
+  {
+    depthPrepass = !depthPrepass;
+    printf("Depth prepass: %s\n", depthPrepass ? "on" : "off");
+  }
+
+  // Enable/disable the level of detail selection
+  if (key == GLFW_KEY_F9 && action == GLFW_PRESS)
+  {
+    lodSelection = !lodSelection;
+    printf("LOD selection: %s\n", lodSelection ? "on" : "off");
+  }
+
+  // Enable/disable the GPU meshlet culling
+  if (key == GLFW_KEY_F10 && action == GLFW_PRESS)
+  {
+    if (meshletCullingSupported)
+    {
+      meshletCulling = !meshletCulling;
+      hiZValid = false;
+      printf("Meshlet culling: %s\n", meshletCulling ? "on" : "off");
+    }
+    else
+    {
+      printf("Meshlet culling requires OpenGL 4.3 and an imported mesh!\n");
+    }
+  }
+
+  // Double/halve the number of Forward+ lights
+  if (key == GLFW_KEY_PAGE_UP && action == GLFW_PRESS && numLights < MAX_LIGHTS)
+  {
+    numLights *= 2;
+    printf("Forward+ lights: %d\n", numLights);
+  }
+
+  if (key == GLFW_KEY_PAGE_DOWN && action == GLFW_PRESS && numLights > 1)
+  {
+    numLights /= 2;
+    printf("Forward+ lights: %d\n", numLights);
+  }
+
   // Zoom in
   if (key == GLFW_KEY_KP_ADD || key == GLFW_KEY_EQUAL && action == GLFW_PRESS)
   {
@@ -289,7 +435,7 @@ void loadTextures()
   loadedTextures[LoadedTextures::Blue] = Textures::CreateSingleColorTexture(127, 127, 255);
   loadedTextures[LoadedTextures::CheckerBoard] = Textures::CreateCheckerBoardTexture(256, 16);
   loadedTextures[LoadedTextures::Diffuse] = Textures::LoadTexture("data/Terracotta_Tiles_002_Base_Color.jpg", true);
-  loadedTextures[LoadedTextures::Normal] = Textures::LoadTexture("data/Terracotta_Tiles_002_Normal.jpg", false);
+  loadedTextures[LoadedTextures::Normal] = Textures::LoadTexture("data/Terracotta_Tiles_002_Normal.jpg", false, true);
   loadedTextures[LoadedTextures::Specular] = Textures::LoadTexture("data/Terracotta_Tiles_002_Roughness.jpg", false);
   loadedTextures[LoadedTextures::Occlusion] = Textures::LoadTexture("data/Terracotta_Tiles_002_ambientOcclusion.jpg", false);
 }
@@ -300,9 +446,79 @@ void createGeometry()
   // Create general use VAO
   glGenVertexArrays(1, &vao);
 
-  // Prepare meshes
-  quad = Geometry::CreateQuadNormalTangentTex();
-  cube = Geometry::CreateCubeNormalTangentTex();
+  // Prepare meshes with position only streams for the depth prepass
+  quad = Geometry::CreateQuadNormalTangentTex(true);
+
+  // Imported mesh replaces the cubes, fall back to them if it fails to load
+  if (meshFile)
+  {
+    glm::vec3 boundsMin, boundsMax;
+    cube = MeshImporter::LoadMesh<Vertex_Pos_Nrm_Tgt_Tex>(meshFile, &boundsMin, &boundsMax, &meshlets, true);
+    if (cube)
+    {
+      glm::vec3 extent = boundsMax - boundsMin;
+      float size = glm::max(extent.x, glm::max(extent.y, extent.z));
+      meshFit = glm::scale(glm::vec3(size > 0.0f ? 1.0f / size : 1.0f)) * glm::translate(-0.5f * (boundsMin + boundsMax));
+    }
+  }
+
+  if (!cube)
+    cube = Geometry::CreateCubeNormalTangentTex(true);
+
+  // Instance index stream shared by both cube VAOs
+  {
+    std::vector<GLuint> instanceIndices(MAX_INSTANCES);
+    for (unsigned int i = 0; i < MAX_INSTANCES; ++i)
+      instanceIndices[i] = i;
+
+    glGenBuffers(1, &instanceIndexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceIndexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCES * sizeof(GLuint), instanceIndices.data(), GL_STATIC_DRAW);
+    ResourceRegistry::GetInstance().TrackBuffer(instanceIndexBuffer, MAX_INSTANCES * sizeof(GLuint), ResourceCategory::Meshes, "Instance indices");
+
+    GLuint cubeVaos[] = {cube->GetVAO(), cube->GetPositionVAO()};
+    for (GLuint cubeVao : cubeVaos)
+    {
+      glBindVertexArray(cubeVao);
+      glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(GLuint), reinterpret_cast<void*>(0));
+      glVertexAttribDivisor(4, 1);
+      glEnableVertexAttribArray(4);
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  // Meshlet culling buffers, the draw commands and counters are filled on the GPU only
+  meshletCullingSupported = forwardPlusSupported && !meshlets.empty();
+  if (meshletCullingSupported)
+  {
+    glGenBuffers(1, &meshletBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshletBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, meshlets.size() * sizeof(Meshlet), meshlets.data(), GL_STATIC_DRAW);
+    ResourceRegistry::GetInstance().TrackBuffer(meshletBuffer, meshlets.size() * sizeof(Meshlet), ResourceCategory::Buffers, "Meshlets");
+
+    // DrawElementsIndirectCommand is 5 GLuints
+    glGenBuffers(1, &drawCommandBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCommandBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, meshlets.size() * numCubes * 5 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    ResourceRegistry::GetInstance().TrackBuffer(drawCommandBuffer, meshlets.size() * numCubes * 5 * sizeof(GLuint), ResourceCategory::Buffers, "Meshlet draw commands");
+
+    glGenBuffers(2, meshletCounterBuffers);
+    for (GLuint counterBuffer : meshletCounterBuffers)
+    {
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+      glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+      ResourceRegistry::GetInstance().TrackBuffer(counterBuffer, 2 * sizeof(GLuint), ResourceCategory::Buffers, "Meshlet counters");
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    printf("Meshlet culling: %d meshlets\n", (int)meshlets.size());
+  }
+
+  // Queries for counting the shading fragment shader invocations
+  if (pipelineStatsSupported)
+    glGenQueries(2, fsInvocationQueries);
 
   {
     // Generate the instancing buffer as Uniform Buffer Object
@@ -314,8 +530,16 @@ void createGeometry()
     GLint uboSize = 0;
     glGetActiveUniformBlockiv(shaderProgram[ShaderProgram::Instancing], uboIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &uboSize);
 
+    // Instances are grouped by their level of detail, each group is bound as a separate range
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    instancingBlockSize = uboSize;
+    instancingStride = (uboSize + alignment - 1) / alignment * alignment;
+    lodInstanceCounts.assign(cube->GetLodCount(), 0);
+
     // Describe the buffer data - we're going to change this every frame
-    glBufferData(GL_UNIFORM_BUFFER, uboSize, nullptr, GL_DYNAMIC_DRAW);
+    glBufferData(GL_UNIFORM_BUFFER, cube->GetLodCount() * instancingStride, nullptr, GL_DYNAMIC_DRAW);
+    ResourceRegistry::GetInstance().TrackBuffer(instancingBuffer, cube->GetLodCount() * instancingStride, ResourceCategory::Buffers, "Instancing");
 
     // Unbind the GL_UNIFORM_BUFFER target for now
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
@@ -336,6 +560,7 @@ void createGeometry()
 
     // Describe the buffer data - we're going to change this every frame
     glBufferData(GL_UNIFORM_BUFFER, uboSize, nullptr, GL_DYNAMIC_DRAW);
+    ResourceRegistry::GetInstance().TrackBuffer(transformBlockUBO, uboSize, ResourceCategory::Buffers, "Transform block");
 
     // Bind the memory for usage
     glBindBufferBase(GL_UNIFORM_BUFFER, 0, transformBlockUBO);
@@ -359,6 +584,38 @@ void createGeometry()
   }
 }
 
+// Helper method for creating the Forward+ lights
+void createLights()
+{
+  if (!forwardPlusSupported)
+    return;
+
+  // Calculate radius based on the light intensity
+  auto getLightRadius = [](const glm::vec3 &color) -> float
+  {
+    // Visible cutoff, but we can afford it with that many lights
+    const float cutoff = 0.05f;
+    return sqrt(getLuminousIntensity(color) / cutoff);
+  };
+
+  // Scatter the lights randomly over the floor
+  std::vector<LightData> lightData(MAX_LIGHTS);
+  for (int i = 0; i < MAX_LIGHTS; ++i)
+  {
+    glm::vec3 color = glm::vec3(getRandom(0.0f, 2.0f), getRandom(0.0f, 2.0f), getRandom(0.0f, 2.0f));
+    glm::vec3 position = glm::vec3(getRandom(-15.0f, 15.0f), getRandom(0.1f, 3.0f), getRandom(-15.0f, 15.0f));
+    lightData[i].position = glm::vec4(position, getLightRadius(color));
+    lightData[i].color = glm::vec4(color, 1.0f);
+  }
+
+  // Upload all of them at once, the number of used lights is passed as a uniform
+  glGenBuffers(1, &lightBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_LIGHTS * sizeof(LightData), lightData.data(), GL_STATIC_DRAW);
+  ResourceRegistry::GetInstance().TrackBuffer(lightBuffer, MAX_LIGHTS * sizeof(LightData), ResourceCategory::Buffers, "Lights");
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
 // Helper method for OpenGL initialization
 bool initOpenGL()
 {
@@ -368,17 +625,26 @@ bool initOpenGL()
   // Initialize the GLFW library
   if (!glfwInit()) return false;
 
-  // Request OpenGL 3.3 core profile upon window creation
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  // Set the context hints, the version is negotiated below
   glfwWindowHint(GLFW_SAMPLES, 0); // Disable MSAA, we'll handle it ourselves
 #if _ENABLE_OPENGL_DEBUG
   glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
 #endif
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-  // Create the window
-  mainWindow.handle = glfwCreateWindow(Window::DefaultWidth, Window::DefaultHeight, "", nullptr, nullptr);
+  // Request OpenGL 4.6 core profile for pipeline statistics, fall back to 4.3 for Forward+ and to 3.3 without both
+  const int contextVersions[][2] = {{4, 6}, {4, 3}, {3, 3}};
+  for (const auto &version : contextVersions)
+  {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+
+    // Create the window
+    mainWindow.handle = glfwCreateWindow(Window::DefaultWidth, Window::DefaultHeight, "", nullptr, nullptr);
+    if (mainWindow.handle != nullptr)
+      break;
+  }
+
   if (mainWindow.handle == nullptr)
   {
     printf("Failed to create the GLFW window!");
@@ -394,6 +660,17 @@ bool initOpenGL()
     return false;
   }
 
+  // Forward+ needs compute shaders and shader storage buffers
+  forwardPlusSupported = GLAD_GL_VERSION_4_3 != 0;
+  if (!forwardPlusSupported)
+    printf("OpenGL 4.3 not available, Forward+ disabled.\n");
+
+  // Fragment shader invocation counts need pipeline statistics queries
+  pipelineStatsSupported = GLAD_GL_VERSION_4_6 != 0;
+  indirectCountSupported = GLAD_GL_VERSION_4_6 != 0;
+  if (!pipelineStatsSupported)
+    printf("OpenGL 4.6 not available, depth prepass statistics disabled.\n");
+
 #if _ENABLE_OPENGL_DEBUG
   // Enable error handling callback function - context must be created with DEBUG flags
   glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
@@ -446,7 +723,11 @@ bool initOpenGL()
   glfwSetCursorPosCallback(mainWindow.handle, mouseMoveCallback);
 
   // Set the OpenGL viewport and camera projection
-  resizeCallback(mainWindow.handle, Window::DefaultWidth, Window::DefaultHeight);
+  resize(Window::DefaultWidth, Window::DefaultHeight);
+
+  // Create the render targets for the initial window size
+  createFramebuffer(Window::DefaultWidth, Window::DefaultHeight, msaaLevel);
+  RenderTargetPool::GetInstance().SetTargetSize(Window::DefaultWidth, Window::DefaultHeight);
 
   // Set the initial camera position and orientation
   camera.SetTransformation(glm::vec3(-3.0f, 3.0f, -5.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
@@ -473,63 +754,23 @@ void createFramebuffer(int width, int height, GLsizei MSAA)
   // Render target texture:
   // --------------------------------------------------------------------------
 
-  // Delete it if necessary
-  if (glIsTexture(renderTarget))
-  {
-    glDeleteTextures(1, &renderTarget);
-    renderTarget = 0;
-  }
+  // Return the previous target to the pool, a target of the same size bucket is handed right back
+  RenderTargetPool &pool = RenderTargetPool::GetInstance();
+  pool.ReleaseTexture(renderTarget);
 
-  // Create the texture name
-  if (renderTarget == 0)
-  {
-    glGenTextures(1, &renderTarget);
-  }
-
-  // Bind and recreate the render target texture
-  if (MSAA > 1)
-  {
-    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, renderTarget);
-    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, MSAA, GL_RGB16F, width, height, GL_TRUE);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, renderTarget, 0);
-  }
-  else
-  {
-    glBindTexture(GL_TEXTURE_2D, renderTarget);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderTarget, 0);
-  }
+  // Get the render target texture, it may be larger than the window
+  GLenum target = MSAA > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+  renderTarget = pool.AcquireTexture(GL_RGB16F, width, height, MSAA, "HDR render target");
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, renderTarget, 0);
 
   // --------------------------------------------------------------------------
   // Depth buffer texture:
   // --------------------------------------------------------------------------
 
-  // Delete it if necessary
-  if (glIsRenderbuffer(depthStencil))
-  {
-    glDeleteRenderbuffers(1, &depthStencil);
-    depthStencil = 0;
-  }
-
-  // Create the depth-stencil name
-  if (depthStencil == 0)
-  {
-    glGenRenderbuffers(1, &depthStencil);
-  }
-
-  // Bind and recreate the depth-stencil Render Buffer Object
-  glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
-  if (MSAA > 1)
-  {
-    glRenderbufferStorageMultisample(GL_RENDERBUFFER, MSAA, GL_DEPTH_COMPONENT32F, width, height);
-  }
-  else
-  {
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
-  }
-  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthStencil);
+  // Get the depth texture, Forward+ light culling reads it
+  pool.ReleaseTexture(depthStencil);
+  depthStencil = pool.AcquireTexture(GL_DEPTH_COMPONENT32F, width, height, MSAA, "Depth buffer");
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target, depthStencil, 0);
 
   // Set the list of draw buffers.
   GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0};
@@ -546,9 +787,57 @@ void createFramebuffer(int width, int height, GLsizei MSAA)
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+// Helper function for creating the Forward+ per tile light lists buffer
+void createTileBuffer(int width, int height)
+{
+  if (!forwardPlusSupported)
+    return;
+
+  // Number of tiles covering the whole screen
+  numTilesX = (width + FORWARD_PLUS_TILE_SIZE - 1) / FORWARD_PLUS_TILE_SIZE;
+  numTilesY = (height + FORWARD_PLUS_TILE_SIZE - 1) / FORWARD_PLUS_TILE_SIZE;
+
+  if (!tileBuffer)
+  {
+    glGenBuffers(1, &tileBuffer);
+  }
+
+  // Each tile stores the number of lights followed by the light indices, filled on the GPU only
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, numTilesX * numTilesY * (FORWARD_PLUS_MAX_TILE_LIGHTS + 1) * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+  ResourceRegistry::GetInstance().TrackBuffer(tileBuffer, numTilesX * numTilesY * (FORWARD_PLUS_MAX_TILE_LIGHTS + 1) * sizeof(GLuint), ResourceCategory::Buffers, "Forward+ tiles");
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// Helper function for creating the hierarchical depth buffer for the meshlet occlusion culling
+void createHiZ(int width, int height)
+{
+  if (!forwardPlusSupported || width <= 0 || height <= 0)
+    return;
+
+  // Immutable storage, recreate it with the full mip chain
+  ResourceRegistry::GetInstance().DeleteTextures(1, &hiZTexture);
+  glGenTextures(1, &hiZTexture);
+
+  int size = width > height ? width : height;
+  hiZLevels = 1;
+  while ((size >> hiZLevels) > 0)
+    ++hiZLevels;
+
+  glBindTexture(GL_TEXTURE_2D, hiZTexture);
+  glTexStorage2D(GL_TEXTURE_2D, hiZLevels, GL_R32F, width, height);
+  ResourceRegistry::GetInstance().TrackTexture(hiZTexture, GL_TEXTURE_2D, ResourceCategory::RenderTargets, "Hierarchical depth");
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  hiZValid = false;
+}
+
 // Helper method for graceful shutdown
 void shutDown()
 {
+  // Report the GPU memory before anything gets released
+  ResourceRegistry::GetInstance().PrintReport();
+
   // Release shader programs
   for (int i = 0; i < ShaderProgram::NumShaderPrograms; ++i)
   {
@@ -562,18 +851,31 @@ void shutDown()
   cube = nullptr;
 
   // Release the instancing buffer
-  glDeleteBuffers(1, &instancingBuffer);
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &instancingBuffer);
 
-  // Release the framebuffer
-  glDeleteTextures(1, &renderTarget);
-  glDeleteTextures(1, &depthStencil);
+  // Release the Forward+ buffers
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &lightBuffer);
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &tileBuffer);
+
+  // Release the meshlet culling resources
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &instanceIndexBuffer);
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &meshletBuffer);
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &drawCommandBuffer);
+  ResourceRegistry::GetInstance().DeleteBuffers(2, meshletCounterBuffers);
+  ResourceRegistry::GetInstance().DeleteTextures(1, &hiZTexture);
+
+  // Release the queries
+  glDeleteQueries(2, fsInvocationQueries);
+
+  // Release the framebuffer and its targets
   glDeleteFramebuffers(1, &fbo);
+  RenderTargetPool::GetInstance().Clear();
 
   // Release the generic VAO
   glDeleteVertexArrays(1, &vao);
 
   // Release textures
-  glDeleteTextures(LoadedTextures::NumTextures, loadedTextures);
+  ResourceRegistry::GetInstance().DeleteTextures(LoadedTextures::NumTextures, loadedTextures);
 
   // Release the window
   glfwDestroyWindow(mainWindow.handle);
@@ -657,6 +959,26 @@ void bindTextures(const GLuint &diffuse, const GLuint &normal, const GLuint &spe
   glBindSampler(3, textures.GetSampler(Sampler::Anisotropic));
 }
 
+// Coarsest level of detail whose simplification error projects under LOD_PIXEL_ERROR pixels
+int selectLod(const glm::vec3 &position)
+{
+  if (!lodSelection)
+    return 0;
+
+  // Instances fit the unit cube, conservative bounding sphere radius and the uniform scale of the fit
+  const float radius = 0.87f;
+  float scale = meshFit[0][0];
+
+  // Pixels per world space unit at unit distance
+  float pixelScale = (float)mainWindow.height / (2.0f * tanf(glm::radians(fov) * 0.5f));
+  float distance = glm::max(glm::length(position - glm::vec3(camera.GetViewToWorld()[3])) - radius, nearClipPlane);
+
+  int lod = 0;
+  while (lod + 1 < cube->GetLodCount() && cube->GetLod(lod + 1).error * scale * pixelScale / distance <= LOD_PIXEL_ERROR)
+    ++lod;
+  return lod;
+}
+
 // Helper function for creating and updating the instance data
 void updateInstanceData()
 {
@@ -664,6 +986,11 @@ void updateInstanceData()
   static glm::mat4x4 transformation;
   // Instance data CPU side buffer
   static std::vector<InstanceData> instanceData(MAX_INSTANCES);
+  // Selected level of detail of each instance
+  static std::vector<int> instanceLods(MAX_INSTANCES);
+
+  std::fill(lodInstanceCounts.begin(), lodInstanceCounts.end(), 0);
+  lodTrianglesSaved = 0;
 
   // Cubes
   float angle = 20.0f;
@@ -671,19 +998,206 @@ void updateInstanceData()
   {
     transformation = glm::translate(cubePositions[i]);
     transformation *= glm::rotate(glm::radians(i * angle), glm::vec3(1.0f, 1.0f, 1.0f));
+    transformation *= meshFit;
 
     instanceData[i].transformation = glm::transpose(transformation);
+
+    int lod = selectLod(cubePositions[i]);
+    instanceLods[i] = lod;
+    ++lodInstanceCounts[lod];
+    lodTrianglesSaved += (cube->GetIBOSize() - cube->GetLod(lod).numIndices) / 3;
   }
 
   // Bind the whole instancing buffer to the index 1
   glBindBufferBase(GL_UNIFORM_BUFFER, 1, instancingBuffer);
 
-  // Update the buffer data using mapping
-  void *ptr = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY);
-  memcpy(ptr, &*(instanceData.begin()), numCubes * sizeof(InstanceData));
+  // Update the buffer data using mapping, instances are grouped by their level of detail
+  unsigned char *ptr = static_cast<unsigned char*>(glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY));
+  std::vector<int> lodFill(lodInstanceCounts.size(), 0);
+  for (int i = 0; i < numCubes; ++i)
+  {
+    int lod = instanceLods[i];
+    memcpy(ptr + lod * instancingStride + lodFill[lod]++ * sizeof(InstanceData), &instanceData[i], sizeof(InstanceData));
+  }
   glUnmapBuffer(GL_UNIFORM_BUFFER);
 }
 
+// Draw the instances level by level of detail, each level reads its own range of the instancing buffer
+void drawInstances(GLuint vao)
+{
+  glBindVertexArray(vao);
+  for (int lod = 0; lod < cube->GetLodCount(); ++lod)
+  {
+    if (lodInstanceCounts[lod] == 0)
+      continue;
+
+    const MeshLod &level = cube->GetLod(lod);
+    glBindBufferRange(GL_UNIFORM_BUFFER, 1, instancingBuffer, lod * instancingStride, instancingBlockSize);
+
+    // Full detail instances draw the meshlets that survived the culling
+    if (lod == 0 && meshletCullingSupported && meshletCulling)
+    {
+      GLsizei maxDraws = (GLsizei)meshlets.size() * lodInstanceCounts[0];
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommandBuffer);
+      if (indirectCountSupported)
+      {
+        glBindBuffer(GL_PARAMETER_BUFFER, meshletCounterBuffers[meshletCounterIndex]);
+        glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<void*>(0), 0, maxDraws, 0);
+        glBindBuffer(GL_PARAMETER_BUFFER, 0);
+      }
+      else
+      {
+        // Slots past the draw count were cleared to empty draws
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<void*>(0), maxDraws, 0);
+      }
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+      continue;
+    }
+
+    glDrawElementsInstanced(GL_TRIANGLES, level.numIndices, GL_UNSIGNED_INT, reinterpret_cast<void*>(level.firstIndex * sizeof(GLuint)), lodInstanceCounts[lod]);
+  }
+}
+
+// World to clip space transformation of the current camera
+glm::mat4x4 getWorldToClip()
+{
+  return camera.GetProjection() * camera.GetWorldToView();
+}
+
+// Cull the meshlets of the full detail instances on the GPU against the frustum, their normal cones and the Hi-Z
+// of the previous frame, the visible ones are compacted into indirect draw commands for drawInstances
+void cullMeshlets()
+{
+  if (!meshletCullingSupported || !meshletCulling)
+  {
+    meshletTrianglesCulled = 0;
+    return;
+  }
+
+  // Triangles submitted to the culling in the frame each counter buffer belongs to
+  static int culledTriangles[2] = {0};
+  static bool counterWritten[2] = {false};
+
+  // Read back the counters of the previous frame, it should be done by now
+  int previous = meshletCounterIndex;
+  meshletCounterIndex = 1 - meshletCounterIndex;
+  if (counterWritten[previous])
+  {
+    GLuint counters[2] = {0};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshletCounterBuffers[previous]);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+    meshletTrianglesCulled = culledTriangles[previous] - (int)counters[1];
+  }
+
+  // Reset the counters of this frame, without the indirect count all the command slots are drawn so clear them too
+  GLuint zero[2] = {0};
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshletCounterBuffers[meshletCounterIndex]);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), zero);
+  if (!indirectCountSupported)
+  {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCommandBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  // World space frustum planes from the rows of the world to clip transformation
+  glm::mat4x4 worldToClip = getWorldToClip();
+  glm::vec4 rows[4];
+  for (int i = 0; i < 4; ++i)
+    rows[i] = glm::vec4(worldToClip[0][i], worldToClip[1][i], worldToClip[2][i], worldToClip[3][i]);
+
+  glm::vec4 planes[6] = {rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[3] + rows[2], rows[3] - rows[2]};
+  for (glm::vec4 &plane : planes)
+    plane /= glm::length(glm::vec3(plane));
+
+  int numInstances = lodInstanceCounts[0];
+  glm::vec4 viewPos = camera.GetViewToWorld()[3];
+
+  glUseProgram(shaderProgram[ShaderProgram::MeshletCulling]);
+  glUniform1i(0, (GLint)meshlets.size());
+  glUniform1i(1, numInstances);
+  glUniform3f(2, viewPos.x, viewPos.y, viewPos.z);
+  // Back faces can't be culled when they're drawn
+  glUniform3i(3, 1, glIsEnabled(GL_CULL_FACE) ? 1 : 0, hiZValid ? 1 : 0);
+  glUniformMatrix4fv(4, 1, GL_FALSE, glm::value_ptr(hiZWorldToClip));
+  glUniform4fv(8, 6, glm::value_ptr(planes[0]));
+
+  glBindBufferRange(GL_UNIFORM_BUFFER, 1, instancingBuffer, 0, instancingBlockSize);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, meshletBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, drawCommandBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, meshletCounterBuffers[meshletCounterIndex]);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, hiZTexture);
+  glBindSampler(0, 0);
+
+  GLuint numInvocations = (GLuint)meshlets.size() * numInstances;
+  glDispatchCompute((numInvocations + MESHLET_CULLING_GROUP_SIZE - 1) / MESHLET_CULLING_GROUP_SIZE, 1, 1);
+
+  // Commands and the draw count are consumed by the indirect draws, the counters are read back the next frame
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+
+  culledTriangles[meshletCounterIndex] = numInstances * cube->GetIBOSize() / 3;
+  counterWritten[meshletCounterIndex] = true;
+}
+
+// Build the Hi-Z from the depth of this frame for the occlusion culling of the next one
+void buildHiZ()
+{
+  if (!meshletCullingSupported || !meshletCulling)
+    return;
+
+  // Finest level from all the depth samples
+  glUseProgram(shaderProgram[ShaderProgram::HiZInit]);
+  glUniform1i(0, msaaLevel);
+  if (msaaLevel > 1)
+  {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, depthStencil);
+    glBindSampler(0, 0);
+  }
+  else
+  {
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, depthStencil);
+    glBindSampler(1, 0);
+  }
+
+  glBindImageTexture(0, hiZTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+  glDispatchCompute((mainWindow.width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (mainWindow.height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+
+  // Farthest depth of the finer texels for the rest of the chain
+  glUseProgram(shaderProgram[ShaderProgram::HiZDownsample]);
+  for (int level = 1; level < hiZLevels; ++level)
+  {
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    int width = (mainWindow.width >> level) > 1 ? (mainWindow.width >> level) : 1;
+    int height = (mainWindow.height >> level) > 1 ? (mainWindow.height >> level) : 1;
+    glBindImageTexture(0, hiZTexture, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+    glBindImageTexture(1, hiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+  }
+
+  // The culling samples it as a texture
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+  glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+
+  hiZWorldToClip = getWorldToClip();
+  hiZValid = true;
+}
+
 void updateProgramData(GLuint program, const glm::vec3 &lightPosition)
 {
   // TODO: make this a transform block as well
@@ -721,6 +1235,141 @@ void updateTransformBlock()
   glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
+// Depth only pass over the scene using the position only streams, expects the instancing buffer bound
+void renderDepthPrepass(const glm::mat4x3 &floorTransformation)
+{
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+  glUseProgram(shaderProgram[ShaderProgram::DepthPrepass]);
+  glUniformMatrix4x3fv(0, 1, GL_FALSE, glm::value_ptr(floorTransformation));
+  glBindVertexArray(quad->GetPositionVAO());
+  glDrawElements(GL_TRIANGLES, quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+
+  glUseProgram(shaderProgram[ShaderProgram::DepthPrepassInstanced]);
+  drawInstances(cube->GetPositionVAO());
+
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+// Start counting fragment shader invocations of the shading passes
+void beginShadingStats()
+{
+  if (!pipelineStatsSupported)
+    return;
+
+  fsInvocationPrepass[frameCount % 2] = (depthPrepass && depthTest) || forwardPlus;
+  glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS, fsInvocationQueries[frameCount % 2]);
+}
+
+// Stop counting and read the results of the previous frame if they are available
+void endShadingStats()
+{
+  if (!pipelineStatsSupported)
+    return;
+
+  glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS);
+
+  if (frameCount > 0)
+  {
+    int previous = (frameCount + 1) % 2;
+    GLint available = 0;
+    glGetQueryObjectiv(fsInvocationQueries[previous], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available)
+      glGetQueryObjectui64v(fsInvocationQueries[previous], GL_QUERY_RESULT, &fsInvocations[fsInvocationPrepass[previous] ? 1 : 0]);
+  }
+  ++frameCount;
+}
+
+// Forward+ rendering: depth prepass, per tile light culling and shading with the tile lights only
+void renderForwardPlus()
+{
+  // Floor transformation - 4 columns, 3 rows, last (0, 0, 0, 1) implicit to save space
+  glm::mat4x3 floorTransformation = glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
+
+  // Update instances and bind the instancing buffer
+  updateInstanceData();
+  cullMeshlets();
+
+  // Depth prepass, no color writes
+  renderDepthPrepass(floorTransformation);
+
+  // Build the per tile light lists
+  {
+    glUseProgram(shaderProgram[ShaderProgram::LightCulling]);
+    glUniform1i(0, numLights);
+    glUniform1i(1, msaaLevel);
+    glUniform2f(2, nearClipPlane, farClipPlane);
+    glUniform2i(3, mainWindow.width, mainWindow.height);
+
+    // Bind the depth buffer to the unit matching its type
+    if (msaaLevel > 1)
+    {
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, depthStencil);
+      glBindSampler(0, 0);
+    }
+    else
+    {
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(GL_TEXTURE_2D, depthStencil);
+      glBindSampler(1, 0);
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, lightBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, tileBuffer);
+    glDispatchCompute(numTilesX, numTilesY, 1);
+
+    // Light lists must be written before the fragment shaders read them
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // Unbind the depth buffer, it's still attached to the framebuffer
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  // Shade the visible fragments only, depth is already there
+  glDepthFunc(GL_EQUAL);
+  glDepthMask(GL_FALSE);
+  beginShadingStats();
+
+  // Draw the scene floor:
+  {
+    GLuint program = shaderProgram[ShaderProgram::ForwardPlus];
+    glUseProgram(program);
+    updateProgramData(program, glm::vec3(0.0f));
+    glUniform1i(6, numTilesX);
+    glUniformMatrix4x3fv(0, 1, GL_FALSE, glm::value_ptr(floorTransformation));
+
+    bindTextures(loadedTextures[LoadedTextures::CheckerBoard], loadedTextures[LoadedTextures::Blue], loadedTextures[LoadedTextures::Grey], loadedTextures[LoadedTextures::White]);
+
+    glBindVertexArray(quad->GetVAO());
+    glDrawElements(GL_TRIANGLES, quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+  }
+
+  // Draw cubes:
+  {
+    GLuint program = shaderProgram[ShaderProgram::ForwardPlusInstanced];
+    glUseProgram(program);
+    updateProgramData(program, glm::vec3(0.0f));
+    glUniform1i(6, numTilesX);
+
+    bindTextures(loadedTextures[LoadedTextures::Diffuse], loadedTextures[LoadedTextures::Normal], loadedTextures[LoadedTextures::Specular], loadedTextures[LoadedTextures::Occlusion]);
+
+    drawInstances(cube->GetVAO());
+  }
+
+  endShadingStats();
+  glDepthFunc(GL_LEQUAL);
+  glDepthMask(GL_TRUE);
+
+  // Unbind the buffers
+  glBindBufferBase(GL_UNIFORM_BUFFER, 1, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+}
+
 void renderScene()
 {
   updateTransformBlock();
@@ -761,45 +1410,73 @@ void renderScene()
   // Light position
   static glm::vec3 lightPosition(-3.0f, 3.0f, 0.0f);
 
-  // Draw the scene floor:
+  if (forwardPlus)
+  {
+    renderForwardPlus();
+  }
+  else
   {
-    glUseProgram(shaderProgram[ShaderProgram::Default]);
-    updateProgramData(shaderProgram[ShaderProgram::Default], lightPosition);
+    // Create floor transformation matrix - 4 columns, 3 rows, last (0, 0, 0, 1) implicit to save space
+    glm::mat4x3 floorTransformation = glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
 
-    // Create transformation matrix - 4 columns, 3 rows, last (0, 0, 0, 1) implicit to save space
-    glm::mat4x3 transformation = glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
-    glUniformMatrix4x3fv(0, 1, GL_FALSE, glm::value_ptr(transformation));
+    // Update instances and bind the instancing buffer
+    updateInstanceData();
+    cullMeshlets();
 
-    bindTextures(loadedTextures[LoadedTextures::CheckerBoard], loadedTextures[LoadedTextures::Blue], loadedTextures[LoadedTextures::Grey], loadedTextures[LoadedTextures::White]);
+    // Optional depth prepass, then shade only the fragments matching the primed depth
+    bool prepass = depthPrepass && depthTest;
+    if (prepass)
+    {
+      renderDepthPrepass(floorTransformation);
+      glDepthFunc(GL_EQUAL);
+      glDepthMask(GL_FALSE);
+    }
 
-    glBindVertexArray(quad->GetVAO());
-    glDrawElements(GL_TRIANGLES, quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
-  }
+    beginShadingStats();
 
-  // --------------------------------------------------------------------------
+    // Draw the scene floor:
+    {
+      glUseProgram(shaderProgram[ShaderProgram::Default]);
+      updateProgramData(shaderProgram[ShaderProgram::Default], lightPosition);
+      glUniformMatrix4x3fv(0, 1, GL_FALSE, glm::value_ptr(floorTransformation));
 
-  // Draw cubes:
-  {
-    glUseProgram(shaderProgram[ShaderProgram::Instancing]);
+      bindTextures(loadedTextures[LoadedTextures::CheckerBoard], loadedTextures[LoadedTextures::Blue], loadedTextures[LoadedTextures::Grey], loadedTextures[LoadedTextures::White]);
 
-    // Update the transformation & projection matrices
-    updateProgramData(shaderProgram[ShaderProgram::Instancing], lightPosition);
+      glBindVertexArray(quad->GetVAO());
+      glDrawElements(GL_TRIANGLES, quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+    }
 
-    // Update instances and bind the instancing buffer
-    updateInstanceData();
+    // ------------------------------------------------------------------------
 
-    bindTextures(loadedTextures[LoadedTextures::Diffuse], loadedTextures[LoadedTextures::Normal], loadedTextures[LoadedTextures::Specular], loadedTextures[LoadedTextures::Occlusion]);
+    // Draw cubes:
+    {
+      glUseProgram(shaderProgram[ShaderProgram::Instancing]);
+
+      // Update the transformation & projection matrices
+      updateProgramData(shaderProgram[ShaderProgram::Instancing], lightPosition);
+
+      bindTextures(loadedTextures[LoadedTextures::Diffuse], loadedTextures[LoadedTextures::Normal], loadedTextures[LoadedTextures::Specular], loadedTextures[LoadedTextures::Occlusion]);
 
-    glBindVertexArray(cube->GetVAO());
-    glDrawElementsInstanced(GL_TRIANGLES, cube->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), numCubes);
+      drawInstances(cube->GetVAO());
 
-    // Unbind the instancing buffer
-    glBindBufferBase(GL_UNIFORM_BUFFER, 1, 0);
+      // Unbind the instancing buffer
+      glBindBufferBase(GL_UNIFORM_BUFFER, 1, 0);
+    }
+
+    endShadingStats();
+
+    // Restore the depth state for the light point
+    if (prepass)
+    {
+      glDepthFunc(GL_LEQUAL);
+      glDepthMask(GL_TRUE);
+    }
   }
 
   // --------------------------------------------------------------------------
 
-  // Draw the light:
+  // Draw the light, not used by Forward+:
+  if (!forwardPlus)
   {
     glUseProgram(shaderProgram[ShaderProgram::PointRendering]);
 
@@ -816,6 +1493,9 @@ void renderScene()
     glDrawArrays(GL_POINTS, 0, 1);
   }
 
+  // Depth of this frame for the next frame's meshlet occlusion culling
+  buildHiZ();
+
   // --------------------------------------------------------------------------
 
   // Unbind the shader program and other resources
@@ -881,12 +1561,39 @@ void mainLoop()
 
     // Print it to the title bar
     static char title[MAX_TEXT_LENGTH];
-    snprintf(title, MAX_TEXT_LENGTH, "dt = %.2fms, FPS = %.1f", dt * 1000.0f, 1.0f / dt);
+    static char stats[MAX_TEXT_LENGTH];
+    bool primed = (depthPrepass && depthTest) || forwardPlus;
+    if (pipelineStatsSupported && fsInvocations[0] && fsInvocations[1])
+      snprintf(stats, MAX_TEXT_LENGTH, ", FS invocations: %llu, saved by prepass: %lld",
+               (unsigned long long)fsInvocations[primed ? 1 : 0], (long long)fsInvocations[0] - (long long)fsInvocations[1]);
+    else if (pipelineStatsSupported)
+      snprintf(stats, MAX_TEXT_LENGTH, ", FS invocations: %llu", (unsigned long long)fsInvocations[primed ? 1 : 0]);
+    else
+      stats[0] = '\0';
+
+    static char culling[MAX_TEXT_LENGTH];
+    if (meshletCullingSupported && meshletCulling)
+      snprintf(culling, MAX_TEXT_LENGTH, ", meshlets culled %d tris", meshletTrianglesCulled);
+    else
+      culling[0] = '\0';
+
+    if (forwardPlus)
+      snprintf(title, MAX_TEXT_LENGTH, "[Forward+ %d lights] dt = %.2fms, FPS = %.1f, LOD saved %d tris%s%s", numLights, dt * 1000.0f, 1.0f / dt, lodTrianglesSaved, culling, stats);
+    else
+      snprintf(title, MAX_TEXT_LENGTH, "%sdt = %.2fms, FPS = %.1f, LOD saved %d tris%s%s", depthPrepass ? "[Prepass] " : "", dt * 1000.0f, 1.0f / dt, lodTrianglesSaved, culling, stats);
     glfwSetWindowTitle(mainWindow.handle, title);
 
     // Poll the events like keyboard, mouse, etc.
     glfwPollEvents();
 
+    // Recreate the render targets once the window size settles
+    int width, height;
+    if (RenderTargetPool::GetInstance().Update(width, height))
+    {
+      createFramebuffer(width, height, msaaLevel);
+      RenderTargetPool::GetInstance().PrintStats();
+    }
+
     // Process keyboard input
     processInput(dt);
 
@@ -898,8 +1605,12 @@ void mainLoop()
   }
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+  // Optional mesh to draw instead of the cubes
+  if (argc > 1)
+    meshFile = argv[1];
+
   // Initialize the OpenGL context and create a window
   if (!initOpenGL())
   {
@@ -919,6 +1630,9 @@ int main()
   // Create the scene geometry
   createGeometry();
 
+  // Create lights for Forward+ rendering
+  createLights();
+
   // Load & create texture
   loadTextures();
 
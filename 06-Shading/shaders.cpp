@@ -11,9 +11,13 @@ bool compileShaders()
 {
   GLuint vertexShader[VertexShader::NumVertexShaders] = {0};
   GLuint fragmentShader[FragmentShader::NumFragmentShaders] = {0};
+  GLuint computeShader[ComputeShader::NumComputeShaders] = {0};
+
+  // Forward+ needs compute shaders and shader storage buffers
+  const bool forwardPlusSupported = GLAD_GL_VERSION_4_3 != 0;
 
   // Cleanup lambda
-  auto cleanUp = [&vertexShader, &fragmentShader]()
+  auto cleanUp = [&vertexShader, &fragmentShader, &computeShader]()
   {
     // First detach shaders from programs
     GLsizei count = 0;
@@ -41,6 +45,12 @@ bool compileShaders()
       if (glIsShader(fragmentShader[i]))
         glDeleteShader(fragmentShader[i]);
     }
+
+    for (int i = 0; i < ComputeShader::NumComputeShaders; ++i)
+    {
+      if (glIsShader(computeShader[i]))
+        glDeleteShader(computeShader[i]);
+    }
   };
 
   // UBO explicit binding lambda - call after program linking
@@ -66,6 +76,10 @@ bool compileShaders()
   // Compile all fragment shaders
   for (int i = 0; i < FragmentShader::NumFragmentShaders; ++i)
   {
+    // GLSL 430 shader can't be compiled on older contexts
+    if (i == FragmentShader::ForwardPlus && !forwardPlusSupported)
+      continue;
+
     fragmentShader[i] = ShaderCompiler::CompileShader(fsSource, i, GL_FRAGMENT_SHADER);
     if (!fragmentShader[i])
     {
@@ -115,6 +129,106 @@ bool compileShaders()
     return false;
   }
 
+  shaderProgram[ShaderProgram::DepthPrepass] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::DepthPrepass], vertexShader[VertexShader::Default]);
+  glAttachShader(shaderProgram[ShaderProgram::DepthPrepass], fragmentShader[FragmentShader::DepthOnly]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::DepthPrepass]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::DepthPrepass]);
+
+  shaderProgram[ShaderProgram::DepthPrepassInstanced] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::DepthPrepassInstanced], vertexShader[VertexShader::Instancing]);
+  glAttachShader(shaderProgram[ShaderProgram::DepthPrepassInstanced], fragmentShader[FragmentShader::DepthOnly]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::DepthPrepassInstanced]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::DepthPrepassInstanced]);
+  uniformBlockBinding(shaderProgram[ShaderProgram::DepthPrepassInstanced], "InstanceBuffer", 1);
+
+  // --------------------------------------------------------------------------
+  // Forward+ shader programs
+  // --------------------------------------------------------------------------
+
+  if (!forwardPlusSupported)
+  {
+    cleanUp();
+    return true;
+  }
+
+  // Compile all compute shaders
+  for (int i = 0; i < ComputeShader::NumComputeShaders; ++i)
+  {
+    computeShader[i] = ShaderCompiler::CompileShader(csSource, i, GL_COMPUTE_SHADER);
+    if (!computeShader[i])
+    {
+      cleanUp();
+      return false;
+    }
+  }
+
+  shaderProgram[ShaderProgram::LightCulling] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::LightCulling], computeShader[ComputeShader::LightCulling]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::LightCulling]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  shaderProgram[ShaderProgram::ForwardPlus] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::ForwardPlus], vertexShader[VertexShader::Default]);
+  glAttachShader(shaderProgram[ShaderProgram::ForwardPlus], fragmentShader[FragmentShader::ForwardPlus]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::ForwardPlus]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::ForwardPlus]);
+
+  shaderProgram[ShaderProgram::ForwardPlusInstanced] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::ForwardPlusInstanced], vertexShader[VertexShader::Instancing]);
+  glAttachShader(shaderProgram[ShaderProgram::ForwardPlusInstanced], fragmentShader[FragmentShader::ForwardPlus]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::ForwardPlusInstanced]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::ForwardPlusInstanced]);
+  uniformBlockBinding(shaderProgram[ShaderProgram::ForwardPlusInstanced], "InstanceBuffer", 1);
+
+  // --------------------------------------------------------------------------
+  // GPU meshlet culling shader programs
+  // --------------------------------------------------------------------------
+
+  shaderProgram[ShaderProgram::MeshletCulling] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::MeshletCulling], computeShader[ComputeShader::MeshletCulling]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::MeshletCulling]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::MeshletCulling], "InstanceBuffer", 1);
+
+  shaderProgram[ShaderProgram::HiZInit] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::HiZInit], computeShader[ComputeShader::HiZInit]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::HiZInit]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  shaderProgram[ShaderProgram::HiZDownsample] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::HiZDownsample], computeShader[ComputeShader::HiZDownsample]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::HiZDownsample]))
+  {
+    cleanUp();
+    return false;
+  }
+
   cleanUp();
   return true;
 }
@@ -12,10 +12,24 @@ namespace ShaderProgram
 {
   enum
   {
-    Default, Instancing, PointRendering, Tonemapping, NumShaderPrograms
+    Default, Instancing, PointRendering, Tonemapping, DepthPrepass, DepthPrepassInstanced,
+    // Forward+ programs, require OpenGL 4.3
+    LightCulling, ForwardPlus, ForwardPlusInstanced,
+    // GPU meshlet culling programs, require OpenGL 4.3
+    MeshletCulling, HiZInit, HiZDownsample,
+    NumShaderPrograms
   };
 }
 
+// Forward+ screen tile size in pixels, must match the light culling compute shader
+static const int FORWARD_PLUS_TILE_SIZE = 16;
+// Maximum number of lights per screen tile, must match the Forward+ shaders
+static const int FORWARD_PLUS_MAX_TILE_LIGHTS = 255;
+// Meshlet culling work group size, must match the meshlet culling compute shader
+static const int MESHLET_CULLING_GROUP_SIZE = 64;
+// Hi-Z build work group size, must match the Hi-Z compute shaders
+static const int HIZ_GROUP_SIZE = 16;
+
 // Shader programs handle
 extern GLuint shaderProgram[ShaderProgram::NumShaderPrograms];
 
@@ -74,6 +88,9 @@ out VertexData
   vec4 worldPos;
 } vOut;
 
+// Depth primed passes rely on bit exact positions with GL_EQUAL
+invariant gl_Position;
+
 void main()
 {
   // Pass texture coordinates to the fragment shader
@@ -121,6 +138,8 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec3 tangent;
 layout (location = 3) in vec2 texCoord;
+// Instance index from an identity instanced stream, unlike gl_InstanceID it includes the base instance of indirect draws
+layout (location = 4) in uint instanceIndex;
 
 // Must match the structure on the CPU side
 struct InstanceData
@@ -147,13 +166,16 @@ out VertexData
   vec4 worldPos;
 } vOut;
 
+// Depth primed passes rely on bit exact positions with GL_EQUAL
+invariant gl_Position;
+
 void main()
 {
   // Pass texture coordinates to the fragment shader
   vOut.texCoord = texCoord.st;
 
   // Retrieve the model to world matrix from the instance buffer
-  mat3x4 modelToWorld = instanceBuffer[gl_InstanceID].modelToWorld;
+  mat3x4 modelToWorld = instanceBuffer[instanceIndex].modelToWorld;
 
   // Construct the normal transformation matrix - only if modelToWorld contains non-uniform scale!
   //mat3 normalTransform = transpose(inverse(mat3(modelToWorld)));
@@ -230,7 +252,7 @@ namespace FragmentShader
 {
   enum
   {
-    Default, SingleColor, Tonemapping, NumFragmentShaders
+    Default, SingleColor, Tonemapping, DepthOnly, ForwardPlus, NumFragmentShaders
   };
 }
 
@@ -383,9 +405,8 @@ vec3 ApplyTonemapping(vec3 hdr)
 
 void main()
 {
-  // Query the size of the texture and calculate texel coordinates
-  ivec2 texSize = textureSize(HDR);
-  ivec2 texel = ivec2(UV * texSize);
+  // Texel coordinates of the fragment, the texture may be larger than the screen
+  ivec2 texel = ivec2(gl_FragCoord.xy);
 
   // Accumulate color for all MSAA samples
   vec3 finalColor = vec3(0.0f);
@@ -404,4 +425,543 @@ void main()
   //color.rgb = pow(color.rgb, vec3(1.0f / gamma));
 }
 )",
+// ----------------------------------------------------------------------------
+// Depth only fragment shader source for the depth prepass
+// ----------------------------------------------------------------------------
+R"(
+#version 330 core
+
+void main()
+{
+  // Nothing to do, depth is written by the fixed function pipeline
+}
+)",
+// ----------------------------------------------------------------------------
+// Forward+ fragment shader source, shades with the lights of its screen tile
+// ----------------------------------------------------------------------------
+R"(
+#version 430 core
+
+// Texture sampler
+layout (binding = 0) uniform sampler2D Diffuse;
+layout (binding = 1) uniform sampler2D Normal;
+layout (binding = 2) uniform sampler2D Specular;
+layout (binding = 3) uniform sampler2D Occlusion;
+
+// View position in world space coordinates
+layout (location = 5) uniform vec4 viewPosWS;
+// Number of screen tiles in the horizontal direction
+layout (location = 6) uniform int numTilesX;
+
+// Screen tile size, must match FORWARD_PLUS_TILE_SIZE
+const int TILE_SIZE = 16;
+// Maximum number of lights per tile, must match FORWARD_PLUS_MAX_TILE_LIGHTS
+const uint MAX_TILE_LIGHTS = 255;
+
+// Must match the structure on the CPU side
+struct LightData
+{
+  // Light position in world space, radius in w
+  vec4 positionWS;
+  // Light color and intensity
+  vec4 color;
+};
+
+// All lights in the scene
+layout (std430, binding = 0) readonly buffer LightBuffer
+{
+  LightData lights[];
+};
+
+// Per tile light lists: number of lights followed by MAX_TILE_LIGHTS light indices
+layout (std430, binding = 1) readonly buffer TileBuffer
+{
+  uint tileData[];
+};
+
+// Fragment shader inputs
+in VertexData
+{
+  vec2 texCoord;
+  vec3 tangent;
+  vec3 bitangent;
+  vec3 normal;
+  vec4 worldPos;
+} vIn;
+
+// Fragment shader outputs
+layout (location = 0) out vec4 color;
+
+void main()
+{
+  // Sample textures
+  vec3 albedo = texture(Diffuse, vIn.texCoord.st).rgb;
+  vec3 noSample = texture(Normal, vIn.texCoord.st).rgb;
+  float specSample = texture(Specular, vIn.texCoord.st).r;
+  float occlusion = texture(Occlusion, vIn.texCoord.st).r;
+
+  // Calculate world-space normal
+  mat3 STN = {vIn.tangent, vIn.bitangent, vIn.normal};
+  vec3 normal = STN * (noSample * 2.0f - 1.0f);
+
+  // Calculate the view direction
+  vec3 viewDir = normalize(viewPosWS.xyz - vIn.worldPos.xyz);
+
+  // Find the light list of our tile
+  ivec2 tile = ivec2(gl_FragCoord.xy) / TILE_SIZE;
+  uint offset = uint(tile.y * numTilesX + tile.x) * (MAX_TILE_LIGHTS + 1);
+  uint numLights = tileData[offset];
+
+  // Accumulate the Blinn-Phong terms of all lights affecting the tile
+  vec3 diffuse = vec3(0.0f);
+  vec3 specular = vec3(0.0f);
+  for (uint i = 0; i < numLights; ++i)
+  {
+    LightData light = lights[tileData[offset + 1 + i]];
+
+    // Calculate the lighting direction and distance
+    vec3 lightDir = light.positionWS.xyz - vIn.worldPos.xyz;
+    float lengthSq = dot(lightDir, lightDir);
+    float length = sqrt(lengthSq);
+    lightDir /= length;
+
+    // Distance function must get to 0 before leaving the light radius
+    float radius = light.positionWS.w;
+    float attenuation = 1.0f - smoothstep(0.66f * radius, 0.9f * radius, length);
+
+    // Cheaper approximation of reflected direction = reflect(-lightDir, normal)
+    vec3 halfDir = normalize(viewDir + lightDir);
+
+    // Calculate diffuse and specular coefficients
+    float NdotL = max(0.0f, dot(normal, lightDir));
+    float NdotH = max(0.0f, dot(normal, halfDir));
+
+    diffuse += attenuation * NdotL * light.color.rgb / lengthSq;
+    specular += attenuation * specSample * light.color.rgb * pow(NdotH, 64.0f) / lengthSq;
+  }
+
+  // Calculate the final color
+  vec3 ambient = vec3(0.01f, 0.01f, 0.01f) * occlusion;
+  vec3 finalColor = albedo * (ambient + diffuse) + specular;
+  color = vec4(finalColor, 1.0f);
+}
+)",
+""};
+
+// ============================================================================
+
+// Compute shader types
+namespace ComputeShader
+{
+  enum
+  {
+    LightCulling, MeshletCulling, HiZInit, HiZDownsample, NumComputeShaders
+  };
+}
+
+// Compute shader sources
+static const char* csSource[] = {
+// ----------------------------------------------------------------------------
+// Forward+ light culling compute shader source, one work group per screen tile
+// ----------------------------------------------------------------------------
+R"(
+#version 430 core
+
+// One invocation per pixel of a tile, must match FORWARD_PLUS_TILE_SIZE
+layout (local_size_x = 16, local_size_y = 16) in;
+
+// Uniform blocks, i.e., constants
+layout (std140, binding = 0) uniform TransformBlock
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  mat3x4 worldToView;
+  mat4x4 projection;
+};
+
+// Depth buffer from the prepass, multisampled or not
+layout (binding = 0) uniform sampler2DMS DepthMS;
+layout (binding = 1) uniform sampler2D Depth;
+
+// Number of lights to cull
+layout (location = 0) uniform int numLights;
+// Number of used MSAA samples
+layout (location = 1) uniform int msaaLevel;
+// Near/far clip planes for depth linearization
+layout (location = 2) uniform vec2 NEAR_FAR;
+// Size of the screen, the depth buffer may be larger
+layout (location = 3) uniform ivec2 screenSize;
+
+// Maximum number of lights per tile, must match FORWARD_PLUS_MAX_TILE_LIGHTS
+const uint MAX_TILE_LIGHTS = 255;
+
+// Must match the structure on the CPU side
+struct LightData
+{
+  // Light position in world space, radius in w
+  vec4 positionWS;
+  // Light color and intensity
+  vec4 color;
+};
+
+// All lights in the scene
+layout (std430, binding = 0) readonly buffer LightBuffer
+{
+  LightData lights[];
+};
+
+// Per tile light lists: number of lights followed by MAX_TILE_LIGHTS light indices
+layout (std430, binding = 1) writeonly buffer TileBuffer
+{
+  uint tileData[];
+};
+
+// Tile depth range as float bits, positive floats keep their ordering as uints
+shared uint minDepthBits;
+shared uint maxDepthBits;
+// Lights intersecting the tile
+shared uint tileLightCount;
+shared uint tileLights[MAX_TILE_LIGHTS];
+
+// Reverts the projection matrix transformation of the depth
+float linearizeDepth(float d)
+{
+  const float near = NEAR_FAR.x;
+  const float far = NEAR_FAR.y;
+  return (near * far) / (far + d * (near - far));
+}
+
+void main()
+{
+  if (gl_LocalInvocationIndex == 0)
+  {
+    minDepthBits = floatBitsToUint(1.0f);
+    maxDepthBits = floatBitsToUint(0.0f);
+    tileLightCount = 0;
+  }
+  barrier();
+
+  // Find the depth range of the tile from all samples of all pixels
+  ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+  if (texel.x < screenSize.x && texel.y < screenSize.y)
+  {
+    float dMin = 1.0f;
+    float dMax = 0.0f;
+    if (msaaLevel > 1)
+    {
+      for (int i = 0; i < msaaLevel; ++i)
+      {
+        float d = texelFetch(DepthMS, texel, i).r;
+        dMin = min(dMin, d);
+        dMax = max(dMax, d);
+      }
+    }
+    else
+    {
+      dMin = dMax = texelFetch(Depth, texel, 0).r;
+    }
+
+    atomicMin(minDepthBits, floatBitsToUint(dMin));
+    atomicMax(maxDepthBits, floatBitsToUint(dMax));
+  }
+  barrier();
+
+  // Skip tiles without any geometry
+  float dMin = uintBitsToFloat(minDepthBits);
+  float dMax = uintBitsToFloat(maxDepthBits);
+  if (dMin < 1.0f)
+  {
+    float zMin = linearizeDepth(dMin);
+    float zMax = linearizeDepth(dMax);
+
+    // Tile rectangle in NDC
+    vec2 ndcMin = vec2(gl_WorkGroupID.xy * gl_WorkGroupSize.xy) / vec2(screenSize) * 2.0f - 1.0f;
+    vec2 ndcMax = vec2((gl_WorkGroupID.xy + 1) * gl_WorkGroupSize.xy) / vec2(screenSize) * 2.0f - 1.0f;
+
+    // View space bounding box of the tile frustum between the min and max depth,
+    // view space x, y are NDC scaled by the depth and the projection scale,
+    // the camera looks down -z, i.e., the depths are negated
+    vec2 scale = vec2(projection[0][0], projection[1][1]);
+    vec2 xyMin = min(ndcMin * zMin, ndcMin * zMax) / scale;
+    vec2 xyMax = max(ndcMax * zMin, ndcMax * zMax) / scale;
+    vec3 aabbMin = vec3(xyMin, -zMax);
+    vec3 aabbMax = vec3(xyMax, -zMin);
+
+    // Test lights in parallel, sphere against the bounding box
+    for (uint i = gl_LocalInvocationIndex; i < uint(numLights); i += gl_WorkGroupSize.x * gl_WorkGroupSize.y)
+    {
+      // Multiply from the left because of transposed worldToView
+      vec4 light = lights[i].positionWS;
+      vec3 lightPosVS = vec4(light.xyz, 1.0f) * worldToView;
+
+      vec3 d = clamp(lightPosVS, aabbMin, aabbMax) - lightPosVS;
+      if (dot(d, d) <= light.w * light.w)
+      {
+        uint index = atomicAdd(tileLightCount, 1);
+        if (index < MAX_TILE_LIGHTS)
+          tileLights[index] = i;
+      }
+    }
+  }
+  barrier();
+
+  // Write out the tile light list
+  uint tileIndex = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+  uint offset = tileIndex * (MAX_TILE_LIGHTS + 1);
+  uint count = min(tileLightCount, MAX_TILE_LIGHTS);
+  if (gl_LocalInvocationIndex == 0)
+    tileData[offset] = count;
+
+  for (uint i = gl_LocalInvocationIndex; i < count; i += gl_WorkGroupSize.x * gl_WorkGroupSize.y)
+  {
+    tileData[offset + 1 + i] = tileLights[i];
+  }
+}
+)",
+// ----------------------------------------------------------------------------
+// Meshlet culling compute shader source, one invocation per meshlet and instance
+// ----------------------------------------------------------------------------
+R"(
+#version 430 core
+
+// Must match MESHLET_CULLING_GROUP_SIZE
+layout (local_size_x = 64) in;
+
+// Must match the structure on the CPU side
+struct InstanceData
+{
+  // Transposed modelToWorld matrix - stored compactly as an array of 3 x vec4
+  mat3x4 modelToWorld;
+};
+
+// Instances of the full detail level
+layout (std140, binding = 1) uniform InstanceBuffer
+{
+  InstanceData instanceBuffer[1024];
+};
+
+// Must match the Meshlet structure on the CPU side
+struct Meshlet
+{
+  // Bounding sphere center and radius
+  vec4 sphere;
+  // Normal cone axis and cutoff
+  vec4 cone;
+  // Index buffer range
+  uint firstIndex;
+  uint numIndices;
+  uint padding[2];
+};
+
+layout (std430, binding = 0) readonly buffer MeshletBuffer
+{
+  Meshlet meshlets[];
+};
+
+// Must match the DrawElementsIndirectCommand layout
+struct DrawCommand
+{
+  uint count;
+  uint instanceCount;
+  uint firstIndex;
+  int baseVertex;
+  uint baseInstance;
+};
+
+// Compacted draws of the visible meshlets
+layout (std430, binding = 1) writeonly buffer DrawCommandBuffer
+{
+  DrawCommand commands[];
+};
+
+// Number of emitted draws, also the parameter of the indirect count draw, and their triangles
+layout (std430, binding = 2) buffer CounterBuffer
+{
+  uint drawCount;
+  uint visibleTriangles;
+};
+
+// Hierarchical depth of the previous frame, farthest depth of each texel
+layout (binding = 0) uniform sampler2D HiZ;
+
+// Number of meshlets and full detail instances
+layout (location = 0) uniform int numMeshlets;
+layout (location = 1) uniform int numInstances;
+// Camera position in world space
+layout (location = 2) uniform vec3 viewPosWS;
+// Enabled tests: frustum, backface cone and Hi-Z occlusion
+layout (location = 3) uniform ivec3 cullTests;
+// World to clip space transformation the Hi-Z was rendered with
+layout (location = 4) uniform mat4 hiZWorldToClip;
+// World space frustum planes, dot(plane.xyz, p) + plane.w >= 0 inside
+layout (location = 8) uniform vec4 frustumPlanes[6];
+
+// Test the bounding box of the sphere against the farthest depth of the Hi-Z texels it covers
+bool isOccluded(vec3 center, float radius)
+{
+  vec3 ndcMin = vec3(1.0f);
+  vec3 ndcMax = vec3(-1.0f);
+  for (int i = 0; i < 8; ++i)
+  {
+    vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0f : -1.0f, (i & 2) != 0 ? 1.0f : -1.0f, (i & 4) != 0 ? 1.0f : -1.0f);
+    vec4 clip = hiZWorldToClip * vec4(corner, 1.0f);
+
+    // Crossing the camera plane, can't tell
+    if (clip.w <= 0.0f)
+      return false;
+
+    vec3 ndc = clip.xyz / clip.w;
+    ndcMin = min(ndcMin, ndc);
+    ndcMax = max(ndcMax, ndc);
+  }
+
+  // Covered pixels of the finest level
+  ivec2 size = textureSize(HiZ, 0);
+  ivec2 pixelMin = clamp(ivec2((ndcMin.xy * 0.5f + 0.5f) * vec2(size)), ivec2(0), size - 1);
+  ivec2 pixelMax = clamp(ivec2((ndcMax.xy * 0.5f + 0.5f) * vec2(size)), ivec2(0), size - 1);
+
+  // Coarsest level where the rectangle spans at most 2x2 texels
+  ivec2 extent = pixelMax - pixelMin;
+  int extentMax = max(extent.x, extent.y);
+  int level = min(extentMax > 0 ? findMSB(extentMax) + 1 : 0, textureQueryLevels(HiZ) - 1);
+  ivec2 levelSize = textureSize(HiZ, level);
+  ivec2 texelMin = min(pixelMin >> level, levelSize - 1);
+  ivec2 texelMax = min(pixelMax >> level, levelSize - 1);
+
+  float farthest = 0.0f;
+  for (int y = texelMin.y; y <= texelMax.y; ++y)
+  {
+    for (int x = texelMin.x; x <= texelMax.x; ++x)
+    {
+      farthest = max(farthest, texelFetch(HiZ, ivec2(x, y), level).r);
+    }
+  }
+
+  return ndcMin.z * 0.5f + 0.5f > farthest;
+}
+
+void main()
+{
+  uint id = gl_GlobalInvocationID.x;
+  if (id >= uint(numMeshlets * numInstances))
+    return;
+
+  uint meshletIndex = id % uint(numMeshlets);
+  uint instance = id / uint(numMeshlets);
+  Meshlet meshlet = meshlets[meshletIndex];
+  mat3x4 modelToWorld = instanceBuffer[instance].modelToWorld;
+
+  // Multiply from the left because of transposed modelToWorld, instances are scaled uniformly
+  vec3 center = vec4(meshlet.sphere.xyz, 1.0f) * modelToWorld;
+  float radius = meshlet.sphere.w * length(vec3(modelToWorld[0].x, modelToWorld[1].x, modelToWorld[2].x));
+
+  if (cullTests.x != 0)
+  {
+    for (int i = 0; i < 6; ++i)
+    {
+      if (dot(frustumPlanes[i].xyz, center) + frustumPlanes[i].w < -radius)
+        return;
+    }
+  }
+
+  // All triangles of the meshlet face away from the camera
+  if (cullTests.y != 0)
+  {
+    vec3 axis = normalize(meshlet.cone.xyz * mat3(modelToWorld));
+    vec3 view = center - viewPosWS;
+    if (dot(view, axis) >= meshlet.cone.w * length(view) + radius)
+      return;
+  }
+
+  if (cullTests.z != 0 && isOccluded(center, radius))
+    return;
+
+  uint slot = atomicAdd(drawCount, 1);
+  commands[slot] = DrawCommand(meshlet.numIndices, 1u, meshlet.firstIndex, 0, instance);
+  atomicAdd(visibleTriangles, meshlet.numIndices / 3);
+}
+)",
+// ----------------------------------------------------------------------------
+// Hi-Z finest level compute shader source, farthest depth of all samples
+// ----------------------------------------------------------------------------
+R"(
+#version 430 core
+
+// Must match HIZ_GROUP_SIZE
+layout (local_size_x = 16, local_size_y = 16) in;
+
+// Depth buffer of the frame, multisampled or not
+layout (binding = 0) uniform sampler2DMS DepthMS;
+layout (binding = 1) uniform sampler2D Depth;
+
+// Number of used MSAA samples
+layout (location = 0) uniform int msaaLevel;
+
+// Finest Hi-Z level
+layout (binding = 0, r32f) uniform writeonly image2D HiZ;
+
+void main()
+{
+  ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(texel, imageSize(HiZ))))
+    return;
+
+  // The window may have outgrown the depth buffer until the render targets catch up, such texels must not occlude
+  ivec2 depthSize = msaaLevel > 1 ? textureSize(DepthMS) : textureSize(Depth, 0);
+  if (any(greaterThanEqual(texel, depthSize)))
+  {
+    imageStore(HiZ, texel, vec4(1.0f));
+    return;
+  }
+
+  float depth = 0.0f;
+  if (msaaLevel > 1)
+  {
+    for (int i = 0; i < msaaLevel; ++i)
+      depth = max(depth, texelFetch(DepthMS, texel, i).r);
+  }
+  else
+  {
+    depth = texelFetch(Depth, texel, 0).r;
+  }
+
+  imageStore(HiZ, texel, vec4(depth));
+}
+)",
+// ----------------------------------------------------------------------------
+// Hi-Z downsampling compute shader source, farthest depth of the finer texels
+// ----------------------------------------------------------------------------
+R"(
+#version 430 core
+
+// Must match HIZ_GROUP_SIZE
+layout (local_size_x = 16, local_size_y = 16) in;
+
+// Finer and coarser Hi-Z level
+layout (binding = 0, r32f) uniform readonly image2D Source;
+layout (binding = 1, r32f) uniform writeonly image2D Destination;
+
+void main()
+{
+  ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+  ivec2 size = imageSize(Destination);
+  if (any(greaterThanEqual(texel, size)))
+    return;
+
+  // The last texel of an odd sized level covers the extra row or column as well
+  ivec2 sourceSize = imageSize(Source);
+  ivec2 first = 2 * texel;
+  ivec2 last = min(first + 1 + ivec2(equal(texel, size - 1)) * (sourceSize & 1), sourceSize - 1);
+
+  float depth = 0.0f;
+  for (int y = first.y; y <= last.y; ++y)
+  {
+    for (int x = first.x; x <= last.x; ++x)
+    {
+      depth = max(depth, imageLoad(Source, ivec2(x, y)).r);
+    }
+  }
+
+  imageStore(Destination, texel, vec4(depth));
+}
+)",
 ""};
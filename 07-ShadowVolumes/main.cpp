@@ -12,6 +12,11 @@
 
 #include <MathSupport.h>
 #include <Camera.h>
+#include <GLIntercept.h>
+#include <PipelineStats.h>
+#include <RenderTargetPool.h>
+#include <ResourceRegistry.h>
+#include <TextOverlay.h>
 
 #include "shaders.h"
 #include "scene.h"
@@ -87,8 +92,11 @@ static constexpr float CameraTurboSpeed = 50.0f;
 
 // ----------------------------------------------------------------------------
 
-// Max buffer length
-static const unsigned int MAX_TEXT_LENGTH = 256;
+// Scale of the statistics overlay text
+static const int HUD_SCALE = 2;
+// Number of the most expensive OpenGL functions shown in the overlay and reported
+static const int MAX_HUD_CALLS = 8;
+static const int MAX_REPORTED_CALLS = 30;
 // MSAA samples
 static const GLsizei MSAA_SAMPLES = 4;
 
@@ -97,11 +105,15 @@ Camera camera;
 // Scene helper instance
 Scene &scene(Scene::GetInstance());
 // Render modes
-RenderMode renderMode = {true, false, true, MSAA_SAMPLES};
+RenderMode renderMode = {true, false, true, MSAA_SAMPLES, true, true, true, true};
 // Enable/disable light movement
 bool animate = false;
-// Enable/disable Carcmack's reverse
-bool carmackReverse = true;
+// Shadow volume algorithm: z-pass, Carmack's reverse or automatic per light
+int shadowMode = ShadowMode::Automatic;
+// Statistics overlay
+TextOverlay hud;
+// Show/hide the statistics overlay
+bool showHud = true;
 
 // Our framebuffer object
 GLuint fbo = 0;
@@ -129,15 +141,23 @@ void APIENTRY debugCallback(GLenum source, GLenum type, GLuint id, GLenum severi
 }
 #endif
 
-// Callback for handling window resize events
-void resizeCallback(GLFWwindow* window, int width, int height)
+// Apply the window size to the viewport and camera, the render targets are recreated separately once the size settles
+void resize(int width, int height)
 {
   mainWindow.width = width;
   mainWindow.height = height;
   glViewport(0, 0, width, height);
   camera.SetProjection(fov, (float)width / (float)height, nearClipPlane, farClipPlane);
+  scene.SetViewport(width, height);
+}
 
-  createFramebuffer(width, height, renderMode.msaaLevel);
+// Callback for handling window resize events, the viewport and camera follow right away while the render targets are
+// recreated only once the size settles and leaves their size buckets so that dragging the window edge doesn't
+// reallocate them on every event
+void resizeCallback(GLFWwindow* window, int width, int height)
+{
+  resize(width, height);
+  RenderTargetPool::GetInstance().RequestResize(width, height);
 }
 
 // Callback for handling mouse movement over the window - called when mouse movement is detected
@@ -198,10 +218,64 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     animate = !animate;
   }
 
-  // Enable/disable Carmack's reverse
+  // Cycle z-pass, Carmack's reverse and automatic selection
   if (key == GLFW_KEY_F6 && action == GLFW_PRESS)
   {
-    carmackReverse = !carmackReverse;
+    static const char *shadowModeNames[] = {"z-pass", "z-fail", "automatic"};
+    shadowMode = (shadowMode + 1) % ShadowMode::NumModes;
+    printf("Shadow volumes: %s\n", shadowModeNames[shadowMode]);
+  }
+
+  // Enable/disable GL_EQUAL depth test for the depth primed light passes
+  if (key == GLFW_KEY_F7 && action == GLFW_PRESS)
+  {
+    renderMode.depthEqual = !renderMode.depthEqual;
+    printf("Light pass depth function: %s\n", renderMode.depthEqual ? "GL_EQUAL" : "GL_LEQUAL");
+  }
+
+  // Enable/disable the per light screen and depth bounds
+  if (key == GLFW_KEY_F8 && action == GLFW_PRESS)
+  {
+    renderMode.lightBounds = !renderMode.lightBounds;
+    printf("Light bounds: %s\n", renderMode.lightBounds ? "on" : "off");
+  }
+
+  // Enable/disable the shadow caster culling
+  if (key == GLFW_KEY_F9 && action == GLFW_PRESS)
+  {
+    renderMode.casterCulling = !renderMode.casterCulling;
+    printf("Shadow caster culling: %s\n", renderMode.casterCulling ? "on" : "off");
+  }
+
+  // Enable/disable the multi draw indirect submission of the depth and light passes
+  if (key == GLFW_KEY_F10 && action == GLFW_PRESS)
+  {
+    renderMode.multiDrawIndirect = !renderMode.multiDrawIndirect;
+    if (scene.IsMultiDrawIndirectSupported())
+      printf("Multi draw indirect: %s\n", renderMode.multiDrawIndirect ? "on" : "off");
+    else
+      printf("Multi draw indirect requires OpenGL 4.6\n");
+  }
+
+  // Show/hide the statistics overlay
+  if (key == GLFW_KEY_F11 && action == GLFW_PRESS)
+  {
+    showHud = !showHud;
+  }
+
+  // Start/stop counting the OpenGL calls, the last frame is reported when stopped
+  if (key == GLFW_KEY_F12 && action == GLFW_PRESS)
+  {
+    GLIntercept &intercept = GLIntercept::GetInstance();
+    if (intercept.IsInstalled())
+    {
+      intercept.Uninstall();
+      intercept.PrintReport(MAX_REPORTED_CALLS);
+    }
+    else
+    {
+      intercept.Install();
+    }
   }
 
   // Zoom in
@@ -240,9 +314,9 @@ bool initOpenGL()
   // Initialize the GLFW library
   if (!glfwInit()) return false;
 
-  // Request OpenGL 3.3 core profile upon window creation
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  // Request OpenGL 4.6 core profile upon window creation for pipeline statistics, fall back to 3.3 without them
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
   glfwWindowHint(GLFW_SAMPLES, 0); // Disable MSAA, we'll handle it ourselves
 #if _ENABLE_OPENGL_DEBUG
   glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
@@ -251,6 +325,13 @@ bool initOpenGL()
 
   // Create the window
   mainWindow.handle = glfwCreateWindow(Window::DefaultWidth, Window::DefaultHeight, "", nullptr, nullptr);
+  if (mainWindow.handle == nullptr)
+  {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    mainWindow.handle = glfwCreateWindow(Window::DefaultWidth, Window::DefaultHeight, "", nullptr, nullptr);
+  }
+
   if (mainWindow.handle == nullptr)
   {
     printf("Failed to create the GLFW window!");
@@ -266,6 +347,12 @@ bool initOpenGL()
     return false;
   }
 
+  // Depth bounds test is an extension, load it ourselves if available
+  if (glfwExtensionSupported("GL_EXT_depth_bounds_test"))
+    scene.SetDepthBoundsProc((PFNGLDEPTHBOUNDSEXTPROC)glfwGetProcAddress("glDepthBoundsEXT"));
+  else
+    printf("GL_EXT_depth_bounds_test not available, light bounds use scissor only.\n");
+
 #if _ENABLE_OPENGL_DEBUG
   // Enable error handling callback function - context must be created with DEBUG flags
   glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
@@ -293,7 +380,11 @@ bool initOpenGL()
   glfwSetCursorPosCallback(mainWindow.handle, mouseMoveCallback);
 
   // Set the OpenGL viewport and camera projection
-  resizeCallback(mainWindow.handle, Window::DefaultWidth, Window::DefaultHeight);
+  resize(Window::DefaultWidth, Window::DefaultHeight);
+
+  // Create the render targets for the initial window size
+  createFramebuffer(Window::DefaultWidth, Window::DefaultHeight, renderMode.msaaLevel);
+  RenderTargetPool::GetInstance().SetTargetSize(Window::DefaultWidth, Window::DefaultHeight);
 
   // Set the initial camera position and orientation
   camera.SetTransformation(glm::vec3(-3.0f, 3.0f, -5.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
@@ -320,62 +411,22 @@ void createFramebuffer(int width, int height, GLsizei MSAA)
   // Render target texture:
   // --------------------------------------------------------------------------
 
-  // Delete it if necessary
-  if (glIsTexture(renderTarget))
-  {
-    glDeleteTextures(1, &renderTarget);
-    renderTarget = 0;
-  }
-
-  // Create the texture name
-  if (renderTarget == 0)
-  {
-    glGenTextures(1, &renderTarget);
-  }
+  // Return the previous target to the pool, a target of the same size bucket is handed right back
+  RenderTargetPool &pool = RenderTargetPool::GetInstance();
+  pool.ReleaseTexture(renderTarget);
 
-  // Bind and recreate the render target texture
-  if (MSAA > 1)
-  {
-    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, renderTarget);
-    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, MSAA, GL_RGB16F, width, height, GL_TRUE);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, renderTarget, 0);
-  }
-  else
-  {
-    glBindTexture(GL_TEXTURE_2D, renderTarget);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderTarget, 0);
-  }
+  // Get the render target texture, it may be larger than the window
+  GLenum target = MSAA > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+  renderTarget = pool.AcquireTexture(GL_RGB16F, width, height, MSAA, "HDR render target");
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, renderTarget, 0);
 
   // --------------------------------------------------------------------------
   // Depth/stencil buffer texture:
   // --------------------------------------------------------------------------
 
-  // Delete it if necessary
-  if (glIsRenderbuffer(depthStencil))
-  {
-    glDeleteRenderbuffers(1, &depthStencil);
-    depthStencil = 0;
-  }
-
-  // Create the depth-stencil name
-  if (depthStencil == 0)
-  {
-    glGenRenderbuffers(1, &depthStencil);
-  }
-
-  // Bind and recreate the depth-stencil Render Buffer Object
-  glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
-  if (MSAA > 1)
-  {
-    glRenderbufferStorageMultisample(GL_RENDERBUFFER, MSAA, GL_DEPTH24_STENCIL8, width, height);
-  }
-  else
-  {
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
-  }
+  // Get the depth-stencil Render Buffer Object
+  pool.ReleaseRenderbuffer(depthStencil);
+  depthStencil = pool.AcquireRenderbuffer(GL_DEPTH24_STENCIL8, width, height, MSAA, "Depth stencil buffer");
   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencil);
 
   // Set the list of draw buffers.
@@ -396,16 +447,22 @@ void createFramebuffer(int width, int height, GLsizei MSAA)
 // Helper method for graceful shutdown
 void shutDown()
 {
+  // Report the GPU memory before anything gets released
+  ResourceRegistry::GetInstance().PrintReport();
+
   // Release shader programs
   for (int i = 0; i < ShaderProgram::NumShaderPrograms; ++i)
   {
     glDeleteProgram(shaderProgram[i]);
   }
 
-  // Release the framebuffer
-  glDeleteTextures(1, &renderTarget);
-  glDeleteRenderbuffers(1, &depthStencil);
+  // Release the framebuffer and its targets
   glDeleteFramebuffers(1, &fbo);
+  RenderTargetPool::GetInstance().Clear();
+
+  // Release the statistics overlay and its queries
+  hud.Release();
+  PipelineStats::GetInstance().Release();
 
   // Release the window
   glfwDestroyWindow(mainWindow.handle);
@@ -474,7 +531,7 @@ void renderScene()
   glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 
   // Draw our scene
-  scene.Draw(camera, renderMode, carmackReverse);
+  scene.Draw(camera, renderMode, shadowMode);
 
   // Unbind the shader program and other resources
   glBindVertexArray(0);
@@ -497,6 +554,7 @@ void renderScene()
     glClear(GL_COLOR_BUFFER_BIT);
 
     // Tonemapping
+    PipelineStats::GetInstance().BeginPass("Tonemapping");
     glUseProgram(shaderProgram[ShaderProgram::Tonemapping]);
 
     // Send in the required data
@@ -511,6 +569,7 @@ void renderScene()
     // Draw fullscreen quad
     glBindVertexArray(scene.GetGenericVAO());
     glDrawArrays(GL_TRIANGLES, 0, 6);
+    PipelineStats::GetInstance().EndPass();
 
     // Unbind the shader program and other resources
     glBindVertexArray(0);
@@ -524,6 +583,31 @@ void renderScene()
     glDrawBuffer(GL_BACK);
     glBlitFramebuffer(0, 0, mainWindow.width, mainWindow.height, 0, 0, mainWindow.width, mainWindow.height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
   }
+
+  // Statistics over the final image
+  {
+    GL_INTERCEPT_SCOPE("Text overlay");
+    hud.Draw(mainWindow.width, mainWindow.height, HUD_SCALE);
+  }
+}
+
+// Print the tracked and driver reported GPU memory to the overlay
+void printMemory()
+{
+  static const float MB = 1024.0f * 1024.0f;
+  ResourceRegistry &registry = ResourceRegistry::GetInstance();
+  hud.Print("GPU memory %.1f MB: targets %.1f, textures %.1f, meshes %.1f, buffers %.1f MB\n", registry.GetTotal() / MB,
+            registry.GetTotal(ResourceCategory::RenderTargets) / MB, registry.GetTotal(ResourceCategory::Textures) / MB,
+            registry.GetTotal(ResourceCategory::Meshes) / MB, registry.GetTotal(ResourceCategory::Buffers) / MB);
+
+  GLint availableKB = 0, totalKB = 0;
+  if (registry.QueryDriverMemory(availableKB, totalKB))
+  {
+    if (totalKB > 0)
+      hud.Print("Driver memory %.1f/%.1f MB available\n", availableKB / 1024.0f, totalKB / 1024.0f);
+    else
+      hud.Print("Driver memory %.1f MB available\n", availableKB / 1024.0f);
+  }
 }
 
 // Helper method for implementing the application main loop
@@ -537,15 +621,46 @@ void mainLoop()
     float dt = (float)(time - prevTime);
     prevTime = time;
 
-    // Print it to the title bar
-    static char title[MAX_TEXT_LENGTH];
-    static char instacing[] = "[Instancing] ";
-    snprintf(title, MAX_TEXT_LENGTH, "dt = %.2fms, FPS = %.1f", dt * 1000.0f, 1.0f / dt);
-    glfwSetWindowTitle(mainWindow.handle, title);
+    // Collect the statistics for the overlay, the pass counters are a few frames old
+    hud.Clear();
+    if (showHud)
+    {
+      const bool indirect = renderMode.multiDrawIndirect && scene.IsMultiDrawIndirectSupported();
+      hud.Print("%sdt = %.2fms, FPS = %.1f, CPU submit = %.2fms\n", indirect ? "[MDI] " : "", dt * 1000.0f, 1.0f / dt, scene.GetSubmitTime());
+      hud.Print("Light fill = %.1f%%, z-pass lights = %d, casters = %d/%d\n", scene.GetLightFillRatio() * 100.0f, scene.GetZPassLights(),
+                scene.GetShadowCasters(), scene.GetShadowCasterCandidates());
+      hud.Print("SV prims = %llu (z-fail %llu)", (unsigned long long)scene.GetShadowVolumePrimitives(shadowMode),
+                (unsigned long long)scene.GetShadowVolumePrimitives(ShadowMode::ZFail));
+      GLuint64 lessEqual = scene.GetLightingInvocations(false);
+      GLuint64 equal = scene.GetLightingInvocations(true);
+      if (lessEqual && equal)
+        hud.Print(", FS invocations: %llu, saved by GL_EQUAL: %lld",
+                  (unsigned long long)scene.GetLightingInvocations(renderMode.depthEqual), (long long)lessEqual - (long long)equal);
+      else if (lessEqual || equal)
+        hud.Print(", FS invocations: %llu", (unsigned long long)scene.GetLightingInvocations(renderMode.depthEqual));
+      const Textures &textures = Textures::GetInstance();
+      hud.Print("\nTextures %.1f/%.0f MB (%d loading)\n", textures.GetStreamingMemory(), textures.GetStreamingBudget(), textures.GetStreamingPending());
+      printMemory();
+      hud.Print("\n");
+      PipelineStats::GetInstance().Print(hud);
+      if (GLIntercept::GetInstance().IsInstalled())
+      {
+        hud.Print("\n");
+        GLIntercept::GetInstance().Print(hud, MAX_HUD_CALLS);
+      }
+    }
 
     // Poll the events like keyboard, mouse, etc.
     glfwPollEvents();
 
+    // Recreate the render targets once the window size settles
+    int width, height;
+    if (RenderTargetPool::GetInstance().Update(width, height))
+    {
+      createFramebuffer(width, height, renderMode.msaaLevel);
+      RenderTargetPool::GetInstance().PrintStats();
+    }
+
     // Process keyboard input
     processInput(dt);
 
@@ -558,6 +673,10 @@ void mainLoop()
 
     // Swap actual buffers on the GPU
     glfwSwapBuffers(mainWindow.handle);
+
+    // Read back the pass counters for the overlay and close the OpenGL call histogram
+    PipelineStats::GetInstance().EndFrame();
+    GLIntercept::GetInstance().EndFrame();
   }
 }
 
@@ -579,6 +698,9 @@ int main()
     return -1;
   }
 
+  // Statistics overlay, the lab runs without it if it fails
+  hud.Init();
+
   // Scene initialization
   scene.Init(10, 5);
 
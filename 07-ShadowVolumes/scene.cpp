@@ -6,17 +6,27 @@
 #include "scene.h"
 #include "shaders.h"
 
+#include <algorithm>
+#include <chrono>
 #include <vector>
 #include <glad/gl.h>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/transform.hpp>
 
+#include <GLIntercept.h>
 #include <MathSupport.h>
+#include <PipelineStats.h>
+#include <ResourceRegistry.h>
 
 // Scaling factor for lights movement curve
 static const glm::vec3 scale = glm::vec3(13.0f, 2.0f, 13.0f);
 // Offset for lights movement curve
 static const glm::vec3 offset = glm::vec3(0.0f, 3.0f, 0.0f);
+// Bounding sphere radius of the unit cube casters, slightly enlarged
+static const float casterRadius = 0.87f;
+// Statistics pass names, separate per shadow mode and depth function so that their counters can be compared
+static const char *shadowPassNames[ShadowMode::NumModes] = {"Volumes z-pass", "Volumes z-fail", "Volumes auto"};
+static const char *lightPassNames[2] = {"Lighting", "Lighting EQUAL"};
 
 // Lissajous curve position calculation based on the parameters
 auto lissajous = [](const glm::vec4 &p, float t) -> glm::vec3
@@ -40,21 +50,24 @@ Scene::Scene() : _textures(Textures::GetInstance())
 Scene::~Scene()
 {
   // Delete meshes
-  delete _quad;
-  _quad = nullptr;
+  delete _background;
+  _background = nullptr;
   delete _cube;
   _cube = nullptr;
   delete _cubeAdjacency;
   _cubeAdjacency = nullptr;
 
-  // Release the instancing buffer
-  glDeleteBuffers(1, &_instancingBuffer);
+  // Release the instancing buffers
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &_instancingBuffer);
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &_shadowInstancingBuffer);
 
   // Release the generic VAO
   glDeleteVertexArrays(1, &_vao);
 
   // Release textures
-  glDeleteTextures(LoadedTextures::NumTextures, _loadedTextures);
+  ResourceRegistry::GetInstance().DeleteTextures(LoadedTextures::Diffuse, _loadedTextures);
+  for (int i = LoadedTextures::Diffuse; i < LoadedTextures::NumTextures; ++i)
+    _textures.DeleteStreamedTexture(_loadedTextures[i]);
 }
 
 void Scene::Init(int numCubes, int numLights)
@@ -66,9 +79,8 @@ void Scene::Init(int numCubes, int numLights)
   _numCubes = numCubes;
   _numLights = numLights;
 
-  // Prepare meshes
-  _quad = Geometry::CreateQuadNormalTangentTex();
-  _cube = Geometry::CreateCubeNormalTangentTex();
+  // Prepare meshes, position only streams are used by the depth pass
+  _cube = Geometry::CreateCubeNormalTangentTex(true);
   _cubeAdjacency = Geometry::CreateCubeAdjacency();
 
   // Create general use VAO
@@ -86,6 +98,19 @@ void Scene::Init(int numCubes, int numLights)
 
     // Describe the buffer data - we're going to change this every frame
     glBufferData(GL_UNIFORM_BUFFER, uboSize, nullptr, GL_DYNAMIC_DRAW);
+    ResourceRegistry::GetInstance().TrackBuffer(_instancingBuffer, uboSize, ResourceCategory::Buffers, "Instancing");
+
+    // Shadow casters of each light get their own range, ranges must respect the offset alignment
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    _shadowInstancingSize = uboSize;
+    _shadowInstancingStride = (uboSize + alignment - 1) / alignment * alignment;
+
+    // Generate the shadow caster instancing buffer
+    glGenBuffers(1, &_shadowInstancingBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, _shadowInstancingBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, _numLights * _shadowInstancingStride, nullptr, GL_DYNAMIC_DRAW);
+    ResourceRegistry::GetInstance().TrackBuffer(_shadowInstancingBuffer, _numLights * _shadowInstancingStride, ResourceCategory::Buffers, "Shadow volume instancing");
 
     // Unbind the GL_UNIFORM_BUFFER target for now
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
@@ -106,6 +131,7 @@ void Scene::Init(int numCubes, int numLights)
 
     // Describe the buffer data - we're going to change this every frame
     glBufferData(GL_UNIFORM_BUFFER, uboSize, nullptr, GL_DYNAMIC_DRAW);
+    ResourceRegistry::GetInstance().TrackBuffer(_transformBlockUBO, uboSize, ResourceCategory::Buffers, "Transform block");
 
     // Bind the memory for usage
     glBindBufferBase(GL_UNIFORM_BUFFER, 0, _transformBlockUBO);
@@ -130,15 +156,72 @@ void Scene::Init(int numCubes, int numLights)
     _cubePositions.push_back(glm::vec3(x, y, z));
   }
 
+  {
+    glm::mat4x4 backgroundTransforms[BACKGROUND_QUADS];
+
+    // Floor
+    backgroundTransforms[0] = glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
+
+    // Z axis wall
+    backgroundTransforms[1] = glm::translate(glm::vec3(0.0f, 0.0f, 15.0f));
+    backgroundTransforms[1] *= glm::rotate(-PI_HALF, glm::vec3(1.0f, 0.0f, 0.0f));
+    backgroundTransforms[1] *= glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
+
+    // X axis wall
+    backgroundTransforms[2] = glm::translate(glm::vec3(15.0f, 0.0f, 0.0f));
+    backgroundTransforms[2] *= glm::rotate(PI_HALF, glm::vec3(0.0f, 0.0f, 1.0f));
+    backgroundTransforms[2] *= glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
+
+    // The backdrop never moves and shares a single material, merge it into one world space mesh
+    std::vector<Vertex_Pos_Nrm_Tgt_Tex> quadVb;
+    std::vector<GLuint> quadIb;
+    Geometry::BuildQuadNormalTangentTex(quadVb, quadIb);
+    StaticBatch<Vertex_Pos_Nrm_Tgt_Tex> batch;
+    for (int i = 0; i < BACKGROUND_QUADS; ++i)
+    {
+      batch.Add(quadVb, quadIb, backgroundTransforms[i]);
+    }
+
+    _background = batch.Create(true);
+    _backgroundBoundsMin = batch.GetBoundsMin();
+    _backgroundBoundsMax = batch.GetBoundsMax();
+  }
+
+  // The backdrop batch is a single instance after the cubes
+  _instanceData.resize(_numCubes + 1);
+  _shadowCasterIndices.resize(_numCubes * _numLights);
+  _shadowCasterCounts.resize(_numLights);
+
+  // The scene is static, the indirect draws of the backdrop and cubes are built just once, gl_DrawID needs OpenGL 4.6
+  if (GLAD_GL_VERSION_4_6)
+  {
+    int background = _meshPool.Add(*_background);
+    int cube = _meshPool.Add(*_cube);
+    _meshPool.Create();
+
+    _sceneDraws.Add(_meshPool.GetEntry(background), 1, {(GLuint)_numCubes, Background});
+    _sceneDraws.Add(_meshPool.GetEntry(cube), _numCubes, {0, Objects});
+    _sceneDraws.Upload();
+  }
+
   // --------------------------------------------------------------------------
 
   // Ambient intensity for the lights
   const float ambientIntentsity = 1e-3f / numLights;
 
+  // Calculate radius based on the light intensity
+  auto getLightRadius = [](const glm::vec4 &color) -> float
+  {
+    // Cutoff low enough not to be noticed with the light fading out
+    const float cutoff = 0.02f;
+    return sqrt(getLuminousIntensity(glm::vec3(color)) / cutoff);
+  };
+
   // Position & color of the first light
   _lights.reserve(_numLights);
   glm::vec4 p = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
-  _lights.push_back({glm::vec3(-3.0f, 3.0f, 0.0f), glm::vec4(10.0f, 10.0f, 10.0f, ambientIntentsity), p});
+  glm::vec4 c = glm::vec4(10.0f, 10.0f, 10.0f, ambientIntentsity);
+  _lights.push_back({glm::vec3(-3.0f, 3.0f, 0.0f), c, p, getLightRadius(c)});
 
   // Generate random positions for the rest of the lights
   for (int i = 1; i < _numLights; ++i)
@@ -147,14 +230,14 @@ void Scene::Init(int numCubes, int numLights)
     float y = getRandom(-2.0f, 2.0f);
     float z = getRandom(-2.0f, 2.0f);
     float w = getRandom(-2.0f, 2.0f);
-    glm::vec4 p = glm::vec4(x, y, z, w);
+    p = glm::vec4(x, y, z, w);
 
     float r = getRandom(0.0f, 5.0f);
     float g = getRandom(0.0f, 5.0f);
     float b = getRandom(0.0f, 5.0f);
-    glm::vec4 c = glm::vec4(r, g, b, ambientIntentsity);
+    c = glm::vec4(r, g, b, ambientIntentsity);
 
-    _lights.push_back({offset + lissajous(p, 0.0f) * scale, c, p});
+    _lights.push_back({offset + lissajous(p, 0.0f) * scale, c, p, getLightRadius(c)});
   }
 
   // --------------------------------------------------------------------------
@@ -167,10 +250,11 @@ void Scene::Init(int numCubes, int numLights)
   _loadedTextures[LoadedTextures::Grey] = Textures::CreateSingleColorTexture(127, 127, 127);
   _loadedTextures[LoadedTextures::Blue] = Textures::CreateSingleColorTexture(127, 127, 255);
   _loadedTextures[LoadedTextures::CheckerBoard] = Textures::CreateCheckerBoardTexture(256, 16);
-  _loadedTextures[LoadedTextures::Diffuse] = Textures::LoadTexture("data/Terracotta_Tiles_002_Base_Color.jpg", true);
-  _loadedTextures[LoadedTextures::Normal] = Textures::LoadTexture("data/Terracotta_Tiles_002_Normal.jpg", false);
-  _loadedTextures[LoadedTextures::Specular] = Textures::LoadTexture("data/Terracotta_Tiles_002_Roughness.jpg", false);
-  _loadedTextures[LoadedTextures::Occlusion] = Textures::LoadTexture("data/Terracotta_Tiles_002_ambientOcclusion.jpg", false);
+  // Only the tail mip levels of the cube textures are loaded now, the rest is streamed as the camera gets closer
+  _loadedTextures[LoadedTextures::Diffuse] = _textures.LoadStreamedTexture("data/Terracotta_Tiles_002_Base_Color.jpg", true);
+  _loadedTextures[LoadedTextures::Normal] = _textures.LoadStreamedTexture("data/Terracotta_Tiles_002_Normal.jpg", false, true);
+  _loadedTextures[LoadedTextures::Specular] = _textures.LoadStreamedTexture("data/Terracotta_Tiles_002_Roughness.jpg", false);
+  _loadedTextures[LoadedTextures::Occlusion] = _textures.LoadStreamedTexture("data/Terracotta_Tiles_002_ambientOcclusion.jpg", false);
 }
 
 void Scene::Update(float dt)
@@ -191,32 +275,34 @@ void Scene::Update(float dt)
   t += dt;
 }
 
-void Scene::BindTextures(const GLuint &diffuse, const GLuint &normal, const GLuint &specular, const GLuint &occlusion)
+void Scene::BindTextures(const GLuint &diffuse, const GLuint &normal, const GLuint &specular, const GLuint &occlusion, int firstUnit)
 {
+  GL_INTERCEPT_SCOPE("BindTextures");
+
   // We want to bind textures and appropriate samplers
-  glActiveTexture(GL_TEXTURE0 + 0);
+  glActiveTexture(GL_TEXTURE0 + firstUnit + 0);
   glBindTexture(GL_TEXTURE_2D, diffuse);
-  glBindSampler(0, _textures.GetSampler(Sampler::Anisotropic));
+  glBindSampler(firstUnit + 0, _textures.GetSampler(Sampler::Anisotropic));
 
-  glActiveTexture(GL_TEXTURE0 + 1);
+  glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
   glBindTexture(GL_TEXTURE_2D, normal);
-  glBindSampler(1, _textures.GetSampler(Sampler::Anisotropic));
+  glBindSampler(firstUnit + 1, _textures.GetSampler(Sampler::Anisotropic));
 
-  glActiveTexture(GL_TEXTURE0 + 2);
+  glActiveTexture(GL_TEXTURE0 + firstUnit + 2);
   glBindTexture(GL_TEXTURE_2D, specular);
-  glBindSampler(2, _textures.GetSampler(Sampler::Anisotropic));
+  glBindSampler(firstUnit + 2, _textures.GetSampler(Sampler::Anisotropic));
 
-  glActiveTexture(GL_TEXTURE0 + 3);
+  glActiveTexture(GL_TEXTURE0 + firstUnit + 3);
   glBindTexture(GL_TEXTURE_2D, occlusion);
-  glBindSampler(3, _textures.GetSampler(Sampler::Anisotropic));
+  glBindSampler(firstUnit + 3, _textures.GetSampler(Sampler::Anisotropic));
 }
 
 void Scene::UpdateInstanceData()
 {
+  GL_INTERCEPT_SCOPE("UpdateInstanceData");
+
   // Create transformation matrix
   glm::mat4x4 transformation = glm::mat4x4(1.0f);
-  // Instance data CPU side buffer
-  static std::vector<InstanceData> instanceData(MAX_INSTANCES);
 
   // Cubes
   float angle = 20.0f;
@@ -226,23 +312,183 @@ void Scene::UpdateInstanceData()
     transformation = glm::translate(_cubePositions[i]);
     transformation *= glm::rotate(glm::radians(i * angle), glm::vec3(1.0f, 1.0f, 1.0f));
 
-    instanceData[i].transformation = glm::transpose(transformation);
+    _instanceData[i].transformation = glm::transpose(transformation);
   }
 
+  // Backdrop batch follows the cubes for the indirect draws, it's already in world space
+  _instanceData[_numCubes].transformation = glm::mat3x4(1.0f);
+
   // Bind the instancing buffer to the index 1
   glBindBufferBase(GL_UNIFORM_BUFFER, 1, _instancingBuffer);
 
   // Update the buffer data using mapping
   void *ptr = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY);
-  memcpy(ptr, &*instanceData.begin(), _numCubes * sizeof(InstanceData));
+  memcpy(ptr, &*_instanceData.begin(), (_numCubes + 1) * sizeof(InstanceData));
   glUnmapBuffer(GL_UNIFORM_BUFFER);
 
   // Unbind the instancing buffer
   glBindBufferBase(GL_UNIFORM_BUFFER, 1, 0);
 }
 
-void Scene::UpdateProgramData(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
+void Scene::RequestTextureLevels(const Camera &camera)
 {
+  const glm::mat4x4 worldToClip = camera.GetProjection() * camera.GetWorldToView();
+
+  // Pixels per world unit at a unit distance from the camera
+  const float pixelsPerUnit = 0.5f * _viewportHeight * camera.GetProjection()[1][1];
+
+  // Screen size of a cube face of the closest visible cube, distance is taken to the closest point of its bounding sphere
+  float screenExtent = 0.0f;
+  for (const glm::vec3 &position : _cubePositions)
+  {
+    if (isBoxOutsideFrustum(worldToClip, position - glm::vec3(casterRadius), position + glm::vec3(casterRadius)))
+      continue;
+
+    glm::vec3 positionVS = camera.GetWorldToView() * glm::vec4(position, 1.0f);
+    float distance = std::max(-positionVS.z - casterRadius, camera.GetNearClip());
+    screenExtent = std::max(screenExtent, pixelsPerUnit / distance);
+  }
+
+  // Each cube face maps the whole texture, i.e., the UV density is one per world unit
+  if (screenExtent > 0.0f)
+  {
+    for (int i = LoadedTextures::Diffuse; i < LoadedTextures::NumTextures; ++i)
+      _textures.RequestStreamedLevel(_loadedTextures[i], 1.0f, screenExtent);
+  }
+
+  _textures.UpdateStreaming();
+}
+
+void Scene::CullShadowCasters(const Camera &camera, bool enabled)
+{
+  _shadowCasters = 0;
+
+  // View frustum corners in world space, near plane first, the far plane is ignored due to depth clamp
+  const glm::mat4x4 &projection = camera.GetProjection();
+  const glm::mat4x4 &viewToWorld = camera.GetViewToWorld();
+  glm::vec3 corners[8];
+  glm::vec3 center = glm::vec3(0.0f);
+  for (int i = 0; i < 2; ++i)
+  {
+    float z = i == 0 ? camera.GetNearClip() : camera.GetFarClip();
+    float x = z / projection[0][0];
+    float y = z / projection[1][1];
+    corners[4 * i + 0] = viewToWorld * glm::vec4(-x, -y, -z, 1.0f);
+    corners[4 * i + 1] = viewToWorld * glm::vec4( x, -y, -z, 1.0f);
+    corners[4 * i + 2] = viewToWorld * glm::vec4( x,  y, -z, 1.0f);
+    corners[4 * i + 3] = viewToWorld * glm::vec4(-x,  y, -z, 1.0f);
+    center += corners[4 * i + 0] + corners[4 * i + 1] + corners[4 * i + 2] + corners[4 * i + 3];
+  }
+  center *= 0.125f;
+
+  // Plane through three points with the frustum center on its negative side
+  auto makePlane = [&center](const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c, glm::vec4 &plane) -> bool
+  {
+    glm::vec3 n = glm::cross(b - a, c - a);
+    float length = glm::length(n);
+    if (length < 1e-6f)
+      return false;
+
+    n /= length;
+    plane = glm::vec4(n, -glm::dot(n, a));
+    if (glm::dot(n, center) + plane.w > 0.0f)
+      plane = -plane;
+    return true;
+  };
+
+  // Near, bottom, right, top and left frustum planes
+  glm::vec4 faces[5];
+  makePlane(corners[0], corners[1], corners[2], faces[0]);
+  makePlane(corners[0], corners[1], corners[5], faces[1]);
+  makePlane(corners[1], corners[2], corners[6], faces[2]);
+  makePlane(corners[2], corners[3], corners[7], faces[3]);
+  makePlane(corners[3], corners[0], corners[4], faces[4]);
+
+  // Frustum edges as pairs of corners and pairs of the adjacent faces
+  static const int edges[8][4] =
+  {
+    {0, 1, 0, 1}, {1, 2, 0, 2}, {2, 3, 0, 3}, {3, 0, 0, 4},
+    {1, 5, 1, 2}, {2, 6, 2, 3}, {3, 7, 3, 4}, {0, 4, 4, 1}
+  };
+
+  for (int i = 0; i < _numLights; ++i)
+  {
+    const Light &light = _lights[i];
+    int *casters = &_shadowCasterIndices[i * _numCubes];
+    int &count = _shadowCasterCounts[i];
+    count = 0;
+
+    if (!enabled)
+    {
+      for (int j = 0; j < _numCubes; ++j)
+        casters[count++] = j;
+      _shadowCasters += count;
+      continue;
+    }
+
+    // Convex hull of the frustum and the light: frustum planes facing away from the light
+    // and planes through the light and the silhouette edges of the frustum
+    glm::vec4 planes[13];
+    int numPlanes = 0;
+    bool lightOutside[5];
+    for (int f = 0; f < 5; ++f)
+    {
+      lightOutside[f] = glm::dot(glm::vec3(faces[f]), light.position) + faces[f].w > 0.0f;
+      if (!lightOutside[f])
+        planes[numPlanes++] = faces[f];
+    }
+
+    for (const int *edge : edges)
+    {
+      if (lightOutside[edge[2]] != lightOutside[edge[3]] && makePlane(corners[edge[0]], corners[edge[1]], light.position, planes[numPlanes]))
+        ++numPlanes;
+    }
+
+    for (int j = 0; j < _numCubes; ++j)
+    {
+      const glm::vec3 &position = _cubePositions[j];
+
+      // Casters out of the light reach don't cast any visible shadow
+      if (glm::length(position - light.position) - casterRadius > light.radius)
+        continue;
+
+      // Volumes of casters outside the hull can't reach the view frustum
+      bool outside = false;
+      for (int p = 0; p < numPlanes; ++p)
+      {
+        if (glm::dot(glm::vec3(planes[p]), position) + planes[p].w > casterRadius)
+        {
+          outside = true;
+          break;
+        }
+      }
+
+      if (!outside)
+        casters[count++] = j;
+    }
+
+    _shadowCasters += count;
+  }
+
+  // Upload the compacted instance data of each light to its range
+  glBindBuffer(GL_UNIFORM_BUFFER, _shadowInstancingBuffer);
+  unsigned char *ptr = static_cast<unsigned char*>(glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY));
+  for (int i = 0; i < _numLights; ++i)
+  {
+    InstanceData *instances = reinterpret_cast<InstanceData*>(ptr + i * _shadowInstancingStride);
+    for (int j = 0; j < _shadowCasterCounts[i]; ++j)
+      instances[j] = _instanceData[_shadowCasterIndices[i * _numCubes + j]];
+  }
+  glUnmapBuffer(GL_UNIFORM_BUFFER);
+
+  // Unbind the GL_UNIFORM_BUFFER target for now
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void Scene::UpdateProgramData(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor, float lightRadius)
+{
+  GL_INTERCEPT_SCOPE("UpdateProgramData");
+
   // Update the light position, use 4th component to pass direct light intensity
   if ((int)renderPass & ((int)RenderPass::ShadowVolume | (int)RenderPass::LightPass))
   {
@@ -261,11 +507,17 @@ void Scene::UpdateProgramData(GLuint program, RenderPass renderPass, const Camer
     // Update the light color, 4th component controls ambient light intensity
     GLint lightColorLoc = glGetUniformLocation(program, "lightColor");
     glUniform4f(lightColorLoc, lightColor.x, lightColor.y, lightColor.z, ((int)renderPass & (int)RenderPass::AmbientLight) ? lightColor.w : 0.0f);
+
+    // Update the light radius, direct light must fade out before the light bounds
+    GLint lightRadiusLoc = glGetUniformLocation(program, "lightRadius");
+    glUniform1f(lightRadiusLoc, lightRadius);
   }
 }
 
 void Scene::UpdateTransformBlock(const Camera &camera)
 {
+  GL_INTERCEPT_SCOPE("UpdateTransformBlock");
+
   // Tell OpenGL we want to work with our transform block
   glBindBuffer(GL_UNIFORM_BUFFER, _transformBlockUBO);
 
@@ -286,11 +538,15 @@ void Scene::UpdateTransformBlock(const Camera &camera)
   glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
-void Scene::DrawBackground(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
+void Scene::DrawBackground(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor, float lightRadius)
 {
+  // Skip the whole batch if it's outside the view frustum
+  if (isBoxOutsideFrustum(camera.GetProjection() * camera.GetWorldToView(), _backgroundBoundsMin, _backgroundBoundsMax))
+    return;
+
   // Bind the shader program and update its data
   glUseProgram(program);
-  UpdateProgramData(program, renderPass, camera, lightPosition, lightColor);
+  UpdateProgramData(program, renderPass, camera, lightPosition, lightColor, lightRadius);
 
   // Bind textures
   if ((int)renderPass & (int)RenderPass::LightPass)
@@ -298,41 +554,88 @@ void Scene::DrawBackground(GLuint program, RenderPass renderPass, const Camera &
     BindTextures(_loadedTextures[LoadedTextures::CheckerBoard], _loadedTextures[LoadedTextures::Blue], _loadedTextures[LoadedTextures::Grey], _loadedTextures[LoadedTextures::White]);
   }
 
-  // Bind the geometry
-  glBindVertexArray(_quad->GetVAO());
+  // Bind the geometry, depth pass needs positions only
+  glBindVertexArray(renderPass == RenderPass::DepthPass ? _background->GetPositionVAO() : _background->GetVAO());
 
-  // Draw floor:
-  glm::mat4x4 transformation = glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
-  glm::mat4x3 passMatrix = transformation;
+  // Draw floor and walls at once, the batch is already in world space
+  glm::mat4x3 passMatrix = glm::mat4x3(1.0f);
   glUniformMatrix4x3fv(0, 1, GL_FALSE, glm::value_ptr(passMatrix));
-  glDrawElements(GL_TRIANGLES, _quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+  glDrawElements(GL_TRIANGLES, _background->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+}
 
-  // Draw Z axis wall
-  transformation = glm::translate(glm::vec3(0.0f, 0.0f, 15.0f));
-  transformation *= glm::rotate(-PI_HALF, glm::vec3(1.0f, 0.0f, 0.0f));
-  transformation *= glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
-  passMatrix = transformation;
-  glUniformMatrix4x3fv(0, 1, GL_FALSE, glm::value_ptr(passMatrix));
-  glDrawElements(GL_TRIANGLES, _quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+bool Scene::IsZPassSafe(const Camera &camera, int light)
+{
+  const glm::vec3 &lightPosition = _lights[light].position;
+
+  // Near plane corners in world space
+  const glm::mat4x4 &projection = camera.GetProjection();
+  const glm::mat4x4 &viewToWorld = camera.GetViewToWorld();
+  float nearClip = camera.GetNearClip();
+  float x = nearClip / projection[0][0];
+  float y = nearClip / projection[1][1];
+  glm::vec3 corners[4] =
+  {
+    viewToWorld * glm::vec4(-x, -y, -nearClip, 1.0f),
+    viewToWorld * glm::vec4( x, -y, -nearClip, 1.0f),
+    viewToWorld * glm::vec4( x,  y, -nearClip, 1.0f),
+    viewToWorld * glm::vec4(-x,  y, -nearClip, 1.0f)
+  };
 
-  // Draw X axis wall
-  transformation = glm::translate(glm::vec3(15.0f, 0.0f, 0.0f));
-  transformation *= glm::rotate(PI_HALF, glm::vec3(0.0f, 0.0f, 1.0f));
-  transformation *= glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
-  passMatrix = transformation;
-  glUniformMatrix4x3fv(0, 1, GL_FALSE, glm::value_ptr(passMatrix));
-  glDrawElements(GL_TRIANGLES, _quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+  // The light lying in the near plane makes the pyramid degenerate, be conservative
+  glm::vec3 viewDir = -glm::vec3(viewToWorld[2]);
+  float lightDistance = glm::dot(lightPosition - corners[0], viewDir);
+  if (fabs(lightDistance) < 1e-3f)
+    return false;
+
+  // Planes of the pyramid spanned by the light and the near plane, normals pointing outwards
+  glm::vec3 center = (lightPosition + corners[0] + corners[1] + corners[2] + corners[3]) * 0.2f;
+  glm::vec4 planes[5];
+  for (int i = 0; i < 4; ++i)
+  {
+    glm::vec3 n = glm::normalize(glm::cross(corners[i] - lightPosition, corners[(i + 1) % 4] - lightPosition));
+    planes[i] = glm::vec4(n, -glm::dot(n, lightPosition));
+  }
+  planes[4] = glm::vec4(viewDir, -glm::dot(viewDir, corners[0]));
+
+  for (glm::vec4 &plane : planes)
+  {
+    if (glm::dot(glm::vec3(plane), center) + plane.w > 0.0f)
+      plane = -plane;
+  }
+
+  // Any drawn caster touching the pyramid casts a shadow volume over the near plane
+  for (int i = 0; i < _shadowCasterCounts[light]; ++i)
+  {
+    const glm::vec3 &position = _cubePositions[_shadowCasterIndices[light * _numCubes + i]];
+    bool outside = false;
+    for (const glm::vec4 &plane : planes)
+    {
+      if (glm::dot(glm::vec3(plane), position) + plane.w > casterRadius)
+      {
+        outside = true;
+        break;
+      }
+    }
+
+    if (!outside)
+      return false;
+  }
+
+  return true;
 }
 
-void Scene::DrawObjects(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
+void Scene::DrawObjects(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor, float lightRadius, int light)
 {
   // Bind the shader program and update its data
   glUseProgram(program);
   // Update the transformation & projection matrices
-  UpdateProgramData(program, renderPass, camera, lightPosition, lightColor);
+  UpdateProgramData(program, renderPass, camera, lightPosition, lightColor, lightRadius);
 
-  // Bind the instancing buffer to the index 1
-  glBindBufferBase(GL_UNIFORM_BUFFER, 1, _instancingBuffer);
+  // Bind the instancing buffer to the index 1, shadow volumes use the light's range of the culled casters
+  if ((int)renderPass & (int)RenderPass::ShadowVolume)
+    glBindBufferRange(GL_UNIFORM_BUFFER, 1, _shadowInstancingBuffer, light * _shadowInstancingStride, _shadowInstancingSize);
+  else
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, _instancingBuffer);
 
   // Bind textures
   if ((int)renderPass & (int)RenderPass::LightPass)
@@ -345,12 +648,13 @@ void Scene::DrawObjects(GLuint program, RenderPass renderPass, const Camera &cam
   {
     // For shadow volumes we need to render using the GL_TRIANGLES_ADJACENCY mode and appropriate geometry
     glBindVertexArray(_cubeAdjacency->GetVAO());
-    glDrawElementsInstanced(GL_TRIANGLES_ADJACENCY, _cubeAdjacency->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), _numCubes);
+    if (_shadowCasterCounts[light] > 0)
+      glDrawElementsInstanced(GL_TRIANGLES_ADJACENCY, _cubeAdjacency->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), _shadowCasterCounts[light]);
   }
   else
   {
-    // All other passes can use default cube VAO and GL_TRIANGLES
-    glBindVertexArray(_cube->GetVAO());
+    // All other passes can use default cube VAO and GL_TRIANGLES, depth pass needs positions only
+    glBindVertexArray(renderPass == RenderPass::DepthPass ? _cube->GetPositionVAO() : _cube->GetVAO());
     glDrawElementsInstanced(GL_TRIANGLES, _cube->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), _numCubes);
   }
 
@@ -361,58 +665,112 @@ void Scene::DrawObjects(GLuint program, RenderPass renderPass, const Camera &cam
 
   // Draw the light object during the ambient pass
   if ((int)renderPass & (int)RenderPass::AmbientLight)
+    DrawLightPoint(lightPosition, lightColor);
+}
+
+void Scene::DrawIndirect(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor, float lightRadius)
+{
+  // Bind the shader program and update its data
+  glUseProgram(program);
+  UpdateProgramData(program, renderPass, camera, lightPosition, lightColor, lightRadius);
+
+  // Both texture sets are bound, each draw selects its own
+  if ((int)renderPass & (int)RenderPass::LightPass)
   {
-    glUseProgram(shaderProgram[ShaderProgram::PointRendering]);
+    BindTextures(_loadedTextures[LoadedTextures::CheckerBoard], _loadedTextures[LoadedTextures::Blue], _loadedTextures[LoadedTextures::Grey], _loadedTextures[LoadedTextures::White], 0);
+    BindTextures(_loadedTextures[LoadedTextures::Diffuse], _loadedTextures[LoadedTextures::Normal], _loadedTextures[LoadedTextures::Specular], _loadedTextures[LoadedTextures::Occlusion], 4);
+  }
+
+  // Backdrop and cubes at once, vertices are pulled from the mesh pool
+  glBindBufferBase(GL_UNIFORM_BUFFER, 1, _instancingBuffer);
+  glBindVertexArray(_meshPool.GetVAO());
+  _meshPool.BindVertexBuffers();
+  _sceneDraws.Draw();
+  glBindBufferBase(GL_UNIFORM_BUFFER, 1, 0);
+
+  // Draw the light object during the ambient pass
+  if ((int)renderPass & (int)RenderPass::AmbientLight)
+    DrawLightPoint(lightPosition, lightColor);
+}
 
-    // Update the light position
-    GLint loc = glGetUniformLocation(shaderProgram[ShaderProgram::PointRendering], "position");
-    glUniform3fv(loc, 1, glm::value_ptr(lightPosition));
+void Scene::DrawLightPoint(const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
+{
+  glUseProgram(shaderProgram[ShaderProgram::PointRendering]);
 
-    // Update the color
-    loc = glGetUniformLocation(shaderProgram[ShaderProgram::PointRendering], "color");
-    glUniform3fv(loc, 1, glm::value_ptr(lightColor * 0.05f));
+  // Update the light position
+  GLint loc = glGetUniformLocation(shaderProgram[ShaderProgram::PointRendering], "position");
+  glUniform3fv(loc, 1, glm::value_ptr(lightPosition));
 
-    // Disable blending for lights
-    glDisable(GL_BLEND);
+  // Update the color
+  loc = glGetUniformLocation(shaderProgram[ShaderProgram::PointRendering], "color");
+  glUniform3fv(loc, 1, glm::value_ptr(lightColor * 0.05f));
 
-    glPointSize(10.0f);
-    glBindVertexArray(_vao);
-    glDrawArrays(GL_POINTS, 0, 1);
-  }
+  // Disable blending for lights
+  glDisable(GL_BLEND);
+
+  // Light points are not in the primed depth buffer
+  glDepthFunc(GL_LEQUAL);
+
+  glPointSize(10.0f);
+  glBindVertexArray(_vao);
+  glDrawArrays(GL_POINTS, 0, 1);
 }
 
-void Scene::Draw(const Camera &camera, const RenderMode &renderMode, bool carmackReverse)
+void Scene::Draw(const Camera &camera, const RenderMode &renderMode, int shadowMode)
 {
+  // Measure the CPU time spent submitting the frame
+  typedef std::chrono::high_resolution_clock Clock;
+  Clock::time_point submitStart = Clock::now();
+
   UpdateTransformBlock(camera);
 
+  // Draw the depth and light passes with a single call each if possible
+  const bool indirect = renderMode.multiDrawIndirect && IsMultiDrawIndirectSupported();
+
   // --------------------------------------------------------------------------
   // Depth pass drawing:
   // --------------------------------------------------------------------------
-  auto depthPass = [this, &renderMode, &camera]()
+  auto depthPass = [this, &renderMode, &camera, indirect]()
   {
     // No need to pass real light position and color as we don't need them in the depth pass
-    DrawBackground(shaderProgram[ShaderProgram::DefaultDepthPass], RenderPass::DepthPass, camera, glm::vec3(0.0f), glm::vec4(0.0f));
-    DrawObjects(shaderProgram[ShaderProgram::InstancingDepthPass], RenderPass::DepthPass, camera, glm::vec3(0.0f), glm::vec4(0.0f));
+    if (indirect)
+    {
+      DrawIndirect(shaderProgram[ShaderProgram::IndirectDepthPass], RenderPass::DepthPass, camera, glm::vec3(0.0f), glm::vec4(0.0f), 0.0f);
+      return;
+    }
+
+    DrawBackground(shaderProgram[ShaderProgram::DefaultDepthPass], RenderPass::DepthPass, camera, glm::vec3(0.0f), glm::vec4(0.0f), 0.0f);
+    DrawObjects(shaderProgram[ShaderProgram::InstancingDepthPass], RenderPass::DepthPass, camera, glm::vec3(0.0f), glm::vec4(0.0f), 0.0f, -1);
   };
 
   // --------------------------------------------------------------------------
   // Light pass drawing:
   // --------------------------------------------------------------------------
-  auto lightPass = [this, &renderMode, &camera](RenderPass renderPass, const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
+  auto lightPass = [this, &renderMode, &camera, indirect](RenderPass renderPass, const glm::vec3 &lightPosition, const glm::vec4 &lightColor, float lightRadius)
   {
     // Enable additive alpha blending
     glEnable(GL_BLEND);
     glBlendEquation(GL_FUNC_ADD);
     glBlendFunc(GL_ONE, GL_ONE);
 
+    // Shade only fragments of the primed depth buffer
+    glDepthFunc(renderMode.depthEqual ? GL_EQUAL : GL_LEQUAL);
+
     // Pass only if equal to 0, i.e., outside shadow volume
     glStencilFunc(GL_EQUAL, 0x00, 0xff);
 
     // Don't update the stencil buffer
     glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
 
-    DrawBackground(shaderProgram[ShaderProgram::Default], renderPass, camera, lightPosition, lightColor);
-    DrawObjects(shaderProgram[ShaderProgram::Instancing], renderPass, camera, lightPosition, lightColor);
+    if (indirect)
+    {
+      DrawIndirect(shaderProgram[ShaderProgram::Indirect], renderPass, camera, lightPosition, lightColor, lightRadius);
+    }
+    else
+    {
+      DrawBackground(shaderProgram[ShaderProgram::Default], renderPass, camera, lightPosition, lightColor, lightRadius);
+      DrawObjects(shaderProgram[ShaderProgram::Instancing], renderPass, camera, lightPosition, lightColor, lightRadius, -1);
+    }
 
     // Disable blending after this pass
     glDisable(GL_BLEND);
@@ -421,15 +779,18 @@ void Scene::Draw(const Camera &camera, const RenderMode &renderMode, bool carmac
   // --------------------------------------------------------------------------
   // Shadow pass drawing:
   // --------------------------------------------------------------------------
-  auto shadowPass = [this, &renderMode, &camera, &carmackReverse](const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
+  auto shadowPass = [this, &renderMode, &camera](int light, bool zFail)
   {
+    // Shadow volumes are tested against the primed depth as usual
+    glDepthFunc(GL_LEQUAL);
+
     // Disable face culling
     glDisable(GL_CULL_FACE);
 
     // Always pass the stencil test
     glStencilFunc(GL_ALWAYS, 0x00, 0xff);
 
-    if (carmackReverse)
+    if (zFail)
     {
       // Set stencil operations for depth fail algorithm (licensed)
       // arguments: face, stencil fail, depth fail, depth pass
@@ -444,7 +805,11 @@ void Scene::Draw(const Camera &camera, const RenderMode &renderMode, bool carmac
       glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
     }
 
-    DrawObjects(shaderProgram[ShaderProgram::InstancedShadowVolume], RenderPass::ShadowVolume, camera, lightPosition, lightColor);
+    // Only depth fail needs the volumes closed by caps
+    glUseProgram(shaderProgram[ShaderProgram::InstancedShadowVolume]);
+    glUniform1i(1, zFail ? 1 : 0);
+
+    DrawObjects(shaderProgram[ShaderProgram::InstancedShadowVolume], RenderPass::ShadowVolume, camera, _lights[light].position, _lights[light].color, 0.0f, light);
 
     // Enable it back again
     glEnable(GL_CULL_FACE);
@@ -454,6 +819,8 @@ void Scene::Draw(const Camera &camera, const RenderMode &renderMode, bool carmac
 
   // Update the scene
   UpdateInstanceData();
+  CullShadowCasters(camera, renderMode.casterCulling);
+  RequestTextureLevels(camera);
 
   // Enable/disable MSAA rendering
   if (renderMode.msaaLevel > 1)
@@ -480,32 +847,105 @@ void Scene::Draw(const Camera &camera, const RenderMode &renderMode, bool carmac
 
   // Render the scene into the depth buffer only, disable color write
   glColorMask(false, false, false, false);
+  PipelineStats::GetInstance().BeginPass("Depth prepass");
   depthPass();
+  PipelineStats::GetInstance().EndPass();
 
-  // We primed the depth buffer, no need to write to it anymore
-  // Note: for depth primed geometry, it would be the best option to also set depth function to GL_EQUAL
+  // We primed the depth buffer, no need to write to it anymore, light passes set GL_EQUAL if requested
   glDepthMask(GL_FALSE);
 
+  // Lights using the z-pass algorithm
+  int zPassLights = 0;
+  const char *lightPassName = lightPassNames[renderMode.depthEqual ? 1 : 0];
+
+  // Pixels touched by the shadow and direct light passes
+  long long litPixels = 0;
+  const long long screenPixels = (long long)_viewportWidth * _viewportHeight;
+
   // For each light we need to render the scene with its contribution
   for (int i = 0; i < _numLights; ++i)
   {
-    // Enable stencil test and clear the stencil buffer
-    glClear(GL_STENCIL_BUFFER_BIT);
-    glEnable(GL_STENCIL_TEST);
+    const Light &light = _lights[i];
 
-    // Draw shadow volumes first, disable color write
-    glColorMask(false, false, false, false);
-    shadowPass(_lights[i].position, _lights[i].color);
+    // Screen and depth bounds of the light influence, full screen if disabled
+    glm::ivec4 rect(0, 0, _viewportWidth, _viewportHeight);
+    glm::vec2 depthRange(0.0f, 1.0f);
+    bool visible = true;
+    if (renderMode.lightBounds)
+    {
+      glm::vec3 lightPosVS = camera.GetWorldToView() * glm::vec4(light.position, 1.0f);
+      visible = getSphereScreenBounds(lightPosVS, light.radius, camera.GetNearClip(), camera.GetFarClip(), camera.GetProjection(),
+                                      _viewportWidth, _viewportHeight, rect, depthRange);
+    }
 
-    // Draw direct light utilizing stenciled shadows, enable color write
-    glColorMask(true, true, true, true);
-    lightPass(RenderPass::DirectLight, _lights[i].position, _lights[i].color);
+    // Shadows and direct light only matter within the bounds, skip them completely for invisible lights
+    if (visible)
+    {
+      litPixels += (long long)rect.z * rect.w;
+
+      // Scissor limits the stencil clear as well
+      glEnable(GL_SCISSOR_TEST);
+      glScissor(rect.x, rect.y, rect.z, rect.w);
+
+      // Reject pixels whose primed depth is out of the light reach
+      if (renderMode.lightBounds && _depthBounds)
+      {
+        glEnable(GL_DEPTH_BOUNDS_TEST_EXT);
+        _depthBounds(depthRange.x, depthRange.y);
+      }
+
+      // Enable stencil test and clear the stencil buffer
+      glClear(GL_STENCIL_BUFFER_BIT);
+      glEnable(GL_STENCIL_TEST);
+
+      // Choose the stencil algorithm, z-pass is cheaper as it doesn't need the caps
+      bool zFail = shadowMode == ShadowMode::ZFail || (shadowMode == ShadowMode::Automatic && !IsZPassSafe(camera, i));
+      if (!zFail)
+        ++zPassLights;
+
+      // Draw shadow volumes first, disable color write
+      glColorMask(false, false, false, false);
+      PipelineStats::GetInstance().BeginPass(shadowPassNames[shadowMode]);
+      shadowPass(i, zFail);
+      PipelineStats::GetInstance().EndPass();
+
+      // Draw direct light utilizing stenciled shadows, enable color write
+      glColorMask(true, true, true, true);
+      PipelineStats::GetInstance().BeginPass(lightPassName);
+      lightPass(RenderPass::DirectLight, light.position, light.color, light.radius);
+      PipelineStats::GetInstance().EndPass();
+
+      // Disable stencil test as we don't want shadows to affect ambient light
+      glDisable(GL_STENCIL_TEST);
+
+      // Ambient light isn't bounded
+      if (_depthBounds)
+        glDisable(GL_DEPTH_BOUNDS_TEST_EXT);
+      glDisable(GL_SCISSOR_TEST);
+    }
 
-    // Disable stencil test as we don't want shadows to affect ambient light
-    glDisable(GL_STENCIL_TEST);
-    lightPass(RenderPass::AmbientLight, _lights[i].position, _lights[i].color);
+    PipelineStats::GetInstance().BeginPass(lightPassName);
+    lightPass(RenderPass::AmbientLight, light.position, light.color, light.radius);
+    PipelineStats::GetInstance().EndPass();
   }
 
-  // Don't forget to leave the color write enabled
+  // Statistics of the bounded light passes
+  _lightFillRatio = (_numLights > 0 && screenPixels > 0) ? (float)((double)litPixels / ((double)screenPixels * _numLights)) : 1.0f;
+  _zPassLights = zPassLights;
+
+  // Don't forget to leave the color write enabled and default depth function
   glColorMask(true, true, true, true);
+  glDepthFunc(GL_LEQUAL);
+
+  _submitTime = std::chrono::duration<float, std::milli>(Clock::now() - submitStart).count();
+}
+
+GLuint64 Scene::GetShadowVolumePrimitives(int shadowMode) const
+{
+  return PipelineStats::GetInstance().GetCounter(shadowPassNames[shadowMode], PipelineStats::PrimitivesGenerated);
+}
+
+GLuint64 Scene::GetLightingInvocations(bool depthEqual) const
+{
+  return PipelineStats::GetInstance().GetCounter(lightPassNames[depthEqual ? 1 : 0], PipelineStats::FragmentShaderInvocations);
 }
@@ -6,7 +6,9 @@
 #pragma once
 
 #include <Camera.h>
+#include <DrawCommands.h>
 #include <Geometry.h>
+#include <StaticBatch.h>
 #include <Textures.h>
 
 // Textures we'll be using
@@ -18,6 +20,29 @@ namespace LoadedTextures
   };
 }
 
+// Depth bounds test from GL_EXT_depth_bounds_test, our core profile loader doesn't provide it
+#ifndef GL_DEPTH_BOUNDS_TEST_EXT
+#define GL_DEPTH_BOUNDS_TEST_EXT 0x8890
+#endif
+#ifndef GL_EXT_depth_bounds_test
+typedef void (APIENTRY *PFNGLDEPTHBOUNDSEXTPROC)(GLclampd zmin, GLclampd zmax);
+#endif
+
+// Shadow volume stencil algorithms
+namespace ShadowMode
+{
+  enum
+  {
+    // Depth pass, invalid when the camera near plane is in a shadow volume
+    ZPass,
+    // Depth fail (Carmack's reverse), always valid, needs capped volumes
+    ZFail,
+    // Depth pass per light whenever it is safe, depth fail otherwise
+    Automatic,
+    NumModes
+  };
+}
+
 // Render mode structure
 struct RenderMode
 {
@@ -29,6 +54,14 @@ struct RenderMode
   bool tonemapping;
   // Used MSAA samples
   GLsizei msaaLevel;
+  // Shade the depth primed geometry with GL_EQUAL?
+  bool depthEqual;
+  // Limit the shadow and direct light passes to the light's screen bounds?
+  bool lightBounds;
+  // Skip shadow casters whose volumes can't reach the view frustum?
+  bool casterCulling;
+  // Submit the depth and light passes with a single multi draw indirect call each?
+  bool multiDrawIndirect;
 };
 
 // Very simple scene abstraction class
@@ -64,9 +97,29 @@ public:
   // Updates positions
   void Update(float dt);
   // Draw the scene
-  void Draw(const Camera &camera, const RenderMode &renderMode, bool carmackReverse);
+  void Draw(const Camera &camera, const RenderMode &renderMode, int shadowMode);
   // Return the generic VAO for rendering
   GLuint GetGenericVAO() { return _vao; }
+  // Set the framebuffer size for the per light screen bounds
+  void SetViewport(int width, int height) { _viewportWidth = width; _viewportHeight = height; }
+  // Set the depth bounds test entry point, nullptr if the extension isn't supported
+  void SetDepthBoundsProc(PFNGLDEPTHBOUNDSEXTPROC proc) { _depthBounds = proc; }
+  // Ratio of the pixels covered by the shadow and direct light passes to the full screen passes in the last frame
+  float GetLightFillRatio() const { return _lightFillRatio; }
+  // Number of lights using z-pass shadow volumes in the last frame
+  int GetZPassLights() const { return _zPassLights; }
+  // Shadow volume primitives generated in the last frame measured with the given shadow mode, 0 if not measured
+  GLuint64 GetShadowVolumePrimitives(int shadowMode) const;
+  // Shadow caster instances drawn over all lights in the last frame
+  int GetShadowCasters() const { return _shadowCasters; }
+  // Shadow caster instances drawn over all lights without culling
+  int GetShadowCasterCandidates() const { return _numCubes * _numLights; }
+  // Fragment shader invocations of the last light passes with GL_LEQUAL or GL_EQUAL, 0 if not measured
+  GLuint64 GetLightingInvocations(bool depthEqual) const;
+  // CPU time spent submitting the last frame in milliseconds
+  float GetSubmitTime() const { return _submitTime; }
+  // Multi draw indirect passes need gl_DrawID, i.e., OpenGL 4.6
+  bool IsMultiDrawIndirectSupported() const { return _sceneDraws.GetCount() > 0; }
 
 private:
   // Structure describing light
@@ -78,8 +131,28 @@ private:
     glm::vec4 color;
     // Parameters for the light movement
     glm::vec4 movement;
+    // Radius of the light based on luminous intensity and cutoff value
+    float radius;
   };
 
+  // Per draw data of the multi draw indirect passes, must match the indirect vertex shader
+  struct DrawData
+  {
+    // Instance buffer index of the first instance of the draw
+    GLuint firstInstance;
+    // Texture set of the draw, see Material
+    GLuint material;
+  };
+
+  // Texture sets selected per draw in the multi draw indirect passes
+  enum Material
+  {
+    Background, Objects
+  };
+
+  // Number of quads forming the backdrop
+  static const int BACKGROUND_QUADS = 3;
+
   // All is private, instance is created in GetInstance()
   Scene();
   ~Scene();
@@ -87,22 +160,32 @@ private:
   Scene(const Scene &);
   Scene & operator = (const Scene &);
 
-  // Helper function for binding the appropriate textures
-  void BindTextures(const GLuint &diffuse, const GLuint &normal, const GLuint &specular, const GLuint &occlusion);
+  // Helper function for binding the appropriate textures to four texture units starting with firstUnit
+  void BindTextures(const GLuint &diffuse, const GLuint &normal, const GLuint &specular, const GLuint &occlusion, int firstUnit = 0);
   // Helper function for creating and updating the instance data
   void UpdateInstanceData();
+  // Request the streamed levels of the cube textures from the screen size of the closest visible cube
+  void RequestTextureLevels(const Camera &camera);
+  // Select the shadow casters of each light and upload their compacted instance data
+  void CullShadowCasters(const Camera &camera, bool enabled);
   // Helper function for updating shader program data
-  void UpdateProgramData(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor);
+  void UpdateProgramData(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor, float lightRadius);
   // Helper method to update transformation uniform block
   void UpdateTransformBlock(const Camera &camera);
   // Draw the backdrop, floor and walls
-  void DrawBackground(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor);
-  // Draw cubes
-  void DrawObjects(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor);
+  void DrawBackground(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor, float lightRadius);
+  // Test whether the light's shadow volumes can't reach the camera near plane, i.e., z-pass is safe
+  bool IsZPassSafe(const Camera &camera, int light);
+  // Draw cubes, the light index selects the shadow casters for the shadow volume pass
+  void DrawObjects(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor, float lightRadius, int light);
+  // Draw the backdrop and cubes with a single multi draw indirect call, not usable for the shadow volume pass
+  void DrawIndirect(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor, float lightRadius);
+  // Draw the light as a point
+  void DrawLightPoint(const glm::vec3 &lightPosition, const glm::vec4 &lightColor);
 
   // Textures helper instance
   Textures &_textures;
-  // Loaded textures
+  // Loaded textures, the cube textures are streamed
   GLuint _loadedTextures[LoadedTextures::NumTextures] = {0};
   // Number of cubes in the scene
   int _numCubes = 10;
@@ -114,14 +197,43 @@ private:
   std::vector<Light> _lights;
   // General use VAO
   GLuint _vao = 0;
-  // Quad instance
-  Mesh<Vertex_Pos_Nrm_Tgt_Tex> *_quad = nullptr;
+  // Floor and walls merged into a single world space mesh
+  Mesh<Vertex_Pos_Nrm_Tgt_Tex> *_background = nullptr;
+  // World space bounding box of the backdrop for culling
+  glm::vec3 _backgroundBoundsMin = glm::vec3(0.0f);
+  glm::vec3 _backgroundBoundsMax = glm::vec3(0.0f);
   // Cube instance
   Mesh<Vertex_Pos_Nrm_Tgt_Tex> *_cube = nullptr;
   // Cube instance w/ adjacency information
   Mesh<Vertex_Pos> *_cubeAdjacency = nullptr;
+  // Backdrop and cube in shared buffers for the multi draw indirect passes
+  MeshPool _meshPool;
+  // Draws of the backdrop and cubes, the same for the depth and all light passes
+  DrawCommandBuffer<DrawData> _sceneDraws;
+  // Instance data CPU side buffer, cubes followed by the backdrop
+  std::vector<InstanceData> _instanceData;
   // Instancing buffer handle
   GLuint _instancingBuffer = 0;
+  // Compacted shadow caster instances, one uniform block range per light
+  GLuint _shadowInstancingBuffer = 0;
+  // Offset between the light ranges and the size of a single range
+  GLsizeiptr _shadowInstancingStride = 0, _shadowInstancingSize = 0;
+  // Shadow caster indices, _numCubes entries reserved for each light
+  std::vector<int> _shadowCasterIndices;
+  // Number of shadow casters of each light
+  std::vector<int> _shadowCasterCounts;
+  // Shadow caster instances drawn over all lights
+  int _shadowCasters = 0;
   // Transformation matrices uniform buffer object
   GLuint _transformBlockUBO = 0;
+  // Number of lights using z-pass shadow volumes in the last frame
+  int _zPassLights = 0;
+  // Framebuffer size
+  int _viewportWidth = 0, _viewportHeight = 0;
+  // Depth bounds test entry point if supported
+  PFNGLDEPTHBOUNDSEXTPROC _depthBounds = nullptr;
+  // Pixels covered by the light bounds relative to full screen light passes
+  float _lightFillRatio = 1.0f;
+  // CPU time of the last Draw() call in milliseconds
+  float _submitTime = 0.0f;
 };
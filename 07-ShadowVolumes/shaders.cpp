@@ -7,11 +7,16 @@
 
 GLuint shaderProgram[ShaderProgram::NumShaderPrograms] = {0};
 
+// Defines selecting the multi draw indirect permutation of the instancing vertex and default fragment shader
+static const char* indirectDrawDefines = "#define INDIRECT_DRAW\n";
+
 bool compileShaders()
 {
   GLuint vertexShader[VertexShader::NumVertexShaders] = {0};
   GLuint fragmentShader[FragmentShader::NumFragmentShaders] = {0};
   GLuint geometryShader[FragmentShader::NumFragmentShaders] = {0};
+  GLuint vertexShaderIndirect = 0;
+  GLuint fragmentShaderIndirect = 0;
 
   // Cleanup lambda
   auto cleanUp = [&]()
@@ -49,6 +54,11 @@ bool compileShaders()
       if (glIsShader(geometryShader[i]))
         glDeleteShader(geometryShader[i]);
     }
+
+    if (glIsShader(vertexShaderIndirect))
+      glDeleteShader(vertexShaderIndirect);
+    if (glIsShader(fragmentShaderIndirect))
+      glDeleteShader(fragmentShaderIndirect);
   };
 
   // UBO explicit binding lambda - call after program linking
@@ -163,6 +173,42 @@ bool compileShaders()
   }
   uniformBlockBinding(shaderProgram[ShaderProgram::PointRendering]);
 
+  // Multi draw indirect programs need gl_DrawID, i.e., OpenGL 4.6, the scene falls back to the instancing ones
+  if (GLAD_GL_VERSION_4_6)
+  {
+    vertexShaderIndirect = ShaderCompiler::CompileShader(vsSource, VertexShader::Instancing, GL_VERTEX_SHADER, indirectDrawDefines);
+    fragmentShaderIndirect = ShaderCompiler::CompileShader(fsSource, FragmentShader::Default, GL_FRAGMENT_SHADER, indirectDrawDefines);
+    if (!vertexShaderIndirect || !fragmentShaderIndirect)
+    {
+      cleanUp();
+      return false;
+    }
+
+    // Shader program for the backdrop and instanced geometry w/ color in a single draw call
+    shaderProgram[ShaderProgram::Indirect] = glCreateProgram();
+    glAttachShader(shaderProgram[ShaderProgram::Indirect], vertexShaderIndirect);
+    glAttachShader(shaderProgram[ShaderProgram::Indirect], fragmentShaderIndirect);
+    if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::Indirect]))
+    {
+      cleanUp();
+      return false;
+    }
+    uniformBlockBinding(shaderProgram[ShaderProgram::Indirect]);
+    uniformBlockBinding(shaderProgram[ShaderProgram::Indirect], "InstanceBuffer", 1);
+
+    // Shader program for the backdrop and instanced geometry w/o color in a single draw call
+    shaderProgram[ShaderProgram::IndirectDepthPass] = glCreateProgram();
+    glAttachShader(shaderProgram[ShaderProgram::IndirectDepthPass], vertexShaderIndirect);
+    glAttachShader(shaderProgram[ShaderProgram::IndirectDepthPass], fragmentShader[FragmentShader::Null]);
+    if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::IndirectDepthPass]))
+    {
+      cleanUp();
+      return false;
+    }
+    uniformBlockBinding(shaderProgram[ShaderProgram::IndirectDepthPass]);
+    uniformBlockBinding(shaderProgram[ShaderProgram::IndirectDepthPass], "InstanceBuffer", 1);
+  }
+
   // Shader program for rendering tonemapping post-process
   shaderProgram[ShaderProgram::Tonemapping] = glCreateProgram();
   glAttachShader(shaderProgram[ShaderProgram::Tonemapping], vertexShader[VertexShader::ScreenQuad]);
@@ -12,11 +12,12 @@ namespace ShaderProgram
 {
   enum
   {
-    Default, DefaultDepthPass, Instancing, InstancingDepthPass, InstancedShadowVolume, PointRendering, Tonemapping, NumShaderPrograms
+    Default, DefaultDepthPass, Instancing, InstancingDepthPass, Indirect, IndirectDepthPass, InstancedShadowVolume, PointRendering, Tonemapping, NumShaderPrograms
   };
 }
 
-// Shader programs handle
+// Shader programs handle, the indirect programs are the INDIRECT_DRAW permutations of the instancing ones and stay
+// zero if OpenGL 4.6 isn't available
 extern GLuint shaderProgram[ShaderProgram::NumShaderPrograms];
 
 // Helper function for creating and compiling the shaders
@@ -74,6 +75,9 @@ out VertexData
   vec4 worldPos;
 } vOut;
 
+// Depth primed passes rely on bit exact positions with GL_EQUAL
+invariant gl_Position;
+
 void main()
 {
   // Pass texture coordinates to the fragment shader
@@ -108,6 +112,14 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
+#ifdef INDIRECT_DRAW
+// The following is not not needed since GLSL version #460
+#extension GL_ARB_shader_draw_parameters : require
+
+// The following is not not needed since GLSL version #430
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
 // Uniform blocks, i.e., constants
 layout (std140, binding = 0) uniform TransformBlock
 {
@@ -116,11 +128,48 @@ layout (std140, binding = 0) uniform TransformBlock
   mat4x4 projection;
 };
 
+#ifdef INDIRECT_DRAW
+// Vertex buffer of the mesh pool as an array of floats, must match Vertex_Pos_Nrm_Tgt_Tex
+layout (std430, binding = 4) readonly buffer VertexBuffer
+{
+  float vertices[];
+};
+
+// Must match Scene::DrawData on the CPU side
+struct DrawData
+{
+  uint firstInstance;
+  uint material;
+};
+
+// Per draw data indexed by gl_DrawIDARB
+layout (std430, binding = 5) readonly buffer DrawDataBuffer
+{
+  DrawData drawData[];
+};
+
+// Vertex attributes fetched by PullVertex()
+vec3 position;
+vec3 normal;
+vec3 tangent;
+vec2 texCoord;
+
+// Fetch the vertex attributes, gl_VertexID already includes the base vertex of the mesh
+void PullVertex()
+{
+  int v = gl_VertexID * 11;
+  position = vec3(vertices[v + 0], vertices[v + 1], vertices[v + 2]);
+  normal = vec3(vertices[v + 3], vertices[v + 4], vertices[v + 5]);
+  tangent = vec3(vertices[v + 6], vertices[v + 7], vertices[v + 8]);
+  texCoord = vec2(vertices[v + 9], vertices[v + 10]);
+}
+#else
 // Vertex attribute block, i.e., input
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec3 tangent;
 layout (location = 3) in vec2 texCoord;
+#endif
 
 // Must match the structure on the CPU side
 struct InstanceData
@@ -147,13 +196,31 @@ out VertexData
   vec4 worldPos;
 } vOut;
 
+#ifdef INDIRECT_DRAW
+// Texture set of the draw
+flat out uint material;
+#endif
+
+// Depth primed passes rely on bit exact positions with GL_EQUAL
+invariant gl_Position;
+
 void main()
 {
+#ifdef INDIRECT_DRAW
+  PullVertex();
+
+  // Instances of the draw follow its first instance in the instance buffer
+  int instance = int(drawData[gl_DrawIDARB].firstInstance) + gl_InstanceID;
+  material = drawData[gl_DrawIDARB].material;
+#else
+  int instance = gl_InstanceID;
+#endif
+
   // Pass texture coordinates to the fragment shader
   vOut.texCoord = texCoord.st;
 
   // Retrieve the model to world matrix from the instance buffer
-  mat3x4 modelToWorld = instanceBuffer[gl_InstanceID].modelToWorld;
+  mat3x4 modelToWorld = instanceBuffer[instance].modelToWorld;
 
   // Construct the normal transformation matrix
   mat3 normalTransform = transpose(inverse(mat3(modelToWorld)));
@@ -298,6 +365,17 @@ layout (binding = 1) uniform sampler2D Normal;
 layout (binding = 2) uniform sampler2D Specular;
 layout (binding = 3) uniform sampler2D Occlusion;
 
+#ifdef INDIRECT_DRAW
+// Texture set of the objects, the background one is above
+layout (binding = 4) uniform sampler2D ObjectDiffuse;
+layout (binding = 5) uniform sampler2D ObjectNormal;
+layout (binding = 6) uniform sampler2D ObjectSpecular;
+layout (binding = 7) uniform sampler2D ObjectOcclusion;
+
+// Texture set of the draw, see Scene::Material
+flat in uint material;
+#endif
+
 // Note: explicit location because AMD APU drivers screw up position when linking against
 // the default vertex shader with mat4x3 modelToWorld at location 0 occupying 4 slots
 
@@ -307,6 +385,8 @@ layout (location = 4) uniform vec4 lightPosWS;
 layout (location = 5) uniform vec4 viewPosWS;
 // Light color
 layout (location = 6) uniform vec4 lightColor;
+// Light radius, direct light fades out before reaching it
+layout (location = 7) uniform float lightRadius;
 
 // Fragment shader inputs
 in VertexData
@@ -328,10 +408,30 @@ void main()
   const float directIntensity = lightPosWS.w;
 
   // Sample textures
+#ifdef INDIRECT_DRAW
+  // The material is the same for the whole primitive, so the implicit derivatives stay valid in the branches
+  vec3 albedo, noSample;
+  float specSample, occlusion;
+  if (material == 0u)
+  {
+    albedo = texture(Diffuse, vIn.texCoord.st).rgb;
+    noSample = texture(Normal, vIn.texCoord.st).rgb;
+    specSample = texture(Specular, vIn.texCoord.st).r;
+    occlusion = texture(Occlusion, vIn.texCoord.st).r;
+  }
+  else
+  {
+    albedo = texture(ObjectDiffuse, vIn.texCoord.st).rgb;
+    noSample = texture(ObjectNormal, vIn.texCoord.st).rgb;
+    specSample = texture(ObjectSpecular, vIn.texCoord.st).r;
+    occlusion = texture(ObjectOcclusion, vIn.texCoord.st).r;
+  }
+#else
   vec3 albedo = texture(Diffuse, vIn.texCoord.st).rgb;
   vec3 noSample = texture(Normal, vIn.texCoord.st).rgb;
   float specSample = texture(Specular, vIn.texCoord.st).r;
   float occlusion = texture(Occlusion, vIn.texCoord.st).r;
+#endif
 
   // Calculate world-space normal
   mat3 STN = {vIn.tangent, vIn.bitangent, vIn.normal};
@@ -343,6 +443,9 @@ void main()
   float length = sqrt(lengthSq);
   lightDir /= length;
 
+  // Need to make sure that distance function gets to 0 before leaving the light bounds
+  float attenuation = 1.0f - smoothstep(0.66f * lightRadius, 0.9f * lightRadius, length);
+
   // Calculate the view and reflection/halfway direction
   vec3 viewDir = normalize(viewPosWS.xyz - vIn.worldPos.xyz);
   // Cheaper approximation of reflected direction = reflect(-lightDir, normal)
@@ -361,8 +464,8 @@ void main()
 
   // Calculate the Phong model terms: ambient, diffuse, specular
   vec3 ambient = ambientIntensity * occlusion * lightColor.rgb;
-  vec3 diffuse = directIntensity * horizon * NdotL * lightColor.rgb / lengthSq;
-  vec3 specular = directIntensity* horizon * specSample * lightColor.rgb * pow(NdotH, 64.0f) / lengthSq; // Defines shininess
+  vec3 diffuse = directIntensity * attenuation * horizon * NdotL * lightColor.rgb / lengthSq;
+  vec3 specular = directIntensity * attenuation * horizon * specSample * lightColor.rgb * pow(NdotH, 64.0f) / lengthSq; // Defines shininess
 
   // Calculate the final color
   vec3 finalColor = albedo * (ambient + diffuse) + specular;
@@ -430,9 +533,8 @@ vec3 ApplyTonemapping(vec3 hdr)
 
 void main()
 {
-  // Query the size of the texture and calculate texel coordinates
-  ivec2 texSize = textureSize(HDR);
-  ivec2 texel = ivec2(UV * texSize);
+  // Texel coordinates of the fragment, the texture may be larger than the screen
+  ivec2 texel = ivec2(gl_FragCoord.xy);
 
   // Accumulate color for all MSAA samples
   vec3 finalColor = vec3(0.0f);
@@ -489,6 +591,8 @@ layout (std140, binding = 0) uniform TransformBlock
 
 // Location 0 is fine, we're linking only against instancing VS
 layout (location = 0) uniform vec4 lightPosWS;
+// Front and back caps are needed only by the depth fail algorithm
+layout (location = 1) uniform bool renderCaps;
 
 // Vertex input
 in VertexData
@@ -578,6 +682,10 @@ void main()
        ExtrudeEdge(v[4].worldPos.xyz, v[0].worldPos.xyz);
      }
 
+     // Depth pass volumes don't need closing
+     if (!renderCaps)
+       return;
+
      // Render the front cap
      lightDir = normalize(v[0].worldPos.xyz - lightPosWS.xyz);
      gl_Position = transform * vec4((v[0].worldPos.xyz + lightDir * epsilon), 1.0);
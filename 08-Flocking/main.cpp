@@ -12,6 +12,10 @@
 
 #include <MathSupport.h>
 #include <Camera.h>
+#include <PipelineStats.h>
+#include <RenderTargetPool.h>
+#include <ResourceRegistry.h>
+#include <TextOverlay.h>
 
 #include "shaders.h"
 #include "scene.h"
@@ -79,8 +83,8 @@ static constexpr float CameraTurboSpeed = 50.0f;
 
 // ----------------------------------------------------------------------------
 
-// Max buffer length
-static const unsigned int MAX_TEXT_LENGTH = 256;
+// Scale of the statistics overlay text
+static const int HUD_SCALE = 2;
 // MSAA samples
 static const GLsizei MSAA_SAMPLES = 4;
 
@@ -94,6 +98,10 @@ RenderMode renderMode = {true, false, true, MSAA_SAMPLES};
 bool animate = false;
 // Enable/disable faster flock movement
 bool turbo = false;
+// Statistics overlay
+TextOverlay hud;
+// Show/hide the statistics overlay
+bool showHud = true;
 
 // Our framebuffer object
 GLuint fbo = 0;
@@ -121,15 +129,22 @@ void APIENTRY debugCallback(GLenum source, GLenum type, GLuint id, GLenum severi
 }
 #endif
 
-// Callback for handling window resize events
-void resizeCallback(GLFWwindow* window, int width, int height)
+// Apply the window size to the viewport and camera, the render targets are recreated separately once the size settles
+void resize(int width, int height)
 {
   mainWindow.width = width;
   mainWindow.height = height;
   glViewport(0, 0, width, height);
   camera.SetProjection(fov, (float)width / (float)height, nearClipPlane, farClipPlane);
+}
 
-  createFramebuffer(width, height, renderMode.msaaLevel);
+// Callback for handling window resize events, the viewport and camera follow right away while the render targets are
+// recreated only once the size settles and leaves their size buckets so that dragging the window edge doesn't
+// reallocate them on every event
+void resizeCallback(GLFWwindow* window, int width, int height)
+{
+  resize(width, height);
+  RenderTargetPool::GetInstance().RequestResize(width, height);
 }
 
 // Callback for handling mouse movement over the window - called when mouse movement is detected
@@ -196,6 +211,12 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     turbo = !turbo;
   }
 
+  // Show/hide the statistics overlay
+  if (key == GLFW_KEY_F11 && action == GLFW_PRESS)
+  {
+    showHud = !showHud;
+  }
+
   // Zoom in
   if (key == GLFW_KEY_KP_ADD || key == GLFW_KEY_EQUAL && action == GLFW_PRESS)
   {
@@ -288,7 +309,11 @@ bool initOpenGL()
   glfwSetCursorPosCallback(mainWindow.handle, mouseMoveCallback);
 
   // Set the OpenGL viewport and camera projection
-  resizeCallback(mainWindow.handle, Window::DefaultWidth, Window::DefaultHeight);
+  resize(Window::DefaultWidth, Window::DefaultHeight);
+
+  // Create the render targets for the initial window size
+  createFramebuffer(Window::DefaultWidth, Window::DefaultHeight, renderMode.msaaLevel);
+  RenderTargetPool::GetInstance().SetTargetSize(Window::DefaultWidth, Window::DefaultHeight);
 
   // Set the initial camera position and orientation
   camera.SetTransformation(glm::vec3(-3.0f, 3.0f, -5.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
@@ -315,62 +340,22 @@ void createFramebuffer(int width, int height, GLsizei MSAA)
   // Render target texture:
   // --------------------------------------------------------------------------
 
-  // Delete it if necessary
-  if (glIsTexture(renderTarget))
-  {
-    glDeleteTextures(1, &renderTarget);
-    renderTarget = 0;
-  }
+  // Return the previous target to the pool, a target of the same size bucket is handed right back
+  RenderTargetPool &pool = RenderTargetPool::GetInstance();
+  pool.ReleaseTexture(renderTarget);
 
-  // Create the texture name
-  if (renderTarget == 0)
-  {
-    glGenTextures(1, &renderTarget);
-  }
-
-  // Bind and recreate the render target texture
-  if (MSAA > 1)
-  {
-    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, renderTarget);
-    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, MSAA, GL_RGB16F, width, height, GL_TRUE);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, renderTarget, 0);
-  }
-  else
-  {
-    glBindTexture(GL_TEXTURE_2D, renderTarget);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderTarget, 0);
-  }
+  // Get the render target texture, it may be larger than the window
+  GLenum target = MSAA > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+  renderTarget = pool.AcquireTexture(GL_RGB16F, width, height, MSAA, "HDR render target");
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, renderTarget, 0);
 
   // --------------------------------------------------------------------------
   // Depth/stencil buffer texture:
   // --------------------------------------------------------------------------
 
-  // Delete it if necessary
-  if (glIsRenderbuffer(depthStencil))
-  {
-    glDeleteRenderbuffers(1, &depthStencil);
-    depthStencil = 0;
-  }
-
-  // Create the depth-stencil name
-  if (depthStencil == 0)
-  {
-    glGenRenderbuffers(1, &depthStencil);
-  }
-
-  // Bind and recreate the depth-stencil Render Buffer Object
-  glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
-  if (MSAA > 1)
-  {
-    glRenderbufferStorageMultisample(GL_RENDERBUFFER, MSAA, GL_DEPTH24_STENCIL8, width, height);
-  }
-  else
-  {
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
-  }
+  // Get the depth-stencil Render Buffer Object
+  pool.ReleaseRenderbuffer(depthStencil);
+  depthStencil = pool.AcquireRenderbuffer(GL_DEPTH24_STENCIL8, width, height, MSAA, "Depth stencil buffer");
   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencil);
 
   // Set the list of draw buffers.
@@ -391,16 +376,22 @@ void createFramebuffer(int width, int height, GLsizei MSAA)
 // Helper method for graceful shutdown
 void shutDown()
 {
+  // Report the GPU memory before anything gets released
+  ResourceRegistry::GetInstance().PrintReport();
+
   // Release shader programs
   for (int i = 0; i < ShaderProgram::NumShaderPrograms; ++i)
   {
     glDeleteProgram(shaderProgram[i]);
   }
 
-  // Release the framebuffer
-  glDeleteTextures(1, &renderTarget);
-  glDeleteTextures(1, &depthStencil);
+  // Release the framebuffer and its targets
   glDeleteFramebuffers(1, &fbo);
+  RenderTargetPool::GetInstance().Clear();
+
+  // Release the statistics overlay and its queries
+  hud.Release();
+  PipelineStats::GetInstance().Release();
 
   // Release the window
   glfwDestroyWindow(mainWindow.handle);
@@ -491,6 +482,7 @@ void renderScene()
     glClear(GL_COLOR_BUFFER_BIT);
 
     // Tonemapping
+    PipelineStats::GetInstance().BeginPass("Tonemapping");
     glUseProgram(shaderProgram[ShaderProgram::Tonemapping]);
 
     // Send in the required data
@@ -505,6 +497,7 @@ void renderScene()
     // Draw fullscreen quad
     glBindVertexArray(scene.GetGenericVAO());
     glDrawArrays(GL_TRIANGLES, 0, 6);
+    PipelineStats::GetInstance().EndPass();
 
     // Unbind the shader program and other resources
     glBindVertexArray(0);
@@ -518,6 +511,28 @@ void renderScene()
     glDrawBuffer(GL_BACK);
     glBlitFramebuffer(0, 0, mainWindow.width, mainWindow.height, 0, 0, mainWindow.width, mainWindow.height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
   }
+
+  // Statistics over the final image
+  hud.Draw(mainWindow.width, mainWindow.height, HUD_SCALE);
+}
+
+// Print the tracked and driver reported GPU memory to the overlay
+void printMemory()
+{
+  static const float MB = 1024.0f * 1024.0f;
+  ResourceRegistry &registry = ResourceRegistry::GetInstance();
+  hud.Print("GPU memory %.1f MB: targets %.1f, textures %.1f, meshes %.1f, buffers %.1f MB\n", registry.GetTotal() / MB,
+            registry.GetTotal(ResourceCategory::RenderTargets) / MB, registry.GetTotal(ResourceCategory::Textures) / MB,
+            registry.GetTotal(ResourceCategory::Meshes) / MB, registry.GetTotal(ResourceCategory::Buffers) / MB);
+
+  GLint availableKB = 0, totalKB = 0;
+  if (registry.QueryDriverMemory(availableKB, totalKB))
+  {
+    if (totalKB > 0)
+      hud.Print("Driver memory %.1f/%.1f MB available\n", availableKB / 1024.0f, totalKB / 1024.0f);
+    else
+      hud.Print("Driver memory %.1f MB available\n", availableKB / 1024.0f);
+  }
 }
 
 // Helper method for implementing the application main loop
@@ -531,15 +546,27 @@ void mainLoop()
     float dt = (float)(time - prevTime);
     prevTime = time;
 
-    // Print it to the title bar
-    static char title[MAX_TEXT_LENGTH];
-    static char instacing[] = "[Instancing] ";
-    snprintf(title, MAX_TEXT_LENGTH, "dt = %.2fms, FPS = %.1f", dt * 1000.0f, 1.0f / dt);
-    glfwSetWindowTitle(mainWindow.handle, title);
+    // Collect the statistics for the overlay, the pass counters are a few frames old
+    hud.Clear();
+    if (showHud)
+    {
+      hud.Print("dt = %.2fms, FPS = %.1f, flock of %u boids\n", dt * 1000.0f, 1.0f / dt, scene.GetFlockSize());
+      printMemory();
+      hud.Print("\n");
+      PipelineStats::GetInstance().Print(hud);
+    }
 
     // Poll the events like keyboard, mouse, etc.
     glfwPollEvents();
 
+    // Recreate the render targets once the window size settles
+    int width, height;
+    if (RenderTargetPool::GetInstance().Update(width, height))
+    {
+      createFramebuffer(width, height, renderMode.msaaLevel);
+      RenderTargetPool::GetInstance().PrintStats();
+    }
+
     // Process keyboard input
     processInput(dt);
 
@@ -551,6 +578,9 @@ void mainLoop()
 
     // Swap actual buffers on the GPU
     glfwSwapBuffers(mainWindow.handle);
+
+    // Read back the pass counters for the overlay
+    PipelineStats::GetInstance().EndFrame();
   }
 }
 
@@ -572,6 +602,9 @@ int main()
     return -1;
   }
 
+  // Statistics overlay, the lab runs without it if it fails
+  hud.Init();
+
   // Scene initialization
   scene.Init(256, 64);
 
@@ -12,6 +12,8 @@
 #include <glm/gtx/transform.hpp>
 
 #include <MathSupport.h>
+#include <PipelineStats.h>
+#include <ResourceRegistry.h>
 
 // Scaling factor for lights movement curve
 static const glm::vec3 scale = glm::vec3(35.0f, 25.0f, 60.0f);
@@ -42,7 +44,7 @@ Scene::~Scene()
   _tetrahedron = nullptr;
 
   // Release the instancing buffer
-  glDeleteBuffers(2, _sbo);
+  ResourceRegistry::GetInstance().DeleteBuffers(2, _sbo);
 
   // Release the generic VAO
   glDeleteVertexArrays(1, &_vao);
@@ -75,6 +77,7 @@ void Scene::Init(unsigned int workGroupSize, unsigned int numWorkGroups)
     // Create the instancing buffer, it will be used for drawing and also updated by the GPU
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, _sbo[ShaderData::Flock0 + i]);
     glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_INSTANCES * sizeof(InstanceData), nullptr, GL_DYNAMIC_COPY);
+    ResourceRegistry::GetInstance().TrackBuffer(_sbo[ShaderData::Flock0 + i], MAX_INSTANCES * sizeof(InstanceData), ResourceCategory::Buffers, "Flock");
   }
 
   // Initialize data for the first frame
@@ -145,7 +148,9 @@ void Scene::Update(float dt, bool moveLight, bool turbo)
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _sbo[_currentFrameData]);
 
   // Perform the simulation step in the compute shader
+  PipelineStats::GetInstance().BeginPass("Flocking");
   glDispatchCompute(_numWorkGroups, 1, 1);
+  PipelineStats::GetInstance().EndPass();
 
   // Unbind the input/output buffers
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
@@ -186,8 +191,10 @@ void Scene::DrawObjects(GLuint program, const Camera &camera, const glm::vec3 &l
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _sbo[_currentFrameData]);
 
   // Draw the flock
+  PipelineStats::GetInstance().BeginPass("Flock");
   glBindVertexArray(_tetrahedron->GetVAO());
   glDrawElementsInstanced(GL_TRIANGLES, _tetrahedron->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), _flockSize);
+  PipelineStats::GetInstance().EndPass();
 
   // Unbind the instancing buffer
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
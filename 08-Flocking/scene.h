@@ -57,6 +57,8 @@ public:
   void Draw(const Camera &camera, const RenderMode &renderMode);
   // Return the generic VAO for rendering
   GLuint GetGenericVAO() { return _vao; }
+  // Number of simulated boids
+  unsigned int GetFlockSize() const { return _flockSize; }
 
 private:
   // Shader data indices for double buffering
@@ -276,9 +276,8 @@ vec3 ApplyTonemapping(vec3 hdr)
 
 void main()
 {
-  // Query the size of the texture and calculate texel coordinates
-  ivec2 texSize = textureSize(HDR);
-  ivec2 texel = ivec2(UV * texSize);
+  // Texel coordinates of the fragment, the texture may be larger than the screen
+  ivec2 texel = ivec2(gl_FragCoord.xy);
 
   // Accumulate color for all MSAA samples
   vec3 finalColor = vec3(0.0f);
@@ -3,7 +3,9 @@
  * Licensed under the zlib license, see LICENSE.txt in the root directory.
  */
 
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
 #include <vector>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -12,6 +14,11 @@
 
 #include <MathSupport.h>
 #include <Camera.h>
+#include <GLIntercept.h>
+#include <PipelineStats.h>
+#include <Profiler.h>
+#include <ResourceRegistry.h>
+#include <TextOverlay.h>
 
 #include "shaders.h"
 #include "scene.h"
@@ -87,24 +94,53 @@ static constexpr float CameraTurboSpeed = 50.0f;
 
 // ----------------------------------------------------------------------------
 
-// Max buffer length
-static const unsigned int MAX_TEXT_LENGTH = 256;
+// Scale of the statistics overlay text
+static const int HUD_SCALE = 2;
+// Number of the most expensive OpenGL functions shown in the overlay and reported
+static const int MAX_HUD_CALLS = 8;
+static const int MAX_REPORTED_CALLS = 30;
+
+// Number of frames of a trace captured by F12
+static const int TRACE_FRAMES = 60;
+// Capture a trace automatically after this many frames, 0 for never
+static const unsigned int TRACE_AFTER_FRAMES = 0;
 
 // Camera instance
 Camera camera;
 // Scene helper instance
 Scene &scene(Scene::GetInstance());
 // Render modes
-RenderMode renderMode = {true, DisplayMode::Default};
+RenderMode renderMode = {true, DisplayMode::Default, GBufferLayout::Default, false, false, false};
+// Vertex pulling from the mesh pool needs shader storage buffers, i.e., OpenGL 4.3
+bool vertexPullingSupported = false;
+// Multi draw indirect passes need gl_DrawID, i.e., OpenGL 4.6
+bool multiDrawIndirectSupported = false;
 // Enable/disable light movement
 bool animate = false;
-// All render targets that will be used
-RenderTargets renderTargets;
+// Passes and render targets of the frame
+FrameGraph frameGraph;
+// CPU time spent declaring, compiling and submitting the last frame in milliseconds
+float submitTime = 0.0f;
+// Statistics overlay
+TextOverlay hud;
+// Show/hide the statistics overlay
+bool showHud = true;
 
 // ----------------------------------------------------------------------------
 
-// Forward declaration for the framebuffer creation
-void createFramebuffer(int width, int height);
+// Returns GBuffer size per pixel in bytes including depth, assumes RGB formats being padded to 4 bytes
+int getGBufferBytesPerPixel(const RenderMode &mode)
+{
+  // Visibility buffer adds R32UI object and triangle indices
+  int visibility = mode.visibilityBuffer ? 4 : 0;
+
+  // D32F + RGBA8 + RGB10_A2
+  if (mode.gBufferLayout == GBufferLayout::Compact)
+    return 4 + 4 + 4 + visibility;
+
+  // D32F + RGB8 + RG16F + RGB8UI
+  return 4 + 4 + 4 + 4 + visibility;
+}
 
 // Callback for handling GLFW errors
 void errorCallback(int error, const char* description)
@@ -127,8 +163,6 @@ void resizeCallback(GLFWwindow* window, int width, int height)
   mainWindow.height = height;
   glViewport(0, 0, width, height);
   camera.SetProjection(fov, (float)width / (float)height, nearClipPlane, farClipPlane);
-
-  createFramebuffer(width, height);
 }
 
 // Callback for handling mouse movement over the window - called when mouse movement is detected
@@ -162,6 +196,78 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     animate = !animate;
   }
 
+  // Switch between the default and compact GBuffer layout
+  if (key == GLFW_KEY_F3 && action == GLFW_PRESS)
+  {
+    renderMode.gBufferLayout = (renderMode.gBufferLayout + 1) % GBufferLayout::NumLayouts;
+
+    int bytesPerPixel = getGBufferBytesPerPixel(renderMode);
+    printf("GBuffer layout: %s, %d B/px, %.2f MB\n", renderMode.gBufferLayout == GBufferLayout::Compact ? "compact" : "default",
+           bytesPerPixel, bytesPerPixel * mainWindow.width * mainWindow.height / (1024.0f * 1024.0f));
+  }
+
+  // Enable/disable filling the GBuffer via the visibility buffer
+  if (key == GLFW_KEY_F4 && action == GLFW_PRESS)
+  {
+    renderMode.visibilityBuffer = !renderMode.visibilityBuffer;
+    printf("Visibility buffer: %s\n", renderMode.visibilityBuffer ? "on" : "off");
+  }
+
+  // Enable/disable drawing all meshes with a single VAO pulling the vertices from the mesh pool
+  if (key == GLFW_KEY_F5 && action == GLFW_PRESS)
+  {
+    if (vertexPullingSupported)
+    {
+      renderMode.vertexPulling = !renderMode.vertexPulling;
+      printf("Vertex pulling: %s\n", renderMode.vertexPulling ? "on" : "off");
+    }
+    else
+    {
+      printf("Vertex pulling requires OpenGL 4.3.\n");
+    }
+  }
+
+  // Enable/disable drawing the whole scene with a single multi draw indirect call per pass
+  if (key == GLFW_KEY_F6 && action == GLFW_PRESS)
+  {
+    if (multiDrawIndirectSupported)
+    {
+      renderMode.multiDrawIndirect = !renderMode.multiDrawIndirect;
+      printf("Multi draw indirect: %s\n", renderMode.multiDrawIndirect ? "on" : "off");
+    }
+    else
+    {
+      printf("Multi draw indirect requires OpenGL 4.6.\n");
+    }
+  }
+
+  // Show/hide the statistics overlay
+  if (key == GLFW_KEY_F11 && action == GLFW_PRESS)
+  {
+    showHud = !showHud;
+  }
+
+  // Start/stop counting the OpenGL calls, the last frame is reported when stopped
+  if (key == GLFW_KEY_F10 && action == GLFW_PRESS)
+  {
+    GLIntercept &intercept = GLIntercept::GetInstance();
+    if (intercept.IsInstalled())
+    {
+      intercept.Uninstall();
+      intercept.PrintReport(MAX_REPORTED_CALLS);
+    }
+    else
+    {
+      intercept.Install();
+    }
+  }
+
+  // Capture a CPU and GPU timeline trace of the next frames
+  if (key == GLFW_KEY_F12 && action == GLFW_PRESS)
+  {
+    Profiler::GetInstance().Capture(TRACE_FRAMES);
+  }
+
   // GBuffer visualization modes
   if (key == GLFW_KEY_1 && action == GLFW_PRESS)
   {
@@ -229,17 +335,26 @@ bool initOpenGL()
   // Initialize the GLFW library
   if (!glfwInit()) return false;
 
-  // Request OpenGL 3.3 core profile upon window creation
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  // Set the context hints, the version is negotiated below
   glfwWindowHint(GLFW_SAMPLES, 0); // Disable MSAA, we can't use it here
 #if _ENABLE_OPENGL_DEBUG
   glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
 #endif
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-  // Create the window
-  mainWindow.handle = glfwCreateWindow(Window::DefaultWidth, Window::DefaultHeight, "", nullptr, nullptr);
+  // Request OpenGL 4.6 core profile for multi draw indirect, 4.3 for vertex pulling, fall back to 3.3 without them
+  const int contextVersions[][2] = {{4, 6}, {4, 3}, {3, 3}};
+  for (const auto &version : contextVersions)
+  {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+
+    // Create the window
+    mainWindow.handle = glfwCreateWindow(Window::DefaultWidth, Window::DefaultHeight, "", nullptr, nullptr);
+    if (mainWindow.handle != nullptr)
+      break;
+  }
+
   if (mainWindow.handle == nullptr)
   {
     printf("Failed to create the GLFW window!");
@@ -255,6 +370,16 @@ bool initOpenGL()
     return false;
   }
 
+  // Vertex pulling needs shader storage buffers
+  vertexPullingSupported = GLAD_GL_VERSION_4_3 != 0;
+  if (!vertexPullingSupported)
+    printf("OpenGL 4.3 not available, vertex pulling disabled.\n");
+
+  // Multi draw indirect needs gl_DrawID
+  multiDrawIndirectSupported = GLAD_GL_VERSION_4_6 != 0;
+  if (!multiDrawIndirectSupported)
+    printf("OpenGL 4.6 not available, multi draw indirect disabled.\n");
+
 #if _ENABLE_OPENGL_DEBUG
   // Enable error handling callback function - context must be created with DEBUG flags
   glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
@@ -290,211 +415,27 @@ bool initOpenGL()
   return true;
 }
 
-// Helper function for creating the HDR framebuffer
-void createFramebuffer(int width, int height)
-{
-  // Bind the default framebuffer
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-  // Generate the HDR FBO if necessary
-  if (!renderTargets.hdrFbo)
-  {
-    glGenFramebuffers(1, &renderTargets.hdrFbo);
-  }
-
-  // Bind it and recreate textures
-  glBindFramebuffer(GL_FRAMEBUFFER, renderTargets.hdrFbo);
-
-  // --------------------------------------------------------------------------
-  // Depth/stencil buffer texture (shared between both framebuffers):
-  // --------------------------------------------------------------------------
-
-  // Delete it if necessary
-  if (glIsTexture(renderTargets.depthStencil))
-  {
-    glDeleteTextures(1, &renderTargets.depthStencil);
-    renderTargets.depthStencil = 0;
-  }
-
-  // Create the depth-stencil name
-  if (renderTargets.depthStencil == 0)
-  {
-    glGenTextures(1, &renderTargets.depthStencil);
-  }
-
-  // Internal format, determines precision, possible choices (depth only)
-  // GL_DEPTH_COMPONENT, GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT32, GL_DEPTH_COMPONENT32F
-  GLint format = GL_DEPTH_COMPONENT32F;
-  glBindTexture(GL_TEXTURE_2D, renderTargets.depthStencil);
-  glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, renderTargets.depthStencil, 0);
-
-  // --------------------------------------------------------------------------
-  // Render target texture:
-  // --------------------------------------------------------------------------
-
-  // Delete it if necessary
-  if (glIsTexture(renderTargets.hdrRT))
-  {
-    glDeleteTextures(1, &renderTargets.hdrRT);
-    renderTargets.hdrRT = 0;
-  }
-
-  // Create the texture name
-  if (renderTargets.hdrRT == 0)
-  {
-    glGenTextures(1, &renderTargets.hdrRT);
-  }
-
-  // Bind and recreate the render target texture
-  glBindTexture(GL_TEXTURE_2D, renderTargets.hdrRT);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderTargets.hdrRT, 0);
-
-  // --------------------------------------------------------------------------
-
-  {
-    // Set the list of draw buffers.
-    GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0};
-    glDrawBuffers(1, drawBuffers);
-
-    // Check for completeness
-    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if (status != GL_FRAMEBUFFER_COMPLETE)
-    {
-      printf("Failed to create framebuffer: 0x%04X\n", status);
-      glBindFramebuffer(GL_FRAMEBUFFER, 0);
-      return;
-    }
-  }
-
-  // Bind back the window system provided framebuffer
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-  // Generate the GBuffer FBO if necessary
-  if (!renderTargets.gBufferFbo)
-  {
-    glGenFramebuffers(1, &renderTargets.gBufferFbo);
-  }
-
-  // Bind it and recreate textures
-  glBindFramebuffer(GL_FRAMEBUFFER, renderTargets.gBufferFbo);
-
-  // Bind the depth/stencil texture to it as well
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, renderTargets.depthStencil, 0);
-
-  // --------------------------------------------------------------------------
-  // Color buffer texture:
-  // --------------------------------------------------------------------------
-
-  // Delete it if necessary
-  if (glIsTexture(renderTargets.colorRT))
-  {
-    glDeleteTextures(1, &renderTargets.colorRT);
-    renderTargets.colorRT = 0;
-  }
-
-  // Create the texture name
-  if (renderTargets.colorRT == 0)
-  {
-    glGenTextures(1, &renderTargets.colorRT);
-  }
-
-  // Bind and recreate the render target texture
-  glBindTexture(GL_TEXTURE_2D, renderTargets.colorRT);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_BYTE, nullptr);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderTargets.colorRT, 0);
-
-  // --------------------------------------------------------------------------
-  // Normals buffer texture:
-  // --------------------------------------------------------------------------
-
-  // Delete it if necessary
-  if (glIsTexture(renderTargets.normalRT))
-  {
-    glDeleteTextures(1, &renderTargets.normalRT);
-    renderTargets.normalRT = 0;
-  }
-
-  // Create the texture name
-  if (renderTargets.normalRT == 0)
-  {
-    glGenTextures(1, &renderTargets.normalRT);
-  }
-
-  // Bind and recreate the render target texture
-  glBindTexture(GL_TEXTURE_2D, renderTargets.normalRT);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, width, height, 0, GL_RG, GL_FLOAT, nullptr);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, renderTargets.normalRT, 0);
-
-  // --------------------------------------------------------------------------
-  // Material buffer texture:
-  // --------------------------------------------------------------------------
-
-  // Delete it if necessary
-  if (glIsTexture(renderTargets.materialRT))
-  {
-    glDeleteTextures(1, &renderTargets.materialRT);
-    renderTargets.materialRT = 0;
-  }
-
-  // Create the texture name
-  if (renderTargets.materialRT == 0)
-  {
-    glGenTextures(1, &renderTargets.materialRT);
-  }
-
-  // Bind and recreate the render target texture
-  glBindTexture(GL_TEXTURE_2D, renderTargets.materialRT);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8UI, width, height, 0, GL_RGB_INTEGER, GL_BYTE, nullptr);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, renderTargets.materialRT, 0);
-
-  // --------------------------------------------------------------------------
-
-  {
-    // Set the list of draw buffers.
-    GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
-    glDrawBuffers(3, drawBuffers);
-
-    // Check for completeness
-    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if (status != GL_FRAMEBUFFER_COMPLETE)
-    {
-      printf("Failed to create framebuffer: 0x%04X\n", status);
-    }
-  }
-
-  // Bind back the window system provided framebuffer
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
 // Helper method for graceful shutdown
 void shutDown()
 {
+  // Report the GPU memory before anything gets released
+  ResourceRegistry::GetInstance().PrintReport();
+
   // Release shader programs
   for (int i = 0; i < ShaderProgram::NumShaderPrograms; ++i)
   {
     glDeleteProgram(shaderProgram[i]);
+    glDeleteProgram(shaderProgramPulling[i]);
+    glDeleteProgram(shaderProgramIndirect[i]);
   }
 
-  // Release the framebuffer
-  glDeleteTextures(1, &renderTargets.hdrRT);
-  glDeleteTextures(1, &renderTargets.depthStencil);
-  glDeleteTextures(1, &renderTargets.colorRT);
-  glDeleteTextures(1, &renderTargets.normalRT);
-  glDeleteTextures(1, &renderTargets.materialRT);
-  glDeleteFramebuffers(1, &renderTargets.hdrFbo);
-  glDeleteFramebuffers(1, &renderTargets.gBufferFbo);
+  // Release the render targets and framebuffers
+  frameGraph.Release();
+
+  // Release the statistics overlay and the profiler queries
+  hud.Release();
+  PipelineStats::GetInstance().Release();
+  Profiler::GetInstance().Release();
 
   // Release the window
   glfwDestroyWindow(mainWindow.handle);
@@ -559,75 +500,187 @@ void processInput(float dt)
 
 void renderScene()
 {
-  // Draw our scene
-  scene.Draw(camera, renderTargets);
-
-  // Unbind the shader program and other resources
-  glBindVertexArray(0);
-  glUseProgram(0);
-
-  // Bind the window system provided FBO
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-  // Solid fill always
-  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-  // Disable depth test
-  glDisable(GL_DEPTH_TEST);
-
-  // Clear the color
-  glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-  glClear(GL_COLOR_BUFFER_BIT);
-
-  // Tonemapping
-  glUseProgram(shaderProgram[ShaderProgram::Tonemapping]);
-
-  // Send in the required data
-  glm::vec3 data = glm::vec3(nearClipPlane, farClipPlane, renderMode.displayMode);
-  glUniform3fv(0, 1, glm::value_ptr(data));
-
-  // Bind the GBuffer textures
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, renderTargets.depthStencil);
-  glBindSampler(0, 0);
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, renderTargets.colorRT);
-  glBindSampler(1, 0);
-  glActiveTexture(GL_TEXTURE2);
-  glBindTexture(GL_TEXTURE_2D, renderTargets.normalRT);
-  glBindSampler(2, 0);
-  glActiveTexture(GL_TEXTURE3);
-  glBindTexture(GL_TEXTURE_2D, renderTargets.materialRT);
-  glBindSampler(3, 0);
-  glActiveTexture(GL_TEXTURE4);
-  glBindTexture(GL_TEXTURE_2D, renderTargets.hdrRT);
-  glBindSampler(4, 0);
-
-  // Draw fullscreen quad
-  glBindVertexArray(scene.GetGenericVAO());
-  glDrawArrays(GL_TRIANGLES, 0, 6);
-
-  // Unbind the shader program and other resources
-  glBindVertexArray(0);
-  glUseProgram(0);
+  // Measure the CPU time spent submitting the frame
+  typedef std::chrono::high_resolution_clock Clock;
+  Clock::time_point submitStart = Clock::now();
+
+  // Declare the scene passes
+  frameGraph.Reset(mainWindow.width, mainWindow.height);
+  SceneTargets targets;
+  {
+    PROFILE_SCOPE("Declare passes");
+    scene.AddPasses(camera, renderMode, frameGraph, targets);
+  }
+
+  // Tonemap the HDR image or show a GBuffer target, only the passes producing the targets read here are executed
+  struct PresentData
+  {
+    SceneTargets targets;
+  };
+
+  const bool compact = renderMode.gBufferLayout == GBufferLayout::Compact;
+  frameGraph.AddPass<PresentData>("Present",
+    [&targets, compact](FrameGraph::PassBuilder &builder, PresentData &data)
+    {
+      builder.SetSideEffect();
+      switch (renderMode.displayMode)
+      {
+      case DisplayMode::Color:
+        data.targets.color = builder.Read(targets.color);
+        break;
+      case DisplayMode::Depth:
+        data.targets.depth = builder.Read(targets.depth);
+        break;
+      case DisplayMode::Normals:
+        data.targets.normal = builder.Read(targets.normal);
+        data.targets.material = builder.Read(targets.material);
+        break;
+      case DisplayMode::Specular:
+        if (compact)
+          data.targets.color = builder.Read(targets.color);
+        else
+          data.targets.material = builder.Read(targets.material);
+        break;
+      case DisplayMode::Occlusion:
+        if (compact)
+          data.targets.normal = builder.Read(targets.normal);
+        else
+          data.targets.material = builder.Read(targets.material);
+        break;
+      default:
+        data.targets.hdr = builder.Read(targets.hdr);
+        break;
+      }
+    },
+    [compact](const PresentData &data)
+    {
+      // Scene passes are done
+      scene.EndFrame();
+
+      // Unbind the shader program and other resources
+      glBindVertexArray(0);
+      glUseProgram(0);
+
+      // Solid fill always
+      glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+      // Disable depth test
+      glDisable(GL_DEPTH_TEST);
+
+      // Clear the color
+      glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+      glClear(GL_COLOR_BUFFER_BIT);
+
+      // Tonemapping
+      glUseProgram(shaderProgram[compact ? ShaderProgram::TonemappingCompact : ShaderProgram::Tonemapping]);
+
+      // Send in the required data
+      glm::vec3 params = glm::vec3(nearClipPlane, farClipPlane, renderMode.displayMode);
+      glUniform3fv(0, 1, glm::value_ptr(params));
+
+      // Bind the GBuffer textures, the ones not needed by the display mode are unbound
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, frameGraph.GetTexture(data.targets.depth));
+      glBindSampler(0, 0);
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(GL_TEXTURE_2D, frameGraph.GetTexture(data.targets.color));
+      glBindSampler(1, 0);
+      glActiveTexture(GL_TEXTURE2);
+      glBindTexture(GL_TEXTURE_2D, frameGraph.GetTexture(data.targets.normal));
+      glBindSampler(2, 0);
+      glActiveTexture(GL_TEXTURE3);
+      glBindTexture(GL_TEXTURE_2D, frameGraph.GetTexture(data.targets.material));
+      glBindSampler(3, 0);
+      glActiveTexture(GL_TEXTURE4);
+      glBindTexture(GL_TEXTURE_2D, frameGraph.GetTexture(data.targets.hdr));
+      glBindSampler(4, 0);
+
+      // Draw fullscreen quad
+      glBindVertexArray(scene.GetGenericVAO());
+      glDrawArrays(GL_TRIANGLES, 0, 6);
+
+      // Unbind the shader program and other resources
+      glBindVertexArray(0);
+      glUseProgram(0);
+    });
+
+  // Cull the unused passes, alias the targets and draw
+  frameGraph.Compile();
+  frameGraph.Execute();
+
+  // Statistics over the final image
+  {
+    GL_INTERCEPT_SCOPE("Text overlay");
+    hud.Draw(mainWindow.width, mainWindow.height, HUD_SCALE);
+  }
+
+  submitTime = std::chrono::duration<float, std::milli>(Clock::now() - submitStart).count();
+}
+
+// Print the tracked and driver reported GPU memory to the overlay
+void printMemory()
+{
+  static const float MB = 1024.0f * 1024.0f;
+  ResourceRegistry &registry = ResourceRegistry::GetInstance();
+  hud.Print("GPU memory %.1f MB: targets %.1f, textures %.1f, meshes %.1f, buffers %.1f MB\n", registry.GetTotal() / MB,
+            registry.GetTotal(ResourceCategory::RenderTargets) / MB, registry.GetTotal(ResourceCategory::Textures) / MB,
+            registry.GetTotal(ResourceCategory::Meshes) / MB, registry.GetTotal(ResourceCategory::Buffers) / MB);
+
+  GLint availableKB = 0, totalKB = 0;
+  if (registry.QueryDriverMemory(availableKB, totalKB))
+  {
+    if (totalKB > 0)
+      hud.Print("Driver memory %.1f/%.1f MB available\n", availableKB / 1024.0f, totalKB / 1024.0f);
+    else
+      hud.Print("Driver memory %.1f MB available\n", availableKB / 1024.0f);
+  }
 }
 
 // Helper method for implementing the application main loop
 void mainLoop()
 {
   static double prevTime = 0.0;
+  unsigned int frame = 0;
+  Profiler::GetInstance().SetThreadName("Main");
   while (!glfwWindowShouldClose(mainWindow.handle))
   {
+    PROFILE_SCOPE("Frame");
+
     // Calculate delta time
     double time = glfwGetTime();
     float dt = (float)(time - prevTime);
     prevTime = time;
 
-    // Print it to the title bar
-    static char title[MAX_TEXT_LENGTH];
-    static char instacing[] = "[Instancing] ";
-    snprintf(title, MAX_TEXT_LENGTH, "dt = %.2fms, FPS = %.1f", dt * 1000.0f, 1.0f / dt);
-    glfwSetWindowTitle(mainWindow.handle, title);
+    // Collect the statistics for the overlay, the pass counters are a few frames old
+    hud.Clear();
+    if (showHud)
+    {
+      hud.Print("dt = %.2fms, FPS = %.1f, CPU submit = %.2fms, GBuffer pass = %.2fms, light passes = %.2fms\n",
+                dt * 1000.0f, 1.0f / dt, submitTime, scene.GetGBufferPassTime(), scene.GetLightPassTime());
+      hud.Print("%s%s%sGBuffer %s %d B/px, RT %.1f MB (%d/%d passes culled)\n",
+                renderMode.multiDrawIndirect ? "[MDI] " : "",
+                renderMode.vertexPulling ? "[Pulling] " : "",
+                renderMode.visibilityBuffer ? "[Visibility] " : "",
+                renderMode.gBufferLayout == GBufferLayout::Compact ? "compact" : "default",
+                getGBufferBytesPerPixel(renderMode), frameGraph.GetAllocatedMemory(), frameGraph.GetCulledCount(), frameGraph.GetPassCount());
+      hud.Print("RT saved %.1f MB by culling, %.1f MB by aliasing, peak %.1f MB\n",
+                frameGraph.GetDeclaredMemory() - frameGraph.GetRequestedMemory(),
+                frameGraph.GetRequestedMemory() - frameGraph.GetAllocatedMemory(), frameGraph.GetPeakSavedMemory());
+      const VirtualTexture &virtualTexture = scene.GetVirtualTexture();
+      if (virtualTexture.IsReady())
+      {
+        hud.Print("VT %d/%d pages (%d pending) in %.1f MB\n", virtualTexture.GetResidentCount(), virtualTexture.GetSlotCount(),
+                  virtualTexture.GetPendingCount(), virtualTexture.GetAtlasMemory());
+      }
+      printMemory();
+      hud.Print("\n");
+      PipelineStats::GetInstance().Print(hud);
+      if (GLIntercept::GetInstance().IsInstalled())
+      {
+        hud.Print("\n");
+        GLIntercept::GetInstance().Print(hud, MAX_HUD_CALLS);
+      }
+    }
 
     // Poll the events like keyboard, mouse, etc.
     glfwPollEvents();
@@ -636,18 +689,40 @@ void mainLoop()
     processInput(dt);
 
     // Update scene
-    scene.Update(animate ? dt : 0.0f, camera);
+    {
+      PROFILE_SCOPE("Update");
+      scene.Update(animate ? dt : 0.0f, camera);
+    }
 
     // Render the scene
     renderScene();
 
-    // Swap actual buffers on the GPU
-    glfwSwapBuffers(mainWindow.handle);
+    // Swap actual buffers on the GPU, waits here when the GPU falls behind
+    {
+      PROFILE_SCOPE("Swap buffers");
+      glfwSwapBuffers(mainWindow.handle);
+    }
+
+    // Read back the GPU scopes and write the trace once it's captured
+    if (++frame == TRACE_AFTER_FRAMES)
+      Profiler::GetInstance().Capture(TRACE_FRAMES);
+    Profiler::GetInstance().EndFrame();
+
+    // Read back the pass counters for the overlay and close the OpenGL call histogram
+    PipelineStats::GetInstance().EndFrame();
+    GLIntercept::GetInstance().EndFrame();
   }
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+  // Optional number of cubes and lights, the backdrop takes one more instance
+  int numCubes = argc > 1 ? atoi(argv[1]) : 10;
+  int numLights = argc > 2 ? atoi(argv[2]) : 5;
+  numCubes = glm::clamp(numCubes, 1, (int)Scene::MAX_INSTANCES - 1);
+  numLights = glm::clamp(numLights, 1, (int)Scene::MAX_INSTANCES);
+  printf("Scene: %d cubes, %d lights\n", numCubes, numLights);
+
   // Initialize the OpenGL context and create a window
   if (!initOpenGL())
   {
@@ -664,8 +739,11 @@ int main()
     return -1;
   }
 
+  // Statistics overlay, the lab runs without it if it fails
+  hud.Init();
+
   // Scene initialization
-  scene.Init(10, 5);
+  scene.Init(numCubes, numLights);
 
   // Enter the application main loop
   mainLoop();
@@ -12,7 +12,9 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/transform.hpp>
 
+#include <GLIntercept.h>
 #include <MathSupport.h>
+#include <ResourceRegistry.h>
 
 // Scaling factor for lights movement curve
 static const glm::vec3 scale = glm::vec3(13.0f, 2.0f, 13.0f);
@@ -41,24 +43,35 @@ Scene::Scene() : _textures(Textures::GetInstance())
 Scene::~Scene()
 {
   // Delete meshes
-  delete _quad;
-  _quad = nullptr;
+  delete _background;
+  _background = nullptr;
   delete _cube;
   _cube = nullptr;
   delete _icosahedron;
   _icosahedron = nullptr;
 
   // Release the instancing buffer
-  glDeleteBuffers(1, &_instancingBuffer);
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &_instancingBuffer);
 
   // Release the light buffer
-  glDeleteBuffers(1, &_lightBuffer);
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &_lightBuffer);
+
+  // Release the material buffer
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &_materialBuffer);
 
   // Release the generic VAO
   glDeleteVertexArrays(1, &_vao);
 
+  // Release the mesh buffer textures
+  ResourceRegistry::GetInstance().DeleteTextures(2, _backgroundBufferTextures);
+  ResourceRegistry::GetInstance().DeleteTextures(2, _cubeBufferTextures);
+
+  // Release the timer queries
+  glDeleteQueries(2, _gBufferPassQueries);
+  glDeleteQueries(2, _lightPassQueries);
+
   // Release textures
-  glDeleteTextures(LoadedTextures::NumTextures, _loadedTextures);
+  ResourceRegistry::GetInstance().DeleteTextures(MaterialMap::NumMaps, _materialMaps);
 }
 
 void Scene::Init(int numCubes, int numLights)
@@ -70,14 +83,85 @@ void Scene::Init(int numCubes, int numLights)
   _numCubes = numCubes;
   _numLights = numLights;
 
+  {
+    glm::mat4x4 backgroundTransforms[BACKGROUND_QUADS];
+
+    // Floor
+    backgroundTransforms[0] = glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
+
+    // Z axis wall
+    backgroundTransforms[1] = glm::translate(glm::vec3(0.0f, 0.0f, 15.0f));
+    backgroundTransforms[1] *= glm::rotate(-PI_HALF, glm::vec3(1.0f, 0.0f, 0.0f));
+    backgroundTransforms[1] *= glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
+
+    // X axis wall
+    backgroundTransforms[2] = glm::translate(glm::vec3(15.0f, 0.0f, 0.0f));
+    backgroundTransforms[2] *= glm::rotate(PI_HALF, glm::vec3(0.0f, 0.0f, 1.0f));
+    backgroundTransforms[2] *= glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
+
+    // The backdrop never moves and shares a single material, merge it into one world space mesh
+    std::vector<Vertex_Pos_Nrm_Tgt_Tex> quadVb;
+    std::vector<GLuint> quadIb;
+    Geometry::BuildQuadNormalTangentTex(quadVb, quadIb);
+    StaticBatch<Vertex_Pos_Nrm_Tgt_Tex> batch;
+    for (int i = 0; i < BACKGROUND_QUADS; ++i)
+    {
+      batch.Add(quadVb, quadIb, backgroundTransforms[i]);
+    }
+
+    _background = batch.Create();
+    _backgroundBoundsMin = batch.GetBoundsMin();
+    _backgroundBoundsMax = batch.GetBoundsMax();
+  }
+
   // Prepare meshes
-  _quad = Geometry::CreateQuadNormalTangentTex();
   _cube = Geometry::CreateCubeNormalTangentTex();
   _icosahedron = Geometry::CreateIcosahedron();
 
+  _meshVAOs[Backdrop] = _background->GetVAO();
+  _meshVAOs[Cube] = _cube->GetVAO();
+  _meshVAOs[Icosahedron] = _icosahedron->GetVAO();
+  _meshIndices[Backdrop] = _background->GetIBOSize();
+  _meshIndices[Cube] = _cube->GetIBOSize();
+  _meshIndices[Icosahedron] = _icosahedron->GetIBOSize();
+
+  // Copy all the meshes into the shared vertex pulling buffers, in the SceneMesh order
+  if (GLAD_GL_VERSION_4_3)
+  {
+    _meshPool.Add(*_background);
+    _meshPool.Add(*_cube);
+    _meshPool.Add(*_icosahedron);
+    _meshPool.Create();
+  }
+
+  // The scene is static, the indirect draws of the backdrop and cubes are built just once, gl_DrawID needs OpenGL 4.6
+  if (GLAD_GL_VERSION_4_6)
+  {
+    _sceneDraws.Add(_meshPool.GetEntry(Backdrop), 1, {(GLuint)_numCubes});
+    _sceneDraws.Add(_meshPool.GetEntry(Cube), _numCubes, {0});
+    _sceneDraws.Upload();
+  }
+
   // Create general use VAO
   glGenVertexArrays(1, &_vao);
 
+  // Create timer queries for the GBuffer and light passes
+  glGenQueries(2, _gBufferPassQueries);
+  glGenQueries(2, _lightPassQueries);
+
+  // Expose mesh vertex and index buffers to the visibility buffer resolve as buffer textures
+  auto createBufferTextures = [](GLuint vbo, GLuint ibo, GLuint textures[2])
+  {
+    glGenTextures(2, textures);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[0]);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, vbo);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[1]);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, ibo);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+  };
+  createBufferTextures(_background->GetVBO(), _background->GetIBO(), _backgroundBufferTextures);
+  createBufferTextures(_cube->GetVBO(), _cube->GetIBO(), _cubeBufferTextures);
+
   {
     // Generate the instancing buffer as Uniform Buffer Object
     glGenBuffers(1, &_instancingBuffer);
@@ -90,6 +174,7 @@ void Scene::Init(int numCubes, int numLights)
 
     // Describe the buffer data - we're going to change this every frame
     glBufferData(GL_UNIFORM_BUFFER, uboSize, nullptr, GL_DYNAMIC_DRAW);
+    ResourceRegistry::GetInstance().TrackBuffer(_instancingBuffer, uboSize, ResourceCategory::Buffers, "Instancing");
 
     // Unbind the GL_UNIFORM_BUFFER target for now
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
@@ -107,6 +192,7 @@ void Scene::Init(int numCubes, int numLights)
 
     // Describe the buffer data - we're going to change this every frame
     glBufferData(GL_UNIFORM_BUFFER, uboSize, nullptr, GL_DYNAMIC_DRAW);
+    ResourceRegistry::GetInstance().TrackBuffer(_lightBuffer, uboSize, ResourceCategory::Buffers, "Lights");
 
     // Unbind the GL_UNIFORM_BUFFER target for now
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
@@ -127,6 +213,7 @@ void Scene::Init(int numCubes, int numLights)
 
     // Describe the buffer data - we're going to change this every frame
     glBufferData(GL_UNIFORM_BUFFER, uboSize, nullptr, GL_DYNAMIC_DRAW);
+    ResourceRegistry::GetInstance().TrackBuffer(_transformBlockUBO, uboSize, ResourceCategory::Buffers, "Transform block");
 
     // Bind the memory for usage
     glBindBufferBase(GL_UNIFORM_BUFFER, 0, _transformBlockUBO);
@@ -202,15 +289,67 @@ void Scene::Init(int numCubes, int numLights)
   // Create texture samplers
   _textures.CreateSamplers();
 
-  // Prepare textures
-  _loadedTextures[LoadedTextures::White] = Textures::CreateSingleColorTexture(255, 255, 255);
-  _loadedTextures[LoadedTextures::Grey] = Textures::CreateSingleColorTexture(127, 127, 127);
-  _loadedTextures[LoadedTextures::Blue] = Textures::CreateSingleColorTexture(127, 127, 255);
-  _loadedTextures[LoadedTextures::CheckerBoard] = Textures::CreateCheckerBoardTexture(256, 16);
-  _loadedTextures[LoadedTextures::Diffuse] = Textures::LoadTexture("data/Terracotta_Tiles_002_Base_Color.jpg", true);
-  _loadedTextures[LoadedTextures::Normal] = Textures::LoadTexture("data/Terracotta_Tiles_002_Normal.jpg", false);
-  _loadedTextures[LoadedTextures::Specular] = Textures::LoadTexture("data/Terracotta_Tiles_002_Roughness.jpg", false);
-  _loadedTextures[LoadedTextures::Occlusion] = Textures::LoadTexture("data/Terracotta_Tiles_002_ambientOcclusion.jpg", false);
+  // Material map formats, the same for the texture arrays and the virtual texture
+  const GLenum mapFormats[MaterialMap::NumMaps] = {GL_SRGB8_ALPHA8, GL_RGBA8, GL_R8, GL_R8};
+  const bool normalMaps[MaterialMap::NumMaps] = {false, true, false, false};
+
+  // Stream the terracotta maps by pages through the virtual texture, its image store feedback requires OpenGL 4.3
+  if (GLAD_GL_VERSION_4_3)
+  {
+    const char *terracotta[MaterialMap::NumMaps] =
+    {
+      "data/Terracotta_Tiles_002_Base_Color.jpg", "data/Terracotta_Tiles_002_Normal.jpg",
+      "data/Terracotta_Tiles_002_Roughness.jpg", "data/Terracotta_Tiles_002_ambientOcclusion.jpg"
+    };
+    if (_virtualTexture.Init(2048, MaterialMap::NumMaps, mapFormats, normalMaps, 16) && _virtualTexture.AddLayer(terracotta) == Material::Terracotta - Material::FirstVirtual)
+      _virtualTexture.Create();
+  }
+
+  // Prepare textures, the terracotta maps are loaded whole only without the virtual texture
+  GLuint loadedTextures[LoadedTextures::NumTextures] = {0};
+  loadedTextures[LoadedTextures::White] = Textures::CreateSingleColorTexture(255, 255, 255);
+  loadedTextures[LoadedTextures::Grey] = Textures::CreateSingleColorTexture(127, 127, 127);
+  loadedTextures[LoadedTextures::Blue] = Textures::CreateSingleColorTexture(127, 127, 255);
+  loadedTextures[LoadedTextures::CheckerBoard] = Textures::CreateCheckerBoardTexture(256, 16);
+  const bool streamed = _virtualTexture.IsReady();
+  if (!streamed)
+  {
+    loadedTextures[LoadedTextures::Diffuse] = Textures::LoadTexture("data/Terracotta_Tiles_002_Base_Color.jpg", true);
+    loadedTextures[LoadedTextures::Normal] = Textures::LoadTexture("data/Terracotta_Tiles_002_Normal.jpg", false, true);
+    loadedTextures[LoadedTextures::Specular] = Textures::LoadTexture("data/Terracotta_Tiles_002_Roughness.jpg", false);
+    loadedTextures[LoadedTextures::Occlusion] = Textures::LoadTexture("data/Terracotta_Tiles_002_ambientOcclusion.jpg", false);
+  }
+
+  // Gather the maps of all materials into texture arrays, single color maps, e.g., the defaults of the streamed
+  // materials, take no layer and are stored as constants of the material instead
+  MaterialData materialData[Material::NumMaterials] = {};
+  auto createMaterialMap = [&loadedTextures, streamed, &mapFormats, &materialData](int map, int checkerBoard, int terracotta, int fallback) -> GLuint
+  {
+    const GLuint textures[Material::NumMaterials] = {loadedTextures[checkerBoard], loadedTextures[streamed ? fallback : terracotta]};
+    GLint layers[Material::NumMaterials];
+    glm::vec4 constants[Material::NumMaterials] = {};
+    GLuint textureArray = Textures::CreateTextureArray(textures, Material::NumMaterials, mapFormats[map], layers, constants);
+    for (int material = 0; material < Material::NumMaterials; ++material)
+    {
+      materialData[material].layers[map] = layers[material];
+      materialData[material].constants[map] = constants[material];
+    }
+    return textureArray;
+  };
+  _materialMaps[MaterialMap::Diffuse] = createMaterialMap(MaterialMap::Diffuse, LoadedTextures::CheckerBoard, LoadedTextures::Diffuse, LoadedTextures::White);
+  _materialMaps[MaterialMap::Normal] = createMaterialMap(MaterialMap::Normal, LoadedTextures::Blue, LoadedTextures::Normal, LoadedTextures::Blue);
+  _materialMaps[MaterialMap::Specular] = createMaterialMap(MaterialMap::Specular, LoadedTextures::Grey, LoadedTextures::Specular, LoadedTextures::Grey);
+  _materialMaps[MaterialMap::Occlusion] = createMaterialMap(MaterialMap::Occlusion, LoadedTextures::White, LoadedTextures::Occlusion, LoadedTextures::White);
+
+  // The separate textures aren't needed anymore
+  ResourceRegistry::GetInstance().DeleteTextures(LoadedTextures::NumTextures, loadedTextures);
+
+  // The material layers and constants never change
+  glGenBuffers(1, &_materialBuffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, _materialBuffer);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(materialData), materialData, GL_STATIC_DRAW);
+  ResourceRegistry::GetInstance().TrackBuffer(_materialBuffer, sizeof(materialData), ResourceCategory::Buffers, "Materials");
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 void Scene::Update(float dt, const Camera &camera)
@@ -254,28 +393,55 @@ void Scene::Update(float dt, const Camera &camera)
   t += dt;
 }
 
-void Scene::BindTextures(const GLuint &diffuse, const GLuint &normal, const GLuint &specular, const GLuint &occlusion)
+GLuint Scene::GetProgram(int program)
+{
+  return _vertexPulling ? shaderProgramPulling[program] : shaderProgram[program];
+}
+
+void Scene::BindMesh(SceneMesh mesh)
+{
+  glBindVertexArray(_vertexPulling ? _meshPool.GetVAO() : _meshVAOs[mesh]);
+}
+
+void Scene::DrawMesh(SceneMesh mesh, GLsizei numInstances)
 {
-  // We want to bind textures and appropriate samplers
-  glActiveTexture(GL_TEXTURE0 + 0);
-  glBindTexture(GL_TEXTURE_2D, diffuse);
-  glBindSampler(0, _textures.GetSampler(Sampler::Anisotropic));
-
-  glActiveTexture(GL_TEXTURE0 + 1);
-  glBindTexture(GL_TEXTURE_2D, normal);
-  glBindSampler(1, _textures.GetSampler(Sampler::Anisotropic));
-
-  glActiveTexture(GL_TEXTURE0 + 2);
-  glBindTexture(GL_TEXTURE_2D, specular);
-  glBindSampler(2, _textures.GetSampler(Sampler::Anisotropic));
-
-  glActiveTexture(GL_TEXTURE0 + 3);
-  glBindTexture(GL_TEXTURE_2D, occlusion);
-  glBindSampler(3, _textures.GetSampler(Sampler::Anisotropic));
+  if (_vertexPulling)
+  {
+    // Range of the mesh in the pool, the base vertex offsets gl_VertexID to the mesh vertices
+    const MeshPool::Entry &entry = _meshPool.GetEntry(mesh);
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, entry.numIndices, GL_UNSIGNED_INT, reinterpret_cast<void*>(entry.firstIndex * sizeof(GLuint)),
+                                      numInstances, entry.baseVertex);
+  }
+  else
+  {
+    glDrawElementsInstanced(GL_TRIANGLES, _meshIndices[mesh], GL_UNSIGNED_INT, reinterpret_cast<void*>(0), numInstances);
+  }
+}
+
+void Scene::BindMaterials()
+{
+  GL_INTERCEPT_SCOPE("BindMaterials");
+
+  // All materials are in the texture arrays, so this is done just once for all the draws of a pass
+  for (int map = 0; map < MaterialMap::NumMaps; ++map)
+  {
+    glActiveTexture(GL_TEXTURE0 + map);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _materialMaps[map]);
+    glBindSampler(map, _textures.GetSampler(Sampler::Anisotropic));
+  }
+
+  // Layers and single colors of the material maps
+  glBindBufferBase(GL_UNIFORM_BUFFER, 4, _materialBuffer);
+
+  // Virtual texture atlases and page table follow the visibility buffer units, feedback goes to image unit 0
+  if (GLAD_GL_VERSION_4_3)
+    _virtualTexture.Bind(8, 0, 3);
 }
 
 void Scene::UpdateInstanceData()
 {
+  GL_INTERCEPT_SCOPE("UpdateInstanceData");
+
   // Create transformation matrix
   glm::mat4x4 transformation = glm::mat4x4(1.0f);
   // Instance data CPU side buffer
@@ -290,8 +456,14 @@ void Scene::UpdateInstanceData()
     transformation *= glm::rotate(glm::radians(i * angle), glm::vec3(1.0f, 1.0f, 1.0f));
 
     instanceData[i].transformation = glm::transpose(transformation);
+    // Mix the materials within the single instanced draw, every third cube is checkered
+    instanceData[i].material = (i % 3 == 2) ? Material::CheckerBoard : Material::Terracotta;
   }
 
+  // Backdrop batch follows the cubes, the visibility buffer needs all objects in the instance buffer, it's already in world space
+  instanceData[_numCubes].transformation = glm::mat3x4(1.0f);
+  instanceData[_numCubes].material = Material::CheckerBoard;
+
   // Start working with instancing buffer
   glBindBuffer(GL_UNIFORM_BUFFER, _instancingBuffer);
 
@@ -300,7 +472,7 @@ void Scene::UpdateInstanceData()
 
   // Update the buffer data using mapping
   void *ptr = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY);
-  memcpy(ptr, &*instanceData.begin(), _numCubes * sizeof(InstanceData));
+  memcpy(ptr, &*instanceData.begin(), (_numCubes + 1) * sizeof(InstanceData));
   glUnmapBuffer(GL_UNIFORM_BUFFER);
 
   // Unbind the uniform buffer target
@@ -309,6 +481,8 @@ void Scene::UpdateInstanceData()
 
 int Scene::UpdateLightData(LightSet lightSet, bool visualization)
 {
+  GL_INTERCEPT_SCOPE("UpdateLightData");
+
   // Instance and light data CPU side buffer
   static std::vector<InstanceData> instanceData(MAX_INSTANCES);
   static std::vector<LightData> lightData(MAX_INSTANCES);
@@ -414,6 +588,8 @@ int Scene::UpdateLightData(LightSet lightSet, bool visualization)
 
 void Scene::UpdateTransformBlock(const Camera &camera)
 {
+  GL_INTERCEPT_SCOPE("UpdateTransformBlock");
+
   // Tell OpenGL we want to work with our transform block
   glBindBuffer(GL_UNIFORM_BUFFER, _transformBlockUBO);
 
@@ -436,38 +612,23 @@ void Scene::UpdateTransformBlock(const Camera &camera)
 
 void Scene::DrawBackground()
 {
-  GLuint program = shaderProgram[ShaderProgram::DefaultGBuffer];
+  // Skip the whole batch if it's outside the view frustum
+  if (!_backgroundVisible)
+    return;
+
+  GLuint program = GetProgram(_gBufferLayout == GBufferLayout::Compact ? ShaderProgram::DefaultGBufferCompact : ShaderProgram::DefaultGBuffer);
 
   // Bind the shader program and update its data
   glUseProgram(program);
 
-  // Bind textures
-  BindTextures(_loadedTextures[LoadedTextures::CheckerBoard], _loadedTextures[LoadedTextures::Blue], _loadedTextures[LoadedTextures::Grey], _loadedTextures[LoadedTextures::White]);
-
   // Bind the geometry
-  glBindVertexArray(_quad->GetVAO());
-
-  // Draw floor:
-  glm::mat4x4 transformation = glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
-  glm::mat4x3 passMatrix = transformation;
-  glUniformMatrix4x3fv(0, 1, GL_FALSE, glm::value_ptr(passMatrix));
-  glDrawElements(GL_TRIANGLES, _quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
-
-  // Draw Z axis wall
-  transformation = glm::translate(glm::vec3(0.0f, 0.0f, 15.0f));
-  transformation *= glm::rotate(-PI_HALF, glm::vec3(1.0f, 0.0f, 0.0f));
-  transformation *= glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
-  passMatrix = transformation;
-  glUniformMatrix4x3fv(0, 1, GL_FALSE, glm::value_ptr(passMatrix));
-  glDrawElements(GL_TRIANGLES, _quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+  BindMesh(Backdrop);
 
-  // Draw X axis wall
-  transformation = glm::translate(glm::vec3(15.0f, 0.0f, 0.0f));
-  transformation *= glm::rotate(PI_HALF, glm::vec3(0.0f, 0.0f, 1.0f));
-  transformation *= glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
-  passMatrix = transformation;
+  // Draw floor and walls at once, the batch is already in world space
+  glm::mat4x3 passMatrix = glm::mat4x3(1.0f);
   glUniformMatrix4x3fv(0, 1, GL_FALSE, glm::value_ptr(passMatrix));
-  glDrawElements(GL_TRIANGLES, _quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+  glUniform1ui(1, Material::CheckerBoard);
+  DrawMesh(Backdrop, 1);
 }
 
 void Scene::DrawObjects()
@@ -475,17 +636,29 @@ void Scene::DrawObjects()
   // Update the instancing buffer
   UpdateInstanceData();
 
-  GLuint program = shaderProgram[ShaderProgram::InstancedGBuffer];
+  GLuint program = GetProgram(_gBufferLayout == GBufferLayout::Compact ? ShaderProgram::InstancedGBufferCompact : ShaderProgram::InstancedGBuffer);
 
   // Bind the shader program and update its data
   glUseProgram(program);
 
-  // Bind textures
-  BindTextures(_loadedTextures[LoadedTextures::Diffuse], _loadedTextures[LoadedTextures::Normal], _loadedTextures[LoadedTextures::Specular], _loadedTextures[LoadedTextures::Occlusion]);
+  // Draw cubes, each one with its own material
+  BindMesh(Cube);
+  DrawMesh(Cube, _numCubes);
+}
 
-  // Draw cubes
-  glBindVertexArray(_cube->GetVAO());
-  glDrawElementsInstanced(GL_TRIANGLES, _cube->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), _numCubes);
+void Scene::DrawSceneIndirect()
+{
+  // Update the instancing buffer, contains the backdrop as well
+  UpdateInstanceData();
+
+  GLuint program = shaderProgramIndirect[_gBufferLayout == GBufferLayout::Compact ? ShaderProgram::InstancedGBufferCompact : ShaderProgram::InstancedGBuffer];
+
+  // Bind the shader program
+  glUseProgram(program);
+
+  // Draw floor, walls and cubes at once
+  glBindVertexArray(_meshPool.GetVAO());
+  _sceneDraws.Draw();
 }
 
 void Scene::DrawLights(const Camera &camera)
@@ -497,15 +670,15 @@ void Scene::DrawLights(const Camera &camera)
 
     if (numLights > 0)
     {
-      glDrawElementsInstanced(GL_TRIANGLES, _icosahedron->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), numLights);
+      DrawMesh(Icosahedron, numLights);
     }
   };
 
   // We'll be drawing icosahedra for both light pass and light visualization
-  glBindVertexArray(_icosahedron->GetVAO());
+  BindMesh(Icosahedron);
 
   // Bind the shader program for instanced light passes
-  GLuint program = shaderProgram[ShaderProgram::InstancedLightPass];
+  GLuint program = GetProgram(_gBufferLayout == GBufferLayout::Compact ? ShaderProgram::InstancedLightPassCompact : ShaderProgram::InstancedLightPass);
   glUseProgram(program);
 
   // Update the camera world space position
@@ -531,7 +704,7 @@ void Scene::DrawLights(const Camera &camera)
   // Draw light points
 
   // Bind the shader program for light point visualization
-  glUseProgram(shaderProgram[ShaderProgram::InstancedLightVis]);
+  glUseProgram(GetProgram(ShaderProgram::InstancedLightVis));
 
   // Draw light volumes as small points for visualization purposes
   lightPass(LightSet::All, true);
@@ -539,7 +712,7 @@ void Scene::DrawLights(const Camera &camera)
 
 void Scene::DrawAmbientPass()
 {
-  GLuint program = shaderProgram[ShaderProgram::AmbientLightPass];
+  GLuint program = shaderProgram[_gBufferLayout == GBufferLayout::Compact ? ShaderProgram::AmbientLightPassCompact : ShaderProgram::AmbientLightPass];
 
   // Bind the shader program and update its data
   glUseProgram(program);
@@ -553,70 +726,328 @@ void Scene::DrawAmbientPass()
   glDrawArrays(GL_TRIANGLES, 0, 6);
 }
 
-void Scene::Draw(const Camera &camera, const RenderTargets &renderTargets)
+void Scene::DrawVisibility()
 {
-  UpdateTransformBlock(camera);
+  // Update the instancing buffer, contains the backdrop as well
+  UpdateInstanceData();
 
-  // Enable depth test, clamp, and write
-  glEnable(GL_DEPTH_TEST);
-  glEnable(GL_DEPTH_CLAMP);
-  glDepthFunc(GL_LEQUAL);
-  glDepthMask(GL_TRUE);
+  // Draw floor, walls and cubes at once, the draws know their first object
+  if (_multiDrawIndirect)
+  {
+    glUseProgram(shaderProgramIndirect[ShaderProgram::Visibility]);
+    glBindVertexArray(_meshPool.GetVAO());
+    _sceneDraws.Draw();
+    return;
+  }
 
-  // Enable backface culling
-  glEnable(GL_CULL_FACE);
-  glCullFace(GL_BACK);
+  // Bind the shader program
+  glUseProgram(GetProgram(ShaderProgram::Visibility));
+
+  // Draw floor and walls as a single object stored after the cubes
+  if (_backgroundVisible)
+  {
+    BindMesh(Backdrop);
+    glUniform1i(0, _numCubes);
+    DrawMesh(Backdrop, 1);
+  }
+
+  // Draw cubes
+  BindMesh(Cube);
+  glUniform1i(0, 0);
+  DrawMesh(Cube, _numCubes);
+}
+
+void Scene::DrawVisibilityResolve(GLuint visibilityTexture)
+{
+  GLuint program = shaderProgram[_gBufferLayout == GBufferLayout::Compact ? ShaderProgram::VisibilityResolveCompact : ShaderProgram::VisibilityResolve];
+
+  // Bind the shader program
+  glUseProgram(program);
+
+  // Bind the visibility buffer
+  glActiveTexture(GL_TEXTURE4);
+  glBindTexture(GL_TEXTURE_2D, visibilityTexture);
+  glBindSampler(4, 0);
+
+  // Binds mesh data as buffer textures
+  auto bindBufferTextures = [](const GLuint textures[2])
+  {
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[0]);
+    glBindSampler(5, 0);
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[1]);
+    glBindSampler(6, 0);
+  };
+
+  // Fullscreen quads are drawn with the generic VAO
+  glBindVertexArray(_vao);
+
+  // Resolve floor and walls
+  bindBufferTextures(_backgroundBufferTextures);
+  glUniform2i(0, _numCubes, 1);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+
+  // Resolve cubes
+  bindBufferTextures(_cubeBufferTextures);
+  glUniform2i(0, 0, _numCubes);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+
+  // Unbind the buffer textures
+  glActiveTexture(GL_TEXTURE5);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glActiveTexture(GL_TEXTURE6);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void Scene::AddPasses(const Camera &camera, const RenderMode &renderMode, FrameGraph &frameGraph, SceneTargets &targets)
+{
+  // Timer queries of this frame
+  const int slot = _frameCount % 2;
+  _lightPassQueried[slot] = false;
+
+  // Select the shader permutations matching the GBuffer layout
+  _gBufferLayout = renderMode.gBufferLayout;
+
+  // Cull the backdrop batch just once for all its passes
+  _backgroundVisible = !isBoxOutsideFrustum(camera.GetProjection() * camera.GetWorldToView(), _backgroundBoundsMin, _backgroundBoundsMax);
+
+  // Select the vertex pulling permutations, all the formats stay bound for the whole frame
+  _vertexPulling = renderMode.vertexPulling && _meshPool.GetVAO() != 0;
+  // The multi draw indirect passes pull the vertices as well
+  _multiDrawIndirect = renderMode.multiDrawIndirect && _sceneDraws.GetCount() > 0;
+
+  // Common state of the first pass drawing the scene
+  auto beginScene = [this, &camera, &frameGraph, slot]()
+  {
+    UpdateTransformBlock(camera);
+
+    // Start collecting the page requests of this frame
+    _virtualTexture.BeginFrame(frameGraph.GetWidth(), frameGraph.GetHeight());
+
+    if (_vertexPulling || _multiDrawIndirect)
+      _meshPool.BindVertexBuffers();
+
+    // Enable depth test, clamp, and write
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_DEPTH_CLAMP);
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_TRUE);
+
+    // Enable backface culling
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+
+    // Measure the GPU time of filling the GBuffer
+    glBeginQuery(GL_TIME_ELAPSED, _gBufferPassQueries[slot]);
+    _gBufferQueryActive = true;
+
+    // Materials are selected per instance, bind them all just once for the whole GBuffer pass
+    BindMaterials();
+  };
+
+  // GBuffer targets of the layout, attached in the order of the shader outputs
+  const bool compact = renderMode.gBufferLayout == GBufferLayout::Compact;
+  auto createGBuffer = [compact](FrameGraph::PassBuilder &builder, SceneTargets &gBuffer)
+  {
+    gBuffer.color = builder.Create("GBuffer color", compact ? GL_RGBA8 : GL_RGB8);
+    gBuffer.normal = builder.Create("GBuffer normal", compact ? GL_RGB10_A2 : GL_RG16F);
+    if (!compact)
+      gBuffer.material = builder.Create("GBuffer material", GL_RGB8UI);
+  };
+
+  // Stop measuring once the GBuffer is filled
+  auto endGBuffer = [this]()
+  {
+    // We primed the depth buffer, no need to write to it anymore
+    glDepthMask(GL_FALSE);
+
+    glEndQuery(GL_TIME_ELAPSED);
+    _gBufferQueryActive = false;
+  };
 
   // --------------------------------------------------------------------------
 
-  // Bind the GBuffer
-  glBindFramebuffer(GL_FRAMEBUFFER, renderTargets.gBufferFbo);
+  if (renderMode.visibilityBuffer)
+  {
+    struct VisibilityData
+    {
+      FrameGraph::Resource depth;
+      FrameGraph::Resource visibility;
+    };
+
+    // Render just the object and triangle indices
+    const VisibilityData &visibility = frameGraph.AddPass<VisibilityData>("Visibility",
+      [](FrameGraph::PassBuilder &builder, VisibilityData &data)
+      {
+        data.depth = builder.Create("Depth buffer", GL_DEPTH_COMPONENT32F);
+        data.visibility = builder.Create("Visibility buffer", GL_R32UI);
+      },
+      [this, beginScene](const VisibilityData &data)
+      {
+        beginScene();
 
-  // Clear the color and depth buffers
-  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // Clear the depth buffer and the indices to an invalid value
+        const GLuint invalidID[] = {0xFFFFFFFFu, 0u, 0u, 0u};
+        glClearBufferuiv(GL_COLOR, 0, invalidID);
+        glClear(GL_DEPTH_BUFFER_BIT);
 
-  // Render the scene into the GBuffer only
-  DrawBackground();
-  DrawObjects();
+        DrawVisibility();
+      });
+    targets.depth = visibility.depth;
 
-  // We primed the depth buffer, no need to write to it anymore
-  glDepthMask(GL_FALSE);
+    struct ResolveData
+    {
+      FrameGraph::Resource visibility;
+      SceneTargets gBuffer;
+    };
+
+    // Fetch the material data just once per visible pixel, the depth buffer isn't needed anymore
+    const ResolveData &resolve = frameGraph.AddPass<ResolveData>("GBuffer",
+      [&visibility, createGBuffer](FrameGraph::PassBuilder &builder, ResolveData &data)
+      {
+        data.visibility = builder.Read(visibility.visibility);
+        createGBuffer(builder, data.gBuffer);
+      },
+      [this, &frameGraph, endGBuffer](const ResolveData &data)
+      {
+        // Clear the color buffers only
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        glDisable(GL_DEPTH_TEST);
+        DrawVisibilityResolve(frameGraph.GetTexture(data.visibility));
+        glEnable(GL_DEPTH_TEST);
+
+        endGBuffer();
+      });
+    targets.color = resolve.gBuffer.color;
+    targets.normal = resolve.gBuffer.normal;
+    targets.material = resolve.gBuffer.material;
+  }
+  else
+  {
+    // Render the scene into the GBuffer only
+    const SceneTargets &gBuffer = frameGraph.AddPass<SceneTargets>("GBuffer",
+      [createGBuffer](FrameGraph::PassBuilder &builder, SceneTargets &data)
+      {
+        data.depth = builder.Create("Depth buffer", GL_DEPTH_COMPONENT32F);
+        createGBuffer(builder, data);
+      },
+      [this, beginScene, endGBuffer](const SceneTargets &data)
+      {
+        beginScene();
+
+        // Clear the color and depth buffers
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        if (_multiDrawIndirect)
+        {
+          DrawSceneIndirect();
+        }
+        else
+        {
+          DrawBackground();
+          DrawObjects();
+        }
+
+        endGBuffer();
+      });
+    targets.depth = gBuffer.depth;
+    targets.color = gBuffer.color;
+    targets.normal = gBuffer.normal;
+    targets.material = gBuffer.material;
+  }
 
   // --------------------------------------------------------------------------
 
-  // Bind the HDR framebuffer
-  glBindFramebuffer(GL_FRAMEBUFFER, renderTargets.hdrFbo);
-
-  // Clear the color buffer
-  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-  glClear(GL_COLOR_BUFFER_BIT);
-
-  // Enable additive alpha blending
-  glEnable(GL_BLEND);
-  glBlendEquation(GL_FUNC_ADD);
-  glBlendFunc(GL_ONE, GL_ONE);
-
-  // Bind the GBuffer textures
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, renderTargets.depthStencil);
-  glBindSampler(0, 0);
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, renderTargets.colorRT);
-  glBindSampler(1, 0);
-  glActiveTexture(GL_TEXTURE2);
-  glBindTexture(GL_TEXTURE_2D, renderTargets.normalRT);
-  glBindSampler(2, 0);
-  glActiveTexture(GL_TEXTURE3);
-  glBindTexture(GL_TEXTURE_2D, renderTargets.materialRT);
-  glBindSampler(3, 0);
-
-  // Combine the GBuffer into the HDR buffer using ambient light
-  DrawAmbientPass();
-
-  // Draw all the lights in the scene using the GBuffer as input outputting to the HDR buffer
-  DrawLights(camera);
-
-  // Disable blending
-  glDisable(GL_BLEND);
+  // Combine the GBuffer into the HDR buffer, culled when only the GBuffer is displayed
+  const SceneTargets &lighting = frameGraph.AddPass<SceneTargets>("Lighting",
+    [&targets](FrameGraph::PassBuilder &builder, SceneTargets &data)
+    {
+      // Light volumes are depth tested against the GBuffer depth
+      data.depth = builder.Read(targets.depth, true);
+      data.color = builder.Read(targets.color);
+      data.normal = builder.Read(targets.normal);
+      data.material = builder.Read(targets.material);
+      data.hdr = builder.Create("HDR render target", GL_RGB16F);
+    },
+    [this, &camera, &frameGraph, slot](const SceneTargets &data)
+    {
+      // Clear the color buffer
+      glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+      glClear(GL_COLOR_BUFFER_BIT);
+
+      // Enable additive alpha blending
+      glEnable(GL_BLEND);
+      glBlendEquation(GL_FUNC_ADD);
+      glBlendFunc(GL_ONE, GL_ONE);
+
+      // Bind the GBuffer textures
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, frameGraph.GetTexture(data.depth));
+      glBindSampler(0, 0);
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(GL_TEXTURE_2D, frameGraph.GetTexture(data.color));
+      glBindSampler(1, 0);
+      glActiveTexture(GL_TEXTURE2);
+      glBindTexture(GL_TEXTURE_2D, frameGraph.GetTexture(data.normal));
+      glBindSampler(2, 0);
+      glActiveTexture(GL_TEXTURE3);
+      glBindTexture(GL_TEXTURE_2D, frameGraph.GetTexture(data.material));
+      glBindSampler(3, 0);
+
+      // Measure the GPU time of the passes reading the GBuffer
+      glBeginQuery(GL_TIME_ELAPSED, _lightPassQueries[slot]);
+      _lightPassQueried[slot] = true;
+
+      // Combine the GBuffer into the HDR buffer using ambient light
+      DrawAmbientPass();
+
+      // Draw all the lights in the scene using the GBuffer as input outputting to the HDR buffer
+      DrawLights(camera);
+
+      glEndQuery(GL_TIME_ELAPSED);
+
+      // Disable blending
+      glDisable(GL_BLEND);
+    });
+  targets.hdr = lighting.hdr;
+
+  // --------------------------------------------------------------------------
+
+  // Read the previous frame's query if it's ready, keep the old value otherwise
+  auto readTimerQuery = [](GLuint query, float &time)
+  {
+    GLint available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available)
+    {
+      GLuint64 elapsed = 0;
+      glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+      time = elapsed * 1e-6f;
+    }
+  };
+
+  if (_frameCount > 0)
+  {
+    readTimerQuery(_gBufferPassQueries[(_frameCount + 1) % 2], _gBufferPassTime);
+    if (_lightPassQueried[(_frameCount + 1) % 2])
+      readTimerQuery(_lightPassQueries[(_frameCount + 1) % 2], _lightPassTime);
+  }
+  ++_frameCount;
+}
+
+void Scene::EndFrame()
+{
+  // The pass ending the measurement may have been culled
+  if (_gBufferQueryActive)
+  {
+    glEndQuery(GL_TIME_ELAPSED);
+    _gBufferQueryActive = false;
+  }
+
+  // All the page requests are written, stream the pages
+  _virtualTexture.EndFrame();
 }
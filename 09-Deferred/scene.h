@@ -6,10 +6,15 @@
 #pragma once
 
 #include <Camera.h>
+#include <DrawCommands.h>
+#include <FrameGraph.h>
 #include <Geometry.h>
+#include <MeshPool.h>
+#include <StaticBatch.h>
 #include <Textures.h>
+#include <VirtualTexture.h>
 
-// Textures we'll be using
+// Textures we'll be using, only the sources of the material texture arrays
 namespace LoadedTextures
 {
   enum
@@ -18,6 +23,26 @@ namespace LoadedTextures
   };
 }
 
+// Materials selected per instance, their layers of the material texture arrays are given by Scene::MaterialData
+namespace Material
+{
+  enum
+  {
+    CheckerBoard, Terracotta, NumMaterials,
+    // Materials from this one on are streamed by the virtual texture if it's available, must match the shaders
+    FirstVirtual = Terracotta
+  };
+}
+
+// Texture arrays holding a single map of all the materials
+namespace MaterialMap
+{
+  enum
+  {
+    Diffuse, Normal, Specular, Occlusion, NumMaps
+  };
+}
+
 namespace DisplayMode
 {
   enum
@@ -26,6 +51,19 @@ namespace DisplayMode
   };
 }
 
+// GBuffer layouts
+namespace GBufferLayout
+{
+  enum
+  {
+    // RGB8 color, RG16F normal.xz, RGB8UI material
+    Default,
+    // RGBA8 color + specularity, RGB10_A2 octahedral normal + occlusion
+    Compact,
+    NumLayouts
+  };
+}
+
 // Render mode structure
 struct RenderMode
 {
@@ -33,24 +71,29 @@ struct RenderMode
   bool vsync;
   // Display mode for presentation
   int displayMode;
+  // Layout of the GBuffer render targets
+  int gBufferLayout;
+  // Fill the GBuffer from the visibility buffer?
+  bool visibilityBuffer;
+  // Draw all meshes with a single VAO pulling the vertices from the mesh pool?
+  bool vertexPulling;
+  // Draw the whole scene with a single multi draw indirect call per pass?
+  bool multiDrawIndirect;
 };
 
-struct RenderTargets
+// Render targets of the scene passes declared in the frame graph, INVALID when not used by the current mode
+struct SceneTargets
 {
-  // Framebuffer object for HDR rendering
-  GLuint hdrFbo = 0;
-  // Framebuffer object for GBuffer rendering
-  GLuint gBufferFbo = 0;
-  // Render target for HDR rendering
-  GLuint hdrRT = 0;
-  // Depth stencil target
-  GLuint depthStencil = 0;
+  // Depth buffer
+  FrameGraph::Resource depth = FrameGraph::INVALID;
   // Diffuse color buffer
-  GLuint colorRT = 0;
+  FrameGraph::Resource color = FrameGraph::INVALID;
   // Normals buffer
-  GLuint normalRT = 0;
-  // Material buffer
-  GLuint materialRT = 0;
+  FrameGraph::Resource normal = FrameGraph::INVALID;
+  // Material buffer, unused by the compact layout
+  FrameGraph::Resource material = FrameGraph::INVALID;
+  // Lit HDR image
+  FrameGraph::Resource hdr = FrameGraph::INVALID;
 };
 
 // Very simple scene abstraction class
@@ -66,17 +109,38 @@ public:
   void Init(int numCubes, int numLights);
   // Updates positions
   void Update(float dt, const Camera &camera);
-  // Draw the scene
-  void Draw(const Camera &camera, const RenderTargets &renderTargets);
+  // Add the GBuffer and light passes to the frame graph, the camera must outlive its execution
+  void AddPasses(const Camera &camera, const RenderMode &renderMode, FrameGraph &frameGraph, SceneTargets &targets);
+  // Finish the frame after the graph has been executed, stream the requested pages
+  void EndFrame();
   // Return the generic VAO for rendering
   GLuint GetGenericVAO() { return _vao; }
+  // Return the GPU time of filling the GBuffer in milliseconds, lags a frame behind
+  float GetGBufferPassTime() { return _gBufferPassTime; }
+  // Return the GPU time of the ambient and light passes in milliseconds, lags a frame behind
+  float GetLightPassTime() { return _lightPassTime; }
+  // Return the virtual texture streaming the large materials
+  const VirtualTexture &GetVirtualTexture() { return _virtualTexture; }
 
 private:
   // GPU data for a single object instance
   struct InstanceData
   {
-    // In this simple example just a transformation matrix, transposed for efficient storage
+    // Transformation matrix, transposed for efficient storage
     glm::mat3x4 transformation;
+    // Layer of the material texture arrays
+    GLuint material;
+    // Pad to vec4 per std140 array stride rules
+    GLuint padding[3];
+  };
+
+  // GPU data for a single material, must match the MaterialBlock in the shaders
+  struct MaterialData
+  {
+    // Layer of each map in its texture array, -1 if the map is a single color
+    GLint layers[MaterialMap::NumMaps];
+    // Colors of the single color maps
+    glm::vec4 constants[MaterialMap::NumMaps];
   };
 
   // GPU data for a single light instance
@@ -101,12 +165,28 @@ private:
     float radius;
   };
 
+  // Per draw data of the multi draw indirect passes, must match the indirect vertex shaders
+  struct DrawData
+  {
+    // Instance buffer index of the first instance of the draw
+    GLuint firstInstance;
+  };
+
+  // Number of quads forming the backdrop
+  static const int BACKGROUND_QUADS = 3;
+
   // Which light set to update and set to instance buffer
   enum class LightSet
   {
     All, Inside, Outside
   };
 
+  // Meshes of the scene, also their entries in the mesh pool
+  enum SceneMesh
+  {
+    Backdrop, Cube, Icosahedron, NumSceneMeshes
+  };
+
   // All is private, instance is created in GetInstance()
   Scene();
   ~Scene();
@@ -114,8 +194,14 @@ private:
   Scene(const Scene &);
   Scene & operator = (const Scene &);
 
-  // Helper function for binding the appropriate textures
-  void BindTextures(const GLuint &diffuse, const GLuint &normal, const GLuint &specular, const GLuint &occlusion);
+  // Return the shader program permutation matching the vertex pulling mode of the current frame
+  GLuint GetProgram(int program);
+  // Bind the VAO for drawing the mesh, its own one or the mesh pool one
+  void BindMesh(SceneMesh mesh);
+  // Draw instances of the mesh, the mesh must be bound
+  void DrawMesh(SceneMesh mesh, GLsizei numInstances);
+  // Helper function for binding the material texture arrays to the first four texture units and the virtual texture
+  void BindMaterials();
   // Helper function for creating and updating the instance data
   void UpdateInstanceData();
   // Helper function for creating and updating light data
@@ -126,15 +212,25 @@ private:
   void DrawBackground();
   // Draw cubes
   void DrawObjects();
+  // Draw the backdrop and cubes with a single multi draw indirect call
+  void DrawSceneIndirect();
   // Draw lights
   void DrawLights(const Camera &camera);
   // Draw the ambient light fullscreen pass
   void DrawAmbientPass();
+  // Draw object and triangle indices of the whole scene into the visibility buffer
+  void DrawVisibility();
+  // Fill the GBuffer from the visibility buffer, one fullscreen pass per material
+  void DrawVisibilityResolve(GLuint visibilityTexture);
 
   // Textures helper instance
   Textures &_textures;
-  // Loaded textures
-  GLuint _loadedTextures[LoadedTextures::NumTextures] = {0};
+  // Texture arrays of the material maps, indexed by the instance material in the shaders
+  GLuint _materialMaps[MaterialMap::NumMaps] = {0};
+  // Uniform buffer with the layers and single colors of the material maps, see MaterialData
+  GLuint _materialBuffer = 0;
+  // Page streamed maps of the materials from Material::FirstVirtual on, a layer per material
+  VirtualTexture _virtualTexture;
   // Number of cubes in the scene
   int _numCubes = 10;
   // Cube positions
@@ -149,16 +245,53 @@ private:
   std::vector<int> _outsideLights;
   // General use VAO
   GLuint _vao = 0;
-  // Quad instance
-  Mesh<Vertex_Pos_Nrm_Tgt_Tex> *_quad = nullptr;
+  // Floor and walls merged into a single world space mesh
+  Mesh<Vertex_Pos_Nrm_Tgt_Tex> *_background = nullptr;
+  // World space bounding box of the backdrop for culling
+  glm::vec3 _backgroundBoundsMin = glm::vec3(0.0f);
+  glm::vec3 _backgroundBoundsMax = glm::vec3(0.0f);
+  // Backdrop intersects the view frustum in the current frame
+  bool _backgroundVisible = true;
   // Cube instance
   Mesh<Vertex_Pos_Nrm_Tgt_Tex> *_cube = nullptr;
   // Icosahedron instance for light rendering
   Mesh<Vertex_Pos> *_icosahedron = nullptr;
+  // VAOs of the meshes for drawing without vertex pulling
+  GLuint _meshVAOs[NumSceneMeshes] = {0};
+  // Number of indices of the meshes for drawing without vertex pulling
+  GLsizei _meshIndices[NumSceneMeshes] = {0};
+  // All the meshes in shared buffers for vertex pulling
+  MeshPool _meshPool;
+  // Draw the meshes pulling the vertices from the mesh pool in the current frame
+  bool _vertexPulling = false;
+  // Draws of the backdrop and cubes, the same for the GBuffer and visibility passes
+  DrawCommandBuffer<DrawData> _sceneDraws;
+  // Draw the whole scene with the multi draw indirect call in the current frame
+  bool _multiDrawIndirect = false;
+  // Backdrop vertex and index buffers as buffer textures for the visibility buffer resolve
+  GLuint _backgroundBufferTextures[2] = {0};
+  // Cube vertex and index buffers as buffer textures for the visibility buffer resolve
+  GLuint _cubeBufferTextures[2] = {0};
   // Instancing buffer handle
   GLuint _instancingBuffer = 0;
   // Light buffer handle
   GLuint _lightBuffer = 0;
   // Transformation matrices uniform buffer object
   GLuint _transformBlockUBO = 0;
+  // GBuffer layout used for the current frame
+  int _gBufferLayout = GBufferLayout::Default;
+  // Timer queries for the GBuffer passes, double buffered so that we don't wait for the results
+  GLuint _gBufferPassQueries[2] = {0};
+  // The GBuffer timer query has been started and not ended yet
+  bool _gBufferQueryActive = false;
+  // Timer queries for the light passes, double buffered as well
+  GLuint _lightPassQueries[2] = {0};
+  // The light passes may be culled, only read the queries which were issued
+  bool _lightPassQueried[2] = {false};
+  // Number of frames drawn, selects the timer query
+  unsigned int _frameCount = 0;
+  // Last measured GBuffer pass GPU time in milliseconds
+  float _gBufferPassTime = 0.0f;
+  // Last measured light pass GPU time in milliseconds
+  float _lightPassTime = 0.0f;
 };
@@ -6,11 +6,26 @@
 #include "shaders.h"
 
 GLuint shaderProgram[ShaderProgram::NumShaderPrograms] = {0};
+GLuint shaderProgramPulling[ShaderProgram::NumShaderPrograms] = {0};
+GLuint shaderProgramIndirect[ShaderProgram::NumShaderPrograms] = {0};
+
+// Defines selecting the compact GBuffer layout permutation of the fragment shaders
+static const char* compactGBufferDefines = "#define COMPACT_GBUFFER\n";
+// Defines enabling the virtual texture in the GBuffer fragment shaders, requires OpenGL 4.3
+static const char* virtualTextureDefines = "#define VIRTUAL_TEXTURE\n";
+static const char* virtualTextureCompactDefines = "#define COMPACT_GBUFFER\n#define VIRTUAL_TEXTURE\n";
+// Defines selecting the vertex pulling permutation of the vertex shaders
+static const char* vertexPullingDefines = "#define VERTEX_PULLING\n";
+// Defines selecting the multi draw indirect permutation of the vertex pulling vertex shaders
+static const char* indirectDrawDefines = "#define VERTEX_PULLING\n#define INDIRECT_DRAW\n";
 
 bool compileShaders()
 {
   GLuint vertexShader[VertexShader::NumVertexShaders] = {0};
+  GLuint vertexShaderPulling[VertexShader::NumVertexShaders] = {0};
   GLuint fragmentShader[FragmentShader::NumFragmentShaders] = {0};
+  GLuint fragmentShaderCompact[FragmentShader::NumFragmentShaders] = {0};
+  GLuint vertexShaderIndirect[VertexShader::NumVertexShaders] = {0};
 
   // Cleanup lambda
   auto cleanUp = [&]()
@@ -28,18 +43,45 @@ bool compileShaders()
           glDetachShader(shaderProgram[i], shaders[j]);
         }
       }
+
+      if (glIsProgram(shaderProgramPulling[i]))
+      {
+        glGetAttachedShaders(shaderProgramPulling[i], 2, &count, shaders);
+        for (GLsizei j = 0; j < count; ++j)
+        {
+          glDetachShader(shaderProgramPulling[i], shaders[j]);
+        }
+      }
+
+      if (glIsProgram(shaderProgramIndirect[i]))
+      {
+        glGetAttachedShaders(shaderProgramIndirect[i], 2, &count, shaders);
+        for (GLsizei j = 0; j < count; ++j)
+        {
+          glDetachShader(shaderProgramIndirect[i], shaders[j]);
+        }
+      }
     }
 
     for (int i = 0; i < VertexShader::NumVertexShaders; ++i)
     {
       if (glIsShader(vertexShader[i]))
         glDeleteShader(vertexShader[i]);
+
+      if (glIsShader(vertexShaderPulling[i]))
+        glDeleteShader(vertexShaderPulling[i]);
+
+      if (glIsShader(vertexShaderIndirect[i]))
+        glDeleteShader(vertexShaderIndirect[i]);
     }
 
     for (int i = 0; i < FragmentShader::NumFragmentShaders; ++i)
     {
       if (glIsShader(fragmentShader[i]))
         glDeleteShader(fragmentShader[i]);
+
+      if (glIsShader(fragmentShaderCompact[i]))
+        glDeleteShader(fragmentShaderCompact[i]);
     }
   };
 
@@ -63,10 +105,11 @@ bool compileShaders()
     }
   }
 
-  // Compile all fragment shaders
+  // Compile all fragment shaders, the GBuffer ones read the streamed materials from the virtual texture if possible
+  const bool virtualTexture = GLAD_GL_VERSION_4_3 != 0;
   for (int i = 0; i < FragmentShader::NumFragmentShaders; ++i)
   {
-    fragmentShader[i] = ShaderCompiler::CompileShader(fsSource, i, GL_FRAGMENT_SHADER);
+    fragmentShader[i] = ShaderCompiler::CompileShader(fsSource, i, GL_FRAGMENT_SHADER, virtualTexture ? virtualTextureDefines : nullptr);
     if (!fragmentShader[i])
     {
       cleanUp();
@@ -74,6 +117,17 @@ bool compileShaders()
     }
   }
 
+  // Compile all fragment shaders again for the compact GBuffer layout
+  for (int i = 0; i < FragmentShader::NumFragmentShaders; ++i)
+  {
+    fragmentShaderCompact[i] = ShaderCompiler::CompileShader(fsSource, i, GL_FRAGMENT_SHADER, virtualTexture ? virtualTextureCompactDefines : compactGBufferDefines);
+    if (!fragmentShaderCompact[i])
+    {
+      cleanUp();
+      return false;
+    }
+  }
+
   // Shader program for non-instanced geometry writing into the GBuffer
   shaderProgram[ShaderProgram::DefaultGBuffer] = glCreateProgram();
   glAttachShader(shaderProgram[ShaderProgram::DefaultGBuffer], vertexShader[VertexShader::Default]);
@@ -143,6 +197,216 @@ bool compileShaders()
     return false;
   }
 
+  // --------------------------------------------------------------------------
+  // Compact GBuffer layout permutations
+  // --------------------------------------------------------------------------
+
+  // Shader program for non-instanced geometry writing into the compact GBuffer
+  shaderProgram[ShaderProgram::DefaultGBufferCompact] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::DefaultGBufferCompact], vertexShader[VertexShader::Default]);
+  glAttachShader(shaderProgram[ShaderProgram::DefaultGBufferCompact], fragmentShaderCompact[FragmentShader::GBuffer]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::DefaultGBufferCompact]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::DefaultGBufferCompact]);
+
+  // Shader program for instanced geometry writing into the compact GBuffer
+  shaderProgram[ShaderProgram::InstancedGBufferCompact] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::InstancedGBufferCompact], vertexShader[VertexShader::Instancing]);
+  glAttachShader(shaderProgram[ShaderProgram::InstancedGBufferCompact], fragmentShaderCompact[FragmentShader::GBuffer]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::InstancedGBufferCompact]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::InstancedGBufferCompact]);
+  uniformBlockBinding(shaderProgram[ShaderProgram::InstancedGBufferCompact], "InstanceBuffer", 1);
+
+  // Shader program for ambient fullscreen light pass reading the compact GBuffer
+  shaderProgram[ShaderProgram::AmbientLightPassCompact] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::AmbientLightPassCompact], vertexShader[VertexShader::ScreenQuad]);
+  glAttachShader(shaderProgram[ShaderProgram::AmbientLightPassCompact], fragmentShaderCompact[FragmentShader::AmbientPass]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::AmbientLightPassCompact]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Shader program for light pass reading the compact GBuffer
+  shaderProgram[ShaderProgram::InstancedLightPassCompact] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::InstancedLightPassCompact], vertexShader[VertexShader::Light]);
+  glAttachShader(shaderProgram[ShaderProgram::InstancedLightPassCompact], fragmentShaderCompact[FragmentShader::LightPass]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::InstancedLightPassCompact]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::InstancedLightPassCompact]);
+  uniformBlockBinding(shaderProgram[ShaderProgram::InstancedLightPassCompact], "InstanceBuffer", 1);
+  uniformBlockBinding(shaderProgram[ShaderProgram::InstancedLightPassCompact], "LightBuffer", 2);
+
+  // Shader program for tonemapping post-process displaying the compact GBuffer
+  shaderProgram[ShaderProgram::TonemappingCompact] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::TonemappingCompact], vertexShader[VertexShader::ScreenQuad]);
+  glAttachShader(shaderProgram[ShaderProgram::TonemappingCompact], fragmentShaderCompact[FragmentShader::Tonemapping]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::TonemappingCompact]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // --------------------------------------------------------------------------
+  // Visibility buffer
+  // --------------------------------------------------------------------------
+
+  // Shader program writing object and triangle indices into the visibility buffer
+  shaderProgram[ShaderProgram::Visibility] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::Visibility], vertexShader[VertexShader::Visibility]);
+  glAttachShader(shaderProgram[ShaderProgram::Visibility], fragmentShader[FragmentShader::Visibility]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::Visibility]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::Visibility]);
+  uniformBlockBinding(shaderProgram[ShaderProgram::Visibility], "InstanceBuffer", 1);
+
+  // Shader program resolving the visibility buffer into the GBuffer
+  shaderProgram[ShaderProgram::VisibilityResolve] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::VisibilityResolve], vertexShader[VertexShader::ScreenQuad]);
+  glAttachShader(shaderProgram[ShaderProgram::VisibilityResolve], fragmentShader[FragmentShader::VisibilityResolve]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::VisibilityResolve]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::VisibilityResolve]);
+  uniformBlockBinding(shaderProgram[ShaderProgram::VisibilityResolve], "InstanceBuffer", 1);
+
+  // Shader program resolving the visibility buffer into the compact GBuffer
+  shaderProgram[ShaderProgram::VisibilityResolveCompact] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::VisibilityResolveCompact], vertexShader[VertexShader::ScreenQuad]);
+  glAttachShader(shaderProgram[ShaderProgram::VisibilityResolveCompact], fragmentShaderCompact[FragmentShader::VisibilityResolve]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::VisibilityResolveCompact]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::VisibilityResolveCompact]);
+  uniformBlockBinding(shaderProgram[ShaderProgram::VisibilityResolveCompact], "InstanceBuffer", 1);
+
+  // --------------------------------------------------------------------------
+  // Vertex pulling
+  // --------------------------------------------------------------------------
+
+  // Shader storage buffers require OpenGL 4.3
+  if (GLAD_GL_VERSION_4_3 == 0)
+  {
+    cleanUp();
+    return true;
+  }
+
+  // Compile the vertex shaders again pulling the vertices from the mesh pool
+  for (int i = 0; i < VertexShader::NumVertexShaders; ++i)
+  {
+    if (i == VertexShader::ScreenQuad)
+      continue;
+
+    vertexShaderPulling[i] = ShaderCompiler::CompileShader(vsSource, i, GL_VERTEX_SHADER, vertexPullingDefines);
+    if (!vertexShaderPulling[i])
+    {
+      cleanUp();
+      return false;
+    }
+  }
+
+  // Programs drawing meshes: program, its vertex shader and fragment shader
+  struct PullingProgram
+  {
+    int program;
+    int vertexShader;
+    GLuint fragmentShader;
+  };
+
+  const PullingProgram pullingPrograms[] =
+  {
+    {ShaderProgram::DefaultGBuffer, VertexShader::Default, fragmentShader[FragmentShader::GBuffer]},
+    {ShaderProgram::InstancedGBuffer, VertexShader::Instancing, fragmentShader[FragmentShader::GBuffer]},
+    {ShaderProgram::InstancedLightPass, VertexShader::Light, fragmentShader[FragmentShader::LightPass]},
+    {ShaderProgram::InstancedLightVis, VertexShader::Light, fragmentShader[FragmentShader::LightColor]},
+    {ShaderProgram::DefaultGBufferCompact, VertexShader::Default, fragmentShaderCompact[FragmentShader::GBuffer]},
+    {ShaderProgram::InstancedGBufferCompact, VertexShader::Instancing, fragmentShaderCompact[FragmentShader::GBuffer]},
+    {ShaderProgram::InstancedLightPassCompact, VertexShader::Light, fragmentShaderCompact[FragmentShader::LightPass]},
+    {ShaderProgram::Visibility, VertexShader::Visibility, fragmentShader[FragmentShader::Visibility]},
+  };
+
+  // Same programs as above with the vertex pulling vertex shaders
+  for (const PullingProgram &pulling : pullingPrograms)
+  {
+    GLuint program = glCreateProgram();
+    shaderProgramPulling[pulling.program] = program;
+    glAttachShader(program, vertexShaderPulling[pulling.vertexShader]);
+    glAttachShader(program, pulling.fragmentShader);
+    if (!ShaderCompiler::LinkProgram(program))
+    {
+      cleanUp();
+      return false;
+    }
+    uniformBlockBinding(program);
+
+    if (pulling.program != ShaderProgram::DefaultGBuffer && pulling.program != ShaderProgram::DefaultGBufferCompact)
+      uniformBlockBinding(program, "InstanceBuffer", 1);
+
+    if (pulling.vertexShader == VertexShader::Light)
+      uniformBlockBinding(program, "LightBuffer", 2);
+  }
+
+  // --------------------------------------------------------------------------
+  // Multi draw indirect
+  // --------------------------------------------------------------------------
+
+  // gl_DrawID requires OpenGL 4.6
+  if (GLAD_GL_VERSION_4_6 == 0)
+  {
+    cleanUp();
+    return true;
+  }
+
+  // Only the GBuffer and visibility passes draw the whole scene
+  vertexShaderIndirect[VertexShader::Instancing] = ShaderCompiler::CompileShader(vsSource, VertexShader::Instancing, GL_VERTEX_SHADER, indirectDrawDefines);
+  vertexShaderIndirect[VertexShader::Visibility] = ShaderCompiler::CompileShader(vsSource, VertexShader::Visibility, GL_VERTEX_SHADER, indirectDrawDefines);
+  if (!vertexShaderIndirect[VertexShader::Instancing] || !vertexShaderIndirect[VertexShader::Visibility])
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Programs drawing the whole scene: program, its vertex shader and fragment shader, materials are selected per
+  // instance, so the regular fragment shaders do
+  const PullingProgram indirectPrograms[] =
+  {
+    {ShaderProgram::InstancedGBuffer, VertexShader::Instancing, fragmentShader[FragmentShader::GBuffer]},
+    {ShaderProgram::InstancedGBufferCompact, VertexShader::Instancing, fragmentShaderCompact[FragmentShader::GBuffer]},
+    {ShaderProgram::Visibility, VertexShader::Visibility, fragmentShader[FragmentShader::Visibility]},
+  };
+
+  for (const PullingProgram &indirect : indirectPrograms)
+  {
+    GLuint program = glCreateProgram();
+    shaderProgramIndirect[indirect.program] = program;
+    glAttachShader(program, vertexShaderIndirect[indirect.vertexShader]);
+    glAttachShader(program, indirect.fragmentShader);
+    if (!ShaderCompiler::LinkProgram(program))
+    {
+      cleanUp();
+      return false;
+    }
+    uniformBlockBinding(program);
+    uniformBlockBinding(program, "InstanceBuffer", 1);
+  }
+
   cleanUp();
   return true;
 }
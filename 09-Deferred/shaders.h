@@ -12,12 +12,23 @@ namespace ShaderProgram
 {
   enum
   {
-    DefaultGBuffer, InstancedGBuffer, AmbientLightPass, InstancedLightPass, InstancedLightVis, Tonemapping, NumShaderPrograms
+    DefaultGBuffer, InstancedGBuffer, AmbientLightPass, InstancedLightPass, InstancedLightVis, Tonemapping,
+    // Permutations using the compact GBuffer layout, see COMPACT_GBUFFER in the fragment shaders
+    DefaultGBufferCompact, InstancedGBufferCompact, AmbientLightPassCompact, InstancedLightPassCompact, TonemappingCompact,
+    // Visibility buffer rendering and its resolve into the GBuffer
+    Visibility, VisibilityResolve, VisibilityResolveCompact,
+    NumShaderPrograms
   };
 }
 
 // Shader programs handle
 extern GLuint shaderProgram[ShaderProgram::NumShaderPrograms];
+// Permutations of the programs drawing meshes pulling the vertices from the mesh pool, see VERTEX_PULLING in the
+// vertex shaders, zero for programs without meshes or if OpenGL 4.3 isn't available
+extern GLuint shaderProgramPulling[ShaderProgram::NumShaderPrograms];
+// Multi draw indirect permutations of the vertex pulling programs drawing the whole scene at once, see INDIRECT_DRAW
+// in the shaders, zero for other programs or if OpenGL 4.6 isn't available
+extern GLuint shaderProgramIndirect[ShaderProgram::NumShaderPrograms];
 
 // Helper function for creating and compiling the shaders
 bool compileShaders();
@@ -29,7 +40,7 @@ namespace VertexShader
 {
   enum
   {
-    Default, Instancing, Light, ScreenQuad, NumVertexShaders
+    Default, Instancing, Light, ScreenQuad, Visibility, NumVertexShaders
   };
 }
 
@@ -47,6 +58,11 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
+#ifdef VERTEX_PULLING
+// The following is not not needed since GLSL version #430
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
 // Uniform blocks, i.e., constants
 layout (std140, binding = 0) uniform TransformBlock
 {
@@ -57,12 +73,38 @@ layout (std140, binding = 0) uniform TransformBlock
 
 // Model to world transformation separately
 layout (location = 0) uniform mat4x3 modelToWorld;
+// Layer of the material texture arrays
+layout (location = 1) uniform uint material;
+
+#ifdef VERTEX_PULLING
+// Vertex buffer of the mesh pool as an array of floats, must match Vertex_Pos_Nrm_Tgt_Tex
+layout (std430, binding = 4) readonly buffer VertexBuffer
+{
+  float vertices[];
+};
 
+// Vertex attributes fetched by PullVertex()
+vec3 position;
+vec3 normal;
+vec3 tangent;
+vec2 texCoord;
+
+// Fetch the vertex attributes, gl_VertexID already includes the base vertex of the mesh
+void PullVertex()
+{
+  int v = gl_VertexID * 11;
+  position = vec3(vertices[v + 0], vertices[v + 1], vertices[v + 2]);
+  normal = vec3(vertices[v + 3], vertices[v + 4], vertices[v + 5]);
+  tangent = vec3(vertices[v + 6], vertices[v + 7], vertices[v + 8]);
+  texCoord = vec2(vertices[v + 9], vertices[v + 10]);
+}
+#else
 // Vertex attribute block, i.e., input
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec3 tangent;
 layout (location = 3) in vec2 texCoord;
+#endif
 
 // Vertex output
 out VertexData
@@ -72,12 +114,18 @@ out VertexData
   vec3 bitangent;
   vec3 normal;
   vec4 worldPos;
+  flat uint material;
 } vOut;
 
 void main()
 {
-  // Pass texture coordinates to the fragment shader
+#ifdef VERTEX_PULLING
+  PullVertex();
+#endif
+
+  // Pass texture coordinates and material to the fragment shader
   vOut.texCoord = texCoord.st;
+  vOut.material = material;
 
   // Construct the normal transformation matrix
   mat3 normalTransform = transpose(inverse(mat3(modelToWorld)));
@@ -108,6 +156,16 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
+#ifdef VERTEX_PULLING
+// The following is not not needed since GLSL version #430
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
+#ifdef INDIRECT_DRAW
+// The following is not not needed since GLSL version #460
+#extension GL_ARB_shader_draw_parameters : require
+#endif
+
 // Uniform blocks, i.e., constants
 layout (std140, binding = 0) uniform TransformBlock
 {
@@ -116,27 +174,67 @@ layout (std140, binding = 0) uniform TransformBlock
   mat4x4 projection;
 };
 
+#ifdef VERTEX_PULLING
+// Vertex buffer of the mesh pool as an array of floats, must match Vertex_Pos_Nrm_Tgt_Tex
+layout (std430, binding = 4) readonly buffer VertexBuffer
+{
+  float vertices[];
+};
+
+// Vertex attributes fetched by PullVertex()
+vec3 position;
+vec3 normal;
+vec3 tangent;
+vec2 texCoord;
+
+// Fetch the vertex attributes, gl_VertexID already includes the base vertex of the mesh
+void PullVertex()
+{
+  int v = gl_VertexID * 11;
+  position = vec3(vertices[v + 0], vertices[v + 1], vertices[v + 2]);
+  normal = vec3(vertices[v + 3], vertices[v + 4], vertices[v + 5]);
+  tangent = vec3(vertices[v + 6], vertices[v + 7], vertices[v + 8]);
+  texCoord = vec2(vertices[v + 9], vertices[v + 10]);
+}
+#else
 // Vertex attribute block, i.e., input
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec3 tangent;
 layout (location = 3) in vec2 texCoord;
+#endif
 
 // Must match the structure on the CPU side
 struct InstanceData
 {
   // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
   mat3x4 modelToWorld;
+  // Layer of the material texture arrays, padded to a whole vec4
+  uint material;
 };
 
 // Uniform buffer used for instances
 layout (std140, binding = 1) uniform InstanceBuffer
 {
   // We are limited to 4096 vec4 registers in total, hence the maximum number of instances
-  // being 1024 meaning we could fit another vec4 worth of data
+  // being 1024 with the material taking the last vec4
   InstanceData instanceBuffer[1024];
 };
 
+#ifdef INDIRECT_DRAW
+// Must match Scene::DrawData on the CPU side
+struct DrawData
+{
+  uint firstInstance;
+};
+
+// Per draw data indexed by gl_DrawIDARB
+layout (std430, binding = 5) readonly buffer DrawDataBuffer
+{
+  DrawData drawData[];
+};
+#endif
+
 // Vertex output
 out VertexData
 {
@@ -145,15 +243,28 @@ out VertexData
   vec3 bitangent;
   vec3 normal;
   vec4 worldPos;
+  flat uint material;
 } vOut;
 
 void main()
 {
-  // Pass texture coordinates to the fragment shader
+#ifdef VERTEX_PULLING
+  PullVertex();
+#endif
+
+#ifdef INDIRECT_DRAW
+  // Instances of the draw follow its first instance in the instance buffer
+  int instance = int(drawData[gl_DrawIDARB].firstInstance) + gl_InstanceID;
+#else
+  int instance = gl_InstanceID;
+#endif
+
+  // Pass texture coordinates and material to the fragment shader
   vOut.texCoord = texCoord.st;
+  vOut.material = instanceBuffer[instance].material;
 
   // Retrieve the model to world matrix from the instance buffer
-  mat3x4 modelToWorld = instanceBuffer[gl_InstanceID].modelToWorld;
+  mat3x4 modelToWorld = instanceBuffer[instance].modelToWorld;
 
   // Construct the normal transformation matrix
   mat3 normalTransform = transpose(inverse(mat3(modelToWorld)));
@@ -183,6 +294,11 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
+#ifdef VERTEX_PULLING
+// The following is not not needed since GLSL version #430
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
 // Uniform blocks, i.e., constants
 layout (std140, binding = 0) uniform TransformBlock
 {
@@ -191,21 +307,41 @@ layout (std140, binding = 0) uniform TransformBlock
   mat4x4 projection;
 };
 
+#ifdef VERTEX_PULLING
+// Vertex buffer of the mesh pool as an array of floats, must match Vertex_Pos
+layout (std430, binding = 0) readonly buffer VertexBuffer
+{
+  float vertices[];
+};
+
+// Vertex position fetched by PullVertex()
+vec3 position;
+
+// Fetch the vertex position, gl_VertexID already includes the base vertex of the mesh
+void PullVertex()
+{
+  int v = gl_VertexID * 3;
+  position = vec3(vertices[v + 0], vertices[v + 1], vertices[v + 2]);
+}
+#else
 // Vertex attribute block, i.e., input
 layout (location = 0) in vec3 position;
+#endif
 
 // Must match the structure on the CPU side
 struct InstanceData
 {
   // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
   mat3x4 modelToWorld;
+  // Layer of the material texture arrays, padded to a whole vec4
+  uint material;
 };
 
 // Uniform buffer used for instances
 layout (std140, binding = 1) uniform InstanceBuffer
 {
   // We are limited to 4096 vec4 registers in total, hence the maximum number of instances
-  // being 1024 meaning we could fit another vec4 worth of data
+  // being 1024 with the material taking the last vec4
   InstanceData instanceBuffer[1024];
 };
 
@@ -225,6 +361,10 @@ out VertexData
 
 void main()
 {
+#ifdef VERTEX_PULLING
+  PullVertex();
+#endif
+
   // Pass in the instance ID to FS
   vOut.lightID = gl_InstanceID;
 
@@ -273,6 +413,118 @@ void main()
   gl_Position = vec4(position[gl_VertexID].xyz, 1.0f);
 }
 )",
+// ----------------------------------------------------------------------------
+// Visibility buffer vertex shader, all objects are stored in the instance buffer
+// ----------------------------------------------------------------------------
+R"(
+#version 330 core
+
+// The following is not not needed since GLSL version #430
+#extension GL_ARB_explicit_uniform_location : require
+
+// The following is not not needed since GLSL version #420
+#extension GL_ARB_shading_language_420pack : require
+
+#ifdef VERTEX_PULLING
+// The following is not not needed since GLSL version #430
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
+#ifdef INDIRECT_DRAW
+// The following is not not needed since GLSL version #460
+#extension GL_ARB_shader_draw_parameters : require
+#endif
+
+// Uniform blocks, i.e., constants
+layout (std140, binding = 0) uniform TransformBlock
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  mat3x4 worldToView;
+  mat4x4 projection;
+};
+
+#ifdef VERTEX_PULLING
+// Vertex buffer of the mesh pool as an array of floats, must match Vertex_Pos_Nrm_Tgt_Tex
+layout (std430, binding = 4) readonly buffer VertexBuffer
+{
+  float vertices[];
+};
+
+// Vertex position fetched by PullVertex()
+vec3 position;
+
+// Fetch the vertex position, gl_VertexID already includes the base vertex of the mesh
+void PullVertex()
+{
+  int v = gl_VertexID * 11;
+  position = vec3(vertices[v + 0], vertices[v + 1], vertices[v + 2]);
+}
+#else
+// Vertex attribute block, i.e., input
+layout (location = 0) in vec3 position;
+#endif
+
+// Must match the structure on the CPU side
+struct InstanceData
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  mat3x4 modelToWorld;
+  // Layer of the material texture arrays, padded to a whole vec4
+  uint material;
+};
+
+// Uniform buffer used for instances
+layout (std140, binding = 1) uniform InstanceBuffer
+{
+  // We are limited to 4096 vec4 registers in total, hence the maximum number of instances
+  // being 1024 with the material taking the last vec4
+  InstanceData instanceBuffer[1024];
+};
+
+#ifdef INDIRECT_DRAW
+// Must match Scene::DrawData on the CPU side
+struct DrawData
+{
+  uint firstInstance;
+};
+
+// Per draw data indexed by gl_DrawIDARB
+layout (std430, binding = 5) readonly buffer DrawDataBuffer
+{
+  DrawData drawData[];
+};
+#else
+// Index of the first object of this draw call in the instance buffer
+layout (location = 0) uniform int objectOffset;
+#endif
+
+// Object index for the visibility buffer, interpolation makes no sense
+flat out uint objectID;
+
+void main()
+{
+#ifdef VERTEX_PULLING
+  PullVertex();
+#endif
+
+  // Each instance is a separate object
+#ifdef INDIRECT_DRAW
+  int object = int(drawData[gl_DrawIDARB].firstInstance) + gl_InstanceID;
+#else
+  int object = objectOffset + gl_InstanceID;
+#endif
+  objectID = uint(object);
+
+  // Retrieve the model to world matrix from the instance buffer
+  mat3x4 modelToWorld = instanceBuffer[object].modelToWorld;
+
+  // Transform vertex position, note we multiply from the left because of transposed modelToWorld
+  vec4 worldPos = vec4(vec4(position.xyz, 1.0f) * modelToWorld, 1.0f);
+  vec4 viewPos = vec4(worldPos * worldToView, 1.0f);
+
+  gl_Position = projection * viewPos;
+}
+)",
 ""};
 
 // ============================================================================
@@ -282,7 +534,7 @@ namespace FragmentShader
 {
   enum
   {
-    GBuffer, AmbientPass, LightPass, LightColor, Tonemapping, NumFragmentShaders
+    GBuffer, AmbientPass, LightPass, LightColor, Tonemapping, Visibility, VisibilityResolve, NumFragmentShaders
   };
 }
 
@@ -297,11 +549,100 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
-// Texture sampler
-layout (binding = 0) uniform sampler2D Diffuse;
-layout (binding = 1) uniform sampler2D Normal;
-layout (binding = 2) uniform sampler2D Specular;
-layout (binding = 3) uniform sampler2D Occlusion;
+#ifdef VIRTUAL_TEXTURE
+// The following is not not needed since GLSL version #420
+#extension GL_ARB_shader_image_load_store : require
+
+// Image stores would disable the early depth test otherwise
+layout (early_fragment_tests) in;
+#endif
+
+// Material texture arrays, a layer per material unless its map is a single color
+layout (binding = 0) uniform sampler2DArray Diffuse;
+layout (binding = 1) uniform sampler2DArray Normal;
+layout (binding = 2) uniform sampler2DArray Specular;
+layout (binding = 3) uniform sampler2DArray Occlusion;
+
+// Must match Scene::MaterialData on the CPU side
+struct MaterialData
+{
+  // Layers of the diffuse, normal, specular and occlusion maps, negative for the single color ones
+  ivec4 layers;
+  // Colors of the single color maps
+  vec4 constants[4];
+};
+
+// Layers and single colors of the maps of all materials, must match Material::NumMaterials
+layout (std140, binding = 4) uniform MaterialBlock
+{
+  MaterialData materials[2];
+};
+
+#ifdef VIRTUAL_TEXTURE
+// Page cache atlases of the material maps and the page table, see VirtualTexture
+layout (binding = 8) uniform sampler2D VirtualDiffuse;
+layout (binding = 9) uniform sampler2D VirtualNormal;
+layout (binding = 10) uniform sampler2D VirtualSpecular;
+layout (binding = 11) uniform sampler2D VirtualOcclusion;
+layout (binding = 12) uniform usampler2DArray PageTable;
+
+// Requested pages at a reduced resolution
+layout (binding = 0, r32ui) uniform writeonly uimage2D Feedback;
+
+// Must match VirtualTexture::ShaderData on the CPU side
+layout (std140, binding = 3) uniform VirtualTextureBlock
+{
+  // Feedback pixel written within each block this frame, feedback scale, number of mip levels or zero if disabled
+  ivec4 vtFeedback;
+  // Pages per side of the finest level, page size and its border in texels, atlas size in texels
+  ivec4 vtLayout;
+};
+
+// Materials from this one on are streamed by the virtual texture, must match Material::FirstVirtual
+const uint FIRST_VIRTUAL_MATERIAL = 1u;
+
+// Request the page needed for the texture coordinates and return the atlas coordinates of its closest resident
+// ancestor, the gradients are converted to the atlas as well
+vec2 VirtualLookup(int layer, vec2 texCoord, inout vec2 dx, inout vec2 dy)
+{
+  int numLevels = vtFeedback.w;
+  int numPages = vtLayout.x;
+  float tileSize = float(vtLayout.y);
+  float tileBorder = float(vtLayout.z);
+  float atlasSize = float(vtLayout.w);
+
+  // Mip level from the gradients in texels of the finest level, rounded down to get enough detail
+  vec2 tx = dx * float(numPages) * tileSize;
+  vec2 ty = dy * float(numPages) * tileSize;
+  float lod = 0.5f * log2(max(max(dot(tx, tx), dot(ty, ty)), 1e-8f));
+  int level = clamp(int(floor(lod)), 0, numLevels - 1);
+
+  // The texture repeats, page of the requested level
+  vec2 uv = fract(texCoord);
+  int levelPages = numPages >> level;
+  ivec2 page = min(ivec2(uv * float(levelPages)), ivec2(levelPages - 1));
+
+  // Just a single pixel of each feedback block writes the request, a different one every frame
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  if (all(equal(pixel % vtFeedback.z, vtFeedback.xy)))
+  {
+    uint request = (uint(layer) << 28) | (uint(level) << 24) | (uint(page.y) << 12) | uint(page.x);
+    imageStore(Feedback, pixel / vtFeedback.z, uvec4(request));
+  }
+
+  // Pages which aren't resident point to their closest resident ancestor: atlas slot and its level
+  uvec4 entry = texelFetch(PageTable, ivec3(page, layer), level);
+  float residentPages = float(numPages >> int(entry.z));
+  vec2 inPage = fract(uv * residentPages);
+
+  // Gradients scale from the whole virtual texture to a single page of the resident level in the atlas
+  float scale = residentPages * tileSize / atlasSize;
+  dx *= scale;
+  dy *= scale;
+
+  return (vec2(entry.xy) * (tileSize + 2.0f * tileBorder) + tileBorder + inPage * tileSize) / atlasSize;
+}
+#endif
 
 // Fragment shader inputs
 in VertexData
@@ -311,20 +652,58 @@ in VertexData
   vec3 bitangent;
   vec3 normal;
   vec4 worldPos;
+  flat uint material;
 } vIn;
 
 // Fragment shader outputs
+#ifdef COMPACT_GBUFFER
+layout (location = 0) out vec4 oColor;  // albedo, specularity
+layout (location = 1) out vec4 oNormal; // octahedral normal, occlusion
+#else
 layout (location = 0) out vec3 oColor;
 layout (location = 1) out vec2 oNormal;
 layout (location = 2) out uvec3 oMaterial;
+#endif
+
+#ifdef COMPACT_GBUFFER
+// Octahedral normal encoding, maps the unit sphere onto the [0, 1]^2 square
+vec2 EncodeNormal(vec3 n)
+{
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  vec2 wrap = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+  vec2 e = n.z >= 0.0f ? n.xy : wrap;
+  return e * 0.5f + 0.5f;
+}
+#endif
 
 void main()
 {
-  // Sample textures
-  vec3 albedo = texture(Diffuse, vIn.texCoord.st).rgb;
-  vec3 noSample = texture(Normal, vIn.texCoord.st).rgb;
-  float specSample = texture(Specular, vIn.texCoord.st).r;
-  float occlusion = texture(Occlusion, vIn.texCoord.st).r;
+  vec3 albedo, noSample;
+  float specSample, occlusion;
+#ifdef VIRTUAL_TEXTURE
+  // Derivatives outside of the branch, the material is the same for the whole primitive anyway
+  vec2 dx = dFdx(vIn.texCoord.st);
+  vec2 dy = dFdy(vIn.texCoord.st);
+  if (vIn.material >= FIRST_VIRTUAL_MATERIAL && vtFeedback.w > 0)
+  {
+    // Sample textures from the resident pages
+    vec2 atlasCoord = VirtualLookup(int(vIn.material - FIRST_VIRTUAL_MATERIAL), vIn.texCoord.st, dx, dy);
+    albedo = textureGrad(VirtualDiffuse, atlasCoord, dx, dy).rgb;
+    noSample = textureGrad(VirtualNormal, atlasCoord, dx, dy).rgb;
+    specSample = textureGrad(VirtualSpecular, atlasCoord, dx, dy).r;
+    occlusion = textureGrad(VirtualOcclusion, atlasCoord, dx, dy).r;
+  }
+  else
+#endif
+  {
+    // Sample textures from the layers of the material, single color maps are constants
+    MaterialData m = materials[vIn.material];
+    vec2 texCoord = vIn.texCoord.st;
+    albedo = m.layers.x < 0 ? m.constants[0].rgb : texture(Diffuse, vec3(texCoord, float(m.layers.x))).rgb;
+    noSample = m.layers.y < 0 ? m.constants[1].rgb : texture(Normal, vec3(texCoord, float(m.layers.y))).rgb;
+    specSample = m.layers.z < 0 ? m.constants[2].r : texture(Specular, vec3(texCoord, float(m.layers.z))).r;
+    occlusion = m.layers.w < 0 ? m.constants[3].r : texture(Occlusion, vec3(texCoord, float(m.layers.w))).r;
+  }
 
   // Calculate world-space normal
   mat3 STN = {vIn.tangent, vIn.bitangent, vIn.normal};
@@ -332,12 +711,18 @@ void main()
 
   // Just output the material properties into the GBuffer:
   // everything that we'll need to calculate lighting later on
+#ifdef COMPACT_GBUFFER
+  // Material is packed next to the albedo and the normal, no separate target needed
+  oColor = vec4(albedo, specSample);
+  oNormal = vec4(EncodeNormal(normal), occlusion, 0.0f);
+#else
   oColor = albedo;
   oNormal = normal.xz;
 
   // Pass information about normal orientation, just a single bit, 7 others free to use
   uint bitFlags = normal.y < 0.0f ? 1u : 0u;
   oMaterial = uvec3(specSample * 255.0f, occlusion * 255.0f, bitFlags);
+#endif
 }
 )",
 // ----------------------------------------------------------------------------
@@ -371,7 +756,11 @@ void main()
 
   // Fetch the required GBuffer data
   vec3 albedo = texelFetch(Color, texel, 0).rgb;
+#ifdef COMPACT_GBUFFER
+  float occlusion = texelFetch(Normals, texel, 0).b;
+#else
   float occlusion = texelFetch(Material, texel, 0).g / 255.0f;
+#endif
 
   // We're calculating here just the ambient light contribution to the scene,
   // but we could calculate directional light here as well
@@ -428,6 +817,19 @@ uniform vec2 NEAR_FAR;
 // Output color
 out vec4 oColor;
 
+#ifdef COMPACT_GBUFFER
+// Octahedral normal decoding, inverse of the encoding in the GBuffer shader
+vec3 DecodeNormal(vec2 e)
+{
+  e = e * 2.0f - 1.0f;
+  vec3 n = vec3(e.xy, 1.0f - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  return normalize(n);
+}
+#endif
+
 void main()
 {
   ivec2 texel = ivec2(gl_FragCoord.xy);
@@ -443,6 +845,30 @@ void main()
   // World space viewing direction
   vec3 viewDirWS = -normalize(vIn.viewRayWS);
 
+  // Calculate the lighting direction and distance
+  vec3 lightDirWS = lightBuffer[vIn.lightID].positionWS.xyz - posWS;
+  float distSq = dot(lightDirWS, lightDirWS);
+  float dist = sqrt(distSq);
+  lightDirWS /= dist;
+
+  // Poor man's depth bounds test: light volume rasterization covers pixels far in front or behind
+  // the light, especially for volumes containing the camera, skip the GBuffer reads and shading there
+  float radius = lightBuffer[vIn.lightID].positionWS.w;
+  if (dist >= 0.9f * radius)
+    discard;
+
+  // Need to make sure that distance function gets to 0 before leaving light volume
+  float attenuation = 1.0f - smoothstep(0.66f * radius, 0.9f * radius, dist);
+
+#ifdef COMPACT_GBUFFER
+  // Decode the world space normal
+  vec3 normalWS = DecodeNormal(texelFetch(Normals, texel, 0).rg);
+
+  // Fetch albedo and specularity with a single read
+  vec4 colorSample = texelFetch(Color, texel, 0);
+  vec3 albedo = colorSample.rgb;
+  float specularity = colorSample.a;
+#else
   // Reconstruct the world space normal
   vec2 n = texelFetch(Normals, texel, 0).rg;
   uint bitFlags = texelFetch(Material, texel, 0).b;
@@ -452,16 +878,7 @@ void main()
   // Fetch albedo and specularity
   vec3 albedo = texelFetch(Color, texel, 0).rgb;
   float specularity = texelFetch(Material, texel, 0).r / 255.0f;
-
-  // Calculate the lighting direction and distance
-  vec3 lightDirWS = lightBuffer[vIn.lightID].positionWS.xyz - posWS;
-  float distSq = dot(lightDirWS, lightDirWS);
-  float dist = sqrt(distSq);
-  lightDirWS /= dist;
-
-  // Need to make sure that distance function gets to 0 before leaving light volume
-  float radius = lightBuffer[vIn.lightID].positionWS.w;
-  float attenuation = 1.0f - smoothstep(0.66f * radius, 0.9f * radius, dist);
+#endif
 
   // Calculate the halfway direction vector (cheaper approximation of
   // the reflected direction = reflect(-lightDirWS, normal)
@@ -552,6 +969,19 @@ vec3 ApplyTonemapping(vec3 hdr)
   return result;
 }
 
+#ifdef COMPACT_GBUFFER
+// Octahedral normal decoding, inverse of the encoding in the GBuffer shader
+vec3 DecodeNormal(vec2 e)
+{
+  e = e * 2.0f - 1.0f;
+  vec3 n = vec3(e.xy, 1.0f - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  return normalize(n);
+}
+#endif
+
 void main()
 {
   // Get the fragment position
@@ -587,21 +1017,33 @@ void main()
   else if (MODE == 3)
   {
     // Reconstruct world space normal and display it
+#ifdef COMPACT_GBUFFER
+    vec3 normal = DecodeNormal(texelFetch(Normals, texel, 0).rg);
+#else
     vec2 n = texelFetch(Normals, texel, 0).rg;
     uint bitFlags = texelFetch(Material, texel, 0).b;
     float y = (bitFlags == 1u ? -1.0f : 1.0f) * sqrt(max(1e-5, 1.0f - dot(n, n)));
     vec3 normal = vec3(n.r, y, n.g);
+#endif
     finalColor = normal * 0.5f + 0.5f;
   }
   else if (MODE == 4)
   {
     // Fetch the material specularity value and display it
+#ifdef COMPACT_GBUFFER
+    finalColor = texelFetch(Color, texel, 0).aaa;
+#else
     finalColor = texelFetch(Material, texel, 0).rrr / 255.0f;
+#endif
   }
   else if (MODE == 5)
   {
     // Fetch the material occlusion value and display it
+#ifdef COMPACT_GBUFFER
+    finalColor = texelFetch(Normals, texel, 0).bbb;
+#else
     finalColor = texelFetch(Material, texel, 0).ggg / 255.0f;
+#endif
   }
   else
   {
@@ -612,4 +1054,296 @@ void main()
   color = vec4(finalColor.rgb, 1.0f);
 }
 )",
+// ----------------------------------------------------------------------------
+// Visibility buffer fragment shader
+// ----------------------------------------------------------------------------
+R"(
+#version 330 core
+
+// Object index from the vertex shader
+flat in uint objectID;
+
+// Single 32 bit output
+layout (location = 0) out uint oVisibility;
+
+void main()
+{
+  // Object index in the upper 12 bits, triangle index within the mesh in the lower 20 bits
+  oVisibility = (objectID << 20) | (uint(gl_PrimitiveID) & 0xFFFFFu);
+}
+)",
+// ----------------------------------------------------------------------------
+// Visibility buffer resolve fragment shader, fills the GBuffer for a single mesh
+// ----------------------------------------------------------------------------
+R"(
+#version 330 core
+
+// The following is not not needed since GLSL version #430
+#extension GL_ARB_explicit_uniform_location : require
+
+// The following is not not needed since GLSL version #420
+#extension GL_ARB_shading_language_420pack : require
+
+#ifdef VIRTUAL_TEXTURE
+// The following is not not needed since GLSL version #420
+#extension GL_ARB_shader_image_load_store : require
+#endif
+
+// Uniform blocks, i.e., constants
+layout (std140, binding = 0) uniform TransformBlock
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  mat3x4 worldToView;
+  mat4x4 projection;
+};
+
+// Must match the structure on the CPU side
+struct InstanceData
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  mat3x4 modelToWorld;
+  // Layer of the material texture arrays, padded to a whole vec4
+  uint material;
+};
+
+// Uniform buffer used for instances
+layout (std140, binding = 1) uniform InstanceBuffer
+{
+  // We are limited to 4096 vec4 registers in total, hence the maximum number of instances
+  // being 1024 with the material taking the last vec4
+  InstanceData instanceBuffer[1024];
+};
+
+// Material texture arrays, a layer per material unless its map is a single color
+layout (binding = 0) uniform sampler2DArray Diffuse;
+layout (binding = 1) uniform sampler2DArray Normal;
+layout (binding = 2) uniform sampler2DArray Specular;
+layout (binding = 3) uniform sampler2DArray Occlusion;
+
+// Must match Scene::MaterialData on the CPU side
+struct MaterialData
+{
+  // Layers of the diffuse, normal, specular and occlusion maps, negative for the single color ones
+  ivec4 layers;
+  // Colors of the single color maps
+  vec4 constants[4];
+};
+
+// Layers and single colors of the maps of all materials, must match Material::NumMaterials
+layout (std140, binding = 4) uniform MaterialBlock
+{
+  MaterialData materials[2];
+};
+
+#ifdef VIRTUAL_TEXTURE
+// Page cache atlases of the material maps and the page table, see VirtualTexture
+layout (binding = 8) uniform sampler2D VirtualDiffuse;
+layout (binding = 9) uniform sampler2D VirtualNormal;
+layout (binding = 10) uniform sampler2D VirtualSpecular;
+layout (binding = 11) uniform sampler2D VirtualOcclusion;
+layout (binding = 12) uniform usampler2DArray PageTable;
+
+// Requested pages at a reduced resolution
+layout (binding = 0, r32ui) uniform writeonly uimage2D Feedback;
+
+// Must match VirtualTexture::ShaderData on the CPU side
+layout (std140, binding = 3) uniform VirtualTextureBlock
+{
+  // Feedback pixel written within each block this frame, feedback scale, number of mip levels or zero if disabled
+  ivec4 vtFeedback;
+  // Pages per side of the finest level, page size and its border in texels, atlas size in texels
+  ivec4 vtLayout;
+};
+
+// Materials from this one on are streamed by the virtual texture, must match Material::FirstVirtual
+const uint FIRST_VIRTUAL_MATERIAL = 1u;
+
+// Request the page needed for the texture coordinates and return the atlas coordinates of its closest resident
+// ancestor, the gradients are converted to the atlas as well
+vec2 VirtualLookup(int layer, vec2 texCoord, inout vec2 dx, inout vec2 dy)
+{
+  int numLevels = vtFeedback.w;
+  int numPages = vtLayout.x;
+  float tileSize = float(vtLayout.y);
+  float tileBorder = float(vtLayout.z);
+  float atlasSize = float(vtLayout.w);
+
+  // Mip level from the gradients in texels of the finest level, rounded down to get enough detail
+  vec2 tx = dx * float(numPages) * tileSize;
+  vec2 ty = dy * float(numPages) * tileSize;
+  float lod = 0.5f * log2(max(max(dot(tx, tx), dot(ty, ty)), 1e-8f));
+  int level = clamp(int(floor(lod)), 0, numLevels - 1);
+
+  // The texture repeats, page of the requested level
+  vec2 uv = fract(texCoord);
+  int levelPages = numPages >> level;
+  ivec2 page = min(ivec2(uv * float(levelPages)), ivec2(levelPages - 1));
+
+  // Just a single pixel of each feedback block writes the request, a different one every frame
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  if (all(equal(pixel % vtFeedback.z, vtFeedback.xy)))
+  {
+    uint request = (uint(layer) << 28) | (uint(level) << 24) | (uint(page.y) << 12) | uint(page.x);
+    imageStore(Feedback, pixel / vtFeedback.z, uvec4(request));
+  }
+
+  // Pages which aren't resident point to their closest resident ancestor: atlas slot and its level
+  uvec4 entry = texelFetch(PageTable, ivec3(page, layer), level);
+  float residentPages = float(numPages >> int(entry.z));
+  vec2 inPage = fract(uv * residentPages);
+
+  // Gradients scale from the whole virtual texture to a single page of the resident level in the atlas
+  float scale = residentPages * tileSize / atlasSize;
+  dx *= scale;
+  dy *= scale;
+
+  return (vec2(entry.xy) * (tileSize + 2.0f * tileBorder) + tileBorder + inPage * tileSize) / atlasSize;
+}
+#endif
+// Object and triangle indices
+layout (binding = 4) uniform usampler2D Visibility;
+// Vertex buffer of the mesh as an array of floats, must match Vertex_Pos_Nrm_Tgt_Tex
+layout (binding = 5) uniform samplerBuffer Vertices;
+// Index buffer of the mesh
+layout (binding = 6) uniform usamplerBuffer Indices;
+
+// Objects sharing this mesh: first object, number of objects
+layout (location = 0) uniform ivec2 objectRange;
+
+// Fragment shader outputs
+#ifdef COMPACT_GBUFFER
+layout (location = 0) out vec4 oColor;  // albedo, specularity
+layout (location = 1) out vec4 oNormal; // octahedral normal, occlusion
+#else
+layout (location = 0) out vec3 oColor;
+layout (location = 1) out vec2 oNormal;
+layout (location = 2) out uvec3 oMaterial;
+#endif
+
+// Number of floats per vertex
+const int VERTEX_STRIDE = 11;
+
+#ifdef COMPACT_GBUFFER
+// Octahedral normal encoding, maps the unit sphere onto the [0, 1]^2 square
+vec2 EncodeNormal(vec3 n)
+{
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  vec2 wrap = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+  vec2 e = n.z >= 0.0f ? n.xy : wrap;
+  return e * 0.5f + 0.5f;
+}
+#endif
+
+// Perspective correct barycentric coordinates of the NDC point p within the triangle given by clip space vertices
+vec3 Barycentrics(vec2 p, vec4 c0, vec4 c1, vec4 c2)
+{
+  vec2 e1 = c1.xy / c1.w - c0.xy / c0.w;
+  vec2 e2 = c2.xy / c2.w - c0.xy / c0.w;
+  vec2 v = p - c0.xy / c0.w;
+
+  // Screen space barycentrics
+  float d = e1.x * e2.y - e1.y * e2.x;
+  float u = (v.x * e2.y - v.y * e2.x) / d;
+  float w = (e1.x * v.y - e1.y * v.x) / d;
+
+  // Attributes are linear in screen space only after the division by w
+  vec3 b = vec3(1.0f - u - w, u, w) / vec3(c0.w, c1.w, c2.w);
+  return b / (b.x + b.y + b.z);
+}
+
+void main()
+{
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+
+  // Skip empty pixels and objects of other meshes
+  uint id = texelFetch(Visibility, texel, 0).r;
+  int object = int(id >> 20);
+  if (id == 0xFFFFFFFFu || object < objectRange.x || object >= objectRange.x + objectRange.y)
+    discard;
+
+  int triangle = int(id & 0xFFFFFu);
+
+  // Retrieve the model to world matrix from the instance buffer
+  mat3x4 modelToWorld = instanceBuffer[object].modelToWorld;
+
+  // Construct the normal transformation matrix
+  mat3 normalTransform = transpose(inverse(mat3(modelToWorld)));
+
+  // Fetch and transform the triangle vertices, the same way the instancing vertex shader does
+  vec4 clipPos[3];
+  vec3 normals[3];
+  vec3 tangents[3];
+  vec2 texCoords[3];
+  for (int i = 0; i < 3; ++i)
+  {
+    int v = int(texelFetch(Indices, 3 * triangle + i).r) * VERTEX_STRIDE;
+    vec3 position = vec3(texelFetch(Vertices, v + 0).r, texelFetch(Vertices, v + 1).r, texelFetch(Vertices, v + 2).r);
+    vec3 normal = vec3(texelFetch(Vertices, v + 3).r, texelFetch(Vertices, v + 4).r, texelFetch(Vertices, v + 5).r);
+    vec3 tangent = vec3(texelFetch(Vertices, v + 6).r, texelFetch(Vertices, v + 7).r, texelFetch(Vertices, v + 8).r);
+    texCoords[i] = vec2(texelFetch(Vertices, v + 9).r, texelFetch(Vertices, v + 10).r);
+
+    vec4 worldPos = vec4(vec4(position, 1.0f) * modelToWorld, 1.0f);
+    clipPos[i] = projection * vec4(worldPos * worldToView, 1.0f);
+    normals[i] = normalize(normal * normalTransform);
+    tangents[i] = normalize(tangent * mat3(modelToWorld));
+  }
+
+  // Barycentrics for this pixel and its right and top neighbours for the texture gradients
+  vec2 pixelSize = 2.0f / vec2(textureSize(Visibility, 0));
+  vec2 p = gl_FragCoord.xy * pixelSize - 1.0f;
+  vec3 b = Barycentrics(p, clipPos[0], clipPos[1], clipPos[2]);
+  vec3 bx = Barycentrics(p + vec2(pixelSize.x, 0.0f), clipPos[0], clipPos[1], clipPos[2]);
+  vec3 by = Barycentrics(p + vec2(0.0f, pixelSize.y), clipPos[0], clipPos[1], clipPos[2]);
+
+  // Interpolate the attributes
+  mat3x2 uv = mat3x2(texCoords[0], texCoords[1], texCoords[2]);
+  vec2 texCoord = uv * b;
+  vec2 dx = uv * bx - texCoord;
+  vec2 dy = uv * by - texCoord;
+  vec3 vNormal = normalize(mat3(normals[0], normals[1], normals[2]) * b);
+  vec3 vTangent = normalize(mat3(tangents[0], tangents[1], tangents[2]) * b);
+  vec3 vBitangent = cross(vTangent, vNormal);
+
+  // Sample textures of the object material, just once per pixel
+  uint material = instanceBuffer[object].material;
+  vec3 albedo, noSample;
+  float specSample, occlusion;
+#ifdef VIRTUAL_TEXTURE
+  if (material >= FIRST_VIRTUAL_MATERIAL && vtFeedback.w > 0)
+  {
+    // Sample textures from the resident pages
+    vec2 atlasCoord = VirtualLookup(int(material - FIRST_VIRTUAL_MATERIAL), texCoord, dx, dy);
+    albedo = textureGrad(VirtualDiffuse, atlasCoord, dx, dy).rgb;
+    noSample = textureGrad(VirtualNormal, atlasCoord, dx, dy).rgb;
+    specSample = textureGrad(VirtualSpecular, atlasCoord, dx, dy).r;
+    occlusion = textureGrad(VirtualOcclusion, atlasCoord, dx, dy).r;
+  }
+  else
+#endif
+  {
+    // Sample textures from the layers of the material, single color maps are constants
+    MaterialData m = materials[material];
+    albedo = m.layers.x < 0 ? m.constants[0].rgb : textureGrad(Diffuse, vec3(texCoord, float(m.layers.x)), dx, dy).rgb;
+    noSample = m.layers.y < 0 ? m.constants[1].rgb : textureGrad(Normal, vec3(texCoord, float(m.layers.y)), dx, dy).rgb;
+    specSample = m.layers.z < 0 ? m.constants[2].r : textureGrad(Specular, vec3(texCoord, float(m.layers.z)), dx, dy).r;
+    occlusion = m.layers.w < 0 ? m.constants[3].r : textureGrad(Occlusion, vec3(texCoord, float(m.layers.w)), dx, dy).r;
+  }
+
+  // Calculate world-space normal
+  mat3 STN = {vTangent, vBitangent, vNormal};
+  vec3 normal = STN * (noSample * 2.0f - 1.0f);
+
+  // Output the same data as the GBuffer shader
+#ifdef COMPACT_GBUFFER
+  oColor = vec4(albedo, specSample);
+  oNormal = vec4(EncodeNormal(normal), occlusion, 0.0f);
+#else
+  oColor = albedo;
+  oNormal = normal.xz;
+
+  uint bitFlags = normal.y < 0.0f ? 1u : 0u;
+  oMaterial = uvec3(specSample * 255.0f, occlusion * 255.0f, bitFlags);
+#endif
+}
+)",
 ""};
@@ -0,0 +1,307 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+// Console checks and benchmarks of the CPU side mesh processing in Geometry, no OpenGL context is needed, returns
+// the number of failed checks
+
+#include <Geometry.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// Number of failed checks
+static int failures = 0;
+
+// Report the result of a single check
+static void check(bool passed, const char *name)
+{
+  printf("[%s] %s\n", passed ? " OK " : "FAIL", name);
+  if (!passed)
+    ++failures;
+}
+
+// Time elapsed since start in milliseconds
+static double elapsed(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// ----------------------------------------------------------------------------
+// Adjacency
+// ----------------------------------------------------------------------------
+
+// Is the edge e of the adjacency triangle t a boundary one, i.e., does it reference the triangle's own opposite vertex
+static bool isBoundaryEdge(const std::vector<GLuint> &adjacencyIb, size_t t, int e)
+{
+  return adjacencyIb[6 * t + 2 * e + 1] == adjacencyIb[6 * t + 2 * ((e + 2) % 3)];
+}
+
+// Number of boundary edges of the adjacency index buffer
+static size_t countBoundaryEdges(const std::vector<GLuint> &adjacencyIb)
+{
+  size_t count = 0;
+  for (size_t t = 0; t < adjacencyIb.size() / 6; ++t)
+  {
+    for (int e = 0; e < 3; ++e)
+      count += isBoundaryEdge(adjacencyIb, t, e) ? 1 : 0;
+  }
+  return count;
+}
+
+// Regular grid of n x n quads in the xz plane, two triangles each, i.e., 2 n^2 triangles with 4 n boundary edges
+static void createGrid(int n, std::vector<Vertex_Pos> &vb, std::vector<GLuint> &ib)
+{
+  vb.clear();
+  ib.clear();
+  vb.reserve((n + 1) * (n + 1));
+  ib.reserve(6 * n * n);
+  for (int z = 0; z <= n; ++z)
+  {
+    for (int x = 0; x <= n; ++x)
+      vb.push_back({(float)x, 0.0f, (float)z});
+  }
+
+  for (int z = 0; z < n; ++z)
+  {
+    for (int x = 0; x < n; ++x)
+    {
+      GLuint i = z * (n + 1) + x;
+      GLuint quad[6] = {i, i + n + 1, i + n + 2, i + n + 2, i + 1, i};
+      ib.insert(ib.end(), quad, quad + 6);
+    }
+  }
+}
+
+// The welded per face cube has to match the hand written adjacency table it replaced
+static void testCubeAdjacency()
+{
+  // Former hand written cube with shared vertices and its adjacency indices
+  const Vertex_Pos tableVb[] =
+  {
+    {-0.5f,  0.5f, -0.5f}, { 0.5f,  0.5f, -0.5f}, { 0.5f,  0.5f,  0.5f}, {-0.5f,  0.5f,  0.5f},
+    { 0.5f, -0.5f, -0.5f}, {-0.5f, -0.5f, -0.5f}, {-0.5f, -0.5f,  0.5f}, { 0.5f, -0.5f,  0.5f}
+  };
+  const GLuint tableIb[] =
+  {
+    0, 5, 1, 4, 2, 3,  2, 7, 3, 6, 0, 1, // Top face
+    4, 1, 5, 0, 6, 7,  6, 3, 7, 2, 4, 5, // Bottom face
+    5, 6, 4, 2, 1, 0,  1, 2, 0, 6, 5, 4, // Front face
+    7, 4, 6, 0, 3, 2,  3, 0, 2, 4, 7, 6, // Back face
+    6, 4, 5, 1, 0, 3,  0, 2, 3, 7, 6, 5, // Left face
+    4, 6, 7, 3, 2, 1,  2, 0, 1, 5, 4, 7, // Right face
+  };
+  const size_t tableTriangles = sizeof(tableIb) / sizeof(tableIb[0]) / 6;
+
+  // Per face cube as built by Geometry::CreateCubeAdjacency()
+  const Vertex_Pos faceVb[] =
+  {
+    {-0.5f,  0.5f, -0.5f}, { 0.5f,  0.5f, -0.5f}, { 0.5f,  0.5f,  0.5f}, {-0.5f,  0.5f,  0.5f},
+    { 0.5f, -0.5f, -0.5f}, {-0.5f, -0.5f, -0.5f}, {-0.5f, -0.5f,  0.5f}, { 0.5f, -0.5f,  0.5f},
+    {-0.5f, -0.5f, -0.5f}, { 0.5f, -0.5f, -0.5f}, { 0.5f,  0.5f, -0.5f}, {-0.5f,  0.5f, -0.5f},
+    { 0.5f, -0.5f,  0.5f}, {-0.5f, -0.5f,  0.5f}, {-0.5f,  0.5f,  0.5f}, { 0.5f,  0.5f,  0.5f},
+    {-0.5f, -0.5f,  0.5f}, {-0.5f, -0.5f, -0.5f}, {-0.5f,  0.5f, -0.5f}, {-0.5f,  0.5f,  0.5f},
+    { 0.5f, -0.5f, -0.5f}, { 0.5f, -0.5f,  0.5f}, { 0.5f,  0.5f,  0.5f}, { 0.5f,  0.5f, -0.5f}
+  };
+  std::vector<Vertex_Pos> vb(faceVb, faceVb + sizeof(faceVb) / sizeof(faceVb[0]));
+  std::vector<GLuint> ib;
+  for (GLuint face = 0; face < 6; ++face)
+  {
+    GLuint quad[6] = {4 * face, 4 * face + 1, 4 * face + 2, 4 * face + 2, 4 * face + 3, 4 * face};
+    ib.insert(ib.end(), quad, quad + 6);
+  }
+
+  std::vector<Vertex_Pos> adjacencyVb;
+  std::vector<GLuint> adjacencyIb;
+  Geometry::BuildAdjacency(vb, ib, adjacencyVb, adjacencyIb);
+  check(adjacencyVb.size() == 8, "Cube: corners welded into 8 vertices");
+  check(adjacencyIb.size() == 6 * tableTriangles, "Cube: 12 adjacency triangles");
+  check(countBoundaryEdges(adjacencyIb) == 0, "Cube: closed, no boundary edges");
+
+  // Every generated triangle has to be in the table, compared by positions, rotations of the corners are allowed
+  auto samePosition = [](const Vertex_Pos &a, const Vertex_Pos &b) { return a.x == b.x && a.y == b.y && a.z == b.z; };
+  size_t matched = 0;
+  for (size_t t = 0; t < adjacencyIb.size() / 6; ++t)
+  {
+    bool found = false;
+    for (size_t u = 0; u < tableTriangles && !found; ++u)
+    {
+      for (int rotation = 0; rotation < 6 && !found; rotation += 2)
+      {
+        bool same = true;
+        for (int k = 0; k < 6 && same; ++k)
+          same = samePosition(adjacencyVb[adjacencyIb[6 * t + k]], tableVb[tableIb[6 * u + (k + rotation) % 6]]);
+        found = same;
+      }
+    }
+    matched += found ? 1 : 0;
+  }
+  check(matched == tableTriangles, "Cube: same layout as the hand written table");
+}
+
+// Edges which can't be paired are treated as boundary edges
+static void testNonManifoldEdges()
+{
+  const std::vector<Vertex_Pos> vb = {{0.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}};
+  std::vector<Vertex_Pos> adjacencyVb;
+  std::vector<GLuint> adjacencyIb;
+
+  // Two triangles with consistent winding share the edge 0-1
+  Geometry::BuildAdjacency(vb, {0, 1, 2, 1, 0, 3}, adjacencyVb, adjacencyIb);
+  check(adjacencyIb[1] == 3 && adjacencyIb[7] == 2, "Manifold edge: opposite vertices linked");
+
+  // Third triangle on the edge reverts all of them to boundary edges
+  Geometry::BuildAdjacency(vb, {0, 1, 2, 1, 0, 3, 0, 1, 4}, adjacencyVb, adjacencyIb);
+  check(isBoundaryEdge(adjacencyIb, 0, 0) && isBoundaryEdge(adjacencyIb, 1, 0) && isBoundaryEdge(adjacencyIb, 2, 0),
+        "Three triangles on an edge: all boundary");
+  check(countBoundaryEdges(adjacencyIb) == 9, "Three triangles on an edge: no other edges paired");
+
+  // Flipped winding, both triangles run the edge in the same direction
+  Geometry::BuildAdjacency(vb, {0, 1, 2, 0, 1, 3}, adjacencyVb, adjacencyIb);
+  check(isBoundaryEdge(adjacencyIb, 0, 0) && isBoundaryEdge(adjacencyIb, 1, 0), "Flipped winding: boundary");
+}
+
+// Open grid has exactly its border as boundary edges, timed on large meshes
+static void testGridAdjacency()
+{
+  std::vector<Vertex_Pos> vb;
+  std::vector<GLuint> ib;
+  std::vector<Vertex_Pos> adjacencyVb;
+  std::vector<GLuint> adjacencyIb;
+
+  // 2M triangles
+  const int n = 1000;
+  createGrid(n, vb, ib);
+  Geometry::BuildAdjacency(vb, ib, adjacencyVb, adjacencyIb);
+  check(countBoundaryEdges(adjacencyIb) == 4 * n, "Grid of 2M triangles: 4 n boundary edges");
+
+  // 1M triangles
+  const int benchmarkN = 708;
+  createGrid(benchmarkN, vb, ib);
+  const int runs = 5;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < runs; ++i)
+    Geometry::BuildAdjacency(vb, ib, adjacencyVb, adjacencyIb);
+  const double time = elapsed(start) / runs;
+  printf("       BuildAdjacency: %zu triangles in %.1f ms, %.1f M triangles/s\n", ib.size() / 3, time, ib.size() / 3 / time * 1e-3);
+}
+
+// ----------------------------------------------------------------------------
+// Tangents
+// ----------------------------------------------------------------------------
+
+// Regenerates the tangents of the mesh, they have to match its hand written ones exactly
+static bool regeneratesTangents(const std::vector<Vertex_Pos_Nrm_Tgt_Tex> &reference, const std::vector<GLuint> &ib)
+{
+  std::vector<Vertex_Pos_Nrm_Tgt_Tex> vb = reference;
+  for (Vertex_Pos_Nrm_Tgt_Tex &v : vb)
+    v.tx = v.ty = v.tz = 0.0f;
+
+  Geometry::GenerateTangents(vb, ib);
+  for (size_t i = 0; i < vb.size(); ++i)
+  {
+    if (vb[i].tx != reference[i].tx || vb[i].ty != reference[i].ty || vb[i].tz != reference[i].tz)
+    {
+      printf("       vertex %zu: (%g, %g, %g) instead of (%g, %g, %g)\n", i, vb[i].tx, vb[i].ty, vb[i].tz,
+             reference[i].tx, reference[i].ty, reference[i].tz);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Quad from Geometry::BuildQuadNormalTangentTex() and cube as in Geometry::CreateCubeNormalTangentTex()
+static void testPrimitiveTangents()
+{
+  std::vector<Vertex_Pos_Nrm_Tgt_Tex> quad;
+  std::vector<GLuint> quadIb;
+  Geometry::BuildQuadNormalTangentTex(quad, quadIb);
+  check(regeneratesTangents(quad, quadIb), "Quad: generated tangents match the hand written ones");
+
+  const std::vector<Vertex_Pos_Nrm_Tgt_Tex> cube =
+  {
+    // Top face
+    {-0.5f,  0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f},
+    { 0.5f,  0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f},
+    { 0.5f,  0.5f,  0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f},
+    {-0.5f,  0.5f,  0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f},
+    // Bottom face
+    { 0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f},
+    {-0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f},
+    {-0.5f, -0.5f,  0.5f, 0.0f, -1.0f, 0.0f, -1.0f, 0.0f, 0.0f, 1.0f, 1.0f},
+    { 0.5f, -0.5f,  0.5f, 0.0f, -1.0f, 0.0f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f},
+    // Front face
+    {-0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f},
+    { 0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f},
+    { 0.5f,  0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f},
+    {-0.5f,  0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f},
+    // Back face
+    { 0.5f, -0.5f,  0.5f, 0.0f, 0.0f, 1.0f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f},
+    {-0.5f, -0.5f,  0.5f, 0.0f, 0.0f, 1.0f, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f},
+    {-0.5f,  0.5f,  0.5f, 0.0f, 0.0f, 1.0f, -1.0f, 0.0f, 0.0f, 1.0f, 1.0f},
+    { 0.5f,  0.5f,  0.5f, 0.0f, 0.0f, 1.0f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f},
+    // Left face
+    {-0.5f, -0.5f,  0.5f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f},
+    {-0.5f, -0.5f, -0.5f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f},
+    {-0.5f,  0.5f, -0.5f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.0f, 1.0f, 1.0f},
+    {-0.5f,  0.5f,  0.5f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f},
+    // Right face
+    {0.5f, -0.5f, -0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f},
+    {0.5f, -0.5f,  0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f},
+    {0.5f,  0.5f,  0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f},
+    {0.5f,  0.5f, -0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f}
+  };
+  std::vector<GLuint> ib;
+  for (GLuint face = 0; face < 6; ++face)
+  {
+    GLuint faceIb[6] = {4 * face, 4 * face + 1, 4 * face + 2, 4 * face + 2, 4 * face + 3, 4 * face};
+    ib.insert(ib.end(), faceIb, faceIb + 6);
+  }
+  check(regeneratesTangents(cube, ib), "Cube: generated tangents match the hand written ones");
+}
+
+// Textured grid with u along x and v along z, i.e., tangents along x, timed on a large mesh
+static void testGridTangents()
+{
+  std::vector<Vertex_Pos> positions;
+  std::vector<GLuint> ib;
+
+  // 2M triangles
+  const int n = 1000;
+  createGrid(n, positions, ib);
+  std::vector<Vertex_Pos_Nrm_Tgt_Tex> vb;
+  vb.reserve(positions.size());
+  for (const Vertex_Pos &p : positions)
+    vb.push_back({p.x, p.y, p.z, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, p.x / n, p.z / n});
+
+  const int runs = 5;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < runs; ++i)
+    Geometry::GenerateTangents(vb, ib);
+  const double time = elapsed(start) / runs;
+
+  size_t wrong = 0;
+  for (const Vertex_Pos_Nrm_Tgt_Tex &v : vb)
+    wrong += (fabsf(v.tx - 1.0f) > 1e-5f || fabsf(v.ty) > 1e-5f || fabsf(v.tz) > 1e-5f) ? 1 : 0;
+  check(wrong == 0, "Grid of 2M triangles: tangents along the u direction");
+  printf("       GenerateTangents: %zu triangles in %.1f ms, %.1f M triangles/s\n", ib.size() / 3, time, ib.size() / 3 / time * 1e-3);
+}
+
+// ----------------------------------------------------------------------------
+
+int main()
+{
+  testCubeAdjacency();
+  testNonManifoldEdges();
+  testGridAdjacency();
+  testPrimitiveTangents();
+  testGridTangents();
+
+  printf("%d check(s) failed\n", failures);
+  return failures;
+}
@@ -0,0 +1,119 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/gl.h>
+#include <vector>
+
+#include "MeshPool.h"
+#include "ResourceRegistry.h"
+
+// Shader storage buffer binding of the per draw data, right after the mesh pool vertex buffers
+static const GLuint DRAW_DATA_BINDING = VertexFormat::NumFormats;
+
+// Indexed indirect draw command, the layout is given by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+};
+
+// Builder of indirect draw command buffers: packs all draws of a pass over the mesh pool together with their per draw
+// data, shaders read the data by gl_DrawID, so the whole pass is a single glMultiDrawElementsIndirect call. The per
+// draw data is stored in a std430 shader storage buffer, i.e., DrawData must respect its alignment. Requires OpenGL 4.6.
+template <class DrawData>
+class DrawCommandBuffer
+{
+public:
+  DrawCommandBuffer() : _commandBuffer(0), _dataBuffer(0), _numCommands(0) {}
+  ~DrawCommandBuffer();
+
+  // Remove all the draws
+  void Clear();
+  // Append a draw of the given number of instances of the pooled mesh with its per draw data
+  void Add(const MeshPool::Entry &mesh, GLuint numInstances, const DrawData &data);
+  // Upload the draws to the GPU, buffers are reallocated so that draws still in flight don't stall the upload
+  void Upload();
+  // Draw all the uploaded commands with the mesh pool VAO bound, the per draw data is bound to DRAW_DATA_BINDING
+  void Draw(GLenum mode = GL_TRIANGLES);
+  // Get the number of uploaded draws
+  GLsizei GetCount() const { return _numCommands; }
+
+private:
+  // Indirect draw commands buffer
+  GLuint _commandBuffer;
+  // Per draw data shader storage buffer
+  GLuint _dataBuffer;
+  // Number of uploaded draws
+  GLsizei _numCommands;
+  // CPU side draws
+  std::vector<DrawElementsIndirectCommand> _commands;
+  std::vector<DrawData> _data;
+
+  // No copies allowed
+  DrawCommandBuffer(const DrawCommandBuffer &);
+  DrawCommandBuffer & operator = (const DrawCommandBuffer &);
+};
+
+template <class DrawData>
+DrawCommandBuffer<DrawData>::~DrawCommandBuffer()
+{
+  // Release resources used by the driver
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &_commandBuffer);
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &_dataBuffer);
+}
+
+template <class DrawData>
+void DrawCommandBuffer<DrawData>::Clear()
+{
+  _commands.clear();
+  _data.clear();
+}
+
+template <class DrawData>
+void DrawCommandBuffer<DrawData>::Add(const MeshPool::Entry &mesh, GLuint numInstances, const DrawData &data)
+{
+  // Instances are addressed through the per draw data, base instance stays zero
+  _commands.push_back({(GLuint)mesh.numIndices, numInstances, mesh.firstIndex, mesh.baseVertex, 0});
+  _data.push_back(data);
+}
+
+template <class DrawData>
+void DrawCommandBuffer<DrawData>::Upload()
+{
+  if (!_commandBuffer)
+  {
+    glGenBuffers(1, &_commandBuffer);
+    glGenBuffers(1, &_dataBuffer);
+  }
+
+  _numCommands = (GLsizei)_commands.size();
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _commandBuffer);
+  glBufferData(GL_DRAW_INDIRECT_BUFFER, _commands.size() * sizeof(DrawElementsIndirectCommand), _commands.data(), GL_DYNAMIC_DRAW);
+  ResourceRegistry::GetInstance().TrackBuffer(_commandBuffer, _commands.size() * sizeof(DrawElementsIndirectCommand), ResourceCategory::Buffers, "Draw commands");
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _dataBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, _data.size() * sizeof(DrawData), _data.data(), GL_DYNAMIC_DRAW);
+  ResourceRegistry::GetInstance().TrackBuffer(_dataBuffer, _data.size() * sizeof(DrawData), ResourceCategory::Buffers, "Draw data");
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+template <class DrawData>
+void DrawCommandBuffer<DrawData>::Draw(GLenum mode)
+{
+  if (_numCommands == 0)
+    return;
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, _dataBuffer);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _commandBuffer);
+  glMultiDrawElementsIndirect(mode, GL_UNSIGNED_INT, reinterpret_cast<void*>(0), _numCommands, 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
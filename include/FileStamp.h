@@ -0,0 +1,12 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// Size and modification time of the file, false if it doesn't exist, the binary caches store it to detect stale
+// sources
+bool getFileStamp(const char name[], uint64_t &size, int64_t &time);
@@ -0,0 +1,190 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/gl.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Frame graph of render passes and their transient render targets: passes are declared every frame together with
+// the targets they create, write and read, passes whose outputs are never read are culled and the remaining ones are
+// executed in the declaration order, which is always a valid one as a target can only be used after the pass creating
+// it has been added. Targets are assigned to a pool of textures kept between frames, targets whose lifetimes don't
+// overlap share the same texture, with OpenGL 4.3 even if their formats differ but have the same texel size, the
+// texture is then accessed through a texture view.
+class FrameGraph
+{
+public:
+  // Handle of a render target declared this frame
+  typedef int Resource;
+  static const Resource INVALID = -1;
+  // Maximum number of color attachments of a pass
+  static const int MAX_COLOR_ATTACHMENTS = 4;
+
+  // Declares the targets used by a pass while it's being added
+  class PassBuilder
+  {
+  public:
+    // Create a new target of the frame size written by the pass, it's attached to the pass framebuffer, color
+    // attachments follow the declaration order
+    Resource Create(const char *name, GLenum internalFormat);
+    // Attach the target to the pass framebuffer and write into it
+    Resource Write(Resource resource);
+    // Sample the target in the pass, optionally attach it as well, e.g., depth for testing without writing it
+    Resource Read(Resource resource, bool attach = false);
+    // Never cull the pass, e.g., the one presenting the image
+    void SetSideEffect();
+
+  private:
+    friend class FrameGraph;
+    PassBuilder(FrameGraph &graph, int pass) : _graph(graph), _pass(pass) {}
+
+    FrameGraph &_graph;
+    int _pass;
+  };
+
+  FrameGraph();
+  ~FrameGraph();
+
+  // Start declaring a new frame, the textures of a different size are released
+  void Reset(int width, int height);
+  // Add a pass, setup(builder, data) declares its targets right away, execute(data) is called by Execute() with the
+  // pass framebuffer bound unless the pass is culled, passes without attachments use the window system framebuffer
+  template <class Data, class Setup, class ExecuteFunc>
+  const Data &AddPass(const char *name, Setup setup, ExecuteFunc execute);
+  // Cull the passes, compute the lifetimes of the targets and assign them to the textures
+  void Compile();
+  // Execute the passes which weren't culled, each one is counted by PipelineStats
+  void Execute();
+  // Get the texture of the target for sampling during Execute(), 0 for INVALID
+  GLuint GetTexture(Resource resource) const;
+  // Release all the textures and framebuffers
+  void Release();
+
+  // Get the frame size
+  int GetWidth() const { return _width; }
+  int GetHeight() const { return _height; }
+  // Get the number of passes declared and culled in the last frame
+  int GetPassCount() const { return (int)_passes.size(); }
+  int GetCulledCount() const { return _numCulled; }
+  // Get the memory of all the targets declared in the last frame as if each one had its own texture in MB
+  float GetDeclaredMemory() const { return _declaredMemory / (1024.0f * 1024.0f); }
+  // Get the memory of the targets used in the last frame, i.e., without the culled ones, in MB
+  float GetRequestedMemory() const { return _requestedMemory / (1024.0f * 1024.0f); }
+  // Get the memory of the textures backing them in MB, the difference to the requested memory is saved by aliasing
+  float GetAllocatedMemory() const { return _allocatedMemory / (1024.0f * 1024.0f); }
+  // Get the largest memory saved by culling and aliasing together in a frame so far in MB
+  float GetPeakSavedMemory() const { return _peakSavedMemory / (1024.0f * 1024.0f); }
+
+private:
+  // Render target declared this frame
+  struct ResourceNode
+  {
+    std::string name;
+    GLenum internalFormat;
+    // Passes writing and reading it
+    std::vector<int> writers;
+    int numReaders;
+    // Number of readers which weren't culled, used while culling
+    int refCount;
+    // First and last pass using it after culling, -1 if unused
+    int firstUse;
+    int lastUse;
+    // Assigned texture and its view in the target format
+    int texture;
+    GLuint view;
+  };
+
+  // Pass declared this frame
+  struct PassNode
+  {
+    std::string name;
+    // Targets attached to the framebuffer, the depth one is kept separately
+    std::vector<Resource> colorAttachments;
+    Resource depthAttachment;
+    // Written and read targets
+    std::vector<Resource> writes;
+    std::vector<Resource> reads;
+    bool sideEffect;
+    // Number of written targets which are read, used while culling
+    int refCount;
+    bool culled;
+    std::function<void()> execute;
+  };
+
+  // Texture of the pool
+  struct PooledTexture
+  {
+    GLuint texture;
+    // Format of the storage, views of the same texel size may use other formats
+    GLenum internalFormat;
+    size_t size;
+    // Views in other formats
+    std::unordered_map<GLenum, GLuint> views;
+    // Last pass using the target assigned to it this frame, -1 if free
+    int busyUntil;
+    bool used;
+  };
+
+  // Cached pass framebuffer and its attachments
+  struct Framebuffer
+  {
+    GLuint fbo;
+    GLuint colors[MAX_COLOR_ATTACHMENTS];
+    GLuint depth;
+    int numColors;
+  };
+
+  // Add an empty pass node, returns its index
+  int AddPassNode(const char *name);
+  // Attach the target to the pass framebuffer
+  void Attach(int pass, Resource resource);
+  // Assign a free compatible texture of the pool to the target or create a new one
+  void AssignTexture(Resource resource, int pass);
+  // Get the texture or its view in the format
+  GLuint GetView(PooledTexture &pooled, GLenum internalFormat);
+  // Release the pooled texture and its views
+  void ReleaseTexture(PooledTexture &pooled);
+  // Delete the cached framebuffers, their attachments may have been released
+  void ReleaseFramebuffers();
+
+  // Frame size
+  int _width;
+  int _height;
+  // Texture views need OpenGL 4.3
+  bool _viewsSupported;
+  // Passes and targets of the current frame
+  std::vector<PassNode> _passes;
+  std::vector<ResourceNode> _resources;
+  // Textures kept between frames
+  std::vector<PooledTexture> _pool;
+  // Framebuffers by the pass names
+  std::unordered_map<std::string, Framebuffer> _framebuffers;
+  // Stats of the last compiled frame
+  int _numCulled;
+  size_t _declaredMemory;
+  size_t _requestedMemory;
+  size_t _allocatedMemory;
+  size_t _peakSavedMemory;
+
+  // No copies allowed
+  FrameGraph(const FrameGraph &);
+  FrameGraph & operator = (const FrameGraph &);
+};
+
+template <class Data, class Setup, class ExecuteFunc>
+const Data &FrameGraph::AddPass(const char *name, Setup setup, ExecuteFunc execute)
+{
+  // Pass data outlives the setup, it's shared with the execute callback until the next Reset()
+  std::shared_ptr<Data> data = std::make_shared<Data>();
+  PassBuilder builder(*this, AddPassNode(name));
+  setup(builder, *data);
+  _passes[builder._pass].execute = [data, execute]() { execute(*data); };
+  return *data;
+}
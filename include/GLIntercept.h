@@ -0,0 +1,106 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/gl.h>
+#include <cstdint>
+#include <vector>
+
+class TextOverlay;
+
+// Set to 0 to compile the interception out
+#ifndef _ENABLE_GL_INTERCEPT
+#define _ENABLE_GL_INTERCEPT 1
+#endif
+
+#if _ENABLE_GL_INTERCEPT
+#define GL_INTERCEPT_CONCAT_(a, b) a##b
+#define GL_INTERCEPT_CONCAT(a, b) GL_INTERCEPT_CONCAT_(a, b)
+// Attribute the OpenGL calls of the enclosing scope to a section identified by the name pointer, e.g., a string literal
+#define GL_INTERCEPT_SCOPE(name) GLIntercept::Scope GL_INTERCEPT_CONCAT(glInterceptScope, __LINE__)(name)
+#else
+#define GL_INTERCEPT_SCOPE(name) ((void)0)
+#endif
+
+// Interception of the OpenGL calls: Install() replaces all the entry points loaded by glad with wrappers counting the
+// calls per function and measuring the CPU time spent inside the driver, Uninstall() puts the original ones back. Calls
+// which typically make the driver wait for the GPU, i.e., glGet*, glReadPixels, glFinish, or buffer mapping without
+// GL_MAP_UNSYNCHRONIZED_BIT, are counted as sync-prone. Calls are also summed per section, i.e., the innermost
+// GL_INTERCEPT_SCOPE, to find the code with the most submission overhead. Only the OpenGL thread may call OpenGL.
+class GLIntercept
+{
+public:
+  // Maximum number of distinct sections, the calls of any further ones are attributed to the enclosing section
+  static const int MAX_SECTIONS = 64;
+
+  // Calls of a single function or section
+  struct CallStats
+  {
+    unsigned int calls;
+    unsigned int syncs;
+    // CPU time inside the driver in nanoseconds
+    int64_t time;
+  };
+
+  // Section of the code the calls are attributed to
+  class Scope
+  {
+  public:
+    Scope(const char *name) : _previous(GetInstance().EnterSection(name)) {}
+    ~Scope() { GetInstance()._section = _previous; }
+
+  private:
+    int _previous;
+  };
+
+  // Get and create instance for this singleton
+  static GLIntercept &GetInstance();
+
+  // Wrap the entry points, call after gladLoadGL()
+  void Install();
+  // Restore the original entry points
+  void Uninstall();
+  // Are the calls being counted?
+  bool IsInstalled() const { return _installed; }
+  // Record a finished call, used by the wrappers
+  void Record(int function, bool sync, int64_t time);
+
+  // Call once per frame, makes the calls counted so far the last frame histogram
+  void EndFrame();
+  // Print the histogram of the last frame, the functions sorted by the driver time, and the sections
+  void Print(TextOverlay &overlay, int maxFunctions) const;
+  void PrintReport(int maxFunctions) const;
+
+private:
+  // Calls of the section in the current and last frame
+  struct Section
+  {
+    const char *name;
+    CallStats frame;
+    CallStats last;
+  };
+
+  GLIntercept();
+  // No copies allowed
+  GLIntercept(const GLIntercept &);
+  GLIntercept & operator = (const GLIntercept &);
+
+  // Make the section the current one, returns the previous one
+  int EnterSection(const char *name);
+  // Indices of the functions called in the last frame, sorted by the driver time
+  std::vector<int> GetSortedFunctions() const;
+  // Totals of the last frame
+  CallStats GetLastFrameTotal() const;
+
+  // Are the wrappers installed?
+  bool _installed;
+  // Calls per function in the current and last frame
+  std::vector<CallStats> _frame;
+  std::vector<CallStats> _last;
+  // Sections, the first one is the code outside of any scope
+  std::vector<Section> _sections;
+  int _section;
+};
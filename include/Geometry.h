@@ -8,31 +8,56 @@
 #include "Mesh.h"
 #include "Vertex.h"
 
+// Meshlet size limits, small enough for a single work group or mesh shader invocation
+static const int MESHLET_MAX_VERTICES = 64;
+static const int MESHLET_MAX_TRIANGLES = 124;
+
 // Geometry utilities class
 class Geometry
 {
 public:
   // Creates simple quad with uniform color
   static Mesh<Vertex_Pos_Col> *CreateQuadColor();
-  // Create simple quad with texture coordinates
-  static Mesh<Vertex_Pos_Tex> *CreateQuadTex();
-  // Create simple quad with normals, tangents and texture coordinates
-  static Mesh<Vertex_Pos_Nrm_Tgt_Tex> *CreateQuadNormalTangentTex();
+  // Create simple quad with texture coordinates, optionally with a position only stream, see Mesh::Init()
+  static Mesh<Vertex_Pos_Tex> *CreateQuadTex(bool positionStream = false);
+  // Create simple quad with normals, tangents and texture coordinates, optionally with a position only stream
+  static Mesh<Vertex_Pos_Nrm_Tgt_Tex> *CreateQuadNormalTangentTex(bool positionStream = false);
+  // Fills in the vertex and index buffers of the same quad on the CPU, e.g., for static batches
+  static void BuildQuadNormalTangentTex(std::vector<Vertex_Pos_Nrm_Tgt_Tex> &vb, std::vector<GLuint> &ib);
   // Creates simple cube with colors
   static Mesh<Vertex_Pos_Col> *CreateCubeColor();
   // Creates simple cube with colors and shared vertices
   static Mesh<Vertex_Pos_Col> *CreateCubeColorShared();
-  // Creates simple cube with shared vertices and vertex adjacency info
+  // Creates simple cube with shared vertices and vertex adjacency info, built by CreateAdjacency()
   static Mesh<Vertex_Pos> *CreateCubeAdjacency();
-  // Creates simple cube with texture coordinates
-  static Mesh<Vertex_Pos_Tex> *CreateCubeTex();
-  // Create simple cube with normals, tangents and texture coordinates
-  static Mesh<Vertex_Pos_Nrm_Tgt_Tex> *CreateCubeNormalTangentTex();
+  // Creates simple cube with texture coordinates, optionally with a position only stream
+  static Mesh<Vertex_Pos_Tex> *CreateCubeTex(bool positionStream = false);
+  // Create simple cube with normals, tangents and texture coordinates, optionally with a position only stream
+  static Mesh<Vertex_Pos_Nrm_Tgt_Tex> *CreateCubeNormalTangentTex(bool positionStream = false);
   // Create tethrahedron composed from vertices with normals
   static Mesh<Vertex_Pos_Nrm> *CreateTetrahedron();
   // Create regular icosahedron with just positions
   static Mesh<Vertex_Pos> *CreateIcosahedron();
 
+  // Builds GL_TRIANGLES_ADJACENCY vertex and index buffers from an arbitrary triangle list, vertices with equal
+  // positions are welded, boundary and non-manifold edges reference the triangle's own opposite vertex
+  static void BuildAdjacency(const std::vector<Vertex_Pos> &vb, const std::vector<GLuint> &ib,
+                             std::vector<Vertex_Pos> &adjacencyVb, std::vector<GLuint> &adjacencyIb);
+  // Creates mesh with vertex adjacency info from an arbitrary triangle list
+  static Mesh<Vertex_Pos> *CreateAdjacency(const std::vector<Vertex_Pos> &vb, const std::vector<GLuint> &ib);
+  // Generates MikkTSpace style tangents for an indexed triangle list in place, vertices with equal position,
+  // normal and texture coordinates share the tangent, runs in parallel over triangle and vertex chunks
+  static void GenerateTangents(std::vector<Vertex_Pos_Nrm_Tgt_Tex> &vb, const std::vector<GLuint> &ib);
+  // Simplifies the triangle list by quadric error metric edge collapses into up to numLevels levels of detail, each
+  // halving the triangle count of the previous one, the levels are appended to the index buffer and share the
+  // vertex buffer, attribute seams and open edges are kept intact, lods[0] is the original triangle list
+  static void GenerateLods(const std::vector<Vertex_Pos> &vb, std::vector<GLuint> &ib, std::vector<MeshLod> &lods, int numLevels = 3);
+  // Splits numIndices indices starting at firstIndex into meshlets of up to MESHLET_MAX_VERTICES unique vertices and
+  // MESHLET_MAX_TRIANGLES triangles grown over shared vertices, the triangles are reordered in place so that each
+  // meshlet is a contiguous range, bounding spheres and normal cones are computed from the positions
+  static void BuildMeshlets(const std::vector<Vertex_Pos> &vb, std::vector<GLuint> &ib, GLuint firstIndex, GLsizei numIndices,
+                            std::vector<Meshlet> &meshlets);
+
 private:
   Geometry();
   ~Geometry();
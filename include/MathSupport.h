@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <cfloat>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
@@ -40,3 +41,77 @@ inline float getLuminousIntensity(glm::vec3 color)
 {
   return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
 }
+
+// Conservative screen space bounds of a view space sphere, returns false if the sphere can't be visible,
+// rect is (x, y, width, height) in pixels, depthRange holds the window space depth interval of the sphere
+inline bool getSphereScreenBounds(const glm::vec3 &centerVS, float radius, float nearClip, float farClip, const glm::mat4x4 &projection,
+                                  int width, int height, glm::ivec4 &rect, glm::vec2 &depthRange)
+{
+  // Completely behind the near or beyond the far plane
+  if (centerVS.z - radius > -nearClip || centerVS.z + radius < -farClip)
+    return false;
+
+  // Window space depth of the view space Z clamped to the clip planes
+  auto getDepth = [&projection, nearClip, farClip](float z) -> float
+  {
+    z = glm::clamp(z, -farClip, -nearClip);
+    float ndc = (projection[2][2] * z + projection[3][2]) / -z;
+    return glm::clamp(ndc * 0.5f + 0.5f, 0.0f, 1.0f);
+  };
+  depthRange = glm::vec2(getDepth(centerVS.z + radius), getDepth(centerVS.z - radius));
+
+  // Sphere crossing the near plane covers the whole screen for our purposes
+  if (centerVS.z + radius > -nearClip)
+  {
+    rect = glm::ivec4(0, 0, width, height);
+    return true;
+  }
+
+  // Project the corners of the view space bounding box of the sphere
+  glm::vec2 minNDC(FLT_MAX), maxNDC(-FLT_MAX);
+  for (int i = 0; i < 8; ++i)
+  {
+    glm::vec3 corner = centerVS + radius * glm::vec3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+    glm::vec4 clip = projection * glm::vec4(corner, 1.0f);
+    glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+    minNDC = glm::min(minNDC, ndc);
+    maxNDC = glm::max(maxNDC, ndc);
+  }
+
+  // Clip to the screen and convert to pixels
+  minNDC = glm::max(minNDC, glm::vec2(-1.0f));
+  maxNDC = glm::min(maxNDC, glm::vec2(1.0f));
+  if (minNDC.x >= maxNDC.x || minNDC.y >= maxNDC.y)
+    return false;
+
+  int x0 = (int)floorf((minNDC.x * 0.5f + 0.5f) * width);
+  int y0 = (int)floorf((minNDC.y * 0.5f + 0.5f) * height);
+  int x1 = (int)ceilf((maxNDC.x * 0.5f + 0.5f) * width);
+  int y1 = (int)ceilf((maxNDC.y * 0.5f + 0.5f) * height);
+  rect = glm::ivec4(x0, y0, x1 - x0, y1 - y0);
+  return true;
+}
+
+// Conservative frustum test of a world space axis aligned box, returns true if all its corners lie outside
+// the same side plane or behind the eye, i.e., the box can't be visible, near and far planes are ignored
+// because of the depth clamp
+inline bool isBoxOutsideFrustum(const glm::mat4x4 &worldToClip, const glm::vec3 &boxMin, const glm::vec3 &boxMax)
+{
+  // Bit per plane the corner is outside of, the box is culled if a bit is set for all corners
+  int outside = 0x1F;
+  for (int i = 0; i < 8; ++i)
+  {
+    glm::vec3 corner = glm::vec3((i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z);
+    glm::vec4 clip = worldToClip * glm::vec4(corner, 1.0f);
+
+    int mask = 0;
+    mask |= (clip.x < -clip.w) ? 0x01 : 0;
+    mask |= (clip.x >  clip.w) ? 0x02 : 0;
+    mask |= (clip.y < -clip.w) ? 0x04 : 0;
+    mask |= (clip.y >  clip.w) ? 0x08 : 0;
+    mask |= (clip.w <= 0.0f) ? 0x10 : 0;
+    outside &= mask;
+  }
+
+  return outside != 0;
+}
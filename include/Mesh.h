@@ -8,22 +8,70 @@
 #include <glad/gl.h>
 #include <vector>
 
+#include "ResourceRegistry.h"
+#include "Vertex.h"
+
+// Level of detail stored as a range of the mesh index buffer, all levels share the vertex buffer
+struct MeshLod
+{
+  // First index of the level in the index buffer
+  GLuint firstIndex;
+  // Number of indices of the level
+  GLsizei numIndices;
+  // Simplification error in object space units, zero for the full detail
+  float error;
+};
+
+// Cluster of nearby triangles stored as a range of the mesh index buffer with its culling bounds, the layout
+// matches std430 shader storage buffers
+struct Meshlet
+{
+  // Bounding sphere center and radius
+  float center[3];
+  float radius;
+  // Normal cone axis and cutoff: the cluster faces away from any point p with
+  // dot(center - p, coneAxis) >= coneCutoff * length(center - p) + radius, cutoff 1 never culls
+  float coneAxis[3];
+  float coneCutoff;
+  // First index and number of indices of the cluster
+  GLuint firstIndex;
+  GLsizei numIndices;
+  GLuint padding[2];
+};
+
 // Class for mesh representation
 template <class VertexType>
 class Mesh
 {
 public:
-  Mesh() : _vao(0), _vbo(0), _vboSize(0), _ibo(0), _iboSize(0) {}
+  Mesh() : _vao(0), _vbo(0), _vboSize(0), _ibo(0), _iboSize(0), _positionVao(0), _positionVbo(0) {}
   ~Mesh();
 
-  // Initialize the mesh with data
-  void Init(const std::vector<VertexType> &vb, const std::vector<GLuint> &ib);
+  // Initialize the mesh with data, positionStream adds a tightly packed position only vertex stream sharing the index
+  // buffer, e.g., for depth only passes
+  void Init(const std::vector<VertexType> &vb, const std::vector<GLuint> &ib, bool positionStream = false);
+  // Initialize the mesh with data and levels of detail stored one after another in the index buffer
+  void Init(const std::vector<VertexType> &vb, const std::vector<GLuint> &ib, const std::vector<MeshLod> &lods, bool positionStream = false);
+  // Initialize the mesh with data from raw memory, e.g., a memory mapped file, without levels of detail the
+  // whole index buffer is the only level
+  void Init(const VertexType *vb, GLsizei numVertices, const GLuint *ib, GLsizei numIndices, const MeshLod *lods = nullptr, GLsizei numLods = 0,
+            bool positionStream = false);
   // Return the associated VAO for rendering
   GLuint GetVAO() { return _vao; }
+  // Return the position only VAO if created, the full VAO otherwise
+  GLuint GetPositionVAO() { return _positionVao ? _positionVao : _vao; }
+  // Return the vertex buffer, e.g., for binding it as a buffer texture
+  GLuint GetVBO() { return _vbo; }
   // Get the size of the vertex buffer
   GLsizei GetVBOSize() { return _vboSize; }
-  // Get the size of the index buffer
+  // Return the index buffer
+  GLuint GetIBO() { return _ibo; }
+  // Get the size of the index buffer of the full detail level
   GLsizei GetIBOSize() { return _iboSize; }
+  // Get the number of levels of detail, at least one for an initialized mesh
+  int GetLodCount() { return (int)_lods.size(); }
+  // Get the index range of the given level of detail, level 0 is the full detail
+  const MeshLod &GetLod(int lod) { return _lods[lod]; }
 
 protected:
   // Vertex array object used to draw this mesh
@@ -34,33 +82,64 @@ protected:
   GLsizei _vboSize;
   // Index buffer
   GLuint _ibo;
-  // Index buffer size
+  // Index buffer size of the full detail level
   GLsizei _iboSize;
+  // Levels of detail from the finest to the coarsest
+  std::vector<MeshLod> _lods;
+  // Vertex array object with positions only
+  GLuint _positionVao;
+  // Position only vertex buffer
+  GLuint _positionVbo;
 
 private:
   // No copies allowed
   Mesh(const Mesh &);
   Mesh & operator = (const Mesh &);
+
+  // Create the position only stream from the source vertices
+  void CreatePositionStream(const VertexType *vb);
 };
 
 template <class VertexType>
 Mesh<VertexType>::~Mesh()
 {
   // Release resources used by the driver
+  ResourceRegistry &registry = ResourceRegistry::GetInstance();
   glDeleteVertexArrays(1, &_vao);
-  glDeleteBuffers(1, &_vbo);
-  glDeleteBuffers(1, &_ibo);
+  registry.DeleteBuffers(1, &_vbo);
+  registry.DeleteBuffers(1, &_ibo);
+  glDeleteVertexArrays(1, &_positionVao);
+  registry.DeleteBuffers(1, &_positionVbo);
+}
+
+template<class VertexType>
+void Mesh<VertexType>::Init(const std::vector<VertexType> &vb, const std::vector<GLuint> &ib, bool positionStream)
+{
+  Init(vb.data(), (GLsizei)vb.size(), ib.data(), (GLsizei)ib.size(), nullptr, 0, positionStream);
+}
+
+template<class VertexType>
+void Mesh<VertexType>::Init(const std::vector<VertexType> &vb, const std::vector<GLuint> &ib, const std::vector<MeshLod> &lods, bool positionStream)
+{
+  Init(vb.data(), (GLsizei)vb.size(), ib.data(), (GLsizei)ib.size(), lods.data(), (GLsizei)lods.size(), positionStream);
 }
 
 template<class VertexType>
-void Mesh<VertexType>::Init(const std::vector<VertexType> &vb, const std::vector<GLuint> &ib)
+void Mesh<VertexType>::Init(const VertexType *vb, GLsizei numVertices, const GLuint *ib, GLsizei numIndices, const MeshLod *lods, GLsizei numLods,
+                            bool positionStream)
 {
   // Do nothing if we're already initialized
   if (_vao)
     return;
 
-  _vboSize = (GLsizei)vb.size();
-  _iboSize = (GLsizei)ib.size();
+  // Single level covering the whole index buffer unless told otherwise
+  if (lods && numLods > 0)
+    _lods.assign(lods, lods + numLods);
+  else
+    _lods.assign(1, MeshLod{0, numIndices, 0.0f});
+
+  _vboSize = numVertices;
+  _iboSize = _lods[0].numIndices;
 
   // Create and bind the Vertex Array Object
   glGenVertexArrays(1, &_vao);
@@ -69,7 +148,8 @@ void Mesh<VertexType>::Init(const std::vector<VertexType> &vb, const std::vector
   // Generate the vertex buffer fill it with data
   glGenBuffers(1, &_vbo);
   glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(VertexType) * _vboSize, static_cast<const void *>(&*vb.begin()), GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(VertexType) * _vboSize, static_cast<const void *>(vb), GL_STATIC_DRAW);
+  ResourceRegistry::GetInstance().TrackBuffer(_vbo, sizeof(VertexType) * _vboSize, ResourceCategory::Meshes, "Mesh vertices");
 
   // Describe and enable vertex attributes
   VertexType::BindVertexAttributes();
@@ -80,10 +160,48 @@ void Mesh<VertexType>::Init(const std::vector<VertexType> &vb, const std::vector
   // Generate the index buffer and fill it with data
   glGenBuffers(1, &_ibo);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ibo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * _iboSize, static_cast<const void *>(&*ib.begin()), GL_STATIC_DRAW);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * numIndices, static_cast<const void *>(ib), GL_STATIC_DRAW);
+  ResourceRegistry::GetInstance().TrackBuffer(_ibo, sizeof(GLuint) * numIndices, ResourceCategory::Meshes, "Mesh indices");
 
   // Note: can't unbind the IBO while the VAO is active unlike VBO which got stored trough glVertexAttribPointer call, it would break things
 
   // Unbind the VAO
   glBindVertexArray(0);
+
+  if (positionStream)
+    CreatePositionStream(vb);
+}
+
+template<class VertexType>
+void Mesh<VertexType>::CreatePositionStream(const VertexType *vb)
+{
+  // Extract the positions only from the source vertices
+  std::vector<Vertex_Pos> positions;
+  positions.reserve(_vboSize);
+  for (GLsizei i = 0; i < _vboSize; ++i)
+  {
+    positions.push_back({vb[i].x, vb[i].y, vb[i].z});
+  }
+
+  // Create and bind the position only Vertex Array Object
+  glGenVertexArrays(1, &_positionVao);
+  glBindVertexArray(_positionVao);
+
+  // Generate the position buffer and fill it with data
+  glGenBuffers(1, &_positionVbo);
+  glBindBuffer(GL_ARRAY_BUFFER, _positionVbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex_Pos) * _vboSize, static_cast<const void *>(positions.data()), GL_STATIC_DRAW);
+  ResourceRegistry::GetInstance().TrackBuffer(_positionVbo, sizeof(Vertex_Pos) * _vboSize, ResourceCategory::Meshes, "Mesh positions");
+
+  // Positions are always at location 0, other attributes use their default values
+  Vertex_Pos::BindVertexAttributes();
+
+  // Unbind the array buffer to prevent accidental changes
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  // Share the index buffer with the full vertex format
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ibo);
+
+  // Unbind the VAO
+  glBindVertexArray(0);
 }
@@ -0,0 +1,172 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include "Mesh.h"
+#include "Vertex.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Imported geometry, all the other vertex formats are converted from the full one
+struct MeshData
+{
+  // Vertices with generated tangents
+  std::vector<Vertex_Pos_Nrm_Tgt_Tex> vertices;
+  // Triangle list indices of all the levels of detail
+  std::vector<GLuint> indices;
+  // Index ranges of the levels of detail, the first one is the full detail
+  std::vector<MeshLod> lods;
+  // Meshlets of the full detail level
+  std::vector<Meshlet> meshlets;
+  // Axis aligned bounding box
+  glm::vec3 boundsMin = glm::vec3(0.0f);
+  glm::vec3 boundsMax = glm::vec3(0.0f);
+};
+
+// Mesh import utilities class: Wavefront OBJ and binary glTF parsing with a binary cache
+class MeshImporter
+{
+public:
+  // Load the mesh from the binary cache next to the file if it's up to date, otherwise parse the file and write
+  // the cache, returns nullptr on failure, parse and cache load times are printed to the console, meshlets of the
+  // full detail level are optionally returned for GPU culling, positionStream is passed to Mesh::Init()
+  template <class VertexType>
+  static Mesh<VertexType> *LoadMesh(const char name[], glm::vec3 *boundsMin = nullptr, glm::vec3 *boundsMax = nullptr,
+                                    std::vector<Meshlet> *meshlets = nullptr, bool positionStream = false);
+
+  // Parse OBJ or binary glTF file based on its extension
+  static bool Import(const char name[], MeshData &data);
+  // Parse Wavefront OBJ file in parallel chunks, polygons are triangulated as fans
+  static bool ImportObj(const char name[], MeshData &data);
+  // Parse binary glTF 2.0 file, all triangle primitives are merged, node transformations are ignored
+  static bool ImportGlb(const char name[], MeshData &data);
+  // Write the binary cache of the source file
+  static bool WriteCache(const char name[], const MeshData &data);
+
+private:
+  MeshImporter();
+  ~MeshImporter();
+
+  // Read only memory mapped file
+  struct MappedFile
+  {
+    // Mapped contents
+    const unsigned char *data = nullptr;
+    // Size of the file in bytes
+    size_t size = 0;
+    // Platform specific file and mapping handles
+    void *file = nullptr;
+    void *mapping = nullptr;
+  };
+
+  // Memory mapped binary cache, arrays point directly to the mapping
+  struct CacheView
+  {
+    MappedFile file;
+    const Vertex_Pos_Nrm_Tgt_Tex *vertices = nullptr;
+    const GLuint *indices = nullptr;
+    const MeshLod *lods = nullptr;
+    const Meshlet *meshlets = nullptr;
+    GLsizei numVertices = 0;
+    GLsizei numIndices = 0;
+    GLsizei numLods = 0;
+    GLsizei numMeshlets = 0;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+  };
+
+  // Map the whole file to memory
+  static bool MapFile(const char name[], MappedFile &file);
+  // Release the mapping
+  static void UnmapFile(MappedFile &file);
+  // Map the cache of the source file if it exists and is up to date
+  static bool MapCache(const char name[], CacheView &view);
+
+  // Create the mesh from the full vertices, converting them to the requested format
+  template <class VertexType>
+  static Mesh<VertexType> *CreateMesh(const Vertex_Pos_Nrm_Tgt_Tex *vb, GLsizei numVertices, const GLuint *ib, GLsizei numIndices,
+                                      const MeshLod *lods, GLsizei numLods, bool positionStream);
+
+  // Vertex format conversions
+  static void ConvertVertex(const Vertex_Pos_Nrm_Tgt_Tex &in, Vertex_Pos &out) { out = {in.x, in.y, in.z}; }
+  static void ConvertVertex(const Vertex_Pos_Nrm_Tgt_Tex &in, Vertex_Pos_Col &out) { out = {in.x, in.y, in.z, in.nx * 0.5f + 0.5f, in.ny * 0.5f + 0.5f, in.nz * 0.5f + 0.5f}; }
+  static void ConvertVertex(const Vertex_Pos_Nrm_Tgt_Tex &in, Vertex_Pos_Tex &out) { out = {in.x, in.y, in.z, in.u, in.v}; }
+  static void ConvertVertex(const Vertex_Pos_Nrm_Tgt_Tex &in, Vertex_Pos_Nrm &out) { out = {in.x, in.y, in.z, in.nx, in.ny, in.nz}; }
+};
+
+template <class VertexType>
+Mesh<VertexType> *MeshImporter::CreateMesh(const Vertex_Pos_Nrm_Tgt_Tex *vb, GLsizei numVertices, const GLuint *ib, GLsizei numIndices,
+                                           const MeshLod *lods, GLsizei numLods, bool positionStream)
+{
+  std::vector<VertexType> converted(numVertices);
+  for (GLsizei i = 0; i < numVertices; ++i)
+  {
+    ConvertVertex(vb[i], converted[i]);
+  }
+
+  Mesh<VertexType> *mesh = new Mesh<VertexType>();
+  mesh->Init(converted.data(), numVertices, ib, numIndices, lods, numLods, positionStream);
+  return mesh;
+}
+
+// The full format goes straight from the mapping to the buffer storage
+template <>
+inline Mesh<Vertex_Pos_Nrm_Tgt_Tex> *MeshImporter::CreateMesh<Vertex_Pos_Nrm_Tgt_Tex>(const Vertex_Pos_Nrm_Tgt_Tex *vb, GLsizei numVertices, const GLuint *ib, GLsizei numIndices,
+                                                                                       const MeshLod *lods, GLsizei numLods, bool positionStream)
+{
+  Mesh<Vertex_Pos_Nrm_Tgt_Tex> *mesh = new Mesh<Vertex_Pos_Nrm_Tgt_Tex>();
+  mesh->Init(vb, numVertices, ib, numIndices, lods, numLods, positionStream);
+  return mesh;
+}
+
+template <class VertexType>
+Mesh<VertexType> *MeshImporter::LoadMesh(const char name[], glm::vec3 *boundsMin, glm::vec3 *boundsMax, std::vector<Meshlet> *meshlets, bool positionStream)
+{
+  typedef std::chrono::high_resolution_clock Clock;
+  Clock::time_point start = Clock::now();
+
+  // Up to date cache is mapped and uploaded without any parsing
+  CacheView view;
+  if (MapCache(name, view))
+  {
+    Mesh<VertexType> *mesh = CreateMesh<VertexType>(view.vertices, view.numVertices, view.indices, view.numIndices, view.lods, view.numLods, positionStream);
+    if (boundsMin)
+      *boundsMin = view.boundsMin;
+    if (boundsMax)
+      *boundsMax = view.boundsMax;
+    if (meshlets)
+      meshlets->assign(view.meshlets, view.meshlets + view.numMeshlets);
+    UnmapFile(view.file);
+
+    double time = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    printf("Loaded mesh %s from cache: %d vertices, %d triangles, %d LODs in %.2f ms\n", name, view.numVertices, mesh->GetIBOSize() / 3, view.numLods, time);
+    return mesh;
+  }
+
+  // Parse the source file
+  MeshData data;
+  if (!Import(name, data))
+    return nullptr;
+
+  double parseTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  printf("Parsed mesh %s: %d vertices, %d triangles, %d LODs in %.2f ms\n", name, (int)data.vertices.size(), data.lods[0].numIndices / 3, (int)data.lods.size(), parseTime);
+
+  // Next time we'll load it from the cache
+  WriteCache(name, data);
+
+  Mesh<VertexType> *mesh = CreateMesh<VertexType>(data.vertices.data(), (GLsizei)data.vertices.size(), data.indices.data(), (GLsizei)data.indices.size(),
+                                                  data.lods.data(), (GLsizei)data.lods.size(), positionStream);
+  if (boundsMin)
+    *boundsMin = data.boundsMin;
+  if (boundsMax)
+    *boundsMax = data.boundsMax;
+  if (meshlets)
+    *meshlets = data.meshlets;
+  return mesh;
+}
@@ -0,0 +1,193 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/gl.h>
+#include <cstdio>
+#include <vector>
+
+#include "Mesh.h"
+#include "ResourceRegistry.h"
+#include "Vertex.h"
+
+// Shared storage of meshes for vertex pulling: vertices of each format are stored one mesh after another in
+// a shader storage buffer of that format, indices of all meshes in a single index buffer. Vertex shaders read
+// the vertex at gl_VertexID which already includes the base vertex of the draw, so all the meshes are drawn with
+// a single VAO without any vertex attributes. Requires OpenGL 4.3.
+class MeshPool
+{
+public:
+  // Location of a mesh in the pool
+  struct Entry
+  {
+    // Vertex format of the mesh, selects the vertex buffer
+    int format;
+    // First index of the mesh in the shared index buffer, levels of detail are relative to it
+    GLuint firstIndex;
+    // Number of indices of the full detail level
+    GLsizei numIndices;
+    // Offset of the first mesh vertex in the buffer of its format
+    GLint baseVertex;
+  };
+
+  MeshPool() : _vao(0), _ibo(0), _numIndices(0), _vbos(), _numVertices() {}
+  ~MeshPool();
+
+  // Add the mesh to the pool, its buffers are copied in Create(), so it has to stay alive until then, returns
+  // the index of the mesh entry
+  template <class VertexType>
+  int Add(Mesh<VertexType> &mesh);
+  // Allocate the shared buffers and copy all the added meshes into them on the GPU
+  void Create();
+  // Bind the vertex buffer of each format to the shader storage buffer binding firstBinding + format
+  void BindVertexBuffers(GLuint firstBinding = 0);
+  // Return the VAO without vertex attributes, just the shared index buffer
+  GLuint GetVAO() { return _vao; }
+  // Return the shared index buffer
+  GLuint GetIBO() { return _ibo; }
+  // Return the vertex buffer of the given format, zero if no mesh uses it
+  GLuint GetVBO(int format) { return _vbos[format]; }
+  // Get the number of meshes in the pool
+  int GetEntryCount() { return (int)_entries.size(); }
+  // Get the location of the mesh in the pool
+  const Entry &GetEntry(int mesh) { return _entries[mesh]; }
+
+private:
+  // Mesh buffers waiting for the copy into the pool
+  struct Source
+  {
+    GLuint vbo;
+    GLuint ibo;
+    // Sizes in bytes of the whole buffers, i.e., including all the levels of detail
+    GLsizeiptr vboSize;
+    GLsizeiptr iboSize;
+  };
+
+  // Empty vertex array object with the shared index buffer
+  GLuint _vao;
+  // Shared index buffer
+  GLuint _ibo;
+  // Number of indices in the shared index buffer
+  GLsizei _numIndices;
+  // Vertex buffer per vertex format
+  GLuint _vbos[VertexFormat::NumFormats];
+  // Number of vertices per vertex format
+  GLsizei _numVertices[VertexFormat::NumFormats];
+  // Meshes in the pool
+  std::vector<Entry> _entries;
+  // Buffers of the meshes not copied yet
+  std::vector<Source> _sources;
+
+  // No copies allowed
+  MeshPool(const MeshPool &);
+  MeshPool & operator = (const MeshPool &);
+};
+
+inline MeshPool::~MeshPool()
+{
+  // Release resources used by the driver
+  glDeleteVertexArrays(1, &_vao);
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &_ibo);
+  ResourceRegistry::GetInstance().DeleteBuffers(VertexFormat::NumFormats, _vbos);
+}
+
+template <class VertexType>
+int MeshPool::Add(Mesh<VertexType> &mesh)
+{
+  // Whole index buffer including the levels of detail
+  GLint iboSize = 0;
+  glBindBuffer(GL_COPY_READ_BUFFER, mesh.GetIBO());
+  glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &iboSize);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+  // Mesh goes right after the previous mesh of the same format
+  Entry entry;
+  entry.format = VertexType::Format;
+  entry.firstIndex = _numIndices;
+  entry.numIndices = mesh.GetIBOSize();
+  entry.baseVertex = _numVertices[VertexType::Format];
+  _entries.push_back(entry);
+
+  _sources.push_back({mesh.GetVBO(), mesh.GetIBO(), (GLsizeiptr)(mesh.GetVBOSize() * sizeof(VertexType)), (GLsizeiptr)iboSize});
+
+  _numIndices += iboSize / sizeof(GLuint);
+  _numVertices[VertexType::Format] += mesh.GetVBOSize();
+
+  return (int)_entries.size() - 1;
+}
+
+inline void MeshPool::Create()
+{
+  // Do nothing if we're already created
+  if (_vao)
+    return;
+
+  // Sizes of the vertex formats in bytes
+  const GLsizeiptr vertexSizes[VertexFormat::NumFormats] =
+  {
+    sizeof(Vertex_Pos), sizeof(Vertex_Pos_Col), sizeof(Vertex_Pos_Tex), sizeof(Vertex_Pos_Nrm), sizeof(Vertex_Pos_Nrm_Tgt_Tex)
+  };
+
+  // Allocate the vertex buffers of the used formats
+  for (int format = 0; format < VertexFormat::NumFormats; ++format)
+  {
+    if (_numVertices[format] == 0)
+      continue;
+
+    glGenBuffers(1, &_vbos[format]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _vbos[format]);
+    glBufferData(GL_COPY_WRITE_BUFFER, _numVertices[format] * vertexSizes[format], nullptr, GL_STATIC_DRAW);
+    ResourceRegistry::GetInstance().TrackBuffer(_vbos[format], _numVertices[format] * vertexSizes[format], ResourceCategory::Meshes, "Mesh pool vertices");
+  }
+
+  // Create and bind the Vertex Array Object, there are no attributes, just the index buffer
+  glGenVertexArrays(1, &_vao);
+  glBindVertexArray(_vao);
+
+  glGenBuffers(1, &_ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, _numIndices * sizeof(GLuint), nullptr, GL_STATIC_DRAW);
+  ResourceRegistry::GetInstance().TrackBuffer(_ibo, _numIndices * sizeof(GLuint), ResourceCategory::Meshes, "Mesh pool indices");
+
+  // Unbind the VAO, the index buffer stays attached to it
+  glBindVertexArray(0);
+
+  // Copy the mesh buffers, indices stay relative to the mesh, base vertex of the draw offsets them
+  for (size_t i = 0; i < _entries.size(); ++i)
+  {
+    const Entry &entry = _entries[i];
+    const Source &source = _sources[i];
+
+    glBindBuffer(GL_COPY_READ_BUFFER, source.vbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _vbos[entry.format]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, entry.baseVertex * vertexSizes[entry.format], source.vboSize);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, source.ibo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _ibo);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, entry.firstIndex * sizeof(GLuint), source.iboSize);
+  }
+
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  // The meshes may be deleted from now on
+  _sources.clear();
+
+  GLsizeiptr vertexBytes = 0;
+  for (int format = 0; format < VertexFormat::NumFormats; ++format)
+    vertexBytes += _numVertices[format] * vertexSizes[format];
+
+  printf("Mesh pool: %d meshes, %.1f kB of vertices, %d indices\n", (int)_entries.size(), vertexBytes / 1024.0f, _numIndices);
+}
+
+inline void MeshPool::BindVertexBuffers(GLuint firstBinding)
+{
+  for (int format = 0; format < VertexFormat::NumFormats; ++format)
+  {
+    if (_vbos[format])
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, firstBinding + format, _vbos[format]);
+  }
+}
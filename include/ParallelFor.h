@@ -0,0 +1,38 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Runs func(begin, end) over chunks of the range [0, count) on all hardware threads
+template <typename Func>
+void parallelFor(size_t count, Func func, size_t minChunk = 4096)
+{
+  // Don't bother spawning threads for tiny chunks
+  size_t numThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+  numThreads = std::min(numThreads, (count + minChunk - 1) / minChunk);
+  if (numThreads <= 1)
+  {
+    func((size_t)0, count);
+    return;
+  }
+
+  // The calling thread takes the first chunk
+  size_t chunk = (count + numThreads - 1) / numThreads;
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads - 1);
+  for (size_t i = 1; i < numThreads; ++i)
+  {
+    size_t begin = std::min(count, i * chunk);
+    threads.emplace_back(func, begin, std::min(count, begin + chunk));
+  }
+
+  func((size_t)0, chunk);
+  for (std::thread &thread : threads)
+    thread.join();
+}
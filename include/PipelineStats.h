@@ -0,0 +1,124 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/gl.h>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class TextOverlay;
+
+// Per pass pipeline counters and GPU times: each BeginPass()/EndPass() pair is wrapped in a set of queries which are
+// read back a few frames later without stalling. The counters need ARB_pipeline_statistics_query or OpenGL 4.6,
+// without it only the primitives generated and samples passed are counted. Passes with the same name issued within
+// a frame, e.g., once per light, are summed up. Queries of a single target can't be active twice, i.e., passes don't
+// nest, an inner pass is counted as a part of the outer one, and the code inside them can't issue the counted queries.
+class PipelineStats
+{
+public:
+  // Counted values, the pipeline statistics ones come first
+  enum Counter
+  {
+    VerticesSubmitted,
+    PrimitivesSubmitted,
+    VertexShaderInvocations,
+    GeometryShaderInvocations,
+    GeometryShaderPrimitives,
+    ClippingInput,
+    ClippingOutput,
+    FragmentShaderInvocations,
+    ComputeShaderInvocations,
+    // Available everywhere
+    PrimitivesGenerated,
+    SamplesPassed,
+    NumCounters,
+    NumPipelineCounters = PrimitivesGenerated
+  };
+
+  // Results of a single pass in a frame
+  struct Pass
+  {
+    std::string name;
+    GLuint64 counters[NumCounters];
+    // GPU time in milliseconds
+    float time;
+    // Number of BeginPass() calls summed up
+    int instances;
+  };
+
+  // Get and create instance for this singleton
+  static PipelineStats &GetInstance();
+  // Short name of the counter for printing
+  static const char *GetCounterName(int counter);
+
+  // Start counting the pass, the name has to stay valid until the pass is read back, e.g., a string literal
+  void BeginPass(const char *name);
+  // Stop counting the current pass
+  void EndPass();
+  // Call once per frame, reads back the finished passes of the previous frames
+  void EndFrame();
+  // Release the queries
+  void Release();
+
+  // Are all the counters available, false if only the primitives generated and samples passed are counted
+  bool IsSupported();
+  // Passes of the last frame read back in their submission order
+  const std::vector<Pass> &GetPasses() const { return _passes; }
+  // Last value of the counter of the named pass read back, 0 if never measured
+  GLuint64 GetCounter(const char *name, int counter) const;
+  // Print the table of the last frame passes, unsupported counters are shown as '-'
+  void Print(TextOverlay &overlay) const;
+
+private:
+  // Timestamps before and after the counters
+  static const int NUM_QUERIES = NumCounters + 2;
+
+  // Pass waiting for its queries, unsupported counters are left unused
+  struct PendingPass
+  {
+    const char *name;
+    GLuint queries[NUM_QUERIES];
+    unsigned int frame;
+  };
+
+  // Support of the pipeline statistics
+  enum class Support
+  {
+    Unknown, None, Full
+  };
+
+  PipelineStats() : _support(Support::Unknown), _depth(0), _nestingReported(false), _frame(0), _resolvedFrame(0) {}
+  // No copies allowed
+  PipelineStats(const PipelineStats &);
+  PipelineStats & operator = (const PipelineStats &);
+
+  // Query targets of the counters
+  static GLenum GetTarget(int counter);
+  // Add the read back pass to the frame being resolved
+  void Accumulate(const PendingPass &pending);
+  // Publish the resolved frame
+  void FinishFrame();
+
+  Support _support;
+  // Number of BeginPass() calls without EndPass(), only the outermost pass is counted
+  int _depth;
+  bool _nestingReported;
+  // Passes in the submission order, the current one is at the back
+  std::deque<PendingPass> _pending;
+  // Sets of queries available for reuse, each query keeps its target once used
+  std::vector<PendingPass> _freeQueries;
+  // Frames ended so far
+  unsigned int _frame;
+  // Passes of the frame being read back and the frame itself
+  std::vector<Pass> _resolving;
+  unsigned int _resolvedFrame;
+  // Passes of the last read back frame
+  std::vector<Pass> _passes;
+  // Last values of all the passes ever read back by their names
+  std::unordered_map<std::string, Pass> _lastPasses;
+};
@@ -0,0 +1,160 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/gl.h>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Set to 0 to compile the instrumentation out
+#ifndef _ENABLE_PROFILING
+#define _ENABLE_PROFILING 1
+#endif
+
+#if _ENABLE_PROFILING
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+// Measure the CPU time of the enclosing scope, the name has to outlive the trace, e.g., a string literal
+#define PROFILE_SCOPE(name) Profiler::CpuScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+// Measure the CPU and GPU time of the enclosing scope, needs the OpenGL context
+#define PROFILE_GPU_SCOPE(name) Profiler::GpuScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_GPU_SCOPE(name) ((void)0)
+#endif
+
+// Timeline profiler exporting the Chrome trace event format: CPU scopes are written into per-thread ring buffers
+// without any locking, GPU scopes are measured by timestamp queries read back a few frames later and moved onto the CPU
+// clock using the GL_TIMESTAMP of the context. Capture() records the next frames and writes them into a JSON file
+// which can be opened in chrome://tracing or ui.perfetto.dev, GPU scopes are shown as a separate process.
+class Profiler
+{
+public:
+  // Number of events kept per thread, older ones are overwritten
+  static const int RING_SIZE = 1 << 16;
+  // Number of frames between the CPU and GPU clock calibrations
+  static const int CALIBRATION_FRAMES = 60;
+
+  // CPU scope recorded on destruction
+  class CpuScope
+  {
+  public:
+    CpuScope(const char *name) : _name(name), _begin(Now()) {}
+    ~CpuScope() { GetInstance().Record(_name, _begin, Now()); }
+
+  private:
+    const char *_name;
+    int64_t _begin;
+  };
+
+  // GPU scope, also recorded as a CPU scope of its submission
+  class GpuScope
+  {
+  public:
+    GpuScope(const char *name) : _cpu(name), _index(GetInstance().BeginGpuScope(name)) {}
+    ~GpuScope() { GetInstance().EndGpuScope(_index); }
+
+  private:
+    CpuScope _cpu;
+    size_t _index;
+  };
+
+  // Get and create instance for this singleton
+  static Profiler &GetInstance();
+  // Nanoseconds on the CPU clock since the profiler start
+  static int64_t Now();
+
+  // Name the calling thread in the trace
+  void SetThreadName(const char *name);
+  // Get a copy of the name living until the end of the program, e.g., for names built at runtime
+  const char *Intern(const std::string &name);
+  // Record a finished CPU scope of the calling thread
+  void Record(const char *name, int64_t begin, int64_t end);
+
+  // Call after presenting the frame on the OpenGL thread, reads back the finished GPU scopes and writes the capture
+  void EndFrame();
+  // Record the next frames into a trace file, it's written once their GPU scopes are finished too
+  void Capture(int numFrames);
+  // Is a capture in progress?
+  bool IsCapturing() const { return _captureEndFrame != 0; }
+  // Release the queries
+  void Release();
+
+private:
+  // Single finished scope
+  struct Event
+  {
+    const char *name;
+    int64_t begin;
+    int64_t end;
+  };
+
+  // Events of a single thread, written by the thread only, read during the capture
+  struct ThreadBuffer
+  {
+    int id;
+    std::string name;
+    // Number of events written so far, the ring index is head % RING_SIZE
+    std::atomic<uint64_t> head;
+    Event events[RING_SIZE];
+  };
+
+  // GPU scope waiting for its queries
+  struct PendingGpuScope
+  {
+    const char *name;
+    GLuint queries[2];
+    unsigned int frame;
+  };
+
+  Profiler() : _nextThreadId(1), _numResolved(0), _gpuHead(0), _frame(0), _gpuOffset(0), _captureBegin(0), _captureEnd(0), _captureEndFrame(0) {}
+  // No copies allowed
+  Profiler(const Profiler &);
+  Profiler & operator = (const Profiler &);
+
+  // Get the buffer of the calling thread, registers it on the first use
+  ThreadBuffer &GetThreadBuffer();
+  // Issue the begin timestamp, returns the scope index for EndGpuScope()
+  size_t BeginGpuScope(const char *name);
+  // Issue the end timestamp
+  void EndGpuScope(size_t index);
+  // Get a free query or create a new one
+  GLuint GetQuery();
+  // Measure the offset between the CPU and GPU clocks
+  void Calibrate();
+  // Write the captured events into the file
+  void WriteTrace(const char *fileName);
+
+  // Buffers of all threads, never released as the threads may still write into them
+  std::mutex _threadsMutex;
+  std::vector<ThreadBuffer*> _threads;
+  int _nextThreadId;
+  // Interned names
+  std::mutex _namesMutex;
+  std::unordered_set<std::string> _names;
+  // GPU scopes in the submission order, the ones issued this frame and the ones waiting for the results
+  std::deque<PendingGpuScope> _pending;
+  // Number of scopes removed from the front of the pending ones, scope indices count from the start
+  size_t _numResolved;
+  // Finished GPU scopes on the CPU clock, only touched by the OpenGL thread
+  std::vector<Event> _gpuEvents;
+  size_t _gpuHead;
+  // Queries available for reuse
+  std::vector<GLuint> _freeQueries;
+  // Frames ended so far
+  unsigned int _frame;
+  // CPU time minus GPU time in nanoseconds
+  int64_t _gpuOffset;
+  // Time range and the last frame of the capture in progress, the end time is set once the last frame ends
+  int64_t _captureBegin;
+  int64_t _captureEnd;
+  unsigned int _captureEndFrame;
+};
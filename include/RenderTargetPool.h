@@ -0,0 +1,112 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/gl.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Pool of framebuffer attachments keyed by their format, size and number of samples: the storage is rounded up to
+// whole size buckets so that small window resizes reuse it, released targets stay allocated for a while so that
+// switching back, e.g., MSAA on and off, doesn't allocate either. Window resizes are collected and applied at a frame
+// boundary only once the size hasn't changed for a while, dragging the window edge thus recreates the targets once,
+// resizes within the size buckets of the current targets are dropped as their storage still fits.
+// Targets are larger than the window, passes have to address them by the window size, e.g., gl_FragCoord.
+class RenderTargetPool
+{
+public:
+  // Granularity of the storage size in pixels
+  static const int SIZE_BUCKET = 128;
+  // Time the window size has to stay the same before the resize is applied in milliseconds
+  static const int RESIZE_DELAY = 200;
+  // Number of frames a released target is kept before its storage is deleted
+  static const unsigned int EVICT_FRAMES = 120;
+
+  // Get and create instance for this singleton
+  static RenderTargetPool &GetInstance();
+
+  // Get a 2D texture of at least the size, multisampled if samples > 1, a free matching one is reused
+  GLuint AcquireTexture(GLenum internalFormat, int width, int height, GLsizei samples, const char *owner);
+  // Get a renderbuffer of at least the size, a free matching one is reused
+  GLuint AcquireRenderbuffer(GLenum internalFormat, int width, int height, GLsizei samples, const char *owner);
+  // Return the target to the pool, 0 is ignored
+  void ReleaseTexture(GLuint texture);
+  void ReleaseRenderbuffer(GLuint renderbuffer);
+  // Delete all the targets
+  void Clear();
+
+  // Set the window size the targets are currently created for, e.g., at start up
+  void SetTargetSize(int width, int height);
+  // Record a window resize, only the last one before it's applied counts, sizes within the buckets of the target size
+  // cancel the pending resize
+  void RequestResize(int width, int height);
+  // Call once per frame before rendering, returns true with the size to recreate the targets for once the requests
+  // settle, deletes the targets released long enough ago
+  bool Update(int &width, int &height);
+
+  // Get the number of resize requests and applied resizes
+  int GetResizeRequestCount() const { return _numRequests; }
+  int GetResizeCount() const { return _numResizes; }
+  // Get the number of targets allocated, reused and deleted since the start
+  int GetAllocationCount() const { return _numAllocations; }
+  int GetReuseCount() const { return _numReuses; }
+  int GetEvictionCount() const { return _numEvictions; }
+  // Print the allocation churn and the targets held by the pool
+  void PrintStats();
+
+private:
+  // Single pooled target
+  struct Entry
+  {
+    GLuint name;
+    bool renderbuffer;
+    GLenum internalFormat;
+    // Size of the storage, rounded up to the buckets
+    int width;
+    int height;
+    GLsizei samples;
+    std::string owner;
+    // Released targets can be reused, they're deleted EVICT_FRAMES after being released
+    bool free;
+    unsigned int releaseFrame;
+  };
+
+  typedef std::chrono::steady_clock Clock;
+
+  RenderTargetPool();
+  // No copies allowed
+  RenderTargetPool(const RenderTargetPool &);
+  RenderTargetPool & operator = (const RenderTargetPool &);
+
+  // Find a free matching target or create a new one
+  GLuint Acquire(bool renderbuffer, GLenum internalFormat, int width, int height, GLsizei samples, const char *owner);
+  // Mark the target free
+  void Release(bool renderbuffer, GLuint name);
+  // Delete the storage of the target
+  static void Delete(const Entry &entry);
+  // Round the size up to the bucket
+  static int RoundUp(int size) { return ((size > 0 ? size : 1) + SIZE_BUCKET - 1) / SIZE_BUCKET * SIZE_BUCKET; }
+
+  // All the targets, the pool only holds a few
+  std::vector<Entry> _entries;
+  // Frames since the start
+  unsigned int _frame;
+  // Window size the targets are created for
+  int _targetWidth;
+  int _targetHeight;
+  // Pending resize and the time of its last request
+  bool _resizePending;
+  int _resizeWidth;
+  int _resizeHeight;
+  Clock::time_point _resizeTime;
+  // Churn statistics
+  int _numRequests;
+  int _numResizes;
+  int _numAllocations;
+  int _numReuses;
+  int _numEvictions;
+};
@@ -0,0 +1,350 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/gl.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+// GL_NVX_gpu_memory_info and GL_ATI_meminfo tokens, our core profile loader doesn't provide them
+#ifndef GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX
+#define GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX 0x9048
+#define GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#endif
+#ifndef GL_TEXTURE_FREE_MEMORY_ATI
+#define GL_TEXTURE_FREE_MEMORY_ATI 0x87FC
+#endif
+
+// Categories of the tracked GPU memory
+namespace ResourceCategory
+{
+  enum
+  {
+    // Framebuffer attachments, i.e., HDR and MSAA targets, GBuffers and depth buffers
+    RenderTargets,
+    // Sampled textures
+    Textures,
+    // Vertex and index buffers
+    Meshes,
+    // Uniform, shader storage, indirect and pixel buffers
+    Buffers,
+    NumCategories
+  };
+}
+
+// Registry of the GPU memory allocated by the labs: buffers, textures and renderbuffers are registered together with
+// their owner right after their storage is specified and unregistered when they're deleted through the registry. Texture
+// sizes are computed from the GL state including all the mip levels, layers, cube faces and MSAA samples. The sizes are
+// nominal, i.e., without any padding or alignment the driver may add.
+class ResourceRegistry
+{
+public:
+  // Get and create instance for this singleton
+  static ResourceRegistry &GetInstance();
+
+  // Register the buffer of the given size, call again whenever its storage is respecified
+  void TrackBuffer(GLuint buffer, GLsizeiptr size, int category, const char *owner);
+  // Register the texture with its size read from the GL state, call again whenever its storage is respecified
+  void TrackTexture(GLuint texture, GLenum target, int category, const char *owner);
+  // Register the renderbuffer with its size read from the GL state, call again whenever its storage is respecified
+  void TrackRenderbuffer(GLuint renderbuffer, int category, const char *owner);
+  // Unregister and delete the resources, untracked names are just deleted
+  void DeleteBuffers(GLsizei n, const GLuint *buffers);
+  void DeleteTextures(GLsizei n, const GLuint *textures);
+  void DeleteRenderbuffers(GLsizei n, const GLuint *renderbuffers);
+
+  // Get the current and peak memory of the category in bytes
+  size_t GetTotal(int category) const { return _totals[category]; }
+  size_t GetPeak(int category) const { return _peaks[category]; }
+  // Get the current and peak memory of all the categories in bytes
+  size_t GetTotal() const { return _total; }
+  size_t GetPeak() const { return _peak; }
+  // Get the available and total video memory in kB reported by the driver, false if neither GL_NVX_gpu_memory_info
+  // nor GL_ATI_meminfo is supported, ATI doesn't report the total
+  bool QueryDriverMemory(GLint &availableKB, GLint &totalKB);
+  // Print the current and peak memory per category and the current memory per owner
+  void PrintReport();
+
+private:
+  // Single registered resource
+  struct Allocation
+  {
+    size_t size;
+    int category;
+    std::string owner;
+  };
+
+  // Driver memory extensions
+  enum class DriverMemory
+  {
+    Unknown, None, NVX, ATI
+  };
+
+  ResourceRegistry() : _totals(), _peaks(), _total(0), _peak(0), _driverMemory(DriverMemory::Unknown) {}
+  // No copies allowed
+  ResourceRegistry(const ResourceRegistry &);
+  ResourceRegistry & operator = (const ResourceRegistry &);
+
+  // Add or replace the allocation and update the totals and peaks
+  void Track(std::unordered_map<GLuint, Allocation> &allocations, GLuint name, size_t size, int category, const char *owner);
+  // Remove the allocation and update the totals
+  void Release(std::unordered_map<GLuint, Allocation> &allocations, GLuint name);
+  // Bytes per texel or pixel from the component sizes of the bound texture level or renderbuffer
+  static size_t GetTexelSize(GLint red, GLint green, GLint blue, GLint alpha, GLint depth, GLint stencil, GLint shared);
+
+  // Registered resources by their names
+  std::unordered_map<GLuint, Allocation> _buffers;
+  std::unordered_map<GLuint, Allocation> _textures;
+  std::unordered_map<GLuint, Allocation> _renderbuffers;
+  // Current and peak memory per category and in total
+  size_t _totals[ResourceCategory::NumCategories];
+  size_t _peaks[ResourceCategory::NumCategories];
+  size_t _total;
+  size_t _peak;
+  // Supported driver memory extension, checked on the first query
+  DriverMemory _driverMemory;
+};
+
+inline ResourceRegistry &ResourceRegistry::GetInstance()
+{
+  // Never destroyed, resources released during the static destruction, e.g., by the scene singletons, may still use it
+  static ResourceRegistry *instance = new ResourceRegistry();
+  return *instance;
+}
+
+inline void ResourceRegistry::Track(std::unordered_map<GLuint, Allocation> &allocations, GLuint name, size_t size, int category, const char *owner)
+{
+  if (!name)
+    return;
+
+  Release(allocations, name);
+  allocations[name] = {size, category, owner};
+
+  _totals[category] += size;
+  _peaks[category] = std::max(_peaks[category], _totals[category]);
+  _total += size;
+  _peak = std::max(_peak, _total);
+}
+
+inline void ResourceRegistry::Release(std::unordered_map<GLuint, Allocation> &allocations, GLuint name)
+{
+  auto it = allocations.find(name);
+  if (it == allocations.end())
+    return;
+
+  _totals[it->second.category] -= it->second.size;
+  _total -= it->second.size;
+  allocations.erase(it);
+}
+
+inline size_t ResourceRegistry::GetTexelSize(GLint red, GLint green, GLint blue, GLint alpha, GLint depth, GLint stencil, GLint shared)
+{
+  return (size_t)(red + green + blue + alpha + depth + stencil + shared + 7) / 8;
+}
+
+inline void ResourceRegistry::TrackBuffer(GLuint buffer, GLsizeiptr size, int category, const char *owner)
+{
+  Track(_buffers, buffer, (size_t)size, category, owner);
+}
+
+inline void ResourceRegistry::TrackTexture(GLuint texture, GLenum target, int category, const char *owner)
+{
+  // Query the texture bound to its target, the previous binding is restored afterwards
+  GLenum bindingQuery;
+  switch (target)
+  {
+  case GL_TEXTURE_1D: bindingQuery = GL_TEXTURE_BINDING_1D; break;
+  case GL_TEXTURE_1D_ARRAY: bindingQuery = GL_TEXTURE_BINDING_1D_ARRAY; break;
+  case GL_TEXTURE_2D_ARRAY: bindingQuery = GL_TEXTURE_BINDING_2D_ARRAY; break;
+  case GL_TEXTURE_2D_MULTISAMPLE: bindingQuery = GL_TEXTURE_BINDING_2D_MULTISAMPLE; break;
+  case GL_TEXTURE_2D_MULTISAMPLE_ARRAY: bindingQuery = GL_TEXTURE_BINDING_2D_MULTISAMPLE_ARRAY; break;
+  case GL_TEXTURE_3D: bindingQuery = GL_TEXTURE_BINDING_3D; break;
+  case GL_TEXTURE_CUBE_MAP: bindingQuery = GL_TEXTURE_BINDING_CUBE_MAP; break;
+  case GL_TEXTURE_RECTANGLE: bindingQuery = GL_TEXTURE_BINDING_RECTANGLE; break;
+  default: bindingQuery = GL_TEXTURE_BINDING_2D; break;
+  }
+
+  GLint previous = 0;
+  glGetIntegerv(bindingQuery, &previous);
+  glBindTexture(target, texture);
+
+  // Levels may be missing in between, e.g., the streamed ones, so all the possible levels are checked
+  GLint maxSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+  int maxLevels = 1;
+  while ((maxSize >> maxLevels) > 0)
+    ++maxLevels;
+
+  const bool multisample = target == GL_TEXTURE_2D_MULTISAMPLE || target == GL_TEXTURE_2D_MULTISAMPLE_ARRAY;
+  const int numLevels = multisample ? 1 : maxLevels;
+  const int numFaces = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+
+  size_t size = 0;
+  for (int face = 0; face < numFaces; ++face)
+  {
+    const GLenum levelTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target;
+    for (int level = 0; level < numLevels; ++level)
+    {
+      GLint width = 0, height = 0, depth = 0;
+      glGetTexLevelParameteriv(levelTarget, level, GL_TEXTURE_WIDTH, &width);
+      glGetTexLevelParameteriv(levelTarget, level, GL_TEXTURE_HEIGHT, &height);
+      glGetTexLevelParameteriv(levelTarget, level, GL_TEXTURE_DEPTH, &depth);
+      if (width == 0 || height == 0 || depth == 0)
+        continue;
+
+      GLint compressed = GL_FALSE;
+      glGetTexLevelParameteriv(levelTarget, level, GL_TEXTURE_COMPRESSED, &compressed);
+      if (compressed)
+      {
+        GLint imageSize = 0;
+        glGetTexLevelParameteriv(levelTarget, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &imageSize);
+        size += (size_t)imageSize;
+        continue;
+      }
+
+      GLint sizes[7] = {0};
+      const GLenum sizeQueries[7] =
+      {
+        GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE, GL_TEXTURE_ALPHA_SIZE,
+        GL_TEXTURE_DEPTH_SIZE, GL_TEXTURE_STENCIL_SIZE, GL_TEXTURE_SHARED_SIZE
+      };
+      for (int i = 0; i < 7; ++i)
+        glGetTexLevelParameteriv(levelTarget, level, sizeQueries[i], &sizes[i]);
+
+      GLint samples = 0;
+      if (multisample)
+        glGetTexLevelParameteriv(levelTarget, level, GL_TEXTURE_SAMPLES, &samples);
+
+      size += (size_t)width * height * depth * std::max(samples, 1) *
+              GetTexelSize(sizes[0], sizes[1], sizes[2], sizes[3], sizes[4], sizes[5], sizes[6]);
+    }
+  }
+
+  glBindTexture(target, (GLuint)previous);
+
+  Track(_textures, texture, size, category, owner);
+}
+
+inline void ResourceRegistry::TrackRenderbuffer(GLuint renderbuffer, int category, const char *owner)
+{
+  GLint previous = 0;
+  glGetIntegerv(GL_RENDERBUFFER_BINDING, &previous);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+
+  GLint width = 0, height = 0, samples = 0;
+  glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_WIDTH, &width);
+  glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_HEIGHT, &height);
+  glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_SAMPLES, &samples);
+
+  GLint sizes[6] = {0};
+  const GLenum sizeQueries[6] =
+  {
+    GL_RENDERBUFFER_RED_SIZE, GL_RENDERBUFFER_GREEN_SIZE, GL_RENDERBUFFER_BLUE_SIZE, GL_RENDERBUFFER_ALPHA_SIZE,
+    GL_RENDERBUFFER_DEPTH_SIZE, GL_RENDERBUFFER_STENCIL_SIZE
+  };
+  for (int i = 0; i < 6; ++i)
+    glGetRenderbufferParameteriv(GL_RENDERBUFFER, sizeQueries[i], &sizes[i]);
+
+  glBindRenderbuffer(GL_RENDERBUFFER, (GLuint)previous);
+
+  const size_t size = (size_t)width * height * std::max(samples, 1) * GetTexelSize(sizes[0], sizes[1], sizes[2], sizes[3], sizes[4], sizes[5], 0);
+  Track(_renderbuffers, renderbuffer, size, category, owner);
+}
+
+inline void ResourceRegistry::DeleteBuffers(GLsizei n, const GLuint *buffers)
+{
+  for (GLsizei i = 0; i < n; ++i)
+    Release(_buffers, buffers[i]);
+  glDeleteBuffers(n, buffers);
+}
+
+inline void ResourceRegistry::DeleteTextures(GLsizei n, const GLuint *textures)
+{
+  for (GLsizei i = 0; i < n; ++i)
+    Release(_textures, textures[i]);
+  glDeleteTextures(n, textures);
+}
+
+inline void ResourceRegistry::DeleteRenderbuffers(GLsizei n, const GLuint *renderbuffers)
+{
+  for (GLsizei i = 0; i < n; ++i)
+    Release(_renderbuffers, renderbuffers[i]);
+  glDeleteRenderbuffers(n, renderbuffers);
+}
+
+inline bool ResourceRegistry::QueryDriverMemory(GLint &availableKB, GLint &totalKB)
+{
+  // Look the extensions up just once, our loader doesn't check them
+  if (_driverMemory == DriverMemory::Unknown)
+  {
+    _driverMemory = DriverMemory::None;
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; i < numExtensions; ++i)
+    {
+      const char *extension = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+      if (strcmp(extension, "GL_NVX_gpu_memory_info") == 0)
+        _driverMemory = DriverMemory::NVX;
+      else if (strcmp(extension, "GL_ATI_meminfo") == 0 && _driverMemory == DriverMemory::None)
+        _driverMemory = DriverMemory::ATI;
+    }
+  }
+
+  switch (_driverMemory)
+  {
+  case DriverMemory::NVX:
+    glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &availableKB);
+    glGetIntegerv(GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX, &totalKB);
+    return true;
+
+  case DriverMemory::ATI:
+  {
+    // Total free memory, largest free block, total and largest free auxiliary memory
+    GLint info[4] = {0};
+    glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, info);
+    availableKB = info[0];
+    totalKB = 0;
+    return true;
+  }
+
+  default:
+    return false;
+  }
+}
+
+inline void ResourceRegistry::PrintReport()
+{
+  static const char *categoryNames[ResourceCategory::NumCategories] = {"Render targets", "Textures", "Meshes", "Buffers"};
+  const float MB = 1024.0f * 1024.0f;
+
+  printf("GPU memory: %.1f MB, peak %.1f MB\n", _total / MB, _peak / MB);
+  for (int category = 0; category < ResourceCategory::NumCategories; ++category)
+    printf("  %-16s %8.1f MB, peak %8.1f MB\n", categoryNames[category], _totals[category] / MB, _peaks[category] / MB);
+
+  // Current memory per owner, sorted by the name
+  std::map<std::string, size_t> owners;
+  for (const std::unordered_map<GLuint, Allocation> *allocations : {&_buffers, &_textures, &_renderbuffers})
+  {
+    for (const auto &allocation : *allocations)
+      owners[allocation.second.owner] += allocation.second.size;
+  }
+
+  for (const auto &owner : owners)
+    printf("    %-32s %8.2f MB\n", owner.first.c_str(), owner.second / MB);
+
+  GLint availableKB = 0, totalKB = 0;
+  if (QueryDriverMemory(availableKB, totalKB))
+  {
+    if (totalKB > 0)
+      printf("  Driver reports %.1f MB available of %.1f MB\n", availableKB / 1024.0f, totalKB / 1024.0f);
+    else
+      printf("  Driver reports %.1f MB available\n", availableKB / 1024.0f);
+  }
+}
@@ -0,0 +1,124 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/gl.h>
+#include <cfloat>
+#include <cstdio>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "Vertex.h"
+
+// Builder of static geometry batches: instances of static meshes sharing a material are pre-transformed to world
+// space and merged into a single mesh, so the whole batch costs one draw per pass without any per instance data.
+// Meant for the level geometry that never moves, the batch is drawn with the identity model to world transformation.
+template <class VertexType>
+class StaticBatch
+{
+public:
+  StaticBatch() : _boundsMin(FLT_MAX), _boundsMax(-FLT_MAX), _numInstances(0) {}
+
+  // Add an instance of the mesh given by its CPU side vertex and index buffers, e.g., from the Geometry builders
+  void Add(const std::vector<VertexType> &vb, const std::vector<GLuint> &ib, const glm::mat4x4 &transformation);
+  // Create the merged mesh, optionally with a position only stream, and release the CPU side data, returns nullptr if
+  // nothing was added
+  Mesh<VertexType> *Create(bool positionStream = false);
+  // Return the world space bounding box of the batch for culling
+  const glm::vec3 &GetBoundsMin() const { return _boundsMin; }
+  const glm::vec3 &GetBoundsMax() const { return _boundsMax; }
+
+private:
+  // Merged world space vertices
+  std::vector<VertexType> _vertices;
+  // Merged indices, already offset to the merged vertices
+  std::vector<GLuint> _indices;
+  // World space bounding box
+  glm::vec3 _boundsMin;
+  glm::vec3 _boundsMax;
+  // Number of added instances
+  int _numInstances;
+
+  // Vertex format transformations, directions use the normal transformation matrix
+  static void TransformVertex(Vertex_Pos &v, const glm::mat4x4 &m, const glm::mat3 &n) { TransformPosition(v, m); }
+  static void TransformVertex(Vertex_Pos_Col &v, const glm::mat4x4 &m, const glm::mat3 &n) { TransformPosition(v, m); }
+  static void TransformVertex(Vertex_Pos_Tex &v, const glm::mat4x4 &m, const glm::mat3 &n) { TransformPosition(v, m); }
+  static void TransformVertex(Vertex_Pos_Nrm &v, const glm::mat4x4 &m, const glm::mat3 &n);
+  static void TransformVertex(Vertex_Pos_Nrm_Tgt_Tex &v, const glm::mat4x4 &m, const glm::mat3 &n);
+
+  template <class V>
+  static void TransformPosition(V &v, const glm::mat4x4 &m)
+  {
+    glm::vec3 p = glm::vec3(m * glm::vec4(v.x, v.y, v.z, 1.0f));
+    v.x = p.x; v.y = p.y; v.z = p.z;
+  }
+};
+
+template <class VertexType>
+void StaticBatch<VertexType>::TransformVertex(Vertex_Pos_Nrm &v, const glm::mat4x4 &m, const glm::mat3 &n)
+{
+  TransformPosition(v, m);
+  glm::vec3 normal = glm::normalize(n * glm::vec3(v.nx, v.ny, v.nz));
+  v.nx = normal.x; v.ny = normal.y; v.nz = normal.z;
+}
+
+template <class VertexType>
+void StaticBatch<VertexType>::TransformVertex(Vertex_Pos_Nrm_Tgt_Tex &v, const glm::mat4x4 &m, const glm::mat3 &n)
+{
+  TransformPosition(v, m);
+  glm::vec3 normal = glm::normalize(n * glm::vec3(v.nx, v.ny, v.nz));
+  glm::vec3 tangent = glm::normalize(glm::mat3(m) * glm::vec3(v.tx, v.ty, v.tz));
+  v.nx = normal.x; v.ny = normal.y; v.nz = normal.z;
+  v.tx = tangent.x; v.ty = tangent.y; v.tz = tangent.z;
+}
+
+template <class VertexType>
+void StaticBatch<VertexType>::Add(const std::vector<VertexType> &vb, const std::vector<GLuint> &ib, const glm::mat4x4 &transformation)
+{
+  // Transform the vertices and grow the bounding box
+  const glm::mat3 normalTransform = glm::transpose(glm::inverse(glm::mat3(transformation)));
+  const size_t firstVertex = _vertices.size();
+  _vertices.insert(_vertices.end(), vb.begin(), vb.end());
+  for (size_t i = firstVertex; i < _vertices.size(); ++i)
+  {
+    VertexType &vertex = _vertices[i];
+    TransformVertex(vertex, transformation, normalTransform);
+    _boundsMin = glm::min(_boundsMin, glm::vec3(vertex.x, vertex.y, vertex.z));
+    _boundsMax = glm::max(_boundsMax, glm::vec3(vertex.x, vertex.y, vertex.z));
+  }
+
+  // Mirroring transformations flip the winding, swap two indices of each triangle to keep it
+  const bool flip = glm::determinant(glm::mat3(transformation)) < 0.0f;
+  const GLuint baseVertex = (GLuint)firstVertex;
+  for (size_t i = 0; i + 2 < ib.size(); i += 3)
+  {
+    _indices.push_back(baseVertex + ib[i]);
+    _indices.push_back(baseVertex + ib[flip ? i + 2 : i + 1]);
+    _indices.push_back(baseVertex + ib[flip ? i + 1 : i + 2]);
+  }
+
+  ++_numInstances;
+}
+
+template <class VertexType>
+Mesh<VertexType> *StaticBatch<VertexType>::Create(bool positionStream)
+{
+  if (_indices.empty())
+    return nullptr;
+
+  Mesh<VertexType> *mesh = new Mesh<VertexType>();
+  mesh->Init(_vertices, _indices, positionStream);
+
+  printf("Static batch: %d instances merged, %d vertices, %d triangles\n", _numInstances, (int)_vertices.size(), (int)_indices.size() / 3);
+
+  // Release the CPU side data
+  std::vector<VertexType>().swap(_vertices);
+  std::vector<GLuint>().swap(_indices);
+  _numInstances = 0;
+
+  return mesh;
+}
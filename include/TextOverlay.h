@@ -0,0 +1,58 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/gl.h>
+#include <string>
+#include <vector>
+
+// On-screen text drawn over the frame, e.g., statistics HUD: the text is collected with printf-like calls during the
+// frame and drawn in a single instanced draw, one instance per character cell. Glyphs come from a small built-in 5x8
+// bitmap font stored in a texture atlas, every cell is drawn over a translucent background so that the text stays
+// readable over the scene. Only printable ASCII characters are supported, others are drawn as '?'.
+class TextOverlay
+{
+public:
+  // Size of a glyph and of the whole character cell including the spacing in pixels
+  static const int GLYPH_WIDTH = 5;
+  static const int GLYPH_HEIGHT = 8;
+  static const int CELL_WIDTH = 6;
+  static const int CELL_HEIGHT = 10;
+  // Maximum number of character cells drawn, the rest of the text is cut off
+  static const int MAX_CELLS = 8192;
+
+  TextOverlay();
+
+  // Create the font atlas, instance buffer, and the shader program, needs at least an OpenGL 3.3 context
+  bool Init();
+  // Release the OpenGL objects
+  void Release();
+
+  // Discard the text collected so far
+  void Clear() { _text.clear(); }
+  // Append the formatted text, '\n' starts a new line
+  void Print(const char *format, ...);
+  // Draw the text into the top left corner of the bound framebuffer of the given size, scale multiplies the cell size
+  void Draw(int width, int height, int scale);
+
+private:
+  // No copies allowed
+  TextOverlay(const TextOverlay &);
+  TextOverlay & operator = (const TextOverlay &);
+
+  // Text of the current frame
+  std::string _text;
+  // Packed cells of the last draw: column, row, and glyph index
+  std::vector<GLuint> _cells;
+  // Font atlas with all the glyphs in a single row
+  GLuint _fontTexture;
+  // Per cell instance buffer and its vertex array
+  GLuint _cellBuffer;
+  GLuint _vao;
+  GLuint _program;
+  GLint _viewportLocation;
+  GLint _scaleLocation;
+};
@@ -6,6 +6,12 @@
 #pragma once
 
 #include <glad/gl.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 #include <glm/glm.hpp>
 
 enum class Sampler : int
@@ -13,6 +19,15 @@ enum class Sampler : int
 	Nearest, Bilinear, Trilinear, Anisotropic, AnisotropicClamp, AnisotropicMirrored, NumSamplers
 };
 
+// Filters for the mip level generation
+enum class MipFilter : int
+{
+	// 2x2 average, keeps hard edges without ringing
+	Box,
+	// Kaiser windowed sinc, sharper levels for photographs
+	Kaiser
+};
+
 // Class for handling texture and sampler creation
 class Textures
 {
@@ -23,14 +38,90 @@ public:
 	static GLuint CreateCheckerBoardTexture(unsigned int textureSize, unsigned int checkerSize, glm::vec3 oddColor = glm::vec3(0.15f, 0.15f, 0.6f), glm::vec3 evenColor = glm::vec3(0.85f, 0.75f, 0.3f), bool sRGB = true);
 	// Create single color texture for default usage
 	static GLuint CreateSingleColorTexture(unsigned char r, unsigned char g, unsigned char b);
-	// Load texture from file stored on the disk
-	static GLuint LoadTexture(const char name[], bool sRGB);
+	// Load texture from file stored on the disk, mip levels are generated on the CPU and cached in a file next to the image,
+	// normal map levels are renormalized, the generation and upload times are printed separately
+	static GLuint LoadTexture(const char name[], bool sRGB, bool normalMap = false, MipFilter filter = MipFilter::Kaiser);
+	// Generate all mip levels of the 8-bit image on multiple threads, color channels of sRGB images are filtered in linear
+	// space, normals are renormalized, returns the levels packed from the finest one, i.e., the image itself
+	static std::vector<unsigned char> GenerateMipmaps(const unsigned char* image, int width, int height, int channels, bool sRGB, bool normalMap, MipFilter filter, int& numLevels);
+	// Create texture array with a layer per texture, the layers take the size of the largest texture, smaller ones are
+	// upscaled with nearest filtering, so power of two textures stay pixel exact, the mip levels of the source textures are
+	// copied as well, the source textures may be deleted afterwards. If layers and constants are given, single texel
+	// textures get no layer: their layer is -1 and their decoded color is returned in constants, the other textures get
+	// consecutive layers, returns 0 if there are only constants
+	static GLuint CreateTextureArray(const GLuint textures[], GLsizei numTextures, GLenum internalFormat, GLint layers[] = nullptr, glm::vec4 constants[] = nullptr);
 	// Create all samplers
 	void CreateSamplers();
 	// Get sampler
 	GLuint GetSampler(Sampler sampler);
 
+	// Levels up to this size in texels are resident all the time, see LoadStreamedTexture()
+	static const int STREAMING_TAIL_SIZE = 128;
+	// Number of frames the finer levels stay resident after they were requested the last time
+	static const unsigned int STREAMING_GRACE_FRAMES = 120;
+	// Default memory budget of all streamed textures in bytes
+	static const size_t STREAMING_BUDGET = 64 * 1024 * 1024;
+
+	// Load texture with streamed mip levels: only the tail levels are loaded right away, finer levels are loaded by
+	// a background thread once they are requested, the levels are cached in a file next to the image so that each
+	// of them can be read separately, GL_TEXTURE_BASE_LEVEL points to the finest resident level
+	GLuint LoadStreamedTexture(const char name[], bool sRGB, bool normalMap = false, MipFilter filter = MipFilter::Kaiser);
+	// Delete the streamed texture, levels still being loaded are thrown away
+	void DeleteStreamedTexture(GLuint texture);
+	// Request the level needed for an object spanning uvExtent in texture coordinates and screenExtent pixels on the
+	// screen, i.e., given by its UV density and screen size, the finest level requested since the last update wins
+	void RequestStreamedLevel(GLuint texture, float uvExtent, float screenExtent);
+	// Upload the levels loaded in the meantime, drop the levels which are no longer needed and request the missing
+	// ones, least recently used textures are demoted when the budget is exceeded, call once per frame
+	void UpdateStreaming();
+	// Set memory budget of all streamed textures in bytes, the tail levels are always resident regardless
+	void SetStreamingBudget(size_t budget) { _streamingBudget = budget; }
+	// Get memory used by the streamed textures and their budget in MB
+	float GetStreamingMemory() const { return _streamingMemory / (1024.0f * 1024.0f); }
+	float GetStreamingBudget() const { return _streamingBudget / (1024.0f * 1024.0f); }
+	// Get number of levels being loaded
+	int GetStreamingPending() const { return _streamingPending; }
+
 private:
+	// Texture with streamed mip levels
+	struct StreamedTexture
+	{
+		// Unique identifier, texture names may be reused while a level is being loaded
+		unsigned int id;
+		GLuint texture;
+		// Source image, owner of the texture memory
+		std::string name;
+		// Level cache file and offsets of the levels in it, one extra for the end of the last level
+		std::string cacheFile;
+		std::vector<size_t> levelOffsets;
+		// Texture format
+		GLenum internalFormat;
+		GLenum format;
+		int width, height, numLevels;
+		// Finest resident level and the finest one of the tail
+		int residentLevel, tailLevel;
+		// Finest level requested since the last update, numLevels if none
+		int requestedLevel;
+		// Finest level requested within the last STREAMING_GRACE_FRAMES
+		int wantedLevel;
+		// Frame the wanted level was requested in the last time
+		unsigned int lastUsed;
+		// Level residentLevel - 1 at the time of the request is being loaded
+		bool loading;
+		// Memory of the level being loaded reserved in the pending memory, the resident levels may change meanwhile
+		size_t loadingMemory;
+	};
+
+	// Level read by the background thread
+	struct StreamedLevel
+	{
+		unsigned int id;
+		int level;
+		std::string cacheFile;
+		size_t offset;
+		std::vector<unsigned char> data;
+	};
+
 	// All is private, instance is created in GetInstance()
 	Textures();
 	~Textures();
@@ -38,8 +129,41 @@ private:
 	Textures(const Textures&);
 	Textures& operator = (const Textures&);
 
+	// Get the streamed texture of the given name or id, nullptr if there is none
+	StreamedTexture* FindStreamedTexture(GLuint texture);
+	StreamedTexture* FindStreamedTextureById(unsigned int id);
+	// Memory of the level in bytes, RGB is expected to be padded to RGBA by the driver
+	static size_t GetLevelMemory(const StreamedTexture& streamed, int level);
+	// Upload the level from the cache file data and make it the finest resident one
+	void UploadStreamedLevel(StreamedTexture& streamed, int level, const unsigned char* data);
+	// Release the levels finer than the given one
+	void DropStreamedLevels(StreamedTexture& streamed, int level);
+	// Background thread loop reading the requested levels
+	void StreamingLoop();
+
 	// All available texture samplers
 	GLuint _samplers[(int)Sampler::NumSamplers];
+
+	// Streamed textures
+	std::vector<StreamedTexture> _streamed;
+	// Last streamed texture id
+	unsigned int _streamedId;
+	// Number of UpdateStreaming() calls
+	unsigned int _streamingFrame;
+	// Memory of the resident levels, of the levels being loaded, and the budget in bytes
+	size_t _streamingMemory;
+	size_t _streamingPendingMemory;
+	size_t _streamingBudget;
+	// Number of levels being loaded
+	int _streamingPending;
+
+	// Background thread and its queues
+	std::thread _streamingThread;
+	std::mutex _streamingMutex;
+	std::condition_variable _streamingCondition;
+	std::deque<StreamedLevel> _streamingRequests;
+	std::deque<StreamedLevel> _streamingLoaded;
+	bool _streamingQuit;
 };
 
 inline GLuint Textures::GetSampler(Sampler sampler)
@@ -7,12 +7,24 @@
 
 #include <glad/gl.h>
 
+// Vertex formats, used to select the vertex pulling buffer of each format, see MeshPool
+namespace VertexFormat
+{
+  enum
+  {
+    Pos, Pos_Col, Pos_Tex, Pos_Nrm, Pos_Nrm_Tgt_Tex, NumFormats
+  };
+}
+
 // Vertex containing vec3 position
 struct Vertex_Pos
 {
   // Position
   float x, y, z;
 
+  // Format identifier
+  static const int Format = VertexFormat::Pos;
+
   static void BindVertexAttributes()
   {
     // Positions: 3 floats, stride = 3 * sizeof(float), offset = 0
@@ -29,6 +41,9 @@ struct Vertex_Pos_Col
   // Vertex color
   float r, g, b;
 
+  // Format identifier
+  static const int Format = VertexFormat::Pos_Col;
+
   static void BindVertexAttributes()
   {
     // Positions: 3 floats, stride = 6 * sizeof(float), offset = 0
@@ -48,6 +63,9 @@ struct Vertex_Pos_Tex
   // Texture coordinates
   float u, v;
 
+  // Format identifier
+  static const int Format = VertexFormat::Pos_Tex;
+
   static void BindVertexAttributes()
   {
     // Positions: 3 floats, stride = 5 * sizeof(float), offset = 0
@@ -67,6 +85,9 @@ struct Vertex_Pos_Nrm
   // Normal
   float nx, ny, nz;
 
+  // Format identifier
+  static const int Format = VertexFormat::Pos_Nrm;
+
   static void BindVertexAttributes()
   {
     // Positions: 3 floats, stride = 6 * sizeof(float), offset = 0
@@ -90,6 +111,9 @@ struct Vertex_Pos_Nrm_Tgt_Tex
   // Texture coordinates
   float u, v;
 
+  // Format identifier
+  static const int Format = VertexFormat::Pos_Nrm_Tgt_Tex;
+
   static void BindVertexAttributes()
   {
     // Positions: 3 floats, stride = 11 * sizeof(float), offset = 0
@@ -0,0 +1,201 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/gl.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Virtual texture with a fixed size page cache: all mip levels of the layers are split into pages stored in tile files
+// next to the source images. Shaders write the pages they need into a low resolution feedback image, a background
+// thread reads the missing ones from the tile files and they're uploaded into free or least recently used slots of the
+// page cache atlas. The page table points each virtual page to its atlas slot, pages which aren't resident point to
+// their closest resident ancestor, so the texture memory is given by the atlas size no matter how large the source
+// images are. All layers have the same maps sharing the page table, e.g., diffuse and normal maps of a material.
+// Requires OpenGL 4.3.
+class VirtualTexture
+{
+public:
+  // Size of a page without the border in texels
+  static const int TILE_SIZE = 128;
+  // Border around each page in texels so that the filtering doesn't bleed into the neighbouring slots
+  static const int TILE_BORDER = 4;
+  // Maximum number of maps of each layer
+  static const int MAX_MAPS = 4;
+  // Maximum number of layers, given by the page packing in the feedback image
+  static const int MAX_LAYERS = 16;
+  // Resolution of the feedback image relative to the screen
+  static const int FEEDBACK_SCALE = 8;
+  // Maximum number of page uploads per frame
+  static const int MAX_UPLOADS = 16;
+  // Maximum number of pages waiting for the background thread
+  static const int MAX_PENDING = 64;
+
+  VirtualTexture();
+  ~VirtualTexture();
+
+  // Set up the maps shared by all the layers, source images are resampled to size x size texels, which must be a power
+  // of two multiple of TILE_SIZE, the atlas has atlasPages x atlasPages slots, sRGB formats are mip-mapped in linear space,
+  // the maps flagged in normalMaps are renormalized in each mip level
+  bool Init(int size, int numMaps, const GLenum internalFormats[], const bool normalMaps[], int atlasPages);
+  // Add a layer given by the source images of its maps, tile files are created if they're missing or outdated,
+  // returns the layer index or -1 on failure
+  int AddLayer(const char *const images[]);
+  // Create the page table, load the coarsest pages of all layers and start the background thread
+  bool Create();
+  // Check whether the virtual texture has been successfully created
+  bool IsReady() const { return _pageTable != 0; }
+
+  // Clear the feedback image, it's reallocated when the screen size changes
+  void BeginFrame(int width, int height);
+  // Bind the atlases of the maps to texture units firstUnit + map, the page table right after them, the feedback
+  // image to the image unit and the shader parameters to the uniform block binding
+  void Bind(GLuint firstUnit, GLuint imageUnit, GLuint uniformBinding);
+  // Read back the feedback of this frame, process the feedback of the previous frames, request missing pages and upload
+  // the loaded ones, call after the passes writing the feedback
+  void EndFrame();
+
+  // Get the number of atlas slots
+  int GetSlotCount() const { return (int)_slots.size(); }
+  // Get the number of resident pages
+  int GetResidentCount() const { return (int)_residentPages.size(); }
+  // Get the number of pages waiting for the background thread or the upload
+  int GetPendingCount() const { return (int)_pendingPages.size(); }
+  // Get the memory used by the atlases in MB
+  float GetAtlasMemory() const { return _atlasMemory / (1024.0f * 1024.0f); }
+
+private:
+  // Shader parameters, must match VirtualTextureBlock in the shaders
+  struct ShaderData
+  {
+    // Feedback pixel written within each block this frame, feedback scale, number of mip levels
+    GLint feedbackOffset[2];
+    GLint feedbackScale;
+    GLint numLevels;
+    // Pages per side of the finest level, page size and its border in texels, atlas size in texels
+    GLint numPages;
+    GLint tileSize;
+    GLint tileBorder;
+    GLint atlasSize;
+  };
+
+  // Slot of the page cache atlas
+  struct Slot
+  {
+    // Resident page, INVALID_PAGE for free slots
+    uint32_t page;
+    // Frame the page was last needed in
+    uint32_t lastUsed;
+    // Coarsest pages stay resident, they're the last resort of the page table
+    bool pinned;
+  };
+
+  // Page loaded by the background thread
+  struct LoadedPage
+  {
+    uint32_t page;
+    // Pixels of the maps in the atlas formats, including the border
+    std::vector<unsigned char> data[MAX_MAPS];
+  };
+
+  // Feedback read back, double buffered so that we don't wait for the results
+  struct Readback
+  {
+    GLuint buffer;
+    GLsync fence;
+  };
+
+  // Page packing shared with the shaders: layer, level, y and x page coordinates
+  static const uint32_t INVALID_PAGE = 0xFFFFFFFFu;
+  static uint32_t PackPage(int layer, int level, int x, int y) { return ((uint32_t)layer << 28) | ((uint32_t)level << 24) | ((uint32_t)y << 12) | (uint32_t)x; }
+  static int PageLayer(uint32_t page) { return (int)(page >> 28); }
+  static int PageLevel(uint32_t page) { return (int)((page >> 24) & 0xF); }
+  static int PageY(uint32_t page) { return (int)((page >> 12) & 0xFFF); }
+  static int PageX(uint32_t page) { return (int)(page & 0xFFF); }
+  // Parent page in the next coarser level
+  static uint32_t ParentPage(uint32_t page) { return PackPage(PageLayer(page), PageLevel(page) + 1, PageX(page) / 2, PageY(page) / 2); }
+
+  // Create the tile file of the source image unless there is an up to date one, returns the number of its channels
+  int CreateTileFile(const char image[], const std::string &tiles, bool sRGB, bool normalMap);
+  // Read the page of all the maps from the tile files and convert it to the atlas formats, done by the background thread
+  bool LoadPage(uint32_t page, LoadedPage &loaded);
+  // Background thread loop
+  void WorkerLoop();
+  // Process the feedback image contents
+  void ProcessFeedback(const GLuint *feedback, size_t count);
+  // Upload the page to a free or the least recently used slot, returns false if all the slots are in use this frame
+  bool UploadPage(const LoadedPage &loaded, bool pinned);
+  // Rebuild and upload the page table of the layer
+  void UpdatePageTable(int layer);
+
+  // Size of the finest level in texels
+  int _size;
+  // Number of mip levels, the coarsest one is a single page
+  int _numLevels;
+  // Number of maps of each layer
+  int _numMaps;
+  // Formats of the maps
+  GLenum _internalFormats[MAX_MAPS];
+  // Maps holding normals
+  bool _normalMaps[MAX_MAPS];
+  // Number of channels of the atlas formats, 1 or 4
+  int _atlasChannels[MAX_MAPS];
+  // Page cache atlases, a single level each
+  GLuint _atlases[MAX_MAPS];
+  // Atlas slots per side
+  int _atlasPages;
+  // Memory of the atlases in bytes
+  size_t _atlasMemory;
+  // RGBA8UI 2D array texture with a layer per virtual layer and a level per mip level: atlas slot x, y, resident level
+  GLuint _pageTable;
+  // Shader parameters uniform buffer
+  GLuint _uniformBuffer;
+  // Requested pages, R32UI image FEEDBACK_SCALE times smaller than the screen
+  GLuint _feedback;
+  // Framebuffer object for clearing the feedback image
+  GLuint _feedbackFbo;
+  // Feedback image size
+  int _feedbackWidth;
+  int _feedbackHeight;
+  // Feedback read backs in flight
+  Readback _readbacks[2];
+  // Number of frames, selects the feedback pixel and the read back
+  uint32_t _frame;
+
+  // Tile files of the maps of each layer and their channel counts
+  std::vector<std::string> _tileFiles;
+  std::vector<int> _tileChannels;
+  // Atlas slots
+  std::vector<Slot> _slots;
+  // Slot of each resident page
+  std::unordered_map<uint32_t, int> _residentPages;
+  // Pages requested and not uploaded yet
+  std::unordered_set<uint32_t> _pendingPages;
+  // Layers whose page table needs to be rebuilt
+  std::vector<bool> _dirtyLayers;
+
+  // Background thread and its queues
+  std::thread _worker;
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  std::deque<uint32_t> _requests;
+  std::deque<LoadedPage> _loaded;
+  bool _quit;
+  // Open tile files, used only by the background thread after Create()
+  std::vector<std::ifstream> _tileStreams;
+
+  // No copies allowed
+  VirtualTexture(const VirtualTexture &);
+  VirtualTexture & operator = (const VirtualTexture &);
+};
@@ -0,0 +1,19 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include "FileStamp.h"
+
+#include <sys/stat.h>
+
+bool getFileStamp(const char name[], uint64_t &size, int64_t &time)
+{
+  struct stat info;
+  if (stat(name, &info) != 0)
+    return false;
+
+  size = (uint64_t)info.st_size;
+  time = (int64_t)info.st_mtime;
+  return true;
+}
@@ -0,0 +1,545 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include "FrameGraph.h"
+#include "GLIntercept.h"
+#include "PipelineStats.h"
+#include "Profiler.h"
+#include "ResourceRegistry.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// Kinds of the render target formats, they select the attachment point and the pixel transfer format
+enum class FormatKind
+{
+  Color, Integer, Depth, DepthStencil
+};
+
+// Render target format, views can reinterpret color formats of the same texel size
+struct FormatInfo
+{
+  GLenum internalFormat;
+  int bytes;
+  FormatKind kind;
+};
+
+static const FormatInfo formats[] =
+{
+  {GL_R8, 1, FormatKind::Color},
+  {GL_RG8, 2, FormatKind::Color},
+  {GL_RGB8, 3, FormatKind::Color},
+  {GL_RGBA8, 4, FormatKind::Color},
+  {GL_SRGB8_ALPHA8, 4, FormatKind::Color},
+  {GL_RGB10_A2, 4, FormatKind::Color},
+  {GL_R11F_G11F_B10F, 4, FormatKind::Color},
+  {GL_R16F, 2, FormatKind::Color},
+  {GL_RG16F, 4, FormatKind::Color},
+  {GL_RGB16F, 6, FormatKind::Color},
+  {GL_RGBA16F, 8, FormatKind::Color},
+  {GL_R32F, 4, FormatKind::Color},
+  {GL_RG32F, 8, FormatKind::Color},
+  {GL_RGBA32F, 16, FormatKind::Color},
+  {GL_R8UI, 1, FormatKind::Integer},
+  {GL_RGB8UI, 3, FormatKind::Integer},
+  {GL_RGBA8UI, 4, FormatKind::Integer},
+  {GL_R16UI, 2, FormatKind::Integer},
+  {GL_R32UI, 4, FormatKind::Integer},
+  {GL_RG32UI, 8, FormatKind::Integer},
+  {GL_RGBA32UI, 16, FormatKind::Integer},
+  {GL_DEPTH_COMPONENT16, 2, FormatKind::Depth},
+  {GL_DEPTH_COMPONENT24, 3, FormatKind::Depth},
+  {GL_DEPTH_COMPONENT32F, 4, FormatKind::Depth},
+  {GL_DEPTH24_STENCIL8, 4, FormatKind::DepthStencil},
+  {GL_DEPTH32F_STENCIL8, 5, FormatKind::DepthStencil},
+};
+
+static const FormatInfo &getFormatInfo(GLenum internalFormat)
+{
+  for (const FormatInfo &info : formats)
+  {
+    if (info.internalFormat == internalFormat)
+      return info;
+  }
+
+  // Unknown formats are only shared with the same format
+  static const FormatInfo unknown = {GL_NONE, 4, FormatKind::Color};
+  return unknown;
+}
+
+static bool isDepthFormat(GLenum internalFormat)
+{
+  FormatKind kind = getFormatInfo(internalFormat).kind;
+  return kind == FormatKind::Depth || kind == FormatKind::DepthStencil;
+}
+
+// ----------------------------------------------------------------------------
+
+FrameGraph::Resource FrameGraph::PassBuilder::Create(const char *name, GLenum internalFormat)
+{
+  if (getFormatInfo(internalFormat).internalFormat == GL_NONE)
+    printf("Frame graph: unknown format 0x%04X of %s\n", internalFormat, name);
+
+  ResourceNode node;
+  node.name = name;
+  node.internalFormat = internalFormat;
+  node.numReaders = 0;
+  node.refCount = 0;
+  node.firstUse = -1;
+  node.lastUse = -1;
+  node.texture = -1;
+  node.view = 0;
+  _graph._resources.push_back(node);
+
+  return Write((Resource)_graph._resources.size() - 1);
+}
+
+FrameGraph::Resource FrameGraph::PassBuilder::Write(Resource resource)
+{
+  if (resource == INVALID)
+    return INVALID;
+
+  _graph._resources[resource].writers.push_back(_pass);
+  _graph._passes[_pass].writes.push_back(resource);
+  _graph.Attach(_pass, resource);
+  return resource;
+}
+
+FrameGraph::Resource FrameGraph::PassBuilder::Read(Resource resource, bool attach)
+{
+  if (resource == INVALID)
+    return INVALID;
+
+  ++_graph._resources[resource].numReaders;
+  _graph._passes[_pass].reads.push_back(resource);
+  if (attach)
+    _graph.Attach(_pass, resource);
+  return resource;
+}
+
+void FrameGraph::PassBuilder::SetSideEffect()
+{
+  _graph._passes[_pass].sideEffect = true;
+}
+
+// ----------------------------------------------------------------------------
+
+FrameGraph::FrameGraph() : _width(0), _height(0), _viewsSupported(false), _numCulled(0), _declaredMemory(0), _requestedMemory(0), _allocatedMemory(0),
+  _peakSavedMemory(0) {}
+
+FrameGraph::~FrameGraph()
+{
+  Release();
+}
+
+void FrameGraph::Reset(int width, int height)
+{
+  // Minimized windows have zero size, textures can't
+  width = std::max(width, 1);
+  height = std::max(height, 1);
+
+  // Textures of the previous size are never going to be used again
+  if (width != _width || height != _height)
+    Release();
+
+  _width = width;
+  _height = height;
+  _viewsSupported = GLAD_GL_VERSION_4_3 != 0;
+  _passes.clear();
+  _resources.clear();
+}
+
+int FrameGraph::AddPassNode(const char *name)
+{
+  PassNode node;
+  node.name = name;
+  node.depthAttachment = INVALID;
+  node.sideEffect = false;
+  node.refCount = 0;
+  node.culled = false;
+  _passes.push_back(node);
+  return (int)_passes.size() - 1;
+}
+
+void FrameGraph::Attach(int pass, Resource resource)
+{
+  PassNode &node = _passes[pass];
+  if (isDepthFormat(_resources[resource].internalFormat))
+  {
+    node.depthAttachment = resource;
+  }
+  else if ((int)node.colorAttachments.size() < MAX_COLOR_ATTACHMENTS)
+  {
+    node.colorAttachments.push_back(resource);
+  }
+  else
+  {
+    printf("Frame graph: too many color attachments in pass %s\n", node.name.c_str());
+  }
+}
+
+void FrameGraph::Compile()
+{
+  PROFILE_SCOPE("Frame graph compile");
+
+  // Passes are referenced by their written targets which are read, targets by the passes reading them
+  std::vector<Resource> unreferenced;
+  for (ResourceNode &resource : _resources)
+  {
+    resource.refCount = resource.numReaders;
+    resource.firstUse = -1;
+    resource.lastUse = -1;
+  }
+
+  for (Resource resource = 0; resource < (Resource)_resources.size(); ++resource)
+  {
+    if (_resources[resource].refCount == 0)
+      unreferenced.push_back(resource);
+  }
+
+  for (PassNode &pass : _passes)
+  {
+    pass.refCount = (int)pass.writes.size();
+    pass.culled = false;
+  }
+
+  // Cull the passes whose outputs nobody reads, their inputs may become unreferenced as well
+  auto cullPass = [this, &unreferenced](PassNode &pass)
+  {
+    pass.culled = true;
+    for (Resource read : pass.reads)
+    {
+      if (--_resources[read].refCount == 0)
+        unreferenced.push_back(read);
+    }
+  };
+
+  for (PassNode &pass : _passes)
+  {
+    if (pass.refCount == 0 && !pass.sideEffect)
+      cullPass(pass);
+  }
+
+  while (!unreferenced.empty())
+  {
+    Resource resource = unreferenced.back();
+    unreferenced.pop_back();
+
+    for (int writer : _resources[resource].writers)
+    {
+      PassNode &pass = _passes[writer];
+      if (!pass.culled && !pass.sideEffect && --pass.refCount == 0)
+        cullPass(pass);
+    }
+  }
+
+  // Memory of all the declared targets, including those of the culled passes
+  _declaredMemory = 0;
+  for (const ResourceNode &node : _resources)
+    _declaredMemory += (size_t)_width * _height * getFormatInfo(node.internalFormat).bytes;
+
+  // Lifetimes of the targets used by the remaining passes
+  _numCulled = 0;
+  _requestedMemory = 0;
+  for (int i = 0; i < (int)_passes.size(); ++i)
+  {
+    PassNode &pass = _passes[i];
+    if (pass.culled)
+    {
+      ++_numCulled;
+      continue;
+    }
+
+    for (const std::vector<Resource> *resources : {&pass.writes, &pass.reads})
+    {
+      for (Resource resource : *resources)
+      {
+        ResourceNode &node = _resources[resource];
+        if (node.firstUse < 0)
+        {
+          node.firstUse = i;
+          _requestedMemory += (size_t)_width * _height * getFormatInfo(node.internalFormat).bytes;
+        }
+        node.lastUse = i;
+      }
+    }
+  }
+
+  // Assign the textures in the execution order, a texture is free again after the last pass using its target
+  for (PooledTexture &pooled : _pool)
+  {
+    pooled.busyUntil = -1;
+    pooled.used = false;
+  }
+
+  bool poolChanged = false;
+  for (int i = 0; i < (int)_passes.size(); ++i)
+  {
+    if (_passes[i].culled)
+      continue;
+
+    for (Resource resource : _passes[i].writes)
+    {
+      if (_resources[resource].firstUse == i && _resources[resource].texture < 0)
+      {
+        const size_t poolSize = _pool.size();
+        AssignTexture(resource, i);
+        poolChanged |= _pool.size() != poolSize;
+      }
+    }
+  }
+
+  // Textures not needed this frame, e.g., after switching off a pass, are released right away
+  _allocatedMemory = 0;
+  for (size_t i = 0; i < _pool.size();)
+  {
+    if (_pool[i].used)
+    {
+      _allocatedMemory += _pool[i].size;
+      ++i;
+      continue;
+    }
+
+    ReleaseTexture(_pool[i]);
+    _pool.erase(_pool.begin() + i);
+    poolChanged = true;
+  }
+
+  if (_declaredMemory > _allocatedMemory)
+    _peakSavedMemory = std::max(_peakSavedMemory, _declaredMemory - _allocatedMemory);
+
+  // Pool indices may have shifted, look the textures up again
+  if (poolChanged)
+  {
+    ReleaseFramebuffers();
+    for (Resource resource = 0; resource < (Resource)_resources.size(); ++resource)
+    {
+      _resources[resource].texture = -1;
+      _resources[resource].view = 0;
+    }
+
+    for (PooledTexture &pooled : _pool)
+      pooled.busyUntil = -1;
+
+    for (int i = 0; i < (int)_passes.size(); ++i)
+    {
+      if (_passes[i].culled)
+        continue;
+
+      for (Resource resource : _passes[i].writes)
+      {
+        if (_resources[resource].firstUse == i && _resources[resource].texture < 0)
+          AssignTexture(resource, i);
+      }
+    }
+  }
+}
+
+void FrameGraph::AssignTexture(Resource resource, int pass)
+{
+  ResourceNode &node = _resources[resource];
+  const FormatInfo &info = getFormatInfo(node.internalFormat);
+  const bool viewable = _viewsSupported && info.internalFormat != GL_NONE && !isDepthFormat(node.internalFormat);
+
+  // Prefer the same format, then any color format of the same texel size if views are available
+  int best = -1;
+  for (int i = 0; i < (int)_pool.size(); ++i)
+  {
+    PooledTexture &pooled = _pool[i];
+    if (pooled.busyUntil >= pass)
+      continue;
+
+    if (pooled.internalFormat == node.internalFormat)
+    {
+      best = i;
+      break;
+    }
+
+    const FormatInfo &pooledInfo = getFormatInfo(pooled.internalFormat);
+    if (best < 0 && viewable && pooledInfo.internalFormat != GL_NONE && !isDepthFormat(pooled.internalFormat) &&
+        pooledInfo.bytes == info.bytes)
+    {
+      best = i;
+    }
+  }
+
+  if (best < 0)
+  {
+    PooledTexture pooled;
+    pooled.internalFormat = node.internalFormat;
+    pooled.size = (size_t)_width * _height * info.bytes;
+    pooled.busyUntil = -1;
+    pooled.used = false;
+
+    glGenTextures(1, &pooled.texture);
+    glBindTexture(GL_TEXTURE_2D, pooled.texture);
+    if (_viewsSupported)
+    {
+      // Views can only be created from the immutable storage
+      glTexStorage2D(GL_TEXTURE_2D, 1, node.internalFormat, _width, _height);
+    }
+    else
+    {
+      // No data is uploaded, the pixel format just has to be compatible with the internal one
+      GLenum format = GL_RGBA, type = GL_UNSIGNED_BYTE;
+      if (info.kind == FormatKind::Integer)
+        format = GL_RGBA_INTEGER;
+      else if (info.kind == FormatKind::Depth)
+        format = GL_DEPTH_COMPONENT, type = GL_FLOAT;
+      else if (info.kind == FormatKind::DepthStencil)
+        format = GL_DEPTH_STENCIL, type = GL_UNSIGNED_INT_24_8;
+      glTexImage2D(GL_TEXTURE_2D, 0, node.internalFormat, _width, _height, 0, format, type, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    ResourceRegistry::GetInstance().TrackTexture(pooled.texture, GL_TEXTURE_2D, ResourceCategory::RenderTargets, node.name.c_str());
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    _pool.push_back(pooled);
+    best = (int)_pool.size() - 1;
+  }
+
+  PooledTexture &pooled = _pool[best];
+  pooled.busyUntil = node.lastUse;
+  pooled.used = true;
+  node.texture = best;
+  node.view = GetView(pooled, node.internalFormat);
+}
+
+GLuint FrameGraph::GetView(PooledTexture &pooled, GLenum internalFormat)
+{
+  if (internalFormat == pooled.internalFormat)
+    return pooled.texture;
+
+  auto it = pooled.views.find(internalFormat);
+  if (it != pooled.views.end())
+    return it->second;
+
+  // Views share the storage, they don't take any memory on their own
+  GLuint view;
+  glGenTextures(1, &view);
+  glTextureView(view, GL_TEXTURE_2D, pooled.texture, internalFormat, 0, 1, 0, 1);
+  glBindTexture(GL_TEXTURE_2D, view);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  pooled.views[internalFormat] = view;
+  return view;
+}
+
+void FrameGraph::Execute()
+{
+  for (PassNode &pass : _passes)
+  {
+    if (pass.culled)
+      continue;
+
+    // Pass names are declared every frame, the trace and statistics need them to stay
+    const char *name = Profiler::GetInstance().Intern(pass.name);
+    PROFILE_GPU_SCOPE(name);
+    GL_INTERCEPT_SCOPE(name);
+
+    if (pass.colorAttachments.empty() && pass.depthAttachment == INVALID)
+    {
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    else
+    {
+      Framebuffer &framebuffer = _framebuffers[pass.name];
+      if (!framebuffer.fbo)
+      {
+        glGenFramebuffers(1, &framebuffer.fbo);
+        framebuffer.depth = 0;
+        framebuffer.numColors = 0;
+        for (GLuint &color : framebuffer.colors)
+          color = 0;
+      }
+      glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.fbo);
+
+      // Attach the textures assigned this frame unless they're already attached
+      bool changed = (int)pass.colorAttachments.size() != framebuffer.numColors;
+      for (int i = 0; i < MAX_COLOR_ATTACHMENTS; ++i)
+      {
+        GLuint texture = i < (int)pass.colorAttachments.size() ? GetTexture(pass.colorAttachments[i]) : 0;
+        if (texture != framebuffer.colors[i])
+        {
+          glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, texture, 0);
+          framebuffer.colors[i] = texture;
+          changed = true;
+        }
+      }
+
+      GLuint depth = GetTexture(pass.depthAttachment);
+      if (depth != framebuffer.depth)
+      {
+        GLenum attachment = depth && getFormatInfo(_resources[pass.depthAttachment].internalFormat).kind == FormatKind::DepthStencil ?
+                            GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, depth, 0);
+        framebuffer.depth = depth;
+        changed = true;
+      }
+
+      if (changed)
+      {
+        // Set the list of draw buffers
+        framebuffer.numColors = (int)pass.colorAttachments.size();
+        GLenum drawBuffers[MAX_COLOR_ATTACHMENTS] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
+        if (framebuffer.numColors > 0)
+          glDrawBuffers(framebuffer.numColors, drawBuffers);
+        else
+          glDrawBuffer(GL_NONE);
+
+        // Check for completeness
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+          printf("Failed to create framebuffer of pass %s: 0x%04X\n", pass.name.c_str(), status);
+      }
+    }
+
+    PipelineStats::GetInstance().BeginPass(name);
+    pass.execute();
+    PipelineStats::GetInstance().EndPass();
+  }
+
+  // Bind back the window system provided framebuffer
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+GLuint FrameGraph::GetTexture(Resource resource) const
+{
+  return resource == INVALID ? 0 : _resources[resource].view;
+}
+
+void FrameGraph::ReleaseTexture(PooledTexture &pooled)
+{
+  for (auto &view : pooled.views)
+    glDeleteTextures(1, &view.second);
+  pooled.views.clear();
+  ResourceRegistry::GetInstance().DeleteTextures(1, &pooled.texture);
+}
+
+void FrameGraph::ReleaseFramebuffers()
+{
+  for (auto &framebuffer : _framebuffers)
+    glDeleteFramebuffers(1, &framebuffer.second.fbo);
+  _framebuffers.clear();
+}
+
+void FrameGraph::Release()
+{
+  ReleaseFramebuffers();
+  for (PooledTexture &pooled : _pool)
+    ReleaseTexture(pooled);
+  _pool.clear();
+
+  for (ResourceNode &resource : _resources)
+  {
+    resource.texture = -1;
+    resource.view = 0;
+  }
+  _allocatedMemory = 0;
+}
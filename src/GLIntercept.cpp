@@ -0,0 +1,301 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include "GLIntercept.h"
+#include "TextOverlay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+// Indices of the wrapped functions
+enum GLFunctionId
+{
+#define GL_FUNCTION(name) GLFunctionId_##name,
+#include "GLFunctions.h"
+#undef GL_FUNCTION
+  NUM_GL_FUNCTIONS
+};
+
+// Names of the wrapped functions
+static const char *functionNames[NUM_GL_FUNCTIONS] =
+{
+#define GL_FUNCTION(name) #name,
+#include "GLFunctions.h"
+#undef GL_FUNCTION
+};
+
+// Functions waiting for the GPU regardless of their arguments, set up on the first install
+static bool syncProne[NUM_GL_FUNCTIONS] = {false};
+
+#if _ENABLE_GL_INTERCEPT
+
+typedef std::chrono::steady_clock Clock;
+
+// Measure the call and record it on destruction, i.e., once the original function returns
+class CallTimer
+{
+public:
+  CallTimer(int function, bool sync) : _function(function), _sync(sync), _begin(Clock::now()) {}
+  ~CallTimer()
+  {
+    const int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _begin).count();
+    GLIntercept::GetInstance().Record(_function, _sync, time);
+  }
+
+private:
+  int _function;
+  bool _sync;
+  Clock::time_point _begin;
+};
+
+// Is the call sync-prone, the default depends on the function only
+template <int Id>
+struct SyncCheck
+{
+  template <class... Args>
+  static bool Check(Args...) { return syncProne[Id]; }
+};
+
+// Mapping waits for the GPU to finish with the buffer unless asked not to
+struct MapRangeSyncCheck
+{
+  template <class Buffer, class Offset, class Length>
+  static bool Check(Buffer, Offset, Length, GLbitfield access) { return (access & GL_MAP_UNSYNCHRONIZED_BIT) == 0; }
+};
+
+// Query results wait for the GPU, their availability doesn't
+struct QueryResultSyncCheck
+{
+  template <class Query, class Params>
+  static bool Check(Query, GLenum pname, Params) { return pname == GL_QUERY_RESULT; }
+};
+
+template <> struct SyncCheck<GLFunctionId_glMapBufferRange> : MapRangeSyncCheck {};
+template <> struct SyncCheck<GLFunctionId_glMapNamedBufferRange> : MapRangeSyncCheck {};
+template <> struct SyncCheck<GLFunctionId_glGetQueryObjectiv> : QueryResultSyncCheck {};
+template <> struct SyncCheck<GLFunctionId_glGetQueryObjectuiv> : QueryResultSyncCheck {};
+template <> struct SyncCheck<GLFunctionId_glGetQueryObjecti64v> : QueryResultSyncCheck {};
+template <> struct SyncCheck<GLFunctionId_glGetQueryObjectui64v> : QueryResultSyncCheck {};
+
+// Wrapper of a single entry point with the signature deduced from its glad pointer
+template <int Id, class Proc>
+struct Hook;
+
+template <int Id, class Ret, class... Args>
+struct Hook<Id, Ret (APIENTRY *)(Args...)>
+{
+  typedef Ret (APIENTRY *Proc)(Args...);
+
+  static Ret APIENTRY Call(Args... args)
+  {
+    CallTimer timer(Id, SyncCheck<Id>::Check(args...));
+    return original(args...);
+  }
+
+  static Proc original;
+};
+
+template <int Id, class Ret, class... Args>
+typename Hook<Id, Ret (APIENTRY *)(Args...)>::Proc Hook<Id, Ret (APIENTRY *)(Args...)>::original = nullptr;
+
+// Replace the loaded entry point by its wrapper
+template <int Id, class Proc>
+static void installHook(Proc &entry)
+{
+  if (!entry || entry == &Hook<Id, Proc>::Call)
+    return;
+
+  Hook<Id, Proc>::original = entry;
+  entry = &Hook<Id, Proc>::Call;
+}
+
+// Put the original entry point back
+template <int Id, class Proc>
+static void uninstallHook(Proc &entry)
+{
+  if (entry == &Hook<Id, Proc>::Call)
+    entry = Hook<Id, Proc>::original;
+}
+
+#endif
+
+// ----------------------------------------------------------------------------
+
+GLIntercept &GLIntercept::GetInstance()
+{
+  static GLIntercept intercept;
+  return intercept;
+}
+
+GLIntercept::GLIntercept() : _installed(false), _frame(NUM_GL_FUNCTIONS), _last(NUM_GL_FUNCTIONS), _section(0)
+{
+  Section outside = {"Other", {}, {}};
+  _sections.push_back(outside);
+}
+
+void GLIntercept::Install()
+{
+#if _ENABLE_GL_INTERCEPT
+  if (_installed)
+    return;
+
+  // Reading anything back from the driver may wait for the GPU
+  static const char *syncNames[] = {"glFinish", "glReadPixels", "glReadnPixels", "glClientWaitSync", "glMapBuffer", "glMapNamedBuffer"};
+  for (int i = 0; i < NUM_GL_FUNCTIONS; ++i)
+  {
+    syncProne[i] = strncmp(functionNames[i], "glGet", 5) == 0;
+    for (const char *name : syncNames)
+      syncProne[i] |= strcmp(functionNames[i], name) == 0;
+  }
+
+#define GL_FUNCTION(name) installHook<GLFunctionId_##name>(glad_##name);
+#include "GLFunctions.h"
+#undef GL_FUNCTION
+
+  _installed = true;
+  printf("OpenGL call interception on\n");
+#else
+  printf("OpenGL call interception is compiled out, set _ENABLE_GL_INTERCEPT to 1\n");
+#endif
+}
+
+void GLIntercept::Uninstall()
+{
+#if _ENABLE_GL_INTERCEPT
+  if (!_installed)
+    return;
+
+#define GL_FUNCTION(name) uninstallHook<GLFunctionId_##name>(glad_##name);
+#include "GLFunctions.h"
+#undef GL_FUNCTION
+
+  _installed = false;
+  printf("OpenGL call interception off\n");
+#endif
+}
+
+int GLIntercept::EnterSection(const char *name)
+{
+  const int previous = _section;
+
+  // Names are literals, the pointers identify them
+  for (size_t i = 0; i < _sections.size(); ++i)
+  {
+    if (_sections[i].name == name)
+    {
+      _section = (int)i;
+      return previous;
+    }
+  }
+
+  if (_sections.size() < MAX_SECTIONS)
+  {
+    Section section = {name, {}, {}};
+    _sections.push_back(section);
+    _section = (int)_sections.size() - 1;
+  }
+
+  return previous;
+}
+
+void GLIntercept::Record(int function, bool sync, int64_t time)
+{
+  CallStats &stats = _frame[function];
+  ++stats.calls;
+  stats.syncs += sync ? 1 : 0;
+  stats.time += time;
+
+  CallStats &section = _sections[_section].frame;
+  ++section.calls;
+  section.syncs += sync ? 1 : 0;
+  section.time += time;
+}
+
+void GLIntercept::EndFrame()
+{
+  // Calls made before the install or after the uninstall aren't counted, keep the last complete frame
+  if (!_installed)
+    return;
+
+  _last.swap(_frame);
+  std::fill(_frame.begin(), _frame.end(), CallStats());
+  for (Section &section : _sections)
+  {
+    section.last = section.frame;
+    section.frame = CallStats();
+  }
+}
+
+std::vector<int> GLIntercept::GetSortedFunctions() const
+{
+  std::vector<int> functions;
+  for (int i = 0; i < NUM_GL_FUNCTIONS; ++i)
+  {
+    if (_last[i].calls > 0)
+      functions.push_back(i);
+  }
+
+  std::sort(functions.begin(), functions.end(), [this](int a, int b) { return _last[a].time > _last[b].time; });
+  return functions;
+}
+
+GLIntercept::CallStats GLIntercept::GetLastFrameTotal() const
+{
+  CallStats total = CallStats();
+  for (const CallStats &stats : _last)
+  {
+    total.calls += stats.calls;
+    total.syncs += stats.syncs;
+    total.time += stats.time;
+  }
+  return total;
+}
+
+void GLIntercept::Print(TextOverlay &overlay, int maxFunctions) const
+{
+  const CallStats total = GetLastFrameTotal();
+  overlay.Print("GL calls %u, %.3f ms in the driver, %u sync-prone\n", total.calls, total.time * 1e-6, total.syncs);
+
+  // Bars are relative to the most expensive function
+  const std::vector<int> functions = GetSortedFunctions();
+  const int64_t maxTime = functions.empty() ? 1 : std::max(_last[functions[0]].time, (int64_t)1);
+  overlay.Print("%-32s %7s %9s %6s\n", "Function", "Calls", "Time [ms]", "Sync");
+  for (int i = 0; i < (int)functions.size() && i < maxFunctions; ++i)
+  {
+    const CallStats &stats = _last[functions[i]];
+    const int bar = (int)(20 * stats.time / maxTime);
+    overlay.Print("%-32.32s %7u %9.3f %6u %.*s\n", functionNames[functions[i]], stats.calls, stats.time * 1e-6, stats.syncs,
+                  bar, "####################");
+  }
+
+  overlay.Print("%-32s %7s %9s %6s\n", "Section", "Calls", "Time [ms]", "Sync");
+  for (const Section &section : _sections)
+  {
+    if (section.last.calls > 0)
+      overlay.Print("%-32.32s %7u %9.3f %6u\n", section.name, section.last.calls, section.last.time * 1e-6, section.last.syncs);
+  }
+}
+
+void GLIntercept::PrintReport(int maxFunctions) const
+{
+  const CallStats total = GetLastFrameTotal();
+  printf("OpenGL calls of the last frame: %u calls, %.3f ms in the driver, %u sync-prone\n", total.calls, total.time * 1e-6, total.syncs);
+
+  const std::vector<int> functions = GetSortedFunctions();
+  for (int i = 0; i < (int)functions.size() && i < maxFunctions; ++i)
+  {
+    const CallStats &stats = _last[functions[i]];
+    printf("  %-40s %7u calls %9.3f ms %6u sync-prone\n", functionNames[functions[i]], stats.calls, stats.time * 1e-6, stats.syncs);
+  }
+
+  printf("Per section:\n");
+  for (const Section &section : _sections)
+  {
+    if (section.last.calls > 0)
+      printf("  %-40s %7u calls %9.3f ms %6u sync-prone\n", section.name, section.last.calls, section.last.time * 1e-6, section.last.syncs);
+  }
+}
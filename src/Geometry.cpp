@@ -4,7 +4,13 @@
  */
 
 #include "Geometry.h"
+#include "ParallelFor.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <glm/glm.hpp>
 
 Mesh<Vertex_Pos_Col> *Geometry::CreateQuadColor()
@@ -39,7 +45,7 @@ Mesh<Vertex_Pos_Col> *Geometry::CreateQuadColor()
   return mesh;
 }
 
-Mesh<Vertex_Pos_Tex> *Geometry::CreateQuadTex()
+Mesh<Vertex_Pos_Tex> *Geometry::CreateQuadTex(bool positionStream)
 {
   // Create the vertex buffer for a quad
   std::vector<Vertex_Pos_Tex> vb;
@@ -67,14 +73,26 @@ Mesh<Vertex_Pos_Tex> *Geometry::CreateQuadTex()
 
   // Create, initialize and return the mesh
   Mesh<Vertex_Pos_Tex> *mesh = new Mesh<Vertex_Pos_Tex>();
-  mesh->Init(vb, ib);
+  mesh->Init(vb, ib, positionStream);
   return mesh;
 }
 
-Mesh<Vertex_Pos_Nrm_Tgt_Tex> *Geometry::CreateQuadNormalTangentTex()
+Mesh<Vertex_Pos_Nrm_Tgt_Tex> *Geometry::CreateQuadNormalTangentTex(bool positionStream)
 {
-  // Create the vertex buffer for a quad
   std::vector<Vertex_Pos_Nrm_Tgt_Tex> vb;
+  std::vector<GLuint> ib;
+  BuildQuadNormalTangentTex(vb, ib);
+
+  // Create, initialize and return the mesh
+  Mesh<Vertex_Pos_Nrm_Tgt_Tex> *mesh = new Mesh<Vertex_Pos_Nrm_Tgt_Tex>();
+  mesh->Init(vb, ib, positionStream);
+  return mesh;
+}
+
+void Geometry::BuildQuadNormalTangentTex(std::vector<Vertex_Pos_Nrm_Tgt_Tex> &vb, std::vector<GLuint> &ib)
+{
+  // Create the vertex buffer for a quad
+  vb.clear();
   vb.reserve(4);
 
   // Create vertices
@@ -84,7 +102,7 @@ Mesh<Vertex_Pos_Nrm_Tgt_Tex> *Geometry::CreateQuadNormalTangentTex()
   vb.push_back({-0.5f, 0.0f,  0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f});
 
   // Fill in the index buffer
-  std::vector<GLuint> ib;
+  ib.clear();
   ib.reserve(6);
 
   // One triangle
@@ -96,11 +114,6 @@ Mesh<Vertex_Pos_Nrm_Tgt_Tex> *Geometry::CreateQuadNormalTangentTex()
   ib.push_back(2);
   ib.push_back(3);
   ib.push_back(0);
-
-  // Create, initialize and return the mesh
-  Mesh<Vertex_Pos_Nrm_Tgt_Tex> *mesh = new Mesh<Vertex_Pos_Nrm_Tgt_Tex>();
-  mesh->Init(vb, ib);
-  return mesh;
 }
 
 Mesh<Vertex_Pos_Col> *Geometry::CreateCubeColor()
@@ -247,123 +260,69 @@ Mesh<Vertex_Pos_Col> *Geometry::CreateCubeColorShared()
 
 Mesh<Vertex_Pos> *Geometry::CreateCubeAdjacency()
 {
-  // Create the vertex buffer for a unit cube
+  // Create the vertex buffer for a unit cube, faces have their own vertices like the rendered cubes
   std::vector<Vertex_Pos> vb;
-  vb.reserve(8);
+  vb.reserve(24);
 
-  // Top base
+  // Top face
   vb.push_back({-0.5f,  0.5f, -0.5f});
   vb.push_back({ 0.5f,  0.5f, -0.5f});
   vb.push_back({ 0.5f,  0.5f,  0.5f});
   vb.push_back({-0.5f,  0.5f,  0.5f});
 
-  // Bottom base
+  // Bottom face
   vb.push_back({ 0.5f, -0.5f, -0.5f});
   vb.push_back({-0.5f, -0.5f, -0.5f});
   vb.push_back({-0.5f, -0.5f,  0.5f});
   vb.push_back({ 0.5f, -0.5f,  0.5f});
 
-  // Fill in the index buffer
-  std::vector<GLuint> ib;
-  ib.reserve(72);
-
-  // Top face
-  ib.push_back(0);
-  ib.push_back(5); // Adjacent vertex
-  ib.push_back(1);
-  ib.push_back(4); // Adjacent vertex
-  ib.push_back(2);
-  ib.push_back(3); // Adjacent vertex
-
-  ib.push_back(2);
-  ib.push_back(7); // Adjacent vertex
-  ib.push_back(3);
-  ib.push_back(6); // Adjacent vertex
-  ib.push_back(0);
-  ib.push_back(1); // Adjacent vertex
-
-  // Bottom face
-  ib.push_back(4);
-  ib.push_back(1); // Adjacent vertex
-  ib.push_back(5);
-  ib.push_back(0); // Adjacent vertex
-  ib.push_back(6);
-  ib.push_back(7); // Adjacent vertex
-
-  ib.push_back(6);
-  ib.push_back(3); // Adjacent vertex
-  ib.push_back(7);
-  ib.push_back(2); // Adjacent vertex
-  ib.push_back(4);
-  ib.push_back(5); // Adjacent vertex
-
   // Front face
-  ib.push_back(5);
-  ib.push_back(6); // Adjacent vertex
-  ib.push_back(4);
-  ib.push_back(2); // Adjacent vertex
-  ib.push_back(1);
-  ib.push_back(0); // Adjacent vertex
-
-  ib.push_back(1);
-  ib.push_back(2); // Adjacent vertex
-  ib.push_back(0);
-  ib.push_back(6); // Adjacent vertex
-  ib.push_back(5);
-  ib.push_back(4); // Adjacent vertex
+  vb.push_back({-0.5f, -0.5f, -0.5f});
+  vb.push_back({ 0.5f, -0.5f, -0.5f});
+  vb.push_back({ 0.5f,  0.5f, -0.5f});
+  vb.push_back({-0.5f,  0.5f, -0.5f});
 
   // Back face
-  ib.push_back(7);
-  ib.push_back(4); // Adjacent vertex
-  ib.push_back(6);
-  ib.push_back(0); // Adjacent vertex
-  ib.push_back(3);
-  ib.push_back(2); // Adjacent vertex
-
-  ib.push_back(3);
-  ib.push_back(0); // Adjacent vertex
-  ib.push_back(2);
-  ib.push_back(4); // Adjacent vertex
-  ib.push_back(7);
-  ib.push_back(6); // Adjacent vertex
+  vb.push_back({ 0.5f, -0.5f,  0.5f});
+  vb.push_back({-0.5f, -0.5f,  0.5f});
+  vb.push_back({-0.5f,  0.5f,  0.5f});
+  vb.push_back({ 0.5f,  0.5f,  0.5f});
 
   // Left face
-  ib.push_back(6);
-  ib.push_back(4); // Adjacent vertex
-  ib.push_back(5);
-  ib.push_back(1); // Adjacent vertex
-  ib.push_back(0);
-  ib.push_back(3); // Adjacent vertex
-
-  ib.push_back(0);
-  ib.push_back(2); // Adjacent vertex
-  ib.push_back(3);
-  ib.push_back(7); // Adjacent vertex
-  ib.push_back(6);
-  ib.push_back(5); // Adjacent vertex
+  vb.push_back({-0.5f, -0.5f,  0.5f});
+  vb.push_back({-0.5f, -0.5f, -0.5f});
+  vb.push_back({-0.5f,  0.5f, -0.5f});
+  vb.push_back({-0.5f,  0.5f,  0.5f});
 
   // Right face
-  ib.push_back(4);
-  ib.push_back(6); // Adjacent vertex
-  ib.push_back(7);
-  ib.push_back(3); // Adjacent vertex
-  ib.push_back(2);
-  ib.push_back(1); // Adjacent vertex
+  vb.push_back({0.5f, -0.5f, -0.5f});
+  vb.push_back({0.5f, -0.5f,  0.5f});
+  vb.push_back({0.5f,  0.5f,  0.5f});
+  vb.push_back({0.5f,  0.5f, -0.5f});
 
-  ib.push_back(2);
-  ib.push_back(0); // Adjacent vertex
-  ib.push_back(1);
-  ib.push_back(5); // Adjacent vertex
-  ib.push_back(4);
-  ib.push_back(7); // Adjacent vertex
+  // Fill in the index buffer
+  std::vector<GLuint> ib;
+  ib.reserve(36);
+  for (int face = 0; face < 6; ++face)
+  {
+    GLuint baseIndex = 4 * face;
 
-  // Create, initialize and return the mesh
-  Mesh<Vertex_Pos> *mesh = new Mesh<Vertex_Pos>();
-  mesh->Init(vb, ib);
-  return mesh;
+    // One triangle
+    ib.push_back(baseIndex);
+    ib.push_back(baseIndex + 1);
+    ib.push_back(baseIndex + 2);
+
+    // Other triangle
+    ib.push_back(baseIndex + 2);
+    ib.push_back(baseIndex + 3);
+    ib.push_back(baseIndex);
+  }
+
+  // The face corners are welded into 8 shared vertices and the adjacent vertices are found over the shared edges
+  return CreateAdjacency(vb, ib);
 }
 
-Mesh<Vertex_Pos_Tex> *Geometry::CreateCubeTex()
+Mesh<Vertex_Pos_Tex> *Geometry::CreateCubeTex(bool positionStream)
 {
   // Create the vertex buffer for a unit cube
   std::vector<Vertex_Pos_Tex> vb;
@@ -425,11 +384,11 @@ Mesh<Vertex_Pos_Tex> *Geometry::CreateCubeTex()
 
   // Create, initialize and return the mesh
   Mesh<Vertex_Pos_Tex> *mesh = new Mesh<Vertex_Pos_Tex>();
-  mesh->Init(vb, ib);
+  mesh->Init(vb, ib, positionStream);
   return mesh;
 }
 
-Mesh<Vertex_Pos_Nrm_Tgt_Tex> *Geometry::CreateCubeNormalTangentTex()
+Mesh<Vertex_Pos_Nrm_Tgt_Tex> *Geometry::CreateCubeNormalTangentTex(bool positionStream)
 {
   // Create the vertex buffer for a unit cube
   std::vector<Vertex_Pos_Nrm_Tgt_Tex> vb;
@@ -491,7 +450,7 @@ Mesh<Vertex_Pos_Nrm_Tgt_Tex> *Geometry::CreateCubeNormalTangentTex()
 
   // Create, initialize and return the mesh
   Mesh<Vertex_Pos_Nrm_Tgt_Tex> *mesh = new Mesh<Vertex_Pos_Nrm_Tgt_Tex>();
-  mesh->Init(vb, ib);
+  mesh->Init(vb, ib, positionStream);
   return mesh;
 }
 
@@ -681,3 +640,806 @@ Mesh<Vertex_Pos> *Geometry::CreateIcosahedron()
   mesh->Init(vb, ib);
   return mesh;
 }
+
+// ----------------------------------------------------------------------------
+
+// Marks empty hash table slots and edges without a second triangle
+static const GLuint INVALID_INDEX = 0xffffffff;
+// Marks edges shared by more than two triangles
+static const GLuint NON_MANIFOLD = 0xfffffffe;
+
+// 64-bit hash finalizer (MurmurHash3 fmix64)
+static inline uint64_t hash64(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdull;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ull;
+  k ^= k >> 33;
+  return k;
+}
+
+// Smallest power of two greater or equal to twice the given count, keeps the load factor below 0.5
+static inline size_t hashCapacity(size_t count)
+{
+  size_t capacity = 16;
+  while (capacity < 2 * count)
+    capacity <<= 1;
+  return capacity;
+}
+
+// Bit pattern of the float with negative zero folded to positive zero
+static inline uint32_t floatBits(float f)
+{
+  f += 0.0f;
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+void Geometry::BuildAdjacency(const std::vector<Vertex_Pos> &vb, const std::vector<GLuint> &ib,
+                              std::vector<Vertex_Pos> &adjacencyVb, std::vector<GLuint> &adjacencyIb)
+{
+  adjacencyVb.clear();
+  adjacencyIb.clear();
+
+  // --------------------------------------------------------------------------
+  // Weld vertices with bitwise equal positions using linear probing
+  // --------------------------------------------------------------------------
+  std::vector<GLuint> remap(vb.size());
+  {
+    size_t mask = hashCapacity(vb.size()) - 1;
+    std::vector<GLuint> table(mask + 1, INVALID_INDEX);
+
+    adjacencyVb.reserve(vb.size());
+    for (size_t i = 0; i < vb.size(); ++i)
+    {
+      const Vertex_Pos &v = vb[i];
+      uint64_t h = hash64(((uint64_t)floatBits(v.x) << 32 | floatBits(v.y)) ^ hash64(floatBits(v.z)));
+      for (size_t slot = h & mask; ; slot = (slot + 1) & mask)
+      {
+        GLuint welded = table[slot];
+        if (welded == INVALID_INDEX)
+        {
+          welded = (GLuint)adjacencyVb.size();
+          table[slot] = welded;
+          adjacencyVb.push_back({v.x + 0.0f, v.y + 0.0f, v.z + 0.0f});
+          remap[i] = welded;
+          break;
+        }
+
+        const Vertex_Pos &w = adjacencyVb[welded];
+        if (floatBits(w.x) == floatBits(v.x) && floatBits(w.y) == floatBits(v.y) && floatBits(w.z) == floatBits(v.z))
+        {
+          remap[i] = welded;
+          break;
+        }
+      }
+    }
+  }
+
+  // Welded triangles, degenerate ones are dropped
+  std::vector<GLuint> triangles;
+  triangles.reserve(ib.size());
+  for (size_t i = 0; i + 2 < ib.size(); i += 3)
+  {
+    GLuint a = remap[ib[i + 0]];
+    GLuint b = remap[ib[i + 1]];
+    GLuint c = remap[ib[i + 2]];
+    if (a == b || b == c || c == a)
+      continue;
+
+    triangles.push_back(a);
+    triangles.push_back(b);
+    triangles.push_back(c);
+  }
+
+  // --------------------------------------------------------------------------
+  // Emit the adjacency triangles: v0, adj01, v1, adj12, v2, adj20, the adjacent
+  // vertices start as the triangle's own opposite vertex, i.e., boundary edges
+  // --------------------------------------------------------------------------
+  const size_t numHalfEdges = triangles.size();
+  adjacencyIb.resize(2 * numHalfEdges);
+  for (size_t t = 0; t < numHalfEdges; t += 3)
+  {
+    for (size_t e = 0; e < 3; ++e)
+    {
+      adjacencyIb[2 * (t + e) + 0] = triangles[t + e];
+      adjacencyIb[2 * (t + e) + 1] = triangles[t + (e + 2) % 3];
+    }
+  }
+
+  // --------------------------------------------------------------------------
+  // Pair the half edges through an edge map keyed by the vertex pair
+  // --------------------------------------------------------------------------
+  struct EdgeSlot
+  {
+    // Vertex pair in the direction of the first half edge, start vertex in the upper half
+    uint64_t key;
+    // Half edges sharing this edge, half edge i is the edge starting at triangles[i]
+    GLuint first, second;
+  };
+
+  // Closed meshes have half as many edges as half edges, keep the load below 0.75 even for open ones
+  size_t mask = hashCapacity(numHalfEdges * 2 / 3 + 1) - 1;
+  std::vector<EdgeSlot> edges(mask + 1, {~0ull, INVALID_INDEX, INVALID_INDEX});
+
+  for (size_t t = 0; t < numHalfEdges; t += 3)
+  {
+    for (size_t e = 0; e < 3; ++e)
+    {
+      GLuint a = triangles[t + e];
+      GLuint b = triangles[t + (e + 1) % 3];
+      uint64_t key = (uint64_t)a << 32 | b;
+      uint64_t reversed = (uint64_t)b << 32 | a;
+
+      // Hash the sorted pair so both directions end up in the same probe sequence
+      size_t slot = hash64(a < b ? key : reversed) & mask;
+      while (edges[slot].key != key && edges[slot].key != reversed && edges[slot].key != ~0ull)
+        slot = (slot + 1) & mask;
+
+      GLuint i = (GLuint)(t + e);
+      EdgeSlot &edge = edges[slot];
+      if (edge.key == ~0ull)
+      {
+        edge.key = key;
+        edge.first = i;
+      }
+      else if (edge.second == INVALID_INDEX && edge.key == reversed)
+      {
+        // Manifold edge with consistent winding, link the opposite vertices of both triangles
+        GLuint first = edge.first;
+        edge.second = i;
+        adjacencyIb[2 * first + 1] = triangles[t + (e + 2) % 3];
+        adjacencyIb[2 * i + 1] = triangles[first - first % 3 + (first + 2) % 3];
+      }
+      else if (edge.second != NON_MANIFOLD)
+      {
+        // Third triangle on the edge or inconsistent winding, revert the pair to boundary edges
+        GLuint first = edge.first;
+        adjacencyIb[2 * first + 1] = triangles[first - first % 3 + (first + 2) % 3];
+        if (edge.second != INVALID_INDEX)
+        {
+          GLuint second = edge.second;
+          adjacencyIb[2 * second + 1] = triangles[second - second % 3 + (second + 2) % 3];
+        }
+        edge.second = NON_MANIFOLD;
+      }
+    }
+  }
+}
+
+Mesh<Vertex_Pos> *Geometry::CreateAdjacency(const std::vector<Vertex_Pos> &vb, const std::vector<GLuint> &ib)
+{
+  std::vector<Vertex_Pos> adjacencyVb;
+  std::vector<GLuint> adjacencyIb;
+  BuildAdjacency(vb, ib, adjacencyVb, adjacencyIb);
+
+  // Create, initialize and return the mesh
+  Mesh<Vertex_Pos> *mesh = new Mesh<Vertex_Pos>();
+  mesh->Init(adjacencyVb, adjacencyIb);
+  return mesh;
+}
+
+void Geometry::GenerateTangents(std::vector<Vertex_Pos_Nrm_Tgt_Tex> &vb, const std::vector<GLuint> &ib)
+{
+  const size_t numVertices = vb.size();
+  const size_t numCorners = ib.size() - ib.size() % 3;
+
+  // Normalize, zero vectors are kept as they are
+  auto safeNormalize = [](const glm::vec3 &v) -> glm::vec3
+  {
+    float length = glm::length(v);
+    return length > 1e-20f ? v / length : glm::vec3(0.0f);
+  };
+
+  // --------------------------------------------------------------------------
+  // Weld vertices with bitwise equal position, normal and texture coordinates
+  // --------------------------------------------------------------------------
+  std::vector<GLuint> remap(numVertices);
+  // First input vertex of each welded vertex
+  std::vector<GLuint> welded;
+  {
+    auto equal = [](const Vertex_Pos_Nrm_Tgt_Tex &a, const Vertex_Pos_Nrm_Tgt_Tex &b) -> bool
+    {
+      return floatBits(a.x) == floatBits(b.x) && floatBits(a.y) == floatBits(b.y) && floatBits(a.z) == floatBits(b.z) &&
+             floatBits(a.nx) == floatBits(b.nx) && floatBits(a.ny) == floatBits(b.ny) && floatBits(a.nz) == floatBits(b.nz) &&
+             floatBits(a.u) == floatBits(b.u) && floatBits(a.v) == floatBits(b.v);
+    };
+
+    size_t mask = hashCapacity(numVertices) - 1;
+    std::vector<GLuint> table(mask + 1, INVALID_INDEX);
+
+    welded.reserve(numVertices);
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+      // Position and texture coordinates are enough for the hash, normals are compared only
+      const Vertex_Pos_Nrm_Tgt_Tex &v = vb[i];
+      uint64_t h = hash64(((uint64_t)floatBits(v.x) << 32 | floatBits(v.y)) ^
+                          hash64(((uint64_t)floatBits(v.z) << 32 | floatBits(v.u)) ^ hash64(floatBits(v.v))));
+      for (size_t slot = h & mask; ; slot = (slot + 1) & mask)
+      {
+        if (table[slot] == INVALID_INDEX)
+        {
+          table[slot] = (GLuint)welded.size();
+          remap[i] = (GLuint)welded.size();
+          welded.push_back((GLuint)i);
+          break;
+        }
+
+        if (equal(vb[welded[table[slot]]], v))
+        {
+          remap[i] = table[slot];
+          break;
+        }
+      }
+    }
+  }
+
+  // Corners of each welded vertex in the compressed sparse row layout
+  const size_t numWelded = welded.size();
+  std::vector<GLuint> cornerStart(numWelded + 1, 0);
+  for (size_t c = 0; c < numCorners; ++c)
+    ++cornerStart[remap[ib[c]] + 1];
+  for (size_t w = 0; w < numWelded; ++w)
+    cornerStart[w + 1] += cornerStart[w];
+
+  std::vector<GLuint> vertexCorners(numCorners);
+  {
+    std::vector<GLuint> fill(cornerStart.begin(), cornerStart.end() - 1);
+    for (size_t c = 0; c < numCorners; ++c)
+      vertexCorners[fill[remap[ib[c]]]++] = (GLuint)c;
+  }
+
+  // --------------------------------------------------------------------------
+  // Angle weighted tangent of each triangle corner, w holds the handedness:
+  // +1 if cross(tangent, normal) follows the direction of increasing v as our
+  // shaders expect, -1 for mirrored texture coordinates, 0 for degenerate ones
+  // --------------------------------------------------------------------------
+  std::vector<glm::vec4> cornerTangents(numCorners);
+  parallelFor(numCorners / 3, [&](size_t begin, size_t end)
+  {
+    for (size_t t = begin; t < end; ++t)
+    {
+      const Vertex_Pos_Nrm_Tgt_Tex *v[3] = {&vb[ib[3 * t + 0]], &vb[ib[3 * t + 1]], &vb[ib[3 * t + 2]]};
+      glm::vec3 p[3] = {glm::vec3(v[0]->x, v[0]->y, v[0]->z), glm::vec3(v[1]->x, v[1]->y, v[1]->z), glm::vec3(v[2]->x, v[2]->y, v[2]->z)};
+
+      // Directions of increasing u and v, the determinant sign keeps them valid for mirrored mapping
+      glm::vec3 e1 = p[1] - p[0];
+      glm::vec3 e2 = p[2] - p[0];
+      float du1 = v[1]->u - v[0]->u, dv1 = v[1]->v - v[0]->v;
+      float du2 = v[2]->u - v[0]->u, dv2 = v[2]->v - v[0]->v;
+      float det = du1 * dv2 - du2 * dv1;
+      float sign = det < 0.0f ? -1.0f : 1.0f;
+      glm::vec3 dPdu = (e1 * dv2 - e2 * dv1) * sign;
+      glm::vec3 dPdv = (e2 * du1 - e1 * du2) * sign;
+
+      for (int k = 0; k < 3; ++k)
+      {
+        glm::vec4 &out = cornerTangents[3 * t + k];
+        out = glm::vec4(0.0f);
+        if (det == 0.0f)
+          continue;
+
+        // Project the tangent and the corner edges to the tangent plane of the vertex normal
+        glm::vec3 n = safeNormalize(glm::vec3(v[k]->nx, v[k]->ny, v[k]->nz));
+        glm::vec3 tangent = safeNormalize(dPdu - n * glm::dot(n, dPdu));
+        glm::vec3 a = safeNormalize(p[(k + 1) % 3] - p[k]);
+        glm::vec3 b = safeNormalize(p[(k + 2) % 3] - p[k]);
+        a = safeNormalize(a - n * glm::dot(n, a));
+        b = safeNormalize(b - n * glm::dot(n, b));
+
+        float angle = acosf(glm::clamp(glm::dot(a, b), -1.0f, 1.0f));
+        float handedness = glm::dot(glm::cross(tangent, n), dPdv) < 0.0f ? -1.0f : 1.0f;
+        out = glm::vec4(tangent * angle, handedness);
+      }
+    }
+  });
+
+  // --------------------------------------------------------------------------
+  // Gather the corners of each welded vertex, the fixed corner order makes the
+  // result independent of the thread count and no atomics are needed
+  // --------------------------------------------------------------------------
+  std::vector<glm::vec3> weldedTangents(numWelded);
+  parallelFor(numWelded, [&](size_t begin, size_t end)
+  {
+    for (size_t w = begin; w < end; ++w)
+    {
+      // Our vertices can't store the handedness, prefer the one our shaders expect
+      glm::vec3 sum[2] = {glm::vec3(0.0f), glm::vec3(0.0f)};
+      for (GLuint c = cornerStart[w]; c < cornerStart[w + 1]; ++c)
+      {
+        const glm::vec4 &corner = cornerTangents[vertexCorners[c]];
+        if (corner.w != 0.0f)
+          sum[corner.w > 0.0f ? 0 : 1] += glm::vec3(corner);
+      }
+
+      // Orthogonalize against the normal
+      const Vertex_Pos_Nrm_Tgt_Tex &v = vb[welded[w]];
+      glm::vec3 n = safeNormalize(glm::vec3(v.nx, v.ny, v.nz));
+      glm::vec3 tangent = glm::dot(sum[0], sum[0]) > 0.0f ? sum[0] : sum[1];
+      tangent = safeNormalize(tangent - n * glm::dot(n, tangent));
+
+      // Degenerate texture mapping, any direction perpendicular to the normal will do
+      if (tangent == glm::vec3(0.0f))
+      {
+        tangent = safeNormalize(glm::cross(fabs(n.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f), n));
+        if (tangent == glm::vec3(0.0f))
+          tangent = glm::vec3(1.0f, 0.0f, 0.0f);
+      }
+
+      weldedTangents[w] = tangent;
+    }
+  });
+
+  // Scatter the tangents back to the input vertices
+  parallelFor(numVertices, [&](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i)
+    {
+      const glm::vec3 &tangent = weldedTangents[remap[i]];
+      vb[i].tx = tangent.x;
+      vb[i].ty = tangent.y;
+      vb[i].tz = tangent.z;
+    }
+  });
+}
+
+// ----------------------------------------------------------------------------
+
+// Area weighted sum of the squared distance to triangle planes, symmetric 4x4 matrix stored as its upper triangle
+struct Quadric
+{
+  double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+  // Sum of the weights to turn the sum into the mean squared distance
+  double w;
+};
+
+// Add the plane n.p + d = 0 with the given weight
+static inline void addPlane(Quadric &q, const glm::vec3 &n, float d, double w)
+{
+  q.a2 += w * n.x * n.x; q.ab += w * n.x * n.y; q.ac += w * n.x * n.z; q.ad += w * n.x * d;
+  q.b2 += w * n.y * n.y; q.bc += w * n.y * n.z; q.bd += w * n.y * d;
+  q.c2 += w * n.z * n.z; q.cd += w * n.z * d;
+  q.d2 += w * d * d;
+  q.w += w;
+}
+
+static inline void addQuadric(Quadric &q, const Quadric &r)
+{
+  q.a2 += r.a2; q.ab += r.ab; q.ac += r.ac; q.ad += r.ad;
+  q.b2 += r.b2; q.bc += r.bc; q.bd += r.bd;
+  q.c2 += r.c2; q.cd += r.cd;
+  q.d2 += r.d2;
+  q.w += r.w;
+}
+
+// Mean squared distance of the point to the planes of the quadric
+static inline double quadricError(const Quadric &q, const Vertex_Pos &p)
+{
+  double x = p.x, y = p.y, z = p.z;
+  double error = q.a2 * x * x + q.b2 * y * y + q.c2 * z * z + 2.0 * (q.ab * x * y + q.ac * x * z + q.bc * y * z) +
+                 2.0 * (q.ad * x + q.bd * y + q.cd * z) + q.d2;
+  return q.w > 0.0 ? std::max(error, 0.0) / q.w : 0.0;
+}
+
+void Geometry::GenerateLods(const std::vector<Vertex_Pos> &vb, std::vector<GLuint> &ib, std::vector<MeshLod> &lods, int numLevels)
+{
+  const size_t numVertices = vb.size();
+  ib.resize(ib.size() - ib.size() % 3);
+
+  lods.clear();
+  lods.push_back({0, (GLsizei)ib.size(), 0.0f});
+
+  auto position = [&vb](GLuint i) -> glm::vec3 { return glm::vec3(vb[i].x, vb[i].y, vb[i].z); };
+
+  // --------------------------------------------------------------------------
+  // Lock the vertices we can't move without tearing the mesh: attribute seams,
+  // i.e., positions shared by several vertices, and open or non-manifold edges
+  // --------------------------------------------------------------------------
+  std::vector<unsigned char> locked(numVertices, 0);
+  std::vector<GLuint> positionIds(numVertices);
+  {
+    size_t mask = hashCapacity(numVertices) - 1;
+    std::vector<GLuint> table(mask + 1, INVALID_INDEX);
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+      const Vertex_Pos &v = vb[i];
+      uint64_t h = hash64(((uint64_t)floatBits(v.x) << 32 | floatBits(v.y)) ^ hash64(floatBits(v.z)));
+      for (size_t slot = h & mask; ; slot = (slot + 1) & mask)
+      {
+        GLuint first = table[slot];
+        if (first == INVALID_INDEX)
+        {
+          table[slot] = (GLuint)i;
+          positionIds[i] = (GLuint)i;
+          break;
+        }
+
+        const Vertex_Pos &w = vb[first];
+        if (floatBits(w.x) == floatBits(v.x) && floatBits(w.y) == floatBits(v.y) && floatBits(w.z) == floatBits(v.z))
+        {
+          positionIds[i] = first;
+          locked[i] = locked[first] = 1;
+          break;
+        }
+      }
+    }
+  }
+
+  {
+    // Count the triangles of each undirected edge between the welded positions
+    struct EdgeSlot
+    {
+      uint64_t key;
+      GLuint count;
+    };
+
+    size_t mask = hashCapacity(ib.size() * 2 / 3 + 1) - 1;
+    std::vector<EdgeSlot> edges(mask + 1, {~0ull, 0});
+    for (size_t i = 0; i < ib.size(); ++i)
+    {
+      GLuint a = positionIds[ib[i]];
+      GLuint b = positionIds[ib[i - i % 3 + (i + 1) % 3]];
+      uint64_t key = a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a;
+      size_t slot = hash64(key) & mask;
+      while (edges[slot].key != key && edges[slot].key != ~0ull)
+        slot = (slot + 1) & mask;
+      edges[slot].key = key;
+      ++edges[slot].count;
+    }
+
+    std::vector<unsigned char> lockedPositions(numVertices, 0);
+    for (const EdgeSlot &edge : edges)
+    {
+      if (edge.key != ~0ull && edge.count != 2)
+        lockedPositions[edge.key >> 32] = lockedPositions[edge.key & 0xffffffff] = 1;
+    }
+    for (size_t i = 0; i < numVertices; ++i)
+      locked[i] |= lockedPositions[positionIds[i]];
+  }
+
+  // Plane quadrics of the triangles around each vertex
+  std::vector<Quadric> quadrics(numVertices, Quadric());
+  for (size_t t = 0; t < ib.size(); t += 3)
+  {
+    glm::vec3 p0 = position(ib[t + 0]);
+    glm::vec3 normal = glm::cross(position(ib[t + 1]) - p0, position(ib[t + 2]) - p0);
+    float length = glm::length(normal);
+    if (length <= 0.0f)
+      continue;
+
+    normal /= length;
+    float d = -glm::dot(normal, p0);
+    for (size_t e = 0; e < 3; ++e)
+      addPlane(quadrics[ib[t + e]], normal, d, 0.5 * length);
+  }
+
+  // --------------------------------------------------------------------------
+  // Greedy half edge collapses in passes: collect the collapse candidates,
+  // perform the cheapest independent ones and rebuild the triangle list, the
+  // levels are snapshots of the same continuous simplification
+  // --------------------------------------------------------------------------
+  struct Collapse
+  {
+    GLuint from, to;
+    float error;
+  };
+
+  std::vector<GLuint> triangles(ib);
+  std::vector<GLuint> triangleStart(numVertices + 1);
+  std::vector<GLuint> vertexTriangles;
+  std::vector<Collapse> collapses;
+  std::vector<unsigned char> touched(numVertices);
+  std::vector<GLuint> remap(numVertices);
+  double maxError = 0.0;
+
+  for (int level = 1; level <= numLevels; ++level)
+  {
+    const size_t previous = triangles.size();
+    const size_t target = (previous / 3 / 2) * 3;
+
+    while (triangles.size() > target)
+    {
+      // Triangles around each vertex in the compressed sparse row layout
+      std::fill(triangleStart.begin(), triangleStart.end(), 0);
+      for (GLuint i : triangles)
+        ++triangleStart[i + 1];
+      for (size_t v = 0; v < numVertices; ++v)
+        triangleStart[v + 1] += triangleStart[v];
+
+      vertexTriangles.resize(triangles.size());
+      {
+        std::vector<GLuint> fill(triangleStart.begin(), triangleStart.end() - 1);
+        for (size_t i = 0; i < triangles.size(); ++i)
+          vertexTriangles[fill[triangles[i]]++] = (GLuint)(i - i % 3);
+      }
+
+      // Cheaper direction of each edge, edges are visited from both triangles, duplicates are harmless
+      collapses.resize(triangles.size());
+      parallelFor(triangles.size(), [&](size_t begin, size_t end)
+      {
+        for (size_t i = begin; i < end; ++i)
+        {
+          GLuint a = triangles[i];
+          GLuint b = triangles[i - i % 3 + (i + 1) % 3];
+          Collapse &collapse = collapses[i];
+          collapse = {INVALID_INDEX, INVALID_INDEX, FLT_MAX};
+          if (a > b || (locked[a] && locked[b]))
+            continue;
+
+          Quadric q = quadrics[a];
+          addQuadric(q, quadrics[b]);
+          float errorAB = locked[a] ? FLT_MAX : (float)quadricError(q, vb[b]);
+          float errorBA = locked[b] ? FLT_MAX : (float)quadricError(q, vb[a]);
+          collapse = errorAB <= errorBA ? Collapse{a, b, errorAB} : Collapse{b, a, errorBA};
+        }
+      }, 1024);
+      collapses.erase(std::remove_if(collapses.begin(), collapses.end(), [](const Collapse &c) { return c.from == INVALID_INDEX; }), collapses.end());
+      if (collapses.empty())
+        break;
+
+      // Each collapse removes two triangles on average, consider only the cheapest ones but enough of them to not
+      // stall on the last few collapses
+      size_t needed = (triangles.size() - target) / 6 + 1;
+      size_t sorted = std::min(collapses.size(), std::max(4 * needed, collapses.size() / 8));
+      auto cheaper = [](const Collapse &a, const Collapse &b) { return a.error < b.error; };
+      std::nth_element(collapses.begin(), collapses.begin() + sorted - 1, collapses.end(), cheaper);
+      std::sort(collapses.begin(), collapses.begin() + sorted, cheaper);
+
+      std::fill(touched.begin(), touched.end(), 0);
+      for (size_t v = 0; v < numVertices; ++v)
+        remap[v] = (GLuint)v;
+
+      size_t performed = 0;
+      for (size_t c = 0; c < sorted && performed < needed; ++c)
+      {
+        const Collapse &collapse = collapses[c];
+        if (touched[collapse.from] || touched[collapse.to])
+          continue;
+
+        // Reject collapses flipping or squashing the remaining triangles around the moved vertex
+        bool flips = false;
+        glm::vec3 destination = position(collapse.to);
+        for (GLuint k = triangleStart[collapse.from]; k < triangleStart[collapse.from + 1] && !flips; ++k)
+        {
+          const GLuint *triangle = &triangles[vertexTriangles[k]];
+          if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+            continue;
+
+          glm::vec3 p[3] = {position(triangle[0]), position(triangle[1]), position(triangle[2])};
+          glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+          for (int e = 0; e < 3; ++e)
+          {
+            if (triangle[e] == collapse.from)
+              p[e] = destination;
+          }
+          glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+          flips = glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after);
+        }
+
+        if (flips)
+          continue;
+
+        // Topology around the moved vertex changes, keep the rest of this pass away from it
+        for (GLuint k = triangleStart[collapse.from]; k < triangleStart[collapse.from + 1]; ++k)
+        {
+          const GLuint *triangle = &triangles[vertexTriangles[k]];
+          touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+        }
+
+        remap[collapse.from] = collapse.to;
+        addQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+        maxError = std::max(maxError, (double)collapse.error);
+        ++performed;
+      }
+
+      if (performed == 0)
+        break;
+
+      // Apply the collapses and drop the degenerate triangles
+      size_t count = 0;
+      for (size_t t = 0; t < triangles.size(); t += 3)
+      {
+        GLuint a = remap[triangles[t + 0]];
+        GLuint b = remap[triangles[t + 1]];
+        GLuint c = remap[triangles[t + 2]];
+        if (a == b || b == c || c == a)
+          continue;
+
+        triangles[count++] = a;
+        triangles[count++] = b;
+        triangles[count++] = c;
+      }
+      triangles.resize(count);
+    }
+
+    // Stop once the mesh can't be simplified any further
+    if (triangles.empty() || triangles.size() > previous * 9 / 10)
+      break;
+
+    lods.push_back({(GLuint)ib.size(), (GLsizei)triangles.size(), (float)sqrt(maxError)});
+    ib.insert(ib.end(), triangles.begin(), triangles.end());
+  }
+}
+
+void Geometry::BuildMeshlets(const std::vector<Vertex_Pos> &vb, std::vector<GLuint> &ib, GLuint firstIndex, GLsizei numIndices,
+                             std::vector<Meshlet> &meshlets)
+{
+  meshlets.clear();
+
+  const size_t numVertices = vb.size();
+  const size_t numTriangles = (size_t)numIndices / 3;
+  const std::vector<GLuint> source(ib.begin() + firstIndex, ib.begin() + firstIndex + numTriangles * 3);
+
+  // Triangles around each vertex in the compressed sparse row layout
+  std::vector<GLuint> triangleStart(numVertices + 1, 0);
+  for (GLuint i : source)
+    ++triangleStart[i + 1];
+  for (size_t v = 0; v < numVertices; ++v)
+    triangleStart[v + 1] += triangleStart[v];
+
+  std::vector<GLuint> vertexTriangles(source.size());
+  {
+    std::vector<GLuint> fill(triangleStart.begin(), triangleStart.end() - 1);
+    for (size_t i = 0; i < source.size(); ++i)
+      vertexTriangles[fill[source[i]]++] = (GLuint)(i / 3);
+  }
+
+  // --------------------------------------------------------------------------
+  // Grow the meshlets greedily over the triangles sharing their vertices,
+  // preferring the ones adding the fewest new vertices
+  // --------------------------------------------------------------------------
+  std::vector<unsigned char> emitted(numTriangles, 0);
+  // Last meshlet each vertex was added to, vertices on the meshlet borders are repeated in several ones
+  std::vector<GLuint> vertexMeshlet(numVertices, INVALID_INDEX);
+  // Not yet emitted triangles around the vertices of the current meshlet, duplicates are harmless
+  std::vector<GLuint> candidates;
+  GLuint *out = ib.data() + firstIndex;
+  size_t written = 0;
+  size_t seed = 0;
+
+  while (written < source.size())
+  {
+    const GLuint meshletIndex = (GLuint)meshlets.size();
+    int meshletVertices = 0;
+    int meshletTriangles = 0;
+    const size_t meshletStart = written;
+
+    // Continue next to the previous meshlet if possible to keep the meshlets compact
+    GLuint triangle = INVALID_INDEX;
+    for (GLuint candidate : candidates)
+    {
+      if (!emitted[candidate])
+      {
+        triangle = candidate;
+        break;
+      }
+    }
+    candidates.clear();
+
+    if (triangle == INVALID_INDEX)
+    {
+      while (emitted[seed])
+        ++seed;
+      triangle = (GLuint)seed;
+    }
+
+    while (triangle != INVALID_INDEX)
+    {
+      emitted[triangle] = 1;
+      for (int e = 0; e < 3; ++e)
+      {
+        GLuint v = source[3 * triangle + e];
+        if (vertexMeshlet[v] != meshletIndex)
+        {
+          vertexMeshlet[v] = meshletIndex;
+          ++meshletVertices;
+          for (GLuint k = triangleStart[v]; k < triangleStart[v + 1]; ++k)
+          {
+            if (!emitted[vertexTriangles[k]])
+              candidates.push_back(vertexTriangles[k]);
+          }
+        }
+        out[written++] = v;
+      }
+
+      if (++meshletTriangles == MESHLET_MAX_TRIANGLES)
+        break;
+
+      // Pick the next triangle and drop the emitted candidates on the way
+      triangle = INVALID_INDEX;
+      int bestAdded = 4;
+      size_t kept = 0;
+      for (size_t i = 0; i < candidates.size(); ++i)
+      {
+        GLuint candidate = candidates[i];
+        if (emitted[candidate])
+          continue;
+        candidates[kept++] = candidate;
+
+        int added = 0;
+        for (int e = 0; e < 3; ++e)
+          added += vertexMeshlet[source[3 * candidate + e]] != meshletIndex;
+
+        if (added < bestAdded && meshletVertices + added <= MESHLET_MAX_VERTICES)
+        {
+          bestAdded = added;
+          triangle = candidate;
+        }
+      }
+      candidates.resize(kept);
+
+      // Disconnected pieces, e.g., flat shaded faces, fill the meshlet with the next free triangles
+      if (triangle == INVALID_INDEX && candidates.empty())
+      {
+        while (seed < numTriangles && emitted[seed])
+          ++seed;
+        if (seed < numTriangles)
+        {
+          int added = 0;
+          for (int e = 0; e < 3; ++e)
+            added += vertexMeshlet[source[3 * seed + e]] != meshletIndex;
+          if (meshletVertices + added <= MESHLET_MAX_VERTICES)
+            triangle = (GLuint)seed;
+        }
+      }
+    }
+
+    // ------------------------------------------------------------------------
+    // Bounding sphere around the bounding box center and the normal cone
+    // ------------------------------------------------------------------------
+    glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+    glm::vec3 normalSum(0.0f);
+    std::vector<glm::vec3> normals;
+    normals.reserve(meshletTriangles);
+    for (size_t i = meshletStart; i < written; i += 3)
+    {
+      glm::vec3 p[3];
+      for (int e = 0; e < 3; ++e)
+      {
+        const Vertex_Pos &v = vb[out[i + e]];
+        p[e] = glm::vec3(v.x, v.y, v.z);
+        boundsMin = glm::min(boundsMin, p[e]);
+        boundsMax = glm::max(boundsMax, p[e]);
+      }
+
+      glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+      float length = glm::length(normal);
+      if (length > 0.0f)
+      {
+        normals.push_back(normal / length);
+        normalSum += normals.back();
+      }
+    }
+
+    glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+    float radius = 0.0f;
+    for (size_t i = meshletStart; i < written; ++i)
+    {
+      const Vertex_Pos &v = vb[out[i]];
+      radius = glm::max(radius, glm::length(glm::vec3(v.x, v.y, v.z) - center));
+    }
+
+    // Cone wider than a hemisphere can't be culled
+    float axisLength = glm::length(normalSum);
+    glm::vec3 axis = axisLength > 0.0f ? normalSum / axisLength : glm::vec3(0.0f, 0.0f, 1.0f);
+    float minDot = axisLength > 0.0f ? 1.0f : -1.0f;
+    for (const glm::vec3 &normal : normals)
+      minDot = glm::min(minDot, glm::dot(normal, axis));
+    float cutoff = minDot <= 0.1f ? 1.0f : sqrtf(1.0f - minDot * minDot);
+
+    Meshlet meshlet = {};
+    meshlet.center[0] = center.x;
+    meshlet.center[1] = center.y;
+    meshlet.center[2] = center.z;
+    meshlet.radius = radius;
+    meshlet.coneAxis[0] = axis.x;
+    meshlet.coneAxis[1] = axis.y;
+    meshlet.coneAxis[2] = axis.z;
+    meshlet.coneCutoff = cutoff;
+    meshlet.firstIndex = firstIndex + (GLuint)meshletStart;
+    meshlet.numIndices = (GLsizei)(written - meshletStart);
+    meshlets.push_back(meshlet);
+  }
+}
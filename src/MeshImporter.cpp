@@ -0,0 +1,1093 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include "MeshImporter.h"
+#include "FileStamp.h"
+#include "Geometry.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Binary cache file header, vertex, index, LOD and meshlet blobs follow aligned to CACHE_ALIGNMENT
+struct CacheHeader
+{
+  // CACHE_MAGIC
+  char magic[4];
+  // CACHE_VERSION
+  uint32_t version;
+  // Size and modification time of the source file the cache was created from
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  // sizeof(Vertex_Pos_Nrm_Tgt_Tex) to catch vertex layout changes
+  uint32_t vertexSize;
+  uint32_t numVertices;
+  uint32_t numIndices;
+  uint32_t numLods;
+  uint32_t numMeshlets;
+  // Axis aligned bounding box
+  float boundsMin[3];
+  float boundsMax[3];
+  // Offsets of the blobs from the start of the file
+  uint64_t vertexOffset;
+  uint64_t indexOffset;
+  uint64_t lodOffset;
+  uint64_t meshletOffset;
+};
+
+static const char CACHE_MAGIC[4] = {'N', 'P', 'M', 'C'};
+static const uint32_t CACHE_VERSION = 3;
+static const uint64_t CACHE_ALIGNMENT = 64;
+
+// Round the offset up to the cache alignment
+static inline uint64_t alignOffset(uint64_t offset)
+{
+  return (offset + CACHE_ALIGNMENT - 1) & ~(CACHE_ALIGNMENT - 1);
+}
+
+// Cache lives next to the source file
+static inline std::string cacheName(const char name[])
+{
+  return std::string(name) + ".mcache";
+}
+
+// Case insensitive test of the file extension
+static bool hasExtension(const char name[], const char extension[])
+{
+  size_t nameLength = strlen(name);
+  size_t extensionLength = strlen(extension);
+  if (nameLength < extensionLength)
+    return false;
+
+  for (size_t i = 0; i < extensionLength; ++i)
+  {
+    if (tolower(name[nameLength - extensionLength + i]) != tolower(extension[i]))
+      return false;
+  }
+  return true;
+}
+
+// 64-bit hash finalizer (MurmurHash3 fmix64)
+static inline uint64_t hash64(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdull;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ull;
+  k ^= k >> 33;
+  return k;
+}
+
+// Fill in the missing normals, generate tangents, meshlets and levels of detail and compute bounds, positionIds
+// tell which vertices share a position
+static void completeMeshData(MeshData &data, const std::vector<unsigned char> &hasNormal, const std::vector<GLuint> &positionIds, size_t numPositions)
+{
+  std::vector<Vertex_Pos_Nrm_Tgt_Tex> &vb = data.vertices;
+  const std::vector<GLuint> &ib = data.indices;
+
+  // Smooth normals from the area weighted face normals of the triangles sharing the position
+  bool missingNormals = false;
+  for (unsigned char flag : hasNormal)
+    missingNormals |= !flag;
+
+  if (missingNormals)
+  {
+    std::vector<glm::vec3> normals(numPositions, glm::vec3(0.0f));
+    for (size_t i = 0; i + 2 < ib.size(); i += 3)
+    {
+      const Vertex_Pos_Nrm_Tgt_Tex &a = vb[ib[i + 0]];
+      const Vertex_Pos_Nrm_Tgt_Tex &b = vb[ib[i + 1]];
+      const Vertex_Pos_Nrm_Tgt_Tex &c = vb[ib[i + 2]];
+      glm::vec3 normal = glm::cross(glm::vec3(b.x - a.x, b.y - a.y, b.z - a.z), glm::vec3(c.x - a.x, c.y - a.y, c.z - a.z));
+      normals[positionIds[ib[i + 0]]] += normal;
+      normals[positionIds[ib[i + 1]]] += normal;
+      normals[positionIds[ib[i + 2]]] += normal;
+    }
+
+    for (size_t i = 0; i < vb.size(); ++i)
+    {
+      if (hasNormal[i])
+        continue;
+
+      glm::vec3 normal = normals[positionIds[i]];
+      float length = glm::length(normal);
+      normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+      vb[i].nx = normal.x;
+      vb[i].ny = normal.y;
+      vb[i].nz = normal.z;
+    }
+  }
+
+  Geometry::GenerateTangents(vb, ib);
+
+  // Meshlets reorder the triangles, levels of detail are appended to the index buffer
+  std::vector<Vertex_Pos> positions(vb.size());
+  for (size_t i = 0; i < vb.size(); ++i)
+    positions[i] = {vb[i].x, vb[i].y, vb[i].z};
+  Geometry::BuildMeshlets(positions, data.indices, 0, (GLsizei)data.indices.size(), data.meshlets);
+  Geometry::GenerateLods(positions, data.indices, data.lods);
+
+  // Bounding box
+  data.boundsMin = glm::vec3(vb.empty() ? 0.0f : FLT_MAX);
+  data.boundsMax = glm::vec3(vb.empty() ? 0.0f : -FLT_MAX);
+  for (const Vertex_Pos_Nrm_Tgt_Tex &v : vb)
+  {
+    data.boundsMin = glm::min(data.boundsMin, glm::vec3(v.x, v.y, v.z));
+    data.boundsMax = glm::max(data.boundsMax, glm::vec3(v.x, v.y, v.z));
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+bool MeshImporter::MapFile(const char name[], MappedFile &file)
+{
+  file = MappedFile();
+
+#ifdef _WIN32
+  HANDLE handle = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (handle == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+  {
+    CloseHandle(handle);
+    return false;
+  }
+
+  HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping)
+  {
+    CloseHandle(handle);
+    return false;
+  }
+
+  const void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!data)
+  {
+    CloseHandle(mapping);
+    CloseHandle(handle);
+    return false;
+  }
+
+  file.data = static_cast<const unsigned char *>(data);
+  file.size = (size_t)size.QuadPart;
+  file.file = handle;
+  file.mapping = mapping;
+#else
+  int handle = open(name, O_RDONLY);
+  if (handle < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(handle, &info) != 0 || info.st_size == 0)
+  {
+    close(handle);
+    return false;
+  }
+
+  void *data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, handle, 0);
+  // The mapping stays valid after closing the descriptor
+  close(handle);
+  if (data == MAP_FAILED)
+    return false;
+
+  file.data = static_cast<const unsigned char *>(data);
+  file.size = (size_t)info.st_size;
+#endif
+
+  return true;
+}
+
+void MeshImporter::UnmapFile(MappedFile &file)
+{
+  if (!file.data)
+    return;
+
+#ifdef _WIN32
+  UnmapViewOfFile(file.data);
+  CloseHandle(static_cast<HANDLE>(file.mapping));
+  CloseHandle(static_cast<HANDLE>(file.file));
+#else
+  munmap(const_cast<unsigned char *>(file.data), file.size);
+#endif
+
+  file = MappedFile();
+}
+
+bool MeshImporter::MapCache(const char name[], CacheView &view)
+{
+  view = CacheView();
+
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  if (!getFileStamp(name, sourceSize, sourceTime))
+    return false;
+
+  std::string cache = cacheName(name);
+  if (!MapFile(cache.c_str(), view.file))
+    return false;
+
+  // Validate the header and the blob ranges, stale or broken caches are silently rebuilt
+  const MappedFile &file = view.file;
+  CacheHeader header;
+  bool valid = file.size >= sizeof(CacheHeader);
+  if (valid)
+  {
+    memcpy(&header, file.data, sizeof(CacheHeader));
+    valid = memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 && header.version == CACHE_VERSION &&
+            header.sourceSize == sourceSize && header.sourceTime == sourceTime && header.vertexSize == sizeof(Vertex_Pos_Nrm_Tgt_Tex) &&
+            header.vertexOffset % CACHE_ALIGNMENT == 0 && header.indexOffset % CACHE_ALIGNMENT == 0 &&
+            header.vertexOffset + (uint64_t)header.numVertices * sizeof(Vertex_Pos_Nrm_Tgt_Tex) <= file.size &&
+            header.indexOffset + (uint64_t)header.numIndices * sizeof(GLuint) <= file.size &&
+            header.lodOffset % CACHE_ALIGNMENT == 0 && header.numLods > 0 &&
+            header.lodOffset + (uint64_t)header.numLods * sizeof(MeshLod) <= file.size &&
+            header.meshletOffset % CACHE_ALIGNMENT == 0 &&
+            header.meshletOffset + (uint64_t)header.numMeshlets * sizeof(Meshlet) <= file.size;
+  }
+
+  if (!valid)
+  {
+    UnmapFile(view.file);
+    return false;
+  }
+
+  view.vertices = reinterpret_cast<const Vertex_Pos_Nrm_Tgt_Tex *>(file.data + header.vertexOffset);
+  view.indices = reinterpret_cast<const GLuint *>(file.data + header.indexOffset);
+  view.lods = reinterpret_cast<const MeshLod *>(file.data + header.lodOffset);
+  view.meshlets = reinterpret_cast<const Meshlet *>(file.data + header.meshletOffset);
+  view.numVertices = (GLsizei)header.numVertices;
+  view.numIndices = (GLsizei)header.numIndices;
+  view.numLods = (GLsizei)header.numLods;
+  view.numMeshlets = (GLsizei)header.numMeshlets;
+  view.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+  view.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+  return true;
+}
+
+bool MeshImporter::WriteCache(const char name[], const MeshData &data)
+{
+  CacheHeader header = {};
+  memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header.version = CACHE_VERSION;
+  if (!getFileStamp(name, header.sourceSize, header.sourceTime))
+    return false;
+
+  header.vertexSize = sizeof(Vertex_Pos_Nrm_Tgt_Tex);
+  header.numVertices = (uint32_t)data.vertices.size();
+  header.numIndices = (uint32_t)data.indices.size();
+  header.numLods = (uint32_t)data.lods.size();
+  header.numMeshlets = (uint32_t)data.meshlets.size();
+  memcpy(header.boundsMin, &data.boundsMin.x, sizeof(header.boundsMin));
+  memcpy(header.boundsMax, &data.boundsMax.x, sizeof(header.boundsMax));
+  header.vertexOffset = alignOffset(sizeof(CacheHeader));
+  header.indexOffset = alignOffset(header.vertexOffset + data.vertices.size() * sizeof(Vertex_Pos_Nrm_Tgt_Tex));
+  header.lodOffset = alignOffset(header.indexOffset + data.indices.size() * sizeof(GLuint));
+  header.meshletOffset = alignOffset(header.lodOffset + data.lods.size() * sizeof(MeshLod));
+
+  std::string cache = cacheName(name);
+  std::ofstream out(cache, std::ios::binary | std::ios::trunc);
+  if (!out)
+  {
+    printf("Failed to write mesh cache: %s\n", cache.c_str());
+    return false;
+  }
+
+  // Pad with zeros up to the given offset
+  auto pad = [&out](uint64_t offset)
+  {
+    static const char zeros[CACHE_ALIGNMENT] = {0};
+    uint64_t position = (uint64_t)out.tellp();
+    out.write(zeros, (std::streamsize)(offset - position));
+  };
+
+  out.write(reinterpret_cast<const char *>(&header), sizeof(CacheHeader));
+  pad(header.vertexOffset);
+  out.write(reinterpret_cast<const char *>(data.vertices.data()), (std::streamsize)(data.vertices.size() * sizeof(Vertex_Pos_Nrm_Tgt_Tex)));
+  pad(header.indexOffset);
+  out.write(reinterpret_cast<const char *>(data.indices.data()), (std::streamsize)(data.indices.size() * sizeof(GLuint)));
+  pad(header.lodOffset);
+  out.write(reinterpret_cast<const char *>(data.lods.data()), (std::streamsize)(data.lods.size() * sizeof(MeshLod)));
+  pad(header.meshletOffset);
+  out.write(reinterpret_cast<const char *>(data.meshlets.data()), (std::streamsize)(data.meshlets.size() * sizeof(Meshlet)));
+
+  if (!out)
+  {
+    printf("Failed to write mesh cache: %s\n", cache.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool MeshImporter::Import(const char name[], MeshData &data)
+{
+  if (hasExtension(name, ".obj"))
+    return ImportObj(name, data);
+  if (hasExtension(name, ".glb"))
+    return ImportGlb(name, data);
+
+  printf("Unsupported mesh format: %s\n", name);
+  return false;
+}
+
+// ----------------------------------------------------------------------------
+// Wavefront OBJ
+// ----------------------------------------------------------------------------
+
+// Skip spaces and tabs
+static inline void skipBlanks(const char *&p, const char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t'))
+    ++p;
+}
+
+// Locale independent float parser, advances the pointer past the number
+static float parseFloat(const char *&p, const char *end)
+{
+  skipBlanks(p, end);
+
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+  {
+    negative = *p == '-';
+    ++p;
+  }
+
+  // Up to 19 significant digits in the integer mantissa, the rest only moves the exponent
+  uint64_t mantissa = 0;
+  int digits = 0, exponent = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p)
+  {
+    if (digits < 19)
+    {
+      mantissa = mantissa * 10 + (*p - '0');
+      digits += mantissa > 0 ? 1 : 0;
+    }
+    else
+      ++exponent;
+  }
+
+  if (p < end && *p == '.')
+  {
+    for (++p; p < end && *p >= '0' && *p <= '9'; ++p)
+    {
+      if (digits < 19)
+      {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += mantissa > 0 ? 1 : 0;
+        --exponent;
+      }
+    }
+  }
+
+  if (p < end && (*p == 'e' || *p == 'E'))
+  {
+    ++p;
+    bool negativeExponent = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+      negativeExponent = *p == '-';
+      ++p;
+    }
+
+    int value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p)
+      value = value < 10000 ? value * 10 + (*p - '0') : value;
+    exponent += negativeExponent ? -value : value;
+  }
+
+  double result = (double)mantissa;
+  if (exponent != 0)
+    result *= pow(10.0, exponent);
+  return (float)(negative ? -result : result);
+}
+
+// Integer parser, advances the pointer past the number
+static int parseInt(const char *&p, const char *end)
+{
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+  {
+    negative = *p == '-';
+    ++p;
+  }
+
+  int value = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p)
+    value = value * 10 + (*p - '0');
+  return negative ? -value : value;
+}
+
+// Number of elements of each kind in a chunk of the file
+struct ObjCounts
+{
+  size_t positions = 0, texCoords = 0, normals = 0, triangles = 0;
+};
+
+// Parse or just count the lines in the [begin, end) chunk, counts hold the elements before the chunk on input
+static bool parseObjChunk(const char *begin, const char *end, ObjCounts &counts, bool countOnly,
+                          glm::vec3 *positions, glm::vec2 *texCoords, glm::vec3 *normals, glm::ivec3 *corners)
+{
+  bool valid = true;
+  for (const char *p = begin; p < end; )
+  {
+    // Find the end of the line, comments are ignored
+    const char *lineEnd = static_cast<const char *>(memchr(p, '\n', end - p));
+    if (!lineEnd)
+      lineEnd = end;
+    const char *comment = static_cast<const char *>(memchr(p, '#', lineEnd - p));
+    const char *e = comment ? comment : lineEnd;
+    if (e > p && e[-1] == '\r')
+      --e;
+
+    skipBlanks(p, e);
+    if (e - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+    {
+      if (!countOnly)
+      {
+        p += 2;
+        float x = parseFloat(p, e), y = parseFloat(p, e), z = parseFloat(p, e);
+        positions[counts.positions] = glm::vec3(x, y, z);
+      }
+      ++counts.positions;
+    }
+    else if (e - p >= 3 && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t'))
+    {
+      if (!countOnly)
+      {
+        p += 3;
+        float u = parseFloat(p, e), v = parseFloat(p, e);
+        texCoords[counts.texCoords] = glm::vec2(u, v);
+      }
+      ++counts.texCoords;
+    }
+    else if (e - p >= 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t'))
+    {
+      if (!countOnly)
+      {
+        p += 3;
+        float x = parseFloat(p, e), y = parseFloat(p, e), z = parseFloat(p, e);
+        normals[counts.normals] = glm::vec3(x, y, z);
+      }
+      ++counts.normals;
+    }
+    else if (e - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+    {
+      // Corners as v/vt/vn triplets, missing elements are -1, polygons are triangulated as fans
+      p += 2;
+      glm::ivec3 first, previous;
+      int numCorners = 0;
+      for (skipBlanks(p, e); p < e; skipBlanks(p, e))
+      {
+        glm::ivec3 corner(-1);
+        int count[3] = {(int)counts.positions, (int)counts.texCoords, (int)counts.normals};
+        for (int k = 0; k < 3 && p < e && *p != ' ' && *p != '\t'; ++k)
+        {
+          if (*p != '/')
+          {
+            // Negative indices are relative to the elements read so far
+            int index = parseInt(p, e);
+            corner[k] = index < 0 ? count[k] + index : index - 1;
+            if (index == 0 || corner[k] < 0)
+              valid = false;
+          }
+
+          if (p < e && *p == '/')
+            ++p;
+        }
+
+        // Skip anything unexpected up to the next blank
+        while (p < e && *p != ' ' && *p != '\t')
+          ++p;
+
+        if (numCorners >= 2)
+        {
+          if (!countOnly)
+          {
+            glm::ivec3 *triangle = corners + 3 * counts.triangles;
+            triangle[0] = first;
+            triangle[1] = previous;
+            triangle[2] = corner;
+          }
+          ++counts.triangles;
+        }
+
+        if (numCorners == 0)
+          first = corner;
+        previous = corner;
+        ++numCorners;
+      }
+    }
+
+    p = lineEnd + 1;
+  }
+
+  return valid;
+}
+
+bool MeshImporter::ImportObj(const char name[], MeshData &data)
+{
+  MappedFile file;
+  if (!MapFile(name, file))
+  {
+    printf("Failed to open mesh: %s\n", name);
+    return false;
+  }
+
+  const char *text = reinterpret_cast<const char *>(file.data);
+  const size_t size = file.size;
+
+  // Split the file into line aligned chunks of at least 64 kB, up to 4 chunks per thread to balance the load
+  size_t maxChunks = 4 * std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  size_t numChunks = std::min<size_t>(std::max<size_t>(size >> 16, 1), maxChunks);
+  std::vector<const char *> chunks(numChunks + 1);
+  chunks[0] = text;
+  chunks[numChunks] = text + size;
+  for (size_t c = 1; c < numChunks; ++c)
+  {
+    const char *p = std::max(chunks[c - 1], text + size * c / numChunks);
+    const char *lineEnd = static_cast<const char *>(memchr(p, '\n', text + size - p));
+    chunks[c] = lineEnd ? lineEnd + 1 : text + size;
+  }
+
+  // First pass counts the elements of each chunk so that the second pass can write straight to the final arrays
+  std::vector<ObjCounts> counts(numChunks);
+  parallelFor(numChunks, [&](size_t begin, size_t end)
+  {
+    for (size_t c = begin; c < end; ++c)
+      parseObjChunk(chunks[c], chunks[c + 1], counts[c], true, nullptr, nullptr, nullptr, nullptr);
+  }, 1);
+
+  // Turn the counts into the chunk offsets
+  ObjCounts total;
+  for (ObjCounts &chunk : counts)
+  {
+    ObjCounts offset = total;
+    total.positions += chunk.positions;
+    total.texCoords += chunk.texCoords;
+    total.normals += chunk.normals;
+    total.triangles += chunk.triangles;
+    chunk = offset;
+  }
+
+  std::vector<glm::vec3> positions(total.positions);
+  std::vector<glm::vec2> texCoords(total.texCoords);
+  std::vector<glm::vec3> normals(total.normals);
+  std::vector<glm::ivec3> corners(3 * total.triangles);
+
+  // Second pass parses the chunks in parallel
+  std::vector<unsigned char> chunkValid(numChunks);
+  parallelFor(numChunks, [&](size_t begin, size_t end)
+  {
+    for (size_t c = begin; c < end; ++c)
+    {
+      ObjCounts offset = counts[c];
+      chunkValid[c] = parseObjChunk(chunks[c], chunks[c + 1], offset, false, positions.data(), texCoords.data(), normals.data(), corners.data());
+    }
+  }, 1);
+
+  UnmapFile(file);
+
+  // Validate the indices
+  bool valid = true;
+  for (unsigned char flag : chunkValid)
+    valid &= flag != 0;
+  for (const glm::ivec3 &corner : corners)
+  {
+    valid &= corner.x >= 0 && corner.x < (int)positions.size();
+    valid &= corner.y < (int)texCoords.size();
+    valid &= corner.z < (int)normals.size();
+  }
+
+  if (!valid || corners.empty())
+  {
+    printf("Invalid mesh: %s\n", name);
+    return false;
+  }
+
+  // Unique v/vt/vn triplets become vertices, open addressing with linear probing
+  data.vertices.clear();
+  data.indices.resize(corners.size());
+  std::vector<unsigned char> hasNormal;
+  std::vector<GLuint> positionIds;
+  {
+    size_t capacity = 16;
+    while (capacity < 2 * corners.size())
+      capacity <<= 1;
+    size_t mask = capacity - 1;
+    std::vector<GLuint> table(capacity, 0xffffffff);
+    std::vector<glm::ivec3> unique;
+    unique.reserve(corners.size() / 4);
+
+    for (size_t i = 0; i < corners.size(); ++i)
+    {
+      const glm::ivec3 &corner = corners[i];
+      uint64_t h = hash64(((uint64_t)(uint32_t)corner.x << 32 | (uint32_t)corner.y) ^ hash64((uint32_t)corner.z));
+      size_t slot = h & mask;
+      while (table[slot] != 0xffffffff && unique[table[slot]] != corner)
+        slot = (slot + 1) & mask;
+
+      if (table[slot] == 0xffffffff)
+      {
+        table[slot] = (GLuint)unique.size();
+        unique.push_back(corner);
+      }
+      data.indices[i] = table[slot];
+    }
+
+    data.vertices.resize(unique.size());
+    hasNormal.resize(unique.size());
+    positionIds.resize(unique.size());
+    parallelFor(unique.size(), [&](size_t begin, size_t end)
+    {
+      for (size_t i = begin; i < end; ++i)
+      {
+        const glm::ivec3 &corner = unique[i];
+        const glm::vec3 &position = positions[corner.x];
+        glm::vec2 texCoord = corner.y >= 0 ? texCoords[corner.y] : glm::vec2(0.0f);
+        glm::vec3 normal = corner.z >= 0 ? normals[corner.z] : glm::vec3(0.0f);
+        data.vertices[i] = {position.x, position.y, position.z, normal.x, normal.y, normal.z, 0.0f, 0.0f, 0.0f, texCoord.x, texCoord.y};
+        hasNormal[i] = corner.z >= 0;
+        positionIds[i] = (GLuint)corner.x;
+      }
+    });
+  }
+
+  completeMeshData(data, hasNormal, positionIds, positions.size());
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// Binary glTF
+// ----------------------------------------------------------------------------
+
+// Minimal JSON document node, enough for the glTF scene description
+struct JsonValue
+{
+  enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+  double number = 0.0;
+  std::string string;
+  std::vector<JsonValue> array;
+  std::vector<std::pair<std::string, JsonValue>> object;
+
+  // Member of an object, nullptr if missing
+  const JsonValue *Find(const char key[]) const
+  {
+    for (const std::pair<std::string, JsonValue> &member : object)
+    {
+      if (member.first == key)
+        return &member.second;
+    }
+    return nullptr;
+  }
+
+  // Numeric member of an object with a default value
+  double GetNumber(const char key[], double defaultValue) const
+  {
+    const JsonValue *value = Find(key);
+    return value && value->type == Number ? value->number : defaultValue;
+  }
+};
+
+// Recursive descent JSON parser, returns false on malformed input
+static bool parseJson(const char *&p, const char *end, JsonValue &value, int depth = 0)
+{
+  auto skipWhitespace = [&p, end]()
+  {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+      ++p;
+  };
+
+  // Strings are only used as keys and names, escapes other than the simple ones are kept verbatim
+  auto parseString = [&p, end](std::string &string) -> bool
+  {
+    if (p >= end || *p != '"')
+      return false;
+    for (++p; p < end && *p != '"'; ++p)
+    {
+      if (*p == '\\' && p + 1 < end)
+        ++p;
+      string.push_back(*p);
+    }
+    if (p >= end)
+      return false;
+    ++p;
+    return true;
+  };
+
+  skipWhitespace();
+  if (p >= end || depth > 64)
+    return false;
+
+  if (*p == '{')
+  {
+    value.type = JsonValue::Object;
+    ++p;
+    skipWhitespace();
+    if (p < end && *p == '}')
+    {
+      ++p;
+      return true;
+    }
+
+    while (p < end)
+    {
+      std::pair<std::string, JsonValue> member;
+      skipWhitespace();
+      if (!parseString(member.first))
+        return false;
+      skipWhitespace();
+      if (p >= end || *p != ':')
+        return false;
+      ++p;
+      if (!parseJson(p, end, member.second, depth + 1))
+        return false;
+      value.object.push_back(std::move(member));
+
+      skipWhitespace();
+      if (p < end && *p == ',')
+        ++p;
+      else if (p < end && *p == '}')
+      {
+        ++p;
+        return true;
+      }
+      else
+        return false;
+    }
+    return false;
+  }
+
+  if (*p == '[')
+  {
+    value.type = JsonValue::Array;
+    ++p;
+    skipWhitespace();
+    if (p < end && *p == ']')
+    {
+      ++p;
+      return true;
+    }
+
+    while (p < end)
+    {
+      value.array.emplace_back();
+      if (!parseJson(p, end, value.array.back(), depth + 1))
+        return false;
+
+      skipWhitespace();
+      if (p < end && *p == ',')
+        ++p;
+      else if (p < end && *p == ']')
+      {
+        ++p;
+        return true;
+      }
+      else
+        return false;
+    }
+    return false;
+  }
+
+  if (*p == '"')
+  {
+    value.type = JsonValue::String;
+    return parseString(value.string);
+  }
+
+  if (end - p >= 4 && strncmp(p, "true", 4) == 0)
+  {
+    value.type = JsonValue::Bool;
+    value.number = 1.0;
+    p += 4;
+    return true;
+  }
+
+  if (end - p >= 5 && strncmp(p, "false", 5) == 0)
+  {
+    value.type = JsonValue::Bool;
+    p += 5;
+    return true;
+  }
+
+  if (end - p >= 4 && strncmp(p, "null", 4) == 0)
+  {
+    p += 4;
+    return true;
+  }
+
+  const char *start = p;
+  value.type = JsonValue::Number;
+  value.number = parseFloat(p, end);
+  return p != start;
+}
+
+// Accessor resolved to a strided range of the binary chunk
+struct GlbAccessor
+{
+  const unsigned char *data = nullptr;
+  size_t count = 0;
+  size_t stride = 0;
+  int componentType = 0;
+  int components = 0;
+};
+
+// Resolve the accessor, only tightly or regularly strided non-sparse accessors of the binary chunk are supported
+static bool resolveAccessor(const JsonValue &document, int index, const unsigned char *bin, size_t binSize, GlbAccessor &accessor)
+{
+  const JsonValue *accessors = document.Find("accessors");
+  const JsonValue *bufferViews = document.Find("bufferViews");
+  if (!accessors || !bufferViews || index < 0 || index >= (int)accessors->array.size())
+    return false;
+
+  const JsonValue &a = accessors->array[index];
+  int viewIndex = (int)a.GetNumber("bufferView", -1);
+  if (viewIndex < 0 || viewIndex >= (int)bufferViews->array.size() || a.Find("sparse"))
+    return false;
+
+  const JsonValue &view = bufferViews->array[viewIndex];
+  if ((int)view.GetNumber("buffer", 0) != 0)
+    return false;
+
+  static const char *types[] = {"SCALAR", "VEC2", "VEC3", "VEC4"};
+  const JsonValue *type = a.Find("type");
+  accessor.components = 0;
+  for (int i = 0; i < 4 && type; ++i)
+  {
+    if (type->string == types[i])
+      accessor.components = i + 1;
+  }
+
+  accessor.componentType = (int)a.GetNumber("componentType", 0);
+  size_t componentSize = accessor.componentType == GL_FLOAT || accessor.componentType == GL_UNSIGNED_INT ? 4 :
+                         accessor.componentType == GL_UNSIGNED_SHORT || accessor.componentType == GL_SHORT ? 2 : 1;
+  accessor.count = (size_t)a.GetNumber("count", 0);
+  accessor.stride = (size_t)view.GetNumber("byteStride", 0);
+  if (accessor.stride == 0)
+    accessor.stride = componentSize * accessor.components;
+
+  size_t offset = (size_t)view.GetNumber("byteOffset", 0) + (size_t)a.GetNumber("byteOffset", 0);
+  size_t length = accessor.count ? (accessor.count - 1) * accessor.stride + componentSize * accessor.components : 0;
+  if (accessor.components == 0 || offset + length > binSize || (size_t)a.GetNumber("byteOffset", 0) + length > (size_t)view.GetNumber("byteLength", 0))
+    return false;
+
+  accessor.data = bin + offset;
+  return true;
+}
+
+bool MeshImporter::ImportGlb(const char name[], MeshData &data)
+{
+  MappedFile file;
+  if (!MapFile(name, file))
+  {
+    printf("Failed to open mesh: %s\n", name);
+    return false;
+  }
+
+  // Read little endian 32-bit value
+  auto read32 = [&file](size_t offset) -> uint32_t
+  {
+    uint32_t value;
+    memcpy(&value, file.data + offset, sizeof(value));
+    return value;
+  };
+
+  // Header: magic, version, length, followed by the JSON and BIN chunks
+  const uint32_t GLB_MAGIC = 0x46546c67, CHUNK_JSON = 0x4e4f534a, CHUNK_BIN = 0x004e4942;
+  if (file.size < 20 || read32(0) != GLB_MAGIC || read32(4) != 2)
+  {
+    printf("Not a binary glTF 2.0 file: %s\n", name);
+    UnmapFile(file);
+    return false;
+  }
+
+  const char *json = nullptr;
+  size_t jsonSize = 0;
+  const unsigned char *bin = nullptr;
+  size_t binSize = 0;
+  for (size_t offset = 12; offset + 8 <= file.size; )
+  {
+    size_t chunkSize = read32(offset);
+    uint32_t chunkType = read32(offset + 4);
+    if (offset + 8 + chunkSize > file.size)
+      break;
+
+    if (chunkType == CHUNK_JSON && !json)
+    {
+      json = reinterpret_cast<const char *>(file.data + offset + 8);
+      jsonSize = chunkSize;
+    }
+    else if (chunkType == CHUNK_BIN && !bin)
+    {
+      bin = file.data + offset + 8;
+      binSize = chunkSize;
+    }
+    offset += 8 + ((chunkSize + 3) & ~(size_t)3);
+  }
+
+  JsonValue document;
+  const char *p = json;
+  if (!json || !parseJson(p, json + jsonSize, document) || document.type != JsonValue::Object)
+  {
+    printf("Invalid glTF scene description: %s\n", name);
+    UnmapFile(file);
+    return false;
+  }
+
+  // Collect the triangle primitives and their ranges in the merged buffers
+  struct Primitive
+  {
+    GlbAccessor positions, normals, texCoords, indices;
+    size_t firstVertex, firstIndex, numIndices;
+  };
+
+  std::vector<Primitive> primitives;
+  size_t numVertices = 0, numIndices = 0;
+  const JsonValue *meshes = document.Find("meshes");
+  for (size_t m = 0; meshes && m < meshes->array.size(); ++m)
+  {
+    const JsonValue *meshPrimitives = meshes->array[m].Find("primitives");
+    for (size_t i = 0; meshPrimitives && i < meshPrimitives->array.size(); ++i)
+    {
+      const JsonValue &primitive = meshPrimitives->array[i];
+      const JsonValue *attributes = primitive.Find("attributes");
+      if ((int)primitive.GetNumber("mode", 4) != 4 || !attributes)
+        continue;
+
+      Primitive prim;
+      if (!resolveAccessor(document, (int)attributes->GetNumber("POSITION", -1), bin, binSize, prim.positions) ||
+          prim.positions.componentType != GL_FLOAT || prim.positions.components != 3)
+      {
+        printf("Skipping glTF primitive without float positions in %s\n", name);
+        continue;
+      }
+
+      // Optional attributes of unsupported formats are dropped
+      if (!resolveAccessor(document, (int)attributes->GetNumber("NORMAL", -1), bin, binSize, prim.normals) ||
+          prim.normals.componentType != GL_FLOAT || prim.normals.components != 3 || prim.normals.count != prim.positions.count)
+        prim.normals = GlbAccessor();
+      if (!resolveAccessor(document, (int)attributes->GetNumber("TEXCOORD_0", -1), bin, binSize, prim.texCoords) ||
+          prim.texCoords.componentType != GL_FLOAT || prim.texCoords.components != 2 || prim.texCoords.count != prim.positions.count)
+        prim.texCoords = GlbAccessor();
+
+      // Non-indexed primitives draw the vertices in order
+      if (primitive.Find("indices"))
+      {
+        if (!resolveAccessor(document, (int)primitive.GetNumber("indices", -1), bin, binSize, prim.indices) || prim.indices.components != 1 ||
+            (prim.indices.componentType != GL_UNSIGNED_BYTE && prim.indices.componentType != GL_UNSIGNED_SHORT && prim.indices.componentType != GL_UNSIGNED_INT))
+        {
+          printf("Skipping glTF primitive with invalid indices in %s\n", name);
+          continue;
+        }
+        prim.numIndices = prim.indices.count - prim.indices.count % 3;
+      }
+      else
+        prim.numIndices = prim.positions.count - prim.positions.count % 3;
+
+      prim.firstVertex = numVertices;
+      prim.firstIndex = numIndices;
+      numVertices += prim.positions.count;
+      numIndices += prim.numIndices;
+      primitives.push_back(prim);
+    }
+  }
+
+  if (primitives.empty())
+  {
+    printf("No triangle geometry in: %s\n", name);
+    UnmapFile(file);
+    return false;
+  }
+
+  // Convert the primitives in parallel, each one writes its own ranges
+  data.vertices.resize(numVertices);
+  data.indices.resize(numIndices);
+  std::vector<unsigned char> hasNormal(numVertices);
+  std::vector<unsigned char> primitiveValid(primitives.size(), 1);
+  parallelFor(primitives.size(), [&](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i)
+    {
+      const Primitive &prim = primitives[i];
+      for (size_t v = 0; v < prim.positions.count; ++v)
+      {
+        float position[3], normal[3] = {0.0f, 0.0f, 0.0f}, texCoord[2] = {0.0f, 0.0f};
+        memcpy(position, prim.positions.data + v * prim.positions.stride, sizeof(position));
+        if (prim.normals.data)
+          memcpy(normal, prim.normals.data + v * prim.normals.stride, sizeof(normal));
+        if (prim.texCoords.data)
+          memcpy(texCoord, prim.texCoords.data + v * prim.texCoords.stride, sizeof(texCoord));
+
+        // glTF has the texture origin in the top left corner, our textures are flipped on load
+        data.vertices[prim.firstVertex + v] = {position[0], position[1], position[2], normal[0], normal[1], normal[2],
+                                               0.0f, 0.0f, 0.0f, texCoord[0], 1.0f - texCoord[1]};
+        hasNormal[prim.firstVertex + v] = prim.normals.data != nullptr;
+      }
+
+      for (size_t j = 0; j < prim.numIndices; ++j)
+      {
+        GLuint index = (GLuint)j;
+        if (prim.indices.data)
+        {
+          const unsigned char *src = prim.indices.data + j * prim.indices.stride;
+          if (prim.indices.componentType == GL_UNSIGNED_BYTE)
+            index = *src;
+          else if (prim.indices.componentType == GL_UNSIGNED_SHORT)
+          {
+            uint16_t value;
+            memcpy(&value, src, sizeof(value));
+            index = value;
+          }
+          else
+            memcpy(&index, src, sizeof(index));
+        }
+
+        if (index >= prim.positions.count)
+        {
+          primitiveValid[i] = 0;
+          index = 0;
+        }
+        data.indices[prim.firstIndex + j] = (GLuint)prim.firstVertex + index;
+      }
+    }
+  }, 1);
+
+  UnmapFile(file);
+
+  for (unsigned char flag : primitiveValid)
+  {
+    if (!flag)
+    {
+      printf("Invalid mesh: %s\n", name);
+      return false;
+    }
+  }
+
+  // Vertices of glTF primitives are unique, normals are smoothed only within a primitive
+  std::vector<GLuint> positionIds(numVertices);
+  for (size_t i = 0; i < numVertices; ++i)
+    positionIds[i] = (GLuint)i;
+
+  completeMeshData(data, hasNormal, positionIds, numVertices);
+  return true;
+}
@@ -0,0 +1,226 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include "PipelineStats.h"
+#include "TextOverlay.h"
+
+#include <cstdio>
+#include <cstring>
+
+PipelineStats &PipelineStats::GetInstance()
+{
+  static PipelineStats stats;
+  return stats;
+}
+
+const char *PipelineStats::GetCounterName(int counter)
+{
+  static const char *names[NumCounters] =
+  {
+    "Vertices", "Primitives", "VS invocations", "GS invocations", "GS primitives", "Clipping in", "Clipping out",
+    "FS invocations", "CS invocations", "Primitives generated", "Samples passed"
+  };
+  return names[counter];
+}
+
+GLenum PipelineStats::GetTarget(int counter)
+{
+  // ARB_pipeline_statistics_query tokens have the same values as the core ones
+  static const GLenum targets[NumCounters] =
+  {
+    GL_VERTICES_SUBMITTED, GL_PRIMITIVES_SUBMITTED, GL_VERTEX_SHADER_INVOCATIONS, GL_GEOMETRY_SHADER_INVOCATIONS,
+    GL_GEOMETRY_SHADER_PRIMITIVES_EMITTED, GL_CLIPPING_INPUT_PRIMITIVES, GL_CLIPPING_OUTPUT_PRIMITIVES,
+    GL_FRAGMENT_SHADER_INVOCATIONS, GL_COMPUTE_SHADER_INVOCATIONS, GL_PRIMITIVES_GENERATED, GL_SAMPLES_PASSED
+  };
+  return targets[counter];
+}
+
+bool PipelineStats::IsSupported()
+{
+  // Look the extension up just once, our loader doesn't check them
+  if (_support == Support::Unknown)
+  {
+    _support = GLAD_GL_VERSION_4_6 ? Support::Full : Support::None;
+    GLint numExtensions = 0;
+    if (_support == Support::None)
+      glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; i < numExtensions; ++i)
+    {
+      const char *extension = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+      if (strcmp(extension, "GL_ARB_pipeline_statistics_query") == 0)
+        _support = Support::Full;
+    }
+
+    if (_support == Support::None)
+      printf("Pipeline statistics queries not supported, counting only the primitives generated and samples passed.\n");
+  }
+
+  return _support == Support::Full;
+}
+
+// ----------------------------------------------------------------------------
+
+void PipelineStats::BeginPass(const char *name)
+{
+  if (_depth++ > 0)
+  {
+    if (!_nestingReported)
+      printf("Pipeline statistics: pass %s started within %s, it's counted as a part of it\n", name, _pending.back().name);
+    _nestingReported = true;
+    return;
+  }
+
+  PendingPass pass;
+  if (_freeQueries.empty())
+  {
+    glGenQueries(NUM_QUERIES, pass.queries);
+  }
+  else
+  {
+    pass = _freeQueries.back();
+    _freeQueries.pop_back();
+  }
+  pass.name = name;
+  pass.frame = _frame;
+
+  glQueryCounter(pass.queries[NumCounters], GL_TIMESTAMP);
+  for (int i = IsSupported() ? 0 : NumPipelineCounters; i < NumCounters; ++i)
+    glBeginQuery(GetTarget(i), pass.queries[i]);
+
+  _pending.push_back(pass);
+}
+
+void PipelineStats::EndPass()
+{
+  if (_depth == 0 || --_depth > 0)
+    return;
+
+  const PendingPass &pass = _pending.back();
+  for (int i = IsSupported() ? 0 : NumPipelineCounters; i < NumCounters; ++i)
+    glEndQuery(GetTarget(i));
+  glQueryCounter(pass.queries[NumCounters + 1], GL_TIMESTAMP);
+}
+
+void PipelineStats::EndFrame()
+{
+  ++_frame;
+
+  const int first = IsSupported() ? 0 : NumPipelineCounters;
+  while (!_pending.empty() && _pending.front().frame < _frame)
+  {
+    // The pass left open isn't finished yet
+    const PendingPass &pass = _pending.front();
+    if (_depth > 0 && _pending.size() == 1)
+      break;
+
+    // Passes finish in the submission order, stop at the first one not done yet
+    GLint available = 0;
+    glGetQueryObjectiv(pass.queries[NumCounters + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    for (int i = first; i < NumCounters && available; ++i)
+      glGetQueryObjectiv(pass.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      break;
+
+    // Frame of the passes changed, the previous one is complete
+    if (pass.frame != _resolvedFrame && !_resolving.empty())
+      FinishFrame();
+    _resolvedFrame = pass.frame;
+
+    Accumulate(pass);
+    _freeQueries.push_back(pass);
+    _pending.pop_front();
+  }
+
+  // All the passes of the frame read back
+  if (!_resolving.empty() && (_pending.empty() || _pending.front().frame != _resolvedFrame))
+    FinishFrame();
+}
+
+void PipelineStats::Accumulate(const PendingPass &pending)
+{
+  Pass *pass = nullptr;
+  for (Pass &resolving : _resolving)
+  {
+    if (resolving.name == pending.name)
+    {
+      pass = &resolving;
+      break;
+    }
+  }
+
+  if (!pass)
+  {
+    _resolving.emplace_back();
+    pass = &_resolving.back();
+    pass->name = pending.name;
+    memset(pass->counters, 0, sizeof(pass->counters));
+    pass->time = 0.0f;
+    pass->instances = 0;
+  }
+
+  for (int i = IsSupported() ? 0 : NumPipelineCounters; i < NumCounters; ++i)
+  {
+    GLuint64 value = 0;
+    glGetQueryObjectui64v(pending.queries[i], GL_QUERY_RESULT, &value);
+    pass->counters[i] += value;
+  }
+
+  GLuint64 begin = 0, end = 0;
+  glGetQueryObjectui64v(pending.queries[NumCounters], GL_QUERY_RESULT, &begin);
+  glGetQueryObjectui64v(pending.queries[NumCounters + 1], GL_QUERY_RESULT, &end);
+  pass->time += (float)((double)(end - begin) * 1e-6);
+  ++pass->instances;
+}
+
+void PipelineStats::FinishFrame()
+{
+  _passes.swap(_resolving);
+  _resolving.clear();
+  for (const Pass &pass : _passes)
+    _lastPasses[pass.name] = pass;
+}
+
+GLuint64 PipelineStats::GetCounter(const char *name, int counter) const
+{
+  auto it = _lastPasses.find(name);
+  return it != _lastPasses.end() ? it->second.counters[counter] : 0;
+}
+
+void PipelineStats::Print(TextOverlay &overlay) const
+{
+  // Passes in columns, the counters in rows
+  overlay.Print("%-20s", "Pass");
+  for (const Pass &pass : _passes)
+    overlay.Print(" %14.14s", pass.name.c_str());
+  overlay.Print("\n%-20s", "GPU time [ms]");
+  for (const Pass &pass : _passes)
+    overlay.Print(" %14.2f", pass.time);
+  overlay.Print("\n");
+
+  for (int i = 0; i < NumCounters; ++i)
+  {
+    overlay.Print("%-20s", GetCounterName(i));
+    for (const Pass &pass : _passes)
+    {
+      if (i < NumPipelineCounters && _support != Support::Full)
+        overlay.Print(" %14s", "-");
+      else
+        overlay.Print(" %14llu", (unsigned long long)pass.counters[i]);
+    }
+    overlay.Print("\n");
+  }
+}
+
+void PipelineStats::Release()
+{
+  for (const PendingPass &pass : _pending)
+    glDeleteQueries(NUM_QUERIES, pass.queries);
+  _pending.clear();
+  _depth = 0;
+
+  for (const PendingPass &pass : _freeQueries)
+    glDeleteQueries(NUM_QUERIES, pass.queries);
+  _freeQueries.clear();
+}
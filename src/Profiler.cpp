@@ -0,0 +1,241 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+Profiler &Profiler::GetInstance()
+{
+  // Never destroyed, threads may still record while the statics are being destroyed
+  static Profiler *instance = new Profiler();
+  return *instance;
+}
+
+int64_t Profiler::Now()
+{
+  typedef std::chrono::steady_clock Clock;
+  static const Clock::time_point start = Clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+Profiler::ThreadBuffer &Profiler::GetThreadBuffer()
+{
+  // Registered just once per thread, the recording itself doesn't lock
+  thread_local ThreadBuffer *buffer = nullptr;
+  if (!buffer)
+  {
+    buffer = new ThreadBuffer();
+    buffer->head.store(0, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(_threadsMutex);
+    buffer->id = _nextThreadId++;
+    buffer->name = "Thread " + std::to_string(buffer->id);
+    _threads.push_back(buffer);
+  }
+  return *buffer;
+}
+
+void Profiler::SetThreadName(const char *name)
+{
+  ThreadBuffer &buffer = GetThreadBuffer();
+  std::lock_guard<std::mutex> lock(_threadsMutex);
+  buffer.name = name;
+}
+
+const char *Profiler::Intern(const std::string &name)
+{
+  std::lock_guard<std::mutex> lock(_namesMutex);
+  return _names.insert(name).first->c_str();
+}
+
+void Profiler::Record(const char *name, int64_t begin, int64_t end)
+{
+  ThreadBuffer &buffer = GetThreadBuffer();
+
+  // Only this thread writes, the release store publishes the event to the capture
+  const uint64_t head = buffer.head.load(std::memory_order_relaxed);
+  Event &event = buffer.events[head % RING_SIZE];
+  event.name = name;
+  event.begin = begin;
+  event.end = end;
+  buffer.head.store(head + 1, std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------
+
+GLuint Profiler::GetQuery()
+{
+  if (_freeQueries.empty())
+  {
+    GLuint query;
+    glGenQueries(1, &query);
+    return query;
+  }
+
+  GLuint query = _freeQueries.back();
+  _freeQueries.pop_back();
+  return query;
+}
+
+size_t Profiler::BeginGpuScope(const char *name)
+{
+  PendingGpuScope scope;
+  scope.name = name;
+  scope.queries[0] = GetQuery();
+  scope.queries[1] = GetQuery();
+  scope.frame = _frame;
+  glQueryCounter(scope.queries[0], GL_TIMESTAMP);
+
+  _pending.push_back(scope);
+  return _numResolved + _pending.size() - 1;
+}
+
+void Profiler::EndGpuScope(size_t index)
+{
+  glQueryCounter(_pending[index - _numResolved].queries[1], GL_TIMESTAMP);
+}
+
+void Profiler::Calibrate()
+{
+  // The timestamp is taken once the previous commands reach the GPU, close enough to the CPU time of the call
+  GLint64 gpuTime = 0;
+  glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+  _gpuOffset = Now() - gpuTime;
+}
+
+void Profiler::EndFrame()
+{
+  if (_frame % CALIBRATION_FRAMES == 0)
+    Calibrate();
+  ++_frame;
+
+  if (_gpuEvents.empty())
+    _gpuEvents.resize(RING_SIZE);
+
+  // Scopes finish in the submission order, stop at the first one not done yet
+  while (!_pending.empty() && _pending.front().frame < _frame)
+  {
+    PendingGpuScope &scope = _pending.front();
+    GLint available = 0;
+    glGetQueryObjectiv(scope.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      break;
+
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(scope.queries[0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(scope.queries[1], GL_QUERY_RESULT, &end);
+
+    Event &event = _gpuEvents[_gpuHead++ % RING_SIZE];
+    event.name = scope.name;
+    event.begin = (int64_t)begin + _gpuOffset;
+    event.end = (int64_t)end + _gpuOffset;
+
+    _freeQueries.push_back(scope.queries[0]);
+    _freeQueries.push_back(scope.queries[1]);
+    _pending.pop_front();
+    ++_numResolved;
+  }
+
+  if (!IsCapturing())
+    return;
+
+  // The last captured frame has ended, wait for its GPU scopes as well
+  if (_frame == _captureEndFrame)
+    _captureEnd = Now();
+
+  if (_frame >= _captureEndFrame && (_pending.empty() || _pending.front().frame >= _captureEndFrame))
+  {
+    char fileName[64];
+    snprintf(fileName, sizeof(fileName), "trace_%u.json", _captureEndFrame);
+    WriteTrace(fileName);
+    _captureEndFrame = 0;
+  }
+}
+
+void Profiler::Capture(int numFrames)
+{
+  if (IsCapturing())
+    return;
+
+  _captureBegin = Now();
+  _captureEndFrame = _frame + std::max(numFrames, 1);
+  printf("Capturing a trace of %d frames\n", std::max(numFrames, 1));
+}
+
+void Profiler::WriteTrace(const char *fileName)
+{
+  FILE *file = fopen(fileName, "w");
+  if (!file)
+  {
+    printf("Failed to write the trace %s\n", fileName);
+    return;
+  }
+
+  // Complete events in microseconds, CPU threads in the first process and the GPU in the second one
+  int numEvents = 0;
+  fprintf(file, "{\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"GPU\"}},\n");
+  fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":2,\"tid\":1,\"args\":{\"name\":\"OpenGL\"}}");
+
+  auto writeEvent = [this, file, &numEvents](const Event &event, int pid, int tid)
+  {
+    if (event.end < _captureBegin || event.begin > _captureEnd)
+      return;
+
+    fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", event.name, pid, tid,
+            event.begin * 1e-3, (event.end - event.begin) * 1e-3);
+    ++numEvents;
+  };
+
+  std::vector<ThreadBuffer*> threads;
+  {
+    std::lock_guard<std::mutex> lock(_threadsMutex);
+    threads = _threads;
+    for (ThreadBuffer *buffer : threads)
+      fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", buffer->id, buffer->name.c_str());
+  }
+
+  std::vector<Event> events;
+  for (ThreadBuffer *buffer : threads)
+  {
+    // Copy the ring while the thread keeps writing, then drop the events it has overwritten meanwhile
+    const uint64_t head = buffer->head.load(std::memory_order_acquire);
+    const uint64_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+    events.clear();
+    for (uint64_t i = first; i < head; ++i)
+      events.push_back(buffer->events[i % RING_SIZE]);
+
+    // The slot of the event being written right now isn't valid either
+    const uint64_t newHead = buffer->head.load(std::memory_order_acquire) + 1;
+    const uint64_t valid = newHead > RING_SIZE ? newHead - RING_SIZE : 0;
+    for (uint64_t i = std::max(first, valid); i < head; ++i)
+      writeEvent(events[i - first], 1, buffer->id);
+  }
+
+  const size_t firstGpu = _gpuHead > RING_SIZE ? _gpuHead - RING_SIZE : 0;
+  for (size_t i = firstGpu; i < _gpuHead; ++i)
+    writeEvent(_gpuEvents[i % RING_SIZE], 2, 1);
+
+  fprintf(file, "\n]}\n");
+  fclose(file);
+
+  printf("Trace of %d events written to %s, open it in chrome://tracing or ui.perfetto.dev\n", numEvents, fileName);
+}
+
+void Profiler::Release()
+{
+  for (const PendingGpuScope &scope : _pending)
+    glDeleteQueries(2, scope.queries);
+  _numResolved += _pending.size();
+  _pending.clear();
+
+  if (!_freeQueries.empty())
+    glDeleteQueries((GLsizei)_freeQueries.size(), _freeQueries.data());
+  _freeQueries.clear();
+}
@@ -0,0 +1,216 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include "RenderTargetPool.h"
+#include "ResourceRegistry.h"
+
+#include <cstdio>
+
+RenderTargetPool &RenderTargetPool::GetInstance()
+{
+  static RenderTargetPool pool;
+  return pool;
+}
+
+RenderTargetPool::RenderTargetPool() : _frame(0), _targetWidth(0), _targetHeight(0), _resizePending(false),
+  _resizeWidth(0), _resizeHeight(0), _numRequests(0), _numResizes(0), _numAllocations(0), _numReuses(0), _numEvictions(0) {}
+
+GLuint RenderTargetPool::AcquireTexture(GLenum internalFormat, int width, int height, GLsizei samples, const char *owner)
+{
+  return Acquire(false, internalFormat, width, height, samples, owner);
+}
+
+GLuint RenderTargetPool::AcquireRenderbuffer(GLenum internalFormat, int width, int height, GLsizei samples, const char *owner)
+{
+  return Acquire(true, internalFormat, width, height, samples, owner);
+}
+
+void RenderTargetPool::ReleaseTexture(GLuint texture)
+{
+  Release(false, texture);
+}
+
+void RenderTargetPool::ReleaseRenderbuffer(GLuint renderbuffer)
+{
+  Release(true, renderbuffer);
+}
+
+GLuint RenderTargetPool::Acquire(bool renderbuffer, GLenum internalFormat, int width, int height, GLsizei samples, const char *owner)
+{
+  width = RoundUp(width);
+  height = RoundUp(height);
+  samples = samples > 1 ? samples : 1;
+
+  for (Entry &entry : _entries)
+  {
+    if (entry.free && entry.renderbuffer == renderbuffer && entry.internalFormat == internalFormat &&
+        entry.width == width && entry.height == height && entry.samples == samples)
+    {
+      entry.free = false;
+      ++_numReuses;
+      return entry.name;
+    }
+  }
+
+  Entry entry;
+  entry.renderbuffer = renderbuffer;
+  entry.internalFormat = internalFormat;
+  entry.width = width;
+  entry.height = height;
+  entry.samples = samples;
+  entry.owner = owner;
+  entry.free = false;
+  entry.releaseFrame = 0;
+
+  if (renderbuffer)
+  {
+    glGenRenderbuffers(1, &entry.name);
+    glBindRenderbuffer(GL_RENDERBUFFER, entry.name);
+    if (samples > 1)
+      glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, internalFormat, width, height);
+    else
+      glRenderbufferStorage(GL_RENDERBUFFER, internalFormat, width, height);
+    ResourceRegistry::GetInstance().TrackRenderbuffer(entry.name, ResourceCategory::RenderTargets, owner);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  }
+  else if (samples > 1)
+  {
+    glGenTextures(1, &entry.name);
+    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, entry.name);
+    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples, internalFormat, width, height, GL_TRUE);
+    ResourceRegistry::GetInstance().TrackTexture(entry.name, GL_TEXTURE_2D_MULTISAMPLE, ResourceCategory::RenderTargets, owner);
+    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+  }
+  else
+  {
+    // No data is uploaded, the pixel format just has to be compatible with the internal one
+    GLenum format = GL_RGBA, type = GL_FLOAT;
+    switch (internalFormat)
+    {
+    case GL_DEPTH_COMPONENT16:
+    case GL_DEPTH_COMPONENT24:
+    case GL_DEPTH_COMPONENT32:
+    case GL_DEPTH_COMPONENT32F:
+      format = GL_DEPTH_COMPONENT;
+      break;
+    case GL_DEPTH24_STENCIL8:
+      format = GL_DEPTH_STENCIL;
+      type = GL_UNSIGNED_INT_24_8;
+      break;
+    case GL_DEPTH32F_STENCIL8:
+      format = GL_DEPTH_STENCIL;
+      type = GL_FLOAT_32_UNSIGNED_INT_24_8_REV;
+      break;
+    }
+
+    glGenTextures(1, &entry.name);
+    glBindTexture(GL_TEXTURE_2D, entry.name);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    ResourceRegistry::GetInstance().TrackTexture(entry.name, GL_TEXTURE_2D, ResourceCategory::RenderTargets, owner);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  ++_numAllocations;
+  _entries.push_back(entry);
+  return entry.name;
+}
+
+void RenderTargetPool::Release(bool renderbuffer, GLuint name)
+{
+  if (name == 0)
+    return;
+
+  for (Entry &entry : _entries)
+  {
+    if (entry.name == name && entry.renderbuffer == renderbuffer && !entry.free)
+    {
+      entry.free = true;
+      entry.releaseFrame = _frame;
+      return;
+    }
+  }
+
+  printf("Render target pool: %s %u wasn't acquired from the pool\n", renderbuffer ? "renderbuffer" : "texture", name);
+}
+
+void RenderTargetPool::Delete(const Entry &entry)
+{
+  if (entry.renderbuffer)
+    ResourceRegistry::GetInstance().DeleteRenderbuffers(1, &entry.name);
+  else
+    ResourceRegistry::GetInstance().DeleteTextures(1, &entry.name);
+}
+
+void RenderTargetPool::Clear()
+{
+  for (const Entry &entry : _entries)
+    Delete(entry);
+  _entries.clear();
+}
+
+void RenderTargetPool::SetTargetSize(int width, int height)
+{
+  _targetWidth = width;
+  _targetHeight = height;
+}
+
+void RenderTargetPool::RequestResize(int width, int height)
+{
+  ++_numRequests;
+
+  // The storage of the current targets still fits, e.g., the window went back to where it was
+  if (RoundUp(width) == RoundUp(_targetWidth) && RoundUp(height) == RoundUp(_targetHeight))
+  {
+    _resizePending = false;
+    return;
+  }
+
+  _resizePending = true;
+  _resizeWidth = width;
+  _resizeHeight = height;
+  _resizeTime = Clock::now();
+}
+
+bool RenderTargetPool::Update(int &width, int &height)
+{
+  ++_frame;
+
+  // Delete the targets nobody asked for in a while, e.g., the ones of the previous size after a resize
+  for (size_t i = 0; i < _entries.size();)
+  {
+    if (_entries[i].free && _frame - _entries[i].releaseFrame > EVICT_FRAMES)
+    {
+      Delete(_entries[i]);
+      _entries.erase(_entries.begin() + i);
+      ++_numEvictions;
+      continue;
+    }
+    ++i;
+  }
+
+  // Wait until the window size settles
+  if (!_resizePending || Clock::now() - _resizeTime < std::chrono::milliseconds(RESIZE_DELAY))
+    return false;
+
+  _resizePending = false;
+  width = _targetWidth = _resizeWidth;
+  height = _targetHeight = _resizeHeight;
+  ++_numResizes;
+  return true;
+}
+
+void RenderTargetPool::PrintStats()
+{
+  printf("Render target pool: %d resize requests applied as %d resizes, %d allocations, %d reuses, %d evictions\n",
+         _numRequests, _numResizes, _numAllocations, _numReuses, _numEvictions);
+  for (const Entry &entry : _entries)
+  {
+    printf("  %s: %s 0x%04X %dx%d, %d samples%s\n", entry.owner.c_str(), entry.renderbuffer ? "renderbuffer" : "texture",
+           entry.internalFormat, entry.width, entry.height, entry.samples, entry.free ? ", free" : "");
+  }
+}
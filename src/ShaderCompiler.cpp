@@ -4,13 +4,32 @@
  */
 
 #include <cstdio>
+#include <cstring>
 #include <ShaderCompiler.h>
 
-GLuint ShaderCompiler::CompileShader(const char* source[], int index, GLenum type)
+GLuint ShaderCompiler::CompileShader(const char* source[], int index, GLenum type, const char* defines)
 {
-  // Create and compile the shader
+  // Create the shader
   GLuint shader = glCreateShader(type);
-  glShaderSource(shader, 1, source + index, nullptr);
+
+  // Find the end of the #version line, defines must not precede it
+  const char* body = defines ? strstr(source[index], "#version") : nullptr;
+  if (body)
+    body = strchr(body, '\n');
+
+  if (body)
+  {
+    // Permutation: split the source after the #version line and insert the defines in between
+    const GLchar* strings[] = {source[index], defines, body + 1};
+    GLint lengths[] = {(GLint)(body + 1 - source[index]), -1, -1};
+    glShaderSource(shader, 3, strings, lengths);
+  }
+  else
+  {
+    glShaderSource(shader, 1, source + index, nullptr);
+  }
+
+  // Compile the shader
   glCompileShader(shader);
 
   // Check that compilation was a success
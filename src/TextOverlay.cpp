@@ -0,0 +1,379 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include "TextOverlay.h"
+#include "ResourceRegistry.h"
+#include "ShaderCompiler.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+
+// First and last character in the font
+static const int FIRST_GLYPH = ' ';
+static const int LAST_GLYPH = '~';
+static const int NUM_GLYPHS = LAST_GLYPH - FIRST_GLYPH + 1;
+
+// Rows of the glyphs from the top, the highest of the 5 bits is the leftmost pixel, the baseline is in the 7th row
+static const unsigned char fontData[NUM_GLYPHS * TextOverlay::GLYPH_HEIGHT] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // space
+  0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04, 0x00, // '!'
+  0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00, // '"'
+  0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A, 0x00, // '#'
+  0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04, 0x00, // '$'
+  0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03, 0x00, // '%'
+  0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D, 0x00, // '&'
+  0x04, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, // '''
+  0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02, 0x00, // '('
+  0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08, 0x00, // ')'
+  0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00, 0x00, // '*'
+  0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00, 0x00, // '+'
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08, // ','
+  0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00, 0x00, // '-'
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00, // '.'
+  0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00, 0x00, // '/'
+  0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E, 0x00, // '0'
+  0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E, 0x00, // '1'
+  0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F, 0x00, // '2'
+  0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E, 0x00, // '3'
+  0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02, 0x00, // '4'
+  0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E, 0x00, // '5'
+  0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E, 0x00, // '6'
+  0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08, 0x00, // '7'
+  0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E, 0x00, // '8'
+  0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C, 0x00, // '9'
+  0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00, 0x00, // ':'
+  0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08, 0x00, // ';'
+  0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02, 0x00, // '<'
+  0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00, 0x00, // '='
+  0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08, 0x00, // '>'
+  0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04, 0x00, // '?'
+  0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E, 0x00, // '@'
+  0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11, 0x00, // 'A'
+  0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E, 0x00, // 'B'
+  0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E, 0x00, // 'C'
+  0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C, 0x00, // 'D'
+  0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F, 0x00, // 'E'
+  0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10, 0x00, // 'F'
+  0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F, 0x00, // 'G'
+  0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11, 0x00, // 'H'
+  0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E, 0x00, // 'I'
+  0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C, 0x00, // 'J'
+  0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11, 0x00, // 'K'
+  0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F, 0x00, // 'L'
+  0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11, 0x00, // 'M'
+  0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11, 0x00, // 'N'
+  0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E, 0x00, // 'O'
+  0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10, 0x00, // 'P'
+  0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D, 0x00, // 'Q'
+  0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11, 0x00, // 'R'
+  0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E, 0x00, // 'S'
+  0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, // 'T'
+  0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E, 0x00, // 'U'
+  0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04, 0x00, // 'V'
+  0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A, 0x00, // 'W'
+  0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11, 0x00, // 'X'
+  0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04, 0x00, // 'Y'
+  0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F, 0x00, // 'Z'
+  0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E, 0x00, // '['
+  0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00, 0x00, // backslash
+  0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E, 0x00, // ']'
+  0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00, // '^'
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, // '_'
+  0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, // '`'
+  0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F, 0x00, // 'a'
+  0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E, 0x00, // 'b'
+  0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E, 0x00, // 'c'
+  0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F, 0x00, // 'd'
+  0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E, 0x00, // 'e'
+  0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08, 0x00, // 'f'
+  0x00, 0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E, // 'g'
+  0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11, 0x00, // 'h'
+  0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E, 0x00, // 'i'
+  0x02, 0x00, 0x06, 0x02, 0x02, 0x02, 0x12, 0x0C, // 'j'
+  0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12, 0x00, // 'k'
+  0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E, 0x00, // 'l'
+  0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11, 0x00, // 'm'
+  0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11, 0x00, // 'n'
+  0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E, 0x00, // 'o'
+  0x00, 0x00, 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, // 'p'
+  0x00, 0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x01, // 'q'
+  0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10, 0x00, // 'r'
+  0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E, 0x00, // 's'
+  0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06, 0x00, // 't'
+  0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D, 0x00, // 'u'
+  0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04, 0x00, // 'v'
+  0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A, 0x00, // 'w'
+  0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x00, // 'x'
+  0x00, 0x00, 0x11, 0x11, 0x11, 0x0F, 0x01, 0x0E, // 'y'
+  0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F, 0x00, // 'z'
+  0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02, 0x00, // '{'
+  0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, // '|'
+  0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08, 0x00, // '}'
+  0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00, 0x00, // '~'
+};
+
+// Shaders of the overlay, the glyph and cell sizes are injected as defines, they stick to GLSL 3.30 so that the overlay
+// works on the 3.3 context fallback of the labs, i.e., without explicit uniform locations or sampler bindings
+static const char *overlaySource[] = {
+// ----------------------------------------------------------------------------
+// Character cell vertex shader, a quad expanded from the packed instance
+// ----------------------------------------------------------------------------
+R"(
+#version 330 core
+
+// Framebuffer size and the cell scale
+uniform ivec2 viewport;
+uniform int scale;
+
+// Column in bits 0-11, row in bits 12-23, and glyph index in bits 24-31
+layout (location = 0) in uint cell;
+
+flat out uint glyph;
+noperspective out vec2 cellPos;
+
+void main()
+{
+  // Triangle strip corners
+  vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+  ivec2 cellIndex = ivec2(cell & 0xfffu, (cell >> 12) & 0xfffu);
+
+  // Position in pixels from the top left corner with a margin of a single cell
+  vec2 pos = (vec2(cellIndex + ivec2(1)) + corner) * vec2(CELL_WIDTH, CELL_HEIGHT) * float(scale);
+  gl_Position = vec4(pos.x / viewport.x * 2.0f - 1.0f, 1.0f - pos.y / viewport.y * 2.0f, 0.0f, 1.0f);
+
+  glyph = cell >> 24;
+  cellPos = corner * vec2(CELL_WIDTH, CELL_HEIGHT);
+}
+)",
+// ----------------------------------------------------------------------------
+// Character cell fragment shader
+// ----------------------------------------------------------------------------
+R"(
+#version 330 core
+
+uniform sampler2D font;
+
+flat in uint glyph;
+noperspective in vec2 cellPos;
+
+layout (location = 0) out vec4 color;
+
+void main()
+{
+  // Glyph is centered vertically in the cell, the spacing is at the right
+  ivec2 texel = ivec2(cellPos) - ivec2(0, (CELL_HEIGHT - GLYPH_HEIGHT) / 2);
+  float coverage = 0.0f;
+  if (all(greaterThanEqual(texel, ivec2(0))) && all(lessThan(texel, ivec2(GLYPH_WIDTH, GLYPH_HEIGHT))))
+    coverage = texelFetch(font, ivec2(int(glyph) * GLYPH_WIDTH + texel.x, texel.y), 0).r;
+
+  color = mix(vec4(0.0f, 0.0f, 0.0f, 0.6f), vec4(1.0f), coverage);
+}
+)",
+};
+
+// Pack the cell for the vertex shader
+static GLuint packCell(int column, int row, int glyph)
+{
+  return (GLuint)column | ((GLuint)row << 12) | ((GLuint)glyph << 24);
+}
+
+// ----------------------------------------------------------------------------
+
+TextOverlay::TextOverlay() : _fontTexture(0), _cellBuffer(0), _vao(0), _program(0), _viewportLocation(-1), _scaleLocation(-1) {}
+
+bool TextOverlay::Init()
+{
+  // Expand the bits into a single row atlas
+  std::vector<GLubyte> atlas(NUM_GLYPHS * GLYPH_WIDTH * GLYPH_HEIGHT);
+  for (int glyph = 0; glyph < NUM_GLYPHS; ++glyph)
+  {
+    for (int y = 0; y < GLYPH_HEIGHT; ++y)
+    {
+      for (int x = 0; x < GLYPH_WIDTH; ++x)
+      {
+        const bool set = (fontData[glyph * GLYPH_HEIGHT + y] >> (GLYPH_WIDTH - 1 - x)) & 1;
+        atlas[y * NUM_GLYPHS * GLYPH_WIDTH + glyph * GLYPH_WIDTH + x] = set ? 255 : 0;
+      }
+    }
+  }
+
+  glGenTextures(1, &_fontTexture);
+  glBindTexture(GL_TEXTURE_2D, _fontTexture);
+  // Rows of the atlas aren't 4 byte aligned
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, NUM_GLYPHS * GLYPH_WIDTH, GLYPH_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, atlas.data());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  // Single level only
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  ResourceRegistry::GetInstance().TrackTexture(_fontTexture, GL_TEXTURE_2D, ResourceCategory::Textures, "Text overlay");
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // Cells are streamed every frame
+  glGenVertexArrays(1, &_vao);
+  glBindVertexArray(_vao);
+  glGenBuffers(1, &_cellBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, _cellBuffer);
+  glBufferData(GL_ARRAY_BUFFER, MAX_CELLS * sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+  ResourceRegistry::GetInstance().TrackBuffer(_cellBuffer, MAX_CELLS * sizeof(GLuint), ResourceCategory::Buffers, "Text overlay");
+  glEnableVertexAttribArray(0);
+  glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(GLuint), nullptr);
+  glVertexAttribDivisor(0, 1);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  char defines[256];
+  snprintf(defines, sizeof(defines), "#define GLYPH_WIDTH %d\n#define GLYPH_HEIGHT %d\n#define CELL_WIDTH %d\n#define CELL_HEIGHT %d\n",
+           GLYPH_WIDTH, GLYPH_HEIGHT, CELL_WIDTH, CELL_HEIGHT);
+  GLuint vertexShader = ShaderCompiler::CompileShader(overlaySource, 0, GL_VERTEX_SHADER, defines);
+  GLuint fragmentShader = ShaderCompiler::CompileShader(overlaySource, 1, GL_FRAGMENT_SHADER, defines);
+
+  bool linked = false;
+  if (vertexShader && fragmentShader)
+  {
+    _program = glCreateProgram();
+    glAttachShader(_program, vertexShader);
+    glAttachShader(_program, fragmentShader);
+    linked = ShaderCompiler::LinkProgram(_program);
+    glDetachShader(_program, vertexShader);
+    glDetachShader(_program, fragmentShader);
+  }
+  glDeleteShader(vertexShader);
+  glDeleteShader(fragmentShader);
+
+  if (!linked)
+  {
+    printf("Text overlay shaders failed!\n");
+    Release();
+    return false;
+  }
+
+  // The font stays bound to the first texture unit
+  _viewportLocation = glGetUniformLocation(_program, "viewport");
+  _scaleLocation = glGetUniformLocation(_program, "scale");
+  glUseProgram(_program);
+  glUniform1i(glGetUniformLocation(_program, "font"), 0);
+  glUseProgram(0);
+
+  return true;
+}
+
+void TextOverlay::Release()
+{
+  ResourceRegistry::GetInstance().DeleteTextures(1, &_fontTexture);
+  ResourceRegistry::GetInstance().DeleteBuffers(1, &_cellBuffer);
+  glDeleteVertexArrays(1, &_vao);
+  glDeleteProgram(_program);
+  _fontTexture = _cellBuffer = _vao = _program = 0;
+}
+
+void TextOverlay::Print(const char *format, ...)
+{
+  va_list args, argsCopy;
+  va_start(args, format);
+  va_copy(argsCopy, args);
+
+  // Short strings fit into the stack buffer, longer ones are formatted again directly into the text
+  char buffer[256];
+  const int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  if (length >= (int)sizeof(buffer))
+  {
+    const size_t offset = _text.size();
+    _text.resize(offset + length + 1);
+    vsnprintf(&_text[offset], length + 1, format, argsCopy);
+    _text.resize(offset + length);
+  }
+  else if (length > 0)
+  {
+    _text.append(buffer, length);
+  }
+
+  va_end(argsCopy);
+  va_end(args);
+}
+
+void TextOverlay::Draw(int width, int height, int scale)
+{
+  if (!_program || width <= 0 || height <= 0)
+    return;
+
+  // Find the widest line, the shorter ones are padded by spaces so that the background is a single box
+  int columns = 0, column = 0;
+  for (char c : _text)
+  {
+    column = c == '\n' ? 0 : column + 1;
+    columns = std::max(columns, column);
+  }
+
+  _cells.clear();
+  int row = 0;
+  column = 0;
+  for (size_t i = 0; i <= _text.size() && _cells.size() < MAX_CELLS; ++i)
+  {
+    const bool lineEnd = i == _text.size() || _text[i] == '\n';
+    if (lineEnd)
+    {
+      // The text usually ends by a new line, don't add an empty line for it
+      if (i < _text.size() || column > 0)
+      {
+        for (; column < columns && _cells.size() < MAX_CELLS; ++column)
+          _cells.push_back(packCell(column, row, 0));
+      }
+      column = 0;
+      ++row;
+      continue;
+    }
+
+    int glyph = (unsigned char)_text[i];
+    if (glyph < FIRST_GLYPH || glyph > LAST_GLYPH)
+      glyph = '?';
+    _cells.push_back(packCell(column++, row, glyph - FIRST_GLYPH));
+  }
+
+  if (_cells.empty())
+    return;
+
+  // Orphan the previous contents, the last frame may still be reading them
+  glBindBuffer(GL_ARRAY_BUFFER, _cellBuffer);
+  glBufferData(GL_ARRAY_BUFFER, MAX_CELLS * sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, _cells.size() * sizeof(GLuint), _cells.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  // Blend over whatever is in the framebuffer, restore the state afterwards
+  const GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+  const GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+  const GLboolean blend = glIsEnabled(GL_BLEND);
+  const GLboolean stencilTest = glIsEnabled(GL_STENCIL_TEST);
+  const GLboolean scissorTest = glIsEnabled(GL_SCISSOR_TEST);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  glDisable(GL_STENCIL_TEST);
+  glDisable(GL_SCISSOR_TEST);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  glColorMask(true, true, true, true);
+  glViewport(0, 0, width, height);
+
+  glUseProgram(_program);
+  glUniform2i(_viewportLocation, width, height);
+  glUniform1i(_scaleLocation, std::max(scale, 1));
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, _fontTexture);
+  glBindVertexArray(_vao);
+  glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)_cells.size());
+
+  glBindVertexArray(0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glUseProgram(0);
+
+  if (depthTest) glEnable(GL_DEPTH_TEST);
+  if (cullFace) glEnable(GL_CULL_FACE);
+  if (stencilTest) glEnable(GL_STENCIL_TEST);
+  if (scissorTest) glEnable(GL_SCISSOR_TEST);
+  if (!blend) glDisable(GL_BLEND);
+}
@@ -5,16 +5,273 @@
 
 #include <Textures.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 
-Textures::Textures() : _samplers{ 0 }
+#include <FileStamp.h>
+#include <MathSupport.h>
+#include <ParallelFor.h>
+#include <ResourceRegistry.h>
+
+// Mip level cache file header, all the levels follow from the finest one
+struct MipCacheHeader
+{
+    // MIP_CACHE_MAGIC
+    char magic[4];
+    // MIP_CACHE_VERSION
+    uint32_t version;
+    // Size and modification time of the source image the levels were created from
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    // Size of the finest level in texels
+    uint32_t width;
+    uint32_t height;
+    uint32_t numLevels;
+    uint32_t channels;
+    // Settings the mip levels were generated with
+    uint32_t sRGB;
+    uint32_t normalMap;
+    uint32_t filter;
+};
+
+static const char MIP_CACHE_MAGIC[4] = { 'N', 'P', 'M', 'L' };
+static const uint32_t MIP_CACHE_VERSION = 2;
+
+// Radius of the Kaiser filter in texels of the smaller level and its window shape
+static const float KAISER_RADIUS = 2.0f;
+static const float KAISER_ALPHA = 4.0f;
+
+// Size of the mip level
+static int getLevelSize(int size, int level)
+{
+    return std::max(size >> level, 1);
+}
+
+// Sized internal format and pixel format of 8-bit images, sRGB applies to the three and four channel images only
+static void getTextureFormats(int channels, bool sRGB, GLenum& internalFormat, GLenum& format)
+{
+    static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    static const GLenum linearFormats[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+    static const GLenum srgbFormats[] = { GL_R8, GL_RG8, GL_SRGB8, GL_SRGB8_ALPHA8 };
+    format = formats[channels - 1];
+    internalFormat = sRGB ? srgbFormats[channels - 1] : linearFormats[channels - 1];
+}
+
+// Modified Bessel function of the first kind of order zero for the Kaiser window
+static float besselI0(float x)
+{
+    float sum = 1.0f, term = 1.0f;
+    for (int k = 1; k < 32 && term > 1e-7f * sum; ++k)
+    {
+        term *= (0.5f * x / k) * (0.5f * x / k);
+        sum += term;
+    }
+    return sum;
+}
+
+// Filter weight of the source texel at the distance x measured in texels of the smaller level
+static float getFilterWeight(MipFilter filter, float x)
+{
+    if (filter == MipFilter::Box)
+        return fabsf(x) <= 0.5f ? 1.0f : 0.0f;
+
+    // Kaiser windowed sinc
+    if (fabsf(x) >= KAISER_RADIUS)
+        return 0.0f;
+
+    const float px = PI * x;
+    const float sinc = fabsf(x) < 1e-4f ? 1.0f : sinf(px) / px;
+    const float t = x / KAISER_RADIUS;
+    return sinc * besselI0(KAISER_ALPHA * sqrtf(1.0f - t * t)) / besselI0(KAISER_ALPHA);
+}
+
+// Source texels and their normalized weights of each texel of the smaller level along a single axis
+struct FilterTaps
+{
+    std::vector<int> first;
+    std::vector<int> count;
+    std::vector<int> texels;
+    std::vector<float> weights;
+};
+
+static FilterTaps getFilterTaps(MipFilter filter, int sourceSize, int size)
+{
+    FilterTaps taps;
+    const float scale = (float)sourceSize / size;
+    const float radius = (filter == MipFilter::Box ? 0.5f : KAISER_RADIUS) * scale;
+    for (int i = 0; i < size; ++i)
+    {
+        const float center = (i + 0.5f) * scale;
+        const int begin = (int)floorf(center - radius);
+        const int end = (int)ceilf(center + radius);
+
+        taps.first.push_back((int)taps.texels.size());
+        float sum = 0.0f;
+        for (int s = begin; s <= end; ++s)
+        {
+            const float weight = getFilterWeight(filter, (s + 0.5f - center) / scale);
+            if (weight == 0.0f)
+                continue;
+
+            // Textures repeat, so does the filter
+            taps.texels.push_back(((s % sourceSize) + sourceSize) % sourceSize);
+            taps.weights.push_back(weight);
+            sum += weight;
+        }
+        taps.count.push_back((int)taps.texels.size() - taps.first.back());
+
+        for (int t = taps.first.back(); t < (int)taps.texels.size(); ++t)
+            taps.weights[t] /= sum;
+    }
+
+    return taps;
+}
+
+// Create the mip level cache of the image unless there is an up to date one, generation time is zero for the cached
+// levels, returns false on failure
+static bool createMipCache(const char name[], const std::string& cacheFile, bool sRGB, bool normalMap, MipFilter filter, MipCacheHeader& header, float& generationTime)
+{
+    generationTime = 0.0f;
+
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!getFileStamp(name, sourceSize, sourceTime))
+        return false;
+
+    // Up to date cache is used as it is, stale or broken ones are silently rebuilt
+    {
+        std::ifstream in(cacheFile, std::ios::binary);
+        if (in.read(reinterpret_cast<char*>(&header), sizeof(MipCacheHeader)) &&
+            memcmp(header.magic, MIP_CACHE_MAGIC, sizeof(MIP_CACHE_MAGIC)) == 0 && header.version == MIP_CACHE_VERSION &&
+            header.sourceSize == sourceSize && header.sourceTime == sourceTime && header.sRGB == (sRGB ? 1u : 0u) &&
+            header.normalMap == (normalMap ? 1u : 0u) && header.filter == (uint32_t)filter &&
+            header.width > 0 && header.height > 0 && header.channels >= 1 && header.channels <= 4)
+        {
+            return true;
+        }
+    }
+
+    int width, height, numChannels;
+    unsigned char* data = stbi_load(name, &width, &height, &numChannels, 0);
+    if (!data)
+        return false;
+
+    typedef std::chrono::high_resolution_clock Clock;
+    Clock::time_point start = Clock::now();
+
+    int numLevels = 0;
+    std::vector<unsigned char> levels = Textures::GenerateMipmaps(data, width, height, numChannels, sRGB, normalMap, filter, numLevels);
+    stbi_image_free(data);
+
+    generationTime = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+
+    memcpy(header.magic, MIP_CACHE_MAGIC, sizeof(MIP_CACHE_MAGIC));
+    header.version = MIP_CACHE_VERSION;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    header.width = width;
+    header.height = height;
+    header.numLevels = numLevels;
+    header.channels = numChannels;
+    header.sRGB = sRGB ? 1 : 0;
+    header.normalMap = normalMap ? 1 : 0;
+    header.filter = (uint32_t)filter;
+
+    std::ofstream out(cacheFile, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(MipCacheHeader));
+    out.write(reinterpret_cast<const char*>(levels.data()), levels.size());
+    if (!out)
+    {
+        printf("Failed to write mip level cache: %s\n", cacheFile.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Create texture from the packed mip levels, immutable storage is used if available, returns the upload time
+static GLuint createTexture(const unsigned char* levels, int width, int height, int numLevels, int channels, bool sRGB, const char* owner, float* uploadTime = nullptr)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    Clock::time_point start = Clock::now();
+
+    GLenum internalFormat, format;
+    getTextureFormats(channels, sRGB, internalFormat, format);
+
+    // Generate the texture name
+    GLuint tex;
+    glGenTextures(1, &tex);
+
+    // Create the texture object (first bind call for this name)
+    glBindTexture(GL_TEXTURE_2D, tex);
+
+    // Allocate all the levels at once, the driver doesn't have to guess the final size
+    if (GLAD_GL_VERSION_4_2)
+        glTexStorage2D(GL_TEXTURE_2D, numLevels, internalFormat, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+
+    // Upload texture data level by level, rows are tightly packed
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int level = 0; level < numLevels; ++level)
+    {
+        const int w = getLevelSize(width, level);
+        const int h = getLevelSize(height, level);
+        if (GLAD_GL_VERSION_4_2)
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, format, GL_UNSIGNED_BYTE, levels);
+        else
+            glTexImage2D(GL_TEXTURE_2D, level, internalFormat, w, h, 0, format, GL_UNSIGNED_BYTE, levels);
+        levels += w * h * channels;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    ResourceRegistry::GetInstance().TrackTexture(tex, GL_TEXTURE_2D, ResourceCategory::Textures, owner);
+
+    // Unbind the texture
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Wait for the transfer so that the time is meaningful
+    if (uploadTime)
+    {
+        glFinish();
+        *uploadTime = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+    }
+
+    return tex;
+}
+
+// ----------------------------------------------------------------------------
+
+Textures::Textures() : _samplers{ 0 }, _streamedId(0), _streamingFrame(0), _streamingMemory(0), _streamingPendingMemory(0),
+    _streamingBudget(STREAMING_BUDGET), _streamingPending(0), _streamingQuit(false)
 {
     stbi_set_flip_vertically_on_load(true);
 }
 
 Textures::~Textures()
 {
+    // Stop the background thread
+    if (_streamingThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(_streamingMutex);
+            _streamingQuit = true;
+        }
+        _streamingCondition.notify_one();
+        _streamingThread.join();
+    }
+
+    // Release streamed textures
+    for (const StreamedTexture& streamed : _streamed)
+        ResourceRegistry::GetInstance().DeleteTextures(1, &streamed.texture);
+
     // Release samplers
     glDeleteSamplers((GLsizei)Sampler::NumSamplers, _samplers);
 }
@@ -27,13 +284,6 @@ Textures& Textures::GetInstance()
 
 GLuint Textures::CreateCheckerBoardTexture(unsigned int textureSize, unsigned int checkerSize, glm::vec3 oddColor, glm::vec3 evenColor, bool sRGB)
 {
-    // Generate the texture name
-    GLuint tex;
-    glGenTextures(1, &tex);
-
-    // Create the texture object (first bind call for this name)
-    glBindTexture(GL_TEXTURE_2D, tex);
-
     // Generate texture RGB data
     const int stride = 3;
     unsigned char* data = new unsigned char[stride * textureSize * textureSize];
@@ -53,70 +303,318 @@ GLuint Textures::CreateCheckerBoardTexture(unsigned int textureSize, unsigned in
         }
     }
 
-    // Upload texture data: 2D texture, mip level 0, internal format RGB, width, height, border, input format RGB, type, data
-    glTexImage2D(GL_TEXTURE_2D, 0, sRGB ? GL_SRGB : GL_RGB, textureSize, textureSize, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-
-    // Unbind the texture
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // Box filter keeps the hard checker edges free of ringing
+    int numLevels = 0;
+    std::vector<unsigned char> levels = GenerateMipmaps(data, textureSize, textureSize, stride, sRGB, false, MipFilter::Box, numLevels);
 
     // Delete the temporary buffer
     delete[] data;
 
     // Note: the caller is now responsible for handling this resource
-    return tex;
+    return createTexture(levels.data(), textureSize, textureSize, numLevels, stride, sRGB, "Checker board texture");
 }
 
 GLuint Textures::CreateSingleColorTexture(unsigned char r, unsigned char g, unsigned char b)
 {
-    // Generate the texture name
-    GLuint tex;
-    glGenTextures(1, &tex);
+    unsigned char data[] = { r, g, b };
 
-    // Create the texture object (first bind call for this name)
-    glBindTexture(GL_TEXTURE_2D, tex);
+    // Single level, there is nothing to filter
+    return createTexture(data, 1, 1, 1, 3, false, "Single color texture");
+}
 
-    unsigned char data[] = { r, g, b };
+GLuint Textures::LoadTexture(const char name[], bool sRGB, bool normalMap, MipFilter filter)
+{
+    // Mip levels are generated ahead of time and cached next to the image
+    const std::string cacheFile = std::string(name) + ".mips";
+    MipCacheHeader header;
+    float generationTime = 0.0f;
+    if (!createMipCache(name, cacheFile, sRGB, normalMap, filter, header, generationTime))
+    {
+        printf("Failed to load texture: %s\n", name);
+        return 0;
+    }
 
-    // Upload texture data: 2D texture, mip level 0, internal format RGB, width, height, border, input format RGB, type, data
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+    // Read all the levels
+    std::ifstream in(cacheFile, std::ios::binary);
+    in.seekg(sizeof(MipCacheHeader));
+    size_t size = 0;
+    for (uint32_t level = 0; level < header.numLevels; ++level)
+        size += (size_t)getLevelSize(header.width, level) * getLevelSize(header.height, level) * header.channels;
+    std::vector<unsigned char> levels(size);
+    if (!in.read(reinterpret_cast<char*>(levels.data()), size))
+    {
+        printf("Failed to read mip level cache: %s\n", cacheFile.c_str());
+        return 0;
+    }
 
-    // Unbind the texture
-    glBindTexture(GL_TEXTURE_2D, 0);
+    float uploadTime = 0.0f;
+    GLuint tex = createTexture(levels.data(), header.width, header.height, header.numLevels, header.channels, sRGB, name, &uploadTime);
+
+    if (generationTime > 0.0f)
+        printf("Texture %s: %u x %u, %u levels, mip generation %.1f ms, upload %.1f ms\n", name, header.width, header.height, header.numLevels, generationTime, uploadTime);
+    else
+        printf("Texture %s: %u x %u, %u levels, cached mip levels, upload %.1f ms\n", name, header.width, header.height, header.numLevels, uploadTime);
 
     return tex;
 }
 
-GLuint Textures::LoadTexture(const char name[], bool sRGB)
+std::vector<unsigned char> Textures::GenerateMipmaps(const unsigned char* image, int width, int height, int channels, bool sRGB, bool normalMap, MipFilter filter, int& numLevels)
 {
-    // Load stored texture on the disk
-    int width, height, numChannels;
-    unsigned char* data = stbi_load(name, &width, &height, &numChannels, 0);
+    static float toLinear[256];
+    static bool initialized = false;
+    if (!initialized)
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            float c = i / 255.0f;
+            toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+        initialized = true;
+    }
 
-    // Early return when we failed to load the texture
-    if (!data)
+    numLevels = 1;
+    while (getLevelSize(std::max(width, height), numLevels - 1) > 1)
+        ++numLevels;
+
+    // Alpha is the last channel of the two and four channel images, it's always filtered as it is
+    const int colorChannels = (channels == 2 || channels == 4) ? channels - 1 : channels;
+    const bool renormalize = normalMap && colorChannels == 3;
+
+    // The finest level is the image itself
+    std::vector<unsigned char> result(image, image + width * height * channels);
+
+    // Filtering is done on linear values: sRGB is decoded, normals are unpacked to [-1, 1]
+    std::vector<float> level(width * height * channels);
+    parallelFor((size_t)height, [&](size_t begin, size_t end)
     {
-        printf("Failed to load texture: %s\n", name);
+        for (int i = (int)begin * width * channels; i < (int)end * width * channels; ++i)
+        {
+            const bool color = i % channels < colorChannels;
+            level[i] = color && normalMap ? image[i] / 127.5f - 1.0f : (color && sRGB ? toLinear[image[i]] : image[i] / 255.0f);
+        }
+    }, 16);
+
+    std::vector<float> rows, next;
+    for (int l = 1; l < numLevels; ++l)
+    {
+        const int w = getLevelSize(width, l - 1), h = getLevelSize(height, l - 1);
+        const int nw = getLevelSize(width, l), nh = getLevelSize(height, l);
+        const FilterTaps horizontal = getFilterTaps(filter, w, nw);
+        const FilterTaps vertical = getFilterTaps(filter, h, nh);
+
+        // Separable filter, the rows first
+        rows.assign(h * nw * channels, 0.0f);
+        parallelFor((size_t)h, [&](size_t begin, size_t end)
+        {
+            for (int y = (int)begin; y < (int)end; ++y)
+            {
+                for (int x = 0; x < nw; ++x)
+                {
+                    float* out = &rows[(y * nw + x) * channels];
+                    for (int t = horizontal.first[x]; t < horizontal.first[x] + horizontal.count[x]; ++t)
+                    {
+                        const float* in = &level[(y * w + horizontal.texels[t]) * channels];
+                        for (int c = 0; c < channels; ++c)
+                            out[c] += horizontal.weights[t] * in[c];
+                    }
+                }
+            }
+        }, 16);
+
+        // Then the columns, normals are renormalized and the level is encoded back to 8 bits
+        next.assign(nh * nw * channels, 0.0f);
+        const size_t offset = result.size();
+        result.resize(offset + nw * nh * channels);
+        parallelFor((size_t)nh, [&](size_t begin, size_t end)
+        {
+            for (int y = (int)begin; y < (int)end; ++y)
+            {
+                for (int x = 0; x < nw; ++x)
+                {
+                    float* out = &next[(y * nw + x) * channels];
+                    for (int t = vertical.first[y]; t < vertical.first[y] + vertical.count[y]; ++t)
+                    {
+                        const float* in = &rows[(vertical.texels[t] * nw + x) * channels];
+                        for (int c = 0; c < channels; ++c)
+                            out[c] += vertical.weights[t] * in[c];
+                    }
+
+                    if (renormalize)
+                    {
+                        const float length = sqrtf(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+                        if (length > 1e-3f)
+                        {
+                            out[0] /= length;
+                            out[1] /= length;
+                            out[2] /= length;
+                        }
+                        else
+                        {
+                            out[0] = out[1] = 0.0f;
+                            out[2] = 1.0f;
+                        }
+                    }
+
+                    unsigned char* encoded = &result[offset + (y * nw + x) * channels];
+                    for (int c = 0; c < channels; ++c)
+                    {
+                        float v = out[c];
+                        if (c < colorChannels && normalMap)
+                            v = 0.5f * v + 0.5f;
+                        else if (c < colorChannels && sRGB)
+                            v = v <= 0.0031308f ? v * 12.92f : 1.055f * powf(std::max(v, 0.0f), 1.0f / 2.4f) - 0.055f;
+                        encoded[c] = (unsigned char)(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+                    }
+                }
+            }
+        }, 16);
+
+        level.swap(next);
+    }
+
+    return result;
+}
+
+GLuint Textures::CreateTextureArray(const GLuint textures[], GLsizei numTextures, GLenum internalFormat, GLint layers[], glm::vec4 constants[])
+{
+    // Single texel textures would be upscaled to whole layers, hand them to the caller as constants if it takes them
+    const bool sRGB = internalFormat == GL_SRGB8 || internalFormat == GL_SRGB8_ALPHA8;
+    std::vector<GLuint> layerTextures;
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    for (GLsizei i = 0; i < numTextures; ++i)
+    {
+        GLint w = 0, h = 0;
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+        if (layers && constants && w == 1 && h == 1)
+        {
+            // Decoded the same way the texture unit would decode the layer
+            unsigned char texel[4];
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+            constants[i] = glm::vec4(texel[0], texel[1], texel[2], texel[3]) / 255.0f;
+            for (int c = 0; sRGB && c < 3; ++c)
+                constants[i][c] = constants[i][c] <= 0.04045f ? constants[i][c] / 12.92f : powf((constants[i][c] + 0.055f) / 1.055f, 2.4f);
+            layers[i] = -1;
+            continue;
+        }
+
+        if (layers)
+            layers[i] = (GLint)layerTextures.size();
+        layerTextures.push_back(textures[i]);
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    // Nothing but constants, no array is needed
+    const GLsizei numLayers = (GLsizei)layerTextures.size();
+    if (numLayers == 0)
+    {
+        glBindTexture(GL_TEXTURE_2D, 0);
         return 0;
     }
 
+    // The array size is given by the largest texture
+    GLint width = 0, height = 0;
+    for (GLsizei layer = 0; layer < numLayers; ++layer)
+    {
+        GLint w = 0, h = 0;
+        glBindTexture(GL_TEXTURE_2D, layerTextures[layer]);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+        width = w > width ? w : width;
+        height = h > height ? h : height;
+    }
+
+    // Full mip chain down to 1 x 1 texel
+    int numLevels = 1;
+    while (getLevelSize(width, numLevels - 1) > 1 || getLevelSize(height, numLevels - 1) > 1)
+        ++numLevels;
+
     // Generate the texture name
     GLuint tex;
     glGenTextures(1, &tex);
 
-    // Create the texture object (first bind call for this name)
-    glBindTexture(GL_TEXTURE_2D, tex);
-
-    // Upload texture data: 2D texture, mip level 0, internal format RGB, width, height, border, input format RGB, type, data
-    glTexImage2D(GL_TEXTURE_2D, 0, sRGB ? GL_SRGB : GL_RGB, width, height, 0, numChannels == 4 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-
-    // Free the image data, we don't need them anymore
-    stbi_image_free(data);
+    // Create the texture object and allocate all its levels and layers
+    glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+    if (GLAD_GL_VERSION_4_2)
+    {
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, numLevels, internalFormat, width, height, numLayers);
+    }
+    else
+    {
+        for (int level = 0; level < numLevels; ++level)
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internalFormat, getLevelSize(width, level), getLevelSize(height, level), numLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+
+    // Read back each level of each texture and upload it into its layer, this is a one time preprocess so the stall
+    // doesn't matter, raw values are copied, i.e., sRGB textures stay sRGB encoded and the mip levels generated on the
+    // CPU, e.g., renormalized normals, are kept as they are
+    const int stride = 4;
+    std::vector<unsigned char> source;
+    std::vector<unsigned char> data(stride * width * height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    for (GLsizei layer = 0; layer < numLayers; ++layer)
+    {
+        GLint w = 0, h = 0, maxLevel = 0;
+        glBindTexture(GL_TEXTURE_2D, layerTextures[layer]);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+
+        // Number of halvings from the array size to the texture size, smaller textures start at their finest level
+        int shift = 0;
+        while (getLevelSize(width, shift) > w && getLevelSize(height, shift) > h)
+            ++shift;
+
+        int sourceLevel = -1;
+        GLint sw = 0, sh = 0;
+        for (int level = 0; level < numLevels; ++level)
+        {
+            // The corresponding level of the texture, its coarsest one is reused when it has fewer levels
+            const int wanted = std::min(std::max(level - shift, 0), (int)maxLevel);
+            if (wanted != sourceLevel)
+            {
+                GLint lw = 0, lh = 0;
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, wanted, GL_TEXTURE_WIDTH, &lw);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, wanted, GL_TEXTURE_HEIGHT, &lh);
+                if (lw > 0 && lh > 0)
+                {
+                    sourceLevel = wanted;
+                    sw = lw;
+                    sh = lh;
+                    source.resize(stride * sw * sh);
+                    glGetTexImage(GL_TEXTURE_2D, sourceLevel, GL_RGBA, GL_UNSIGNED_BYTE, source.data());
+                }
+            }
+
+            // Nearest neighbour resample to the array level size
+            const int lw = getLevelSize(width, level);
+            const int lh = getLevelSize(height, level);
+            for (int y = 0; y < lh; ++y)
+            {
+                for (int x = 0; x < lw; ++x)
+                {
+                    int i = (y * lw + x) * stride;
+                    int j = ((y * sh / lh) * sw + x * sw / lw) * stride;
+                    data[i] = source[j];
+                    data[i + 1] = source[j + 1];
+                    data[i + 2] = source[j + 2];
+                    data[i + 3] = source[j + 3];
+                }
+            }
+
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, lw, lh, 1, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+        }
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    ResourceRegistry::GetInstance().TrackTexture(tex, GL_TEXTURE_2D_ARRAY, ResourceCategory::Textures, "Texture array");
 
-    // Unbind the texture
+    // Unbind the textures
     glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 
+    // Note: the caller is now responsible for handling this resource
     return tex;
 }
 
@@ -175,3 +673,311 @@ void Textures::CreateSamplers()
     glSamplerParameteri(_samplers[(int)Sampler::AnisotropicMirrored], GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
     glSamplerParameteri(_samplers[(int)Sampler::AnisotropicMirrored], GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
 }
+
+// ----------------------------------------------------------------------------
+
+GLuint Textures::LoadStreamedTexture(const char name[], bool sRGB, bool normalMap, MipFilter filter)
+{
+    StreamedTexture streamed;
+    streamed.name = name;
+    streamed.cacheFile = streamed.name + ".mips";
+
+    MipCacheHeader header;
+    float generationTime = 0.0f;
+    if (!createMipCache(name, streamed.cacheFile, sRGB, normalMap, filter, header, generationTime))
+    {
+        printf("Failed to load texture: %s\n", name);
+        return 0;
+    }
+
+    streamed.id = ++_streamedId;
+    streamed.width = header.width;
+    streamed.height = header.height;
+    streamed.numLevels = header.numLevels;
+
+    getTextureFormats(header.channels, sRGB, streamed.internalFormat, streamed.format);
+
+    // Level offsets in the cache file
+    streamed.levelOffsets.push_back(sizeof(MipCacheHeader));
+    for (int level = 0; level < streamed.numLevels; ++level)
+    {
+        size_t size = (size_t)getLevelSize(streamed.width, level) * getLevelSize(streamed.height, level) * header.channels;
+        streamed.levelOffsets.push_back(streamed.levelOffsets.back() + size);
+    }
+
+    // Tail levels up to STREAMING_TAIL_SIZE
+    streamed.tailLevel = 0;
+    while (streamed.tailLevel < streamed.numLevels - 1 &&
+           std::max(getLevelSize(streamed.width, streamed.tailLevel), getLevelSize(streamed.height, streamed.tailLevel)) > STREAMING_TAIL_SIZE)
+        ++streamed.tailLevel;
+
+    streamed.residentLevel = streamed.numLevels;
+    streamed.requestedLevel = streamed.numLevels;
+    streamed.wantedLevel = streamed.tailLevel;
+    streamed.lastUsed = 0;
+    streamed.loading = false;
+    streamed.loadingMemory = 0;
+
+    // Read just the tail from the cache, the finer levels are skipped
+    std::ifstream in(streamed.cacheFile, std::ios::binary);
+    const size_t tailSize = streamed.levelOffsets.back() - streamed.levelOffsets[streamed.tailLevel];
+    std::vector<unsigned char> tail(tailSize);
+    in.seekg(streamed.levelOffsets[streamed.tailLevel]);
+    if (!in.read(reinterpret_cast<char*>(tail.data()), tailSize))
+    {
+        printf("Failed to read mip level cache: %s\n", streamed.cacheFile.c_str());
+        return 0;
+    }
+
+    // Generate the texture name
+    glGenTextures(1, &streamed.texture);
+
+    // Create the texture object, levels are specified one by one so that only the resident ones take memory
+    glBindTexture(GL_TEXTURE_2D, streamed.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, streamed.numLevels - 1);
+
+    for (int level = streamed.numLevels - 1; level >= streamed.tailLevel; --level)
+        UploadStreamedLevel(streamed, level, &tail[streamed.levelOffsets[level] - streamed.levelOffsets[streamed.tailLevel]]);
+    ResourceRegistry::GetInstance().TrackTexture(streamed.texture, GL_TEXTURE_2D, ResourceCategory::Textures, streamed.name.c_str());
+
+    // Unbind the texture
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    if (generationTime > 0.0f)
+        printf("Streamed texture %s: %d x %d, %d levels, mip generation %.1f ms\n", name, streamed.width, streamed.height, streamed.numLevels, generationTime);
+
+    _streamed.push_back(streamed);
+
+    // Start the background thread with the first streamed texture
+    if (!_streamingThread.joinable())
+        _streamingThread = std::thread(&Textures::StreamingLoop, this);
+
+    // Note: the caller is now responsible for handling this resource via DeleteStreamedTexture()
+    return streamed.texture;
+}
+
+void Textures::DeleteStreamedTexture(GLuint texture)
+{
+    for (size_t i = 0; i < _streamed.size(); ++i)
+    {
+        if (_streamed[i].texture != texture)
+            continue;
+
+        // Levels being loaded are thrown away once they are read, the id won't match anymore
+        if (_streamed[i].loading)
+            _streamingPendingMemory -= _streamed[i].loadingMemory;
+        DropStreamedLevels(_streamed[i], _streamed[i].numLevels);
+        ResourceRegistry::GetInstance().DeleteTextures(1, &_streamed[i].texture);
+        _streamed.erase(_streamed.begin() + i);
+        return;
+    }
+}
+
+void Textures::RequestStreamedLevel(GLuint texture, float uvExtent, float screenExtent)
+{
+    StreamedTexture* streamed = FindStreamedTexture(texture);
+    if (!streamed || screenExtent <= 0.0f)
+        return;
+
+    // Texels per pixel of the finest level, rounded down to get enough detail
+    const float texelsPerPixel = uvExtent * std::max(streamed->width, streamed->height) / screenExtent;
+    const int level = texelsPerPixel > 1.0f ? (int)floorf(log2f(texelsPerPixel)) : 0;
+    streamed->requestedLevel = std::min(streamed->requestedLevel, std::min(level, streamed->numLevels - 1));
+}
+
+void Textures::UpdateStreaming()
+{
+    ++_streamingFrame;
+
+    // Upload the levels loaded in the meantime
+    std::deque<StreamedLevel> loaded;
+    {
+        std::lock_guard<std::mutex> lock(_streamingMutex);
+        loaded.swap(_streamingLoaded);
+    }
+
+    for (const StreamedLevel& level : loaded)
+    {
+        --_streamingPending;
+        StreamedTexture* streamed = FindStreamedTextureById(level.id);
+        if (!streamed)
+            continue;
+
+        _streamingPendingMemory -= streamed->loadingMemory;
+        streamed->loading = false;
+        streamed->loadingMemory = 0;
+
+        // The coarser levels may have been dropped in the meantime
+        if (level.data.empty() || level.level != streamed->residentLevel - 1)
+            continue;
+
+        glBindTexture(GL_TEXTURE_2D, streamed->texture);
+        UploadStreamedLevel(*streamed, level.level, level.data.data());
+        ResourceRegistry::GetInstance().TrackTexture(streamed->texture, GL_TEXTURE_2D, ResourceCategory::Textures, streamed->name.c_str());
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // The finest level requested recently is kept, coarser requests take effect after the grace period
+    for (StreamedTexture& streamed : _streamed)
+    {
+        if (streamed.requestedLevel <= streamed.wantedLevel)
+        {
+            streamed.wantedLevel = streamed.requestedLevel;
+            streamed.lastUsed = _streamingFrame;
+        }
+        else if (_streamingFrame - streamed.lastUsed > STREAMING_GRACE_FRAMES)
+        {
+            streamed.wantedLevel = std::min(streamed.requestedLevel, streamed.tailLevel);
+            streamed.lastUsed = _streamingFrame;
+        }
+
+        streamed.requestedLevel = streamed.numLevels;
+
+        // Drop the levels which are not needed anymore
+        if (streamed.residentLevel < streamed.wantedLevel)
+            DropStreamedLevels(streamed, streamed.wantedLevel);
+    }
+
+    // The most under resolved textures go first, each of them loads a single level at a time from the coarse ones
+    std::vector<StreamedTexture*> candidates;
+    for (StreamedTexture& streamed : _streamed)
+    {
+        if (!streamed.loading && streamed.residentLevel > streamed.wantedLevel)
+            candidates.push_back(&streamed);
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const StreamedTexture* a, const StreamedTexture* b)
+    {
+        return a->residentLevel - a->wantedLevel > b->residentLevel - b->wantedLevel;
+    });
+
+    for (StreamedTexture* streamed : candidates)
+    {
+        const int level = streamed->residentLevel - 1;
+        const size_t memory = GetLevelMemory(*streamed, level);
+
+        // Demote the least recently used textures to make room, textures used more recently are never demoted
+        while (_streamingMemory + _streamingPendingMemory + memory > _streamingBudget)
+        {
+            StreamedTexture* victim = nullptr;
+            for (StreamedTexture& other : _streamed)
+            {
+                if (other.residentLevel < other.tailLevel && other.lastUsed < streamed->lastUsed && (!victim || other.lastUsed < victim->lastUsed))
+                    victim = &other;
+            }
+
+            if (!victim)
+                break;
+
+            DropStreamedLevels(*victim, victim->residentLevel + 1);
+        }
+
+        if (_streamingMemory + _streamingPendingMemory + memory > _streamingBudget)
+            continue;
+
+        streamed->loading = true;
+        streamed->loadingMemory = memory;
+        _streamingPendingMemory += memory;
+        ++_streamingPending;
+
+        {
+            std::lock_guard<std::mutex> lock(_streamingMutex);
+            _streamingRequests.push_back({ streamed->id, level, streamed->cacheFile, streamed->levelOffsets[level],
+                std::vector<unsigned char>(streamed->levelOffsets[level + 1] - streamed->levelOffsets[level]) });
+        }
+        _streamingCondition.notify_one();
+    }
+}
+
+Textures::StreamedTexture* Textures::FindStreamedTexture(GLuint texture)
+{
+    for (StreamedTexture& streamed : _streamed)
+    {
+        if (streamed.texture == texture)
+            return &streamed;
+    }
+    return nullptr;
+}
+
+Textures::StreamedTexture* Textures::FindStreamedTextureById(unsigned int id)
+{
+    for (StreamedTexture& streamed : _streamed)
+    {
+        if (streamed.id == id)
+            return &streamed;
+    }
+    return nullptr;
+}
+
+size_t Textures::GetLevelMemory(const StreamedTexture& streamed, int level)
+{
+    const size_t channels = streamed.format == GL_RED ? 1 : (streamed.format == GL_RG ? 2 : 4);
+    return (size_t)getLevelSize(streamed.width, level) * getLevelSize(streamed.height, level) * channels;
+}
+
+void Textures::UploadStreamedLevel(StreamedTexture& streamed, int level, const unsigned char* data)
+{
+    // Rows of the cache file are tightly packed
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, level, streamed.internalFormat, getLevelSize(streamed.width, level), getLevelSize(streamed.height, level), 0, streamed.format, GL_UNSIGNED_BYTE, data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    // Sampling is limited to the resident levels
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+    streamed.residentLevel = level;
+    _streamingMemory += GetLevelMemory(streamed, level);
+}
+
+void Textures::DropStreamedLevels(StreamedTexture& streamed, int level)
+{
+    // The tail stays unless the whole texture is deleted
+    if (level < streamed.numLevels)
+        level = std::min(level, streamed.tailLevel);
+
+    if (streamed.residentLevel >= level)
+        return;
+
+    glBindTexture(GL_TEXTURE_2D, streamed.texture);
+    if (level < streamed.numLevels)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+
+    // Levels below the base level don't affect the texture completeness, redefining them empty releases their memory
+    for (int l = streamed.residentLevel; l < level; ++l)
+    {
+        glTexImage2D(GL_TEXTURE_2D, l, streamed.internalFormat, 0, 0, 0, streamed.format, GL_UNSIGNED_BYTE, nullptr);
+        _streamingMemory -= GetLevelMemory(streamed, l);
+    }
+    ResourceRegistry::GetInstance().TrackTexture(streamed.texture, GL_TEXTURE_2D, ResourceCategory::Textures, streamed.name.c_str());
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    streamed.residentLevel = level;
+}
+
+void Textures::StreamingLoop()
+{
+    for (;;)
+    {
+        StreamedLevel level;
+        {
+            std::unique_lock<std::mutex> lock(_streamingMutex);
+            _streamingCondition.wait(lock, [this]() { return _streamingQuit || !_streamingRequests.empty(); });
+            if (_streamingQuit)
+                return;
+
+            level = std::move(_streamingRequests.front());
+            _streamingRequests.pop_front();
+        }
+
+        // Failed reads are passed back empty so that the request doesn't stay pending
+        std::ifstream in(level.cacheFile, std::ios::binary);
+        in.seekg(level.offset);
+        if (!in.read(reinterpret_cast<char*>(level.data.data()), level.data.size()))
+        {
+            printf("Failed to read mip level cache: %s\n", level.cacheFile.c_str());
+            level.data.clear();
+        }
+
+        std::lock_guard<std::mutex> lock(_streamingMutex);
+        _streamingLoaded.push_back(std::move(level));
+    }
+}
@@ -0,0 +1,748 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include "VirtualTexture.h"
+#include "FileStamp.h"
+#include "Profiler.h"
+#include "ResourceRegistry.h"
+#include "Textures.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <stb/stb_image.h>
+
+// Tile file header, tiles of all the levels follow from the finest one, row by row
+struct TileFileHeader
+{
+  // TILE_MAGIC
+  char magic[4];
+  // TILE_VERSION
+  uint32_t version;
+  // Size and modification time of the source image the tiles were created from
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  // Size of the finest level in texels
+  uint32_t size;
+  // Page size and its border in texels
+  uint32_t tileSize;
+  uint32_t tileBorder;
+  uint32_t numLevels;
+  // Channels of the source image, converted to the atlas format when loading
+  uint32_t channels;
+  // Mip levels were generated in linear space
+  uint32_t sRGB;
+  // Mip levels were renormalized
+  uint32_t normalMap;
+};
+
+static const char TILE_MAGIC[4] = {'N', 'P', 'V', 'T'};
+static const uint32_t TILE_VERSION = 3;
+
+// sRGB formats are mip-mapped in linear space
+static bool isSRGB(GLenum internalFormat)
+{
+  return internalFormat == GL_SRGB8 || internalFormat == GL_SRGB8_ALPHA8;
+}
+
+// ----------------------------------------------------------------------------
+
+VirtualTexture::VirtualTexture() : _size(0), _numLevels(0), _numMaps(0), _internalFormats(), _normalMaps(), _atlasChannels(), _atlases(),
+  _atlasPages(0), _atlasMemory(0), _pageTable(0), _uniformBuffer(0), _feedback(0), _feedbackFbo(0), _feedbackWidth(0),
+  _feedbackHeight(0), _readbacks(), _frame(0), _quit(false)
+{
+
+}
+
+VirtualTexture::~VirtualTexture()
+{
+  // Stop the background thread
+  if (_worker.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _quit = true;
+    }
+    _condition.notify_one();
+    _worker.join();
+  }
+
+  // Release resources used by the driver
+  ResourceRegistry &registry = ResourceRegistry::GetInstance();
+  for (Readback &readback : _readbacks)
+  {
+    if (readback.fence)
+      glDeleteSync(readback.fence);
+    registry.DeleteBuffers(1, &readback.buffer);
+  }
+
+  glDeleteFramebuffers(1, &_feedbackFbo);
+  registry.DeleteTextures(1, &_feedback);
+  registry.DeleteTextures(1, &_pageTable);
+  registry.DeleteTextures(MAX_MAPS, _atlases);
+  registry.DeleteBuffers(1, &_uniformBuffer);
+}
+
+bool VirtualTexture::Init(int size, int numMaps, const GLenum internalFormats[], const bool normalMaps[], int atlasPages)
+{
+  // Do nothing if we're already initialized
+  if (_uniformBuffer)
+    return true;
+
+  // Page coordinates are packed in 12 bits, atlas slot coordinates in 8 bits
+  const int numPages = size / TILE_SIZE;
+  if (size % TILE_SIZE != 0 || numPages < 1 || (numPages & (numPages - 1)) != 0 || numPages > 4096 ||
+      numMaps < 1 || numMaps > MAX_MAPS || atlasPages < 1 || atlasPages > 256)
+  {
+    printf("Unsupported virtual texture setup: size %d, %d maps, %d atlas pages\n", size, numMaps, atlasPages);
+    return false;
+  }
+
+  _size = size;
+  _numMaps = numMaps;
+  _atlasPages = atlasPages;
+  _numLevels = 1;
+  while ((numPages >> (_numLevels - 1)) > 1)
+    ++_numLevels;
+
+  // Shader parameters stay disabled until Create()
+  glGenBuffers(1, &_uniformBuffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, _uniformBuffer);
+  ShaderData data = {};
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(ShaderData), &data, GL_DYNAMIC_DRAW);
+  ResourceRegistry::GetInstance().TrackBuffer(_uniformBuffer, sizeof(ShaderData), ResourceCategory::Buffers, "Virtual texture parameters");
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+  // Allocate the page cache atlases, there are no mip-maps, each slot holds a page of a single level
+  const int atlasSize = atlasPages * (TILE_SIZE + 2 * TILE_BORDER);
+  glGenTextures(numMaps, _atlases);
+  for (int map = 0; map < numMaps; ++map)
+  {
+    _internalFormats[map] = internalFormats[map];
+    _normalMaps[map] = normalMaps[map];
+    _atlasChannels[map] = internalFormats[map] == GL_R8 ? 1 : 4;
+
+    glBindTexture(GL_TEXTURE_2D, _atlases[map]);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[map], atlasSize, atlasSize, 0, _atlasChannels[map] == 1 ? GL_RED : GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    _atlasMemory += (size_t)atlasSize * atlasSize * _atlasChannels[map];
+    ResourceRegistry::GetInstance().TrackTexture(_atlases[map], GL_TEXTURE_2D, ResourceCategory::Textures, "Virtual texture atlas");
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  _slots.assign(atlasPages * atlasPages, {INVALID_PAGE, 0, false});
+  return true;
+}
+
+int VirtualTexture::AddLayer(const char *const images[])
+{
+  // Layers can be added only between Init() and Create()
+  if (!_uniformBuffer || _pageTable)
+    return -1;
+
+  const int layer = (int)_tileFiles.size() / _numMaps;
+  if (layer >= MAX_LAYERS)
+    return -1;
+
+  std::vector<std::string> tileFiles;
+  std::vector<int> tileChannels;
+  for (int map = 0; map < _numMaps; ++map)
+  {
+    // Tiles live next to the source image
+    std::string tiles = std::string(images[map]) + ".tiles";
+    int channels = CreateTileFile(images[map], tiles, isSRGB(_internalFormats[map]), _normalMaps[map]);
+    if (channels == 0)
+      return -1;
+
+    tileFiles.push_back(tiles);
+    tileChannels.push_back(channels);
+  }
+
+  _tileFiles.insert(_tileFiles.end(), tileFiles.begin(), tileFiles.end());
+  _tileChannels.insert(_tileChannels.end(), tileChannels.begin(), tileChannels.end());
+  return layer;
+}
+
+int VirtualTexture::CreateTileFile(const char image[], const std::string &tiles, bool sRGB, bool normalMap)
+{
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  if (!getFileStamp(image, sourceSize, sourceTime))
+  {
+    printf("Failed to load texture: %s\n", image);
+    return 0;
+  }
+
+  // Up to date tile file is used as it is, stale or broken ones are silently rebuilt
+  {
+    std::ifstream in(tiles, std::ios::binary);
+    TileFileHeader header;
+    if (in.read(reinterpret_cast<char *>(&header), sizeof(TileFileHeader)) &&
+        memcmp(header.magic, TILE_MAGIC, sizeof(TILE_MAGIC)) == 0 && header.version == TILE_VERSION &&
+        header.sourceSize == sourceSize && header.sourceTime == sourceTime && header.size == (uint32_t)_size &&
+        header.tileSize == TILE_SIZE && header.tileBorder == TILE_BORDER && header.numLevels == (uint32_t)_numLevels &&
+        header.channels >= 1 && header.channels <= 4 && header.sRGB == (sRGB ? 1u : 0u) &&
+        header.normalMap == (normalMap ? 1u : 0u))
+    {
+      return (int)header.channels;
+    }
+  }
+
+  typedef std::chrono::high_resolution_clock Clock;
+  Clock::time_point start = Clock::now();
+
+  int width, height, channels;
+  unsigned char *data = stbi_load(image, &width, &height, &channels, 0);
+  if (!data)
+  {
+    printf("Failed to load texture: %s\n", image);
+    return 0;
+  }
+
+  // Resample to the virtual size, nearest neighbour keeps the power of two sources exact
+  std::vector<unsigned char> level(_size * _size * channels);
+  for (int y = 0; y < _size; ++y)
+  {
+    for (int x = 0; x < _size; ++x)
+    {
+      const unsigned char *source = &data[((y * height / _size) * width + x * width / _size) * channels];
+      memcpy(&level[(y * _size + x) * channels], source, channels);
+    }
+  }
+  stbi_image_free(data);
+
+  TileFileHeader header = {};
+  memcpy(header.magic, TILE_MAGIC, sizeof(TILE_MAGIC));
+  header.version = TILE_VERSION;
+  header.sourceSize = sourceSize;
+  header.sourceTime = sourceTime;
+  header.size = _size;
+  header.tileSize = TILE_SIZE;
+  header.tileBorder = TILE_BORDER;
+  header.numLevels = _numLevels;
+  header.channels = channels;
+  header.sRGB = sRGB ? 1 : 0;
+  header.normalMap = normalMap ? 1 : 0;
+
+  std::ofstream out(tiles, std::ios::binary | std::ios::trunc);
+  if (!out)
+  {
+    printf("Failed to write tile file: %s\n", tiles.c_str());
+    return 0;
+  }
+  out.write(reinterpret_cast<const char *>(&header), sizeof(TileFileHeader));
+
+  // Levels past the single page one aren't needed but the generator goes down to 1 x 1 texel anyway
+  int numLevels = 0;
+  std::vector<unsigned char> levels = Textures::GenerateMipmaps(level.data(), _size, _size, channels, sRGB, normalMap, MipFilter::Kaiser, numLevels);
+
+  // Cut each level into pages with borders, the texture repeats, so the borders wrap around
+  const int padded = TILE_SIZE + 2 * TILE_BORDER;
+  std::vector<unsigned char> tile(padded * padded * channels);
+  const unsigned char *levelData = levels.data();
+  for (int l = 0; l < _numLevels; ++l)
+  {
+    const int levelSize = _size >> l;
+    const int pages = levelSize / TILE_SIZE;
+    for (int py = 0; py < pages; ++py)
+    {
+      for (int px = 0; px < pages; ++px)
+      {
+        for (int ty = 0; ty < padded; ++ty)
+        {
+          for (int tx = 0; tx < padded; ++tx)
+          {
+            const int sx = (px * TILE_SIZE + tx - TILE_BORDER + levelSize) & (levelSize - 1);
+            const int sy = (py * TILE_SIZE + ty - TILE_BORDER + levelSize) & (levelSize - 1);
+            memcpy(&tile[(ty * padded + tx) * channels], &levelData[(sy * levelSize + sx) * channels], channels);
+          }
+        }
+        out.write(reinterpret_cast<const char *>(tile.data()), (std::streamsize)tile.size());
+      }
+    }
+
+    levelData += levelSize * levelSize * channels;
+  }
+
+  if (!out)
+  {
+    printf("Failed to write tile file: %s\n", tiles.c_str());
+    return 0;
+  }
+
+  double time = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  printf("Created tile file %s: %d levels of %d x %d pages in %.2f ms\n", tiles.c_str(), _numLevels, _size / TILE_SIZE, _size / TILE_SIZE, time);
+  return channels;
+}
+
+bool VirtualTexture::Create()
+{
+  // Do nothing if we're already created
+  if (_pageTable)
+    return true;
+
+  if (!_uniformBuffer || _tileFiles.empty())
+    return false;
+
+  const int numLayers = (int)_tileFiles.size() / _numMaps;
+
+  for (const std::string &tiles : _tileFiles)
+  {
+    _tileStreams.emplace_back(tiles, std::ios::binary);
+    if (!_tileStreams.back())
+    {
+      printf("Failed to open tile file: %s\n", tiles.c_str());
+      _tileStreams.clear();
+      return false;
+    }
+  }
+
+  // Coarsest pages of all layers are loaded right away and never evicted
+  _dirtyLayers.assign(numLayers, true);
+  for (int layer = 0; layer < numLayers; ++layer)
+  {
+    LoadedPage loaded;
+    loaded.page = PackPage(layer, _numLevels - 1, 0, 0);
+    if (!LoadPage(loaded.page, loaded) || !UploadPage(loaded, true))
+    {
+      printf("Failed to load the virtual texture layer %d\n", layer);
+      _tileStreams.clear();
+      return false;
+    }
+  }
+
+  // Page table has a texel per page in each level, integer textures can't be filtered
+  const int numPages = _size / TILE_SIZE;
+  glGenTextures(1, &_pageTable);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, _pageTable);
+  for (int level = 0; level < _numLevels; ++level)
+  {
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8UI, numPages >> level, numPages >> level, numLayers, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+  }
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, _numLevels - 1);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  ResourceRegistry::GetInstance().TrackTexture(_pageTable, GL_TEXTURE_2D_ARRAY, ResourceCategory::Textures, "Virtual texture page table");
+
+  for (int layer = 0; layer < numLayers; ++layer)
+    UpdatePageTable(layer);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  // Feedback image is cleared through a framebuffer object
+  glGenTextures(1, &_feedback);
+  glGenFramebuffers(1, &_feedbackFbo);
+  glGenBuffers(1, &_readbacks[0].buffer);
+  glGenBuffers(1, &_readbacks[1].buffer);
+
+  // The loading can start now
+  _worker = std::thread(&VirtualTexture::WorkerLoop, this);
+
+  printf("Virtual texture: %d layers of %d levels, %d x %d atlas pages, %.1f MB\n", numLayers, _numLevels, _atlasPages, _atlasPages, GetAtlasMemory());
+  return true;
+}
+
+bool VirtualTexture::LoadPage(uint32_t page, LoadedPage &loaded)
+{
+  const int layer = PageLayer(page);
+  const int level = PageLevel(page);
+  const int numPages = _size / TILE_SIZE;
+  const int padded = TILE_SIZE + 2 * TILE_BORDER;
+
+  // Index of the page within the tile file
+  uint64_t index = 0;
+  for (int l = 0; l < level; ++l)
+    index += (uint64_t)(numPages >> l) * (numPages >> l);
+  index += (uint64_t)PageY(page) * (numPages >> level) + PageX(page);
+
+  std::vector<unsigned char> tile;
+  for (int map = 0; map < _numMaps; ++map)
+  {
+    std::ifstream &in = _tileStreams[layer * _numMaps + map];
+    const int channels = _tileChannels[layer * _numMaps + map];
+    const uint64_t tileBytes = (uint64_t)padded * padded * channels;
+
+    tile.resize((size_t)tileBytes);
+    in.clear();
+    in.seekg((std::streamoff)(sizeof(TileFileHeader) + index * tileBytes));
+    if (!in.read(reinterpret_cast<char *>(tile.data()), (std::streamsize)tileBytes))
+      return false;
+
+    // Convert the texels to the atlas format
+    const int atlasChannels = _atlasChannels[map];
+    std::vector<unsigned char> &data = loaded.data[map];
+    data.resize(padded * padded * atlasChannels);
+    for (int i = 0; i < padded * padded; ++i)
+    {
+      const unsigned char *texel = &tile[i * channels];
+      unsigned char *out = &data[i * atlasChannels];
+      if (atlasChannels == 1)
+      {
+        out[0] = texel[0];
+      }
+      else
+      {
+        out[0] = texel[0];
+        out[1] = channels >= 3 ? texel[1] : texel[0];
+        out[2] = channels >= 3 ? texel[2] : texel[0];
+        out[3] = channels == 2 ? texel[1] : channels == 4 ? texel[3] : 255;
+      }
+    }
+  }
+
+  return true;
+}
+
+void VirtualTexture::WorkerLoop()
+{
+  Profiler::GetInstance().SetThreadName("Tile loader");
+
+  for (;;)
+  {
+    uint32_t page;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _condition.wait(lock, [this] { return _quit || !_requests.empty(); });
+      if (_quit)
+        return;
+
+      page = _requests.front();
+      _requests.pop_front();
+    }
+
+    // Failed pages are handed over empty, so that they're no longer pending
+    PROFILE_SCOPE("Load page");
+    LoadedPage loaded;
+    loaded.page = page;
+    if (!LoadPage(page, loaded))
+    {
+      for (std::vector<unsigned char> &data : loaded.data)
+        data.clear();
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _loaded.push_back(std::move(loaded));
+  }
+}
+
+void VirtualTexture::BeginFrame(int width, int height)
+{
+  if (!IsReady())
+    return;
+
+  ++_frame;
+
+  // Reallocate the feedback image and its read back buffers for the new screen size
+  const int feedbackWidth = std::max(1, (width + FEEDBACK_SCALE - 1) / FEEDBACK_SCALE);
+  const int feedbackHeight = std::max(1, (height + FEEDBACK_SCALE - 1) / FEEDBACK_SCALE);
+  if (feedbackWidth != _feedbackWidth || feedbackHeight != _feedbackHeight)
+  {
+    _feedbackWidth = feedbackWidth;
+    _feedbackHeight = feedbackHeight;
+
+    glBindTexture(GL_TEXTURE_2D, _feedback);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, feedbackWidth, feedbackHeight, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    ResourceRegistry::GetInstance().TrackTexture(_feedback, GL_TEXTURE_2D, ResourceCategory::RenderTargets, "Virtual texture feedback");
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _feedbackFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _feedback, 0);
+
+    // Read backs in flight are of the old size
+    for (Readback &readback : _readbacks)
+    {
+      if (readback.fence)
+        glDeleteSync(readback.fence);
+      readback.fence = 0;
+
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+      glBufferData(GL_PIXEL_PACK_BUFFER, feedbackWidth * feedbackHeight * sizeof(GLuint), nullptr, GL_STREAM_READ);
+      ResourceRegistry::GetInstance().TrackBuffer(readback.buffer, feedbackWidth * feedbackHeight * sizeof(GLuint), ResourceCategory::Buffers, "Virtual texture read back");
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+
+  // Clear the requests of the previous frame
+  const GLuint invalidPage[] = {INVALID_PAGE, 0u, 0u, 0u};
+  glBindFramebuffer(GL_FRAMEBUFFER, _feedbackFbo);
+  glClearBufferuiv(GL_COLOR, 0, invalidPage);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  // Go through all the pixels of the feedback blocks in a scattered order, 37 is coprime with the block size
+  const int block = FEEDBACK_SCALE * FEEDBACK_SCALE;
+  const int pixel = (int)((_frame * 37u) % block);
+
+  ShaderData data;
+  data.feedbackOffset[0] = pixel % FEEDBACK_SCALE;
+  data.feedbackOffset[1] = pixel / FEEDBACK_SCALE;
+  data.feedbackScale = FEEDBACK_SCALE;
+  data.numLevels = _numLevels;
+  data.numPages = _size / TILE_SIZE;
+  data.tileSize = TILE_SIZE;
+  data.tileBorder = TILE_BORDER;
+  data.atlasSize = _atlasPages * (TILE_SIZE + 2 * TILE_BORDER);
+  glBindBuffer(GL_UNIFORM_BUFFER, _uniformBuffer);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ShaderData), &data);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void VirtualTexture::Bind(GLuint firstUnit, GLuint imageUnit, GLuint uniformBinding)
+{
+  // Shaders need the parameters even if the virtual texture isn't ready, they're disabled then
+  glBindBufferBase(GL_UNIFORM_BUFFER, uniformBinding, _uniformBuffer);
+  if (!IsReady())
+    return;
+
+  // Textures use their own sampling parameters
+  for (int map = 0; map < _numMaps; ++map)
+  {
+    glActiveTexture(GL_TEXTURE0 + firstUnit + map);
+    glBindTexture(GL_TEXTURE_2D, _atlases[map]);
+    glBindSampler(firstUnit + map, 0);
+  }
+
+  glActiveTexture(GL_TEXTURE0 + firstUnit + _numMaps);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, _pageTable);
+  glBindSampler(firstUnit + _numMaps, 0);
+
+  glBindImageTexture(imageUnit, _feedback, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32UI);
+}
+
+void VirtualTexture::EndFrame()
+{
+  if (!IsReady())
+    return;
+
+  PROFILE_GPU_SCOPE("Virtual texture streaming");
+
+  // Make the feedback image stores visible to the read back
+  glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+  // Process the finished read backs of the previous frames, don't wait for the unfinished ones
+  for (Readback &readback : _readbacks)
+  {
+    if (!readback.fence)
+      continue;
+
+    GLenum status = glClientWaitSync(readback.fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+      continue;
+
+    glDeleteSync(readback.fence);
+    readback.fence = 0;
+
+    const size_t count = (size_t)_feedbackWidth * _feedbackHeight;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    const GLuint *feedback = static_cast<const GLuint*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, count * sizeof(GLuint), GL_MAP_READ_BIT));
+    if (feedback)
+    {
+      ProcessFeedback(feedback, count);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+  }
+
+  // Read back the feedback of this frame unless the buffer is still in flight
+  Readback &readback = _readbacks[_frame % 2];
+  if (!readback.fence)
+  {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glBindTexture(GL_TEXTURE_2D, _feedback);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+    glBindTexture(GL_TEXTURE_2D, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  // Upload the pages loaded by the background thread
+  std::vector<LoadedPage> loaded;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    while (!_loaded.empty() && loaded.size() < MAX_UPLOADS)
+    {
+      loaded.push_back(std::move(_loaded.front()));
+      _loaded.pop_front();
+    }
+  }
+
+  // Pages which don't fit are dropped, they'll be requested again if they're still needed
+  for (const LoadedPage &page : loaded)
+  {
+    _pendingPages.erase(page.page);
+    if (!page.data[0].empty())
+      UploadPage(page, false);
+  }
+
+  for (int layer = 0; layer < (int)_dirtyLayers.size(); ++layer)
+  {
+    if (_dirtyLayers[layer])
+    {
+      glBindTexture(GL_TEXTURE_2D_ARRAY, _pageTable);
+      UpdatePageTable(layer);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+  }
+}
+
+void VirtualTexture::ProcessFeedback(const GLuint *feedback, size_t count)
+{
+  // Unique requested pages, invalid ones are sorted last
+  std::vector<uint32_t> pages(feedback, feedback + count);
+  std::sort(pages.begin(), pages.end());
+  pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+  const int numLayers = (int)_dirtyLayers.size();
+  const int numPages = _size / TILE_SIZE;
+  std::vector<uint32_t> missing;
+  for (uint32_t page : pages)
+  {
+    if (page == INVALID_PAGE)
+      break;
+
+    const int layer = PageLayer(page);
+    const int level = PageLevel(page);
+    if (layer >= numLayers || level >= _numLevels || PageX(page) >= (numPages >> level) || PageY(page) >= (numPages >> level))
+      continue;
+
+    // Walk up to the coarsest level, ancestors are the fallback until the page arrives
+    for (uint32_t p = page; ; p = ParentPage(p))
+    {
+      std::unordered_map<uint32_t, int>::iterator it = _residentPages.find(p);
+      if (it != _residentPages.end())
+        _slots[it->second].lastUsed = _frame;
+      else if (_pendingPages.find(p) == _pendingPages.end())
+        missing.push_back(p);
+
+      if (PageLevel(p) == _numLevels - 1)
+        break;
+    }
+  }
+
+  // Coarse pages first, so that the quality improves quickly everywhere
+  std::sort(missing.begin(), missing.end());
+  missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+  std::stable_sort(missing.begin(), missing.end(), [](uint32_t a, uint32_t b) { return PageLevel(a) > PageLevel(b); });
+
+  if (missing.empty())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (uint32_t page : missing)
+    {
+      if (_pendingPages.size() >= MAX_PENDING)
+        break;
+
+      _requests.push_back(page);
+      _pendingPages.insert(page);
+    }
+  }
+  _condition.notify_one();
+}
+
+bool VirtualTexture::UploadPage(const LoadedPage &loaded, bool pinned)
+{
+  // Take a free slot or the least recently used one which isn't needed in this frame
+  int best = -1;
+  for (int i = 0; i < (int)_slots.size(); ++i)
+  {
+    const Slot &slot = _slots[i];
+    if (slot.page == INVALID_PAGE)
+    {
+      best = i;
+      break;
+    }
+
+    if (slot.pinned || slot.lastUsed == _frame)
+      continue;
+
+    if (best < 0 || slot.lastUsed < _slots[best].lastUsed)
+      best = i;
+  }
+
+  if (best < 0)
+    return false;
+
+  // Evict the previous page
+  Slot &slot = _slots[best];
+  if (slot.page != INVALID_PAGE)
+  {
+    _residentPages.erase(slot.page);
+    _dirtyLayers[PageLayer(slot.page)] = true;
+  }
+
+  slot.page = loaded.page;
+  slot.lastUsed = _frame;
+  slot.pinned = pinned;
+  _residentPages[loaded.page] = best;
+  _dirtyLayers[PageLayer(loaded.page)] = true;
+
+  // Copy the page including its border into the slot of each atlas
+  const int padded = TILE_SIZE + 2 * TILE_BORDER;
+  const int x = (best % _atlasPages) * padded;
+  const int y = (best / _atlasPages) * padded;
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (int map = 0; map < _numMaps; ++map)
+  {
+    glBindTexture(GL_TEXTURE_2D, _atlases[map]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, padded, padded, _atlasChannels[map] == 1 ? GL_RED : GL_RGBA, GL_UNSIGNED_BYTE, loaded.data[map].data());
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  return true;
+}
+
+void VirtualTexture::UpdatePageTable(int layer)
+{
+  // Coarsest level first, so that the missing pages can copy the entries of their parents
+  const int numPages = _size / TILE_SIZE;
+  std::vector<unsigned char> entries[2];
+  for (int level = _numLevels - 1; level >= 0; --level)
+  {
+    const int pages = numPages >> level;
+    const std::vector<unsigned char> &parents = entries[(level + 1) % 2];
+    std::vector<unsigned char> &current = entries[level % 2];
+    current.resize(pages * pages * 4);
+
+    for (int y = 0; y < pages; ++y)
+    {
+      for (int x = 0; x < pages; ++x)
+      {
+        unsigned char *entry = &current[(y * pages + x) * 4];
+        std::unordered_map<uint32_t, int>::const_iterator it = _residentPages.find(PackPage(layer, level, x, y));
+        if (it != _residentPages.end())
+        {
+          // Atlas slot and the level of the resident page
+          entry[0] = (unsigned char)(it->second % _atlasPages);
+          entry[1] = (unsigned char)(it->second / _atlasPages);
+          entry[2] = (unsigned char)level;
+          entry[3] = 1;
+        }
+        else if (level + 1 < _numLevels)
+        {
+          memcpy(entry, &parents[((y / 2) * (pages / 2) + x / 2) * 4], 4);
+        }
+        else
+        {
+          memset(entry, 0, 4);
+        }
+      }
+    }
+
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, pages, pages, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, current.data());
+  }
+
+  _dirtyLayers[layer] = false;
+}